@@ -43,11 +43,186 @@
 
 #define min(x,y) ((x)<(y)?(x):(y))
 
-static DB_conf_item_t *conf_items;
+#define CONF_HASH_MIN_SIZE 256
+
+typedef struct {
+    int ival;
+    int64_t i64val;
+    float fval;
+} conf_value_t;
+
+typedef struct conf_item_s {
+    DB_conf_item_t item; // must be first, conf_find hands out pointers to it
+    struct conf_item_s *hash_next;
+    struct conf_item_s *retired_next;
+    uint32_t hash;
+    // parsed once in conf_set_str, so that typed getters don't need atoi/atof
+    conf_value_t value;
+} conf_item_t;
+
+typedef struct conf_hash_s {
+    struct conf_hash_s *retired_next;
+    uint32_t size; // power of 2
+    conf_item_t *buckets[];
+} conf_hash_t;
+
+static DB_conf_item_t *conf_items; // sorted by key, for conf_find and conf_save
+static DB_conf_item_t *conf_tail;
+static int conf_count;
 static int changed;
 static uintptr_t mutex;
 static disable_saving;
 
+// The hash index is read without the lock by conf_get_int/int64/float.
+// Writers make conf_version odd while they change it, and readers retry when
+// the version has moved under them. Unlinked items and replaced tables are
+// kept on the retired lists until no lock-free reader is in flight.
+static conf_hash_t *volatile conf_hash;
+static volatile unsigned conf_version;
+static volatile int conf_readers;
+static conf_item_t *conf_retired_items;
+static conf_hash_t *conf_retired_tables;
+
+static uint32_t
+conf_hash_key (const char *key) {
+    // FNV-1a over ascii-lowercased bytes, to match strcasecmp
+    uint32_t h = 2166136261u;
+    for (const uint8_t *p = (const uint8_t *)key; *p; p++) {
+        uint8_t c = *p;
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+static void
+conf_write_begin (void) {
+    conf_version++;
+    __sync_synchronize ();
+}
+
+static void
+conf_write_end (void) {
+    __sync_synchronize ();
+    conf_version++;
+}
+
+static void
+conf_item_delete (conf_item_t *it) {
+    free (it->item.key);
+    free (it->item.value);
+    free (it);
+}
+
+static void
+conf_reclaim (void) {
+    __sync_synchronize ();
+    if (conf_readers) {
+        return;
+    }
+    while (conf_retired_items) {
+        conf_item_t *next = conf_retired_items->retired_next;
+        conf_item_delete (conf_retired_items);
+        conf_retired_items = next;
+    }
+    while (conf_retired_tables) {
+        conf_hash_t *next = conf_retired_tables->retired_next;
+        free (conf_retired_tables);
+        conf_retired_tables = next;
+    }
+}
+
+static conf_item_t *
+conf_hash_find (conf_hash_t *hash, const char *key, uint32_t h) {
+    if (!hash) {
+        return NULL;
+    }
+    for (conf_item_t *it = hash->buckets[h & (hash->size-1)]; it; it = it->hash_next) {
+        if (it->hash == h && !strcasecmp (key, it->item.key)) {
+            return it;
+        }
+    }
+    return NULL;
+}
+
+static void
+conf_hash_grow (void) {
+    conf_hash_t *old = conf_hash;
+    uint32_t size = old ? old->size * 2 : CONF_HASH_MIN_SIZE;
+    conf_hash_t *hash = calloc (1, sizeof (conf_hash_t) + size * sizeof (conf_item_t *));
+    if (!hash) {
+        return;
+    }
+    hash->size = size;
+    conf_write_begin ();
+    for (DB_conf_item_t *i = conf_items; i; i = i->next) {
+        conf_item_t *it = (conf_item_t *)i;
+        conf_item_t **bucket = &hash->buckets[it->hash & (size-1)];
+        it->hash_next = *bucket;
+        *bucket = it;
+    }
+    conf_hash = hash;
+    conf_write_end ();
+    if (old) {
+        old->retired_next = conf_retired_tables;
+        conf_retired_tables = old;
+    }
+}
+
+static void
+conf_hash_remove (conf_item_t *it) {
+    conf_item_t **prev = &conf_hash->buckets[it->hash & (conf_hash->size-1)];
+    while (*prev != it) {
+        prev = &(*prev)->hash_next;
+    }
+    *prev = it->hash_next;
+}
+
+static void
+conf_parse_value (conf_value_t *value, const char *str) {
+    value->ival = atoi (str);
+    value->i64val = atoll (str);
+    value->fval = atof (str);
+}
+
+// lock-free lookup of the cached typed values, returns 0 if the key is not set
+static int
+conf_get_value (const char *key, conf_value_t *value) {
+    uint32_t h = conf_hash_key (key);
+    int found = -1;
+    __sync_add_and_fetch (&conf_readers, 1);
+    for (int attempt = 0; attempt < 4 && found < 0; attempt++) {
+        unsigned version = conf_version;
+        __sync_synchronize ();
+        if (version & 1) {
+            continue;
+        }
+        conf_item_t *it = conf_hash_find (conf_hash, key, h);
+        if (it) {
+            *value = it->value;
+        }
+        __sync_synchronize ();
+        if (conf_version == version) {
+            found = it ? 1 : 0;
+        }
+    }
+    __sync_sub_and_fetch (&conf_readers, 1);
+
+    if (found < 0) {
+        // writers kept getting in the way
+        conf_lock ();
+        conf_item_t *it = conf_hash_find (conf_hash, key, h);
+        if (it) {
+            *value = it->value;
+        }
+        found = it ? 1 : 0;
+        conf_unlock ();
+    }
+    return found;
+}
+
 void
 conf_init (void) {
     mutex = mutex_create ();
@@ -66,12 +241,22 @@ conf_unlock (void) {
 void
 conf_free (void) {
     mutex_lock (mutex);
+    conf_write_begin ();
     DB_conf_item_t *next = NULL;
     for (DB_conf_item_t *it = conf_items; it; it = next) {
         next = it->next;
         conf_item_free (it);
     }
     conf_items = NULL;
+    conf_tail = NULL;
+    conf_count = 0;
+    if (conf_hash) {
+        conf_hash->retired_next = conf_retired_tables;
+        conf_retired_tables = conf_hash;
+        conf_hash = NULL;
+    }
+    conf_write_end ();
+    conf_reclaim ();
     changed = 0;
     mutex_free (mutex);
     mutex = 0;
@@ -219,12 +404,8 @@ conf_item_free (DB_conf_item_t *it) {
 
 const char *
 conf_get_str_fast (const char *key, const char *def) {
-    for (DB_conf_item_t *it = conf_items; it; it = it->next) {
-        if (!strcasecmp (key, it->key)) {
-            return it->value;
-        }
-    }
-    return def;
+    conf_item_t *it = conf_hash_find (conf_hash, key, conf_hash_key (key));
+    return it ? it->item.value : def;
 }
 
 void
@@ -245,26 +426,20 @@ conf_get_str (const char *key, const char *def, char *buffer, int buffer_size) {
 
 float
 conf_get_float (const char *key, float def) {
-    conf_lock ();
-    const char *v = conf_get_str_fast (key, NULL);
-    conf_unlock ();
-    return v ? atof (v) : def;
+    conf_value_t v;
+    return conf_get_value (key, &v) ? v.fval : def;
 }
 
 int
 conf_get_int (const char *key, int def) {
-    conf_lock ();
-    const char *v = conf_get_str_fast (key, NULL);
-    conf_unlock ();
-    return v ? atoi (v) : def;
+    conf_value_t v;
+    return conf_get_value (key, &v) ? v.ival : def;
 }
 
 int64_t
 conf_get_int64 (const char *key, int64_t def) {
-    conf_lock ();
-    const char *v = conf_get_str_fast (key, NULL);
-    conf_unlock ();
-    return v ? atoll (v) : def;
+    conf_value_t v;
+    return conf_get_value (key, &v) ? v.i64val : def;
 }
 
 DB_conf_item_t *
@@ -281,43 +456,76 @@ conf_find (const char *group, DB_conf_item_t *prev) {
 void
 conf_set_str (const char *key, const char *val) {
     conf_lock ();
-    DB_conf_item_t *prev = NULL;
-    for (DB_conf_item_t *it = conf_items; it; it = it->next) {
-        int cmp = strcasecmp (key, it->key);
-        if (!cmp) {
-            if (!strcmp (it->value, val)) {
-                conf_unlock ();
-                return;
-            }
-            free (it->value);
-            it->value = strdup (val);
+    uint32_t h = conf_hash_key (key);
+    conf_item_t *found = conf_hash_find (conf_hash, key, h);
+    if (found) {
+        if (!strcmp (found->item.value, val)) {
             conf_unlock ();
-            changed = 1;
             return;
         }
-        else if (cmp < 0) {
-            break;
-        }
-        prev = it;
+        char *value = strdup (val);
+        conf_value_t parsed;
+        conf_parse_value (&parsed, value);
+        conf_write_begin ();
+        found->value = parsed;
+        conf_write_end ();
+        free (found->item.value);
+        found->item.value = value;
+        changed = 1;
+        conf_unlock ();
+        return;
     }
     if (!val) {
         conf_unlock ();
         return;
     }
-    DB_conf_item_t *it = malloc (sizeof (DB_conf_item_t));
-    memset (it, 0, sizeof (DB_conf_item_t));
-    it->key = strdup (key);
-    it->value = strdup (val);
+
+    // find the sorted position; conf_load appends keys in file order, which
+    // is already sorted, so check the tail first
+    DB_conf_item_t *prev = NULL;
+    if (conf_tail && strcasecmp (key, conf_tail->key) > 0) {
+        prev = conf_tail;
+    }
+    else {
+        for (DB_conf_item_t *it = conf_items; it; it = it->next) {
+            if (strcasecmp (key, it->key) < 0) {
+                break;
+            }
+            prev = it;
+        }
+    }
+
+    conf_item_t *it = calloc (1, sizeof (conf_item_t));
+    it->item.key = strdup (key);
+    it->item.value = strdup (val);
+    it->hash = h;
+    conf_parse_value (&it->value, it->item.value);
     changed = 1;
     if (prev) {
-        DB_conf_item_t *next = prev->next;
-        prev->next = it;
-        it->next = next;
+        it->item.next = prev->next;
+        prev->next = &it->item;
     }
     else {
-        it->next = conf_items;
-        conf_items = it;
+        it->item.next = conf_items;
+        conf_items = &it->item;
     }
+    if (!it->item.next) {
+        conf_tail = &it->item;
+    }
+    conf_count++;
+
+    if (!conf_hash || conf_count > conf_hash->size) {
+        conf_hash_grow ();
+    }
+    else {
+        conf_item_t **bucket = &conf_hash->buckets[h & (conf_hash->size-1)];
+        it->hash_next = *bucket;
+        // publish the fully initialized item
+        conf_write_begin ();
+        *bucket = it;
+        conf_write_end ();
+    }
+    conf_reclaim ();
     conf_unlock ();
 }
 
@@ -363,10 +571,19 @@ conf_remove_items (const char *key) {
             break;
         }
     }
+    if (!it) {
+        conf_unlock ();
+        return;
+    }
     DB_conf_item_t *next = NULL;
+    conf_write_begin ();
     while (it) {
         next = it->next;
-        conf_item_free (it);
+        conf_item_t *item = (conf_item_t *)it;
+        conf_hash_remove (item);
+        item->retired_next = conf_retired_items;
+        conf_retired_items = item;
+        conf_count--;
         it = next;
         if (!it || strncasecmp (key, it->key, l)) {
             break;
@@ -378,6 +595,11 @@ conf_remove_items (const char *key) {
     else {
         conf_items = next;
     }
+    if (!next) {
+        conf_tail = prev;
+    }
+    conf_write_end ();
+    conf_reclaim ();
     conf_unlock ();
 }
 
@@ -253,6 +253,18 @@ typedef struct DB_metaInfo_s {
 #endif
 } DB_metaInfo_t;
 
+#if (DDB_API_LEVEL >= 10)
+// string cache statistics, see metacache_get_stats
+typedef struct {
+    int _size; // must be set to sizeof(ddb_metacache_stats_t), only that many bytes are filled
+    int strings; // number of unique strings
+    int64_t bytes; // total length of unique strings, including terminators
+    int64_t allocated; // memory held by the cache, including tables and free nodes
+    int64_t slots; // number of hash table slots
+    float load_factor; // strings / slots
+} ddb_metacache_stats_t;
+#endif
+
 // FIXME: that needs to be in separate plugin
 
 #define JUNK_STRIP_ID3V2 1
@@ -532,6 +544,10 @@ enum {
     // Don't convert linebreaks to semicolons
     DDB_TF_CONTEXT_MULTILINE = 8,
 #endif
+#if (DDB_API_LEVEL >= 10)
+    // Don't look up or store the result in the title formatting cache
+    DDB_TF_CONTEXT_NO_CACHE = 16,
+#endif
 };
 
 // context for title formatting interpreter
@@ -1221,6 +1237,18 @@ typedef struct {
 
     // return direct-access metadata structure for the given track and key
     DB_metaInfo_t * (*pl_meta_for_key) (DB_playItem_t *it, const char *key);
+
+    // fill the structure with current string cache statistics,
+    // stats->_size must be set by the caller
+    void (*metacache_get_stats) (ddb_metacache_stats_t *stats);
+
+    // returns a number which changes each time the metadata of the track is
+    // modified, can be used to validate data derived from the metadata
+    unsigned (*pl_get_item_meta_serial) (DB_playItem_t *it);
+
+    // returns 1 if the output of the title formatting script only depends on
+    // the track metadata, see pl_get_item_meta_serial
+    int (*tf_is_cacheable) (const char *code);
 #endif
 } DB_functions_t;
 
@@ -1297,6 +1325,16 @@ typedef struct DB_plugin_action_s {
 #endif
 } DB_plugin_action_t;
 
+#if (DDB_API_LEVEL >= 10)
+// plugin flags
+enum {
+    // decoder: insert can be called from several threads at once, which lets
+    // folder imports read the files in parallel; insert of decoders without
+    // this flag is never called concurrently by an import
+    DDB_PLUGIN_FLAG_THREADSAFE_INSERT = 0x1,
+};
+#endif
+
 // base plugin interface
 typedef struct DB_plugin_s {
     // type must be one of DB_PLUGIN_ types
@@ -1308,7 +1346,7 @@ typedef struct DB_plugin_s {
     int16_t version_major;
     int16_t version_minor;
 
-    uint32_t flags; // currently unused
+    uint32_t flags; // DDB_PLUGIN_FLAG_* values
     uint32_t reserved1;
     uint32_t reserved2;
     uint32_t reserved3;
@@ -1553,6 +1591,30 @@ typedef struct DB_dsp_s {
     // 0 otherwise
     int (*can_bypass) (ddb_dsp_context_t *ctx, ddb_waveformat_t *fmt);
 #endif
+
+    // since 1.10
+#if (DDB_API_LEVEL >= 10)
+    // can be NULL
+    // called by the streamer when the chain or the input format changes,
+    // to size the processing buffers in advance.
+    // fmt is the input format of this dsp, and must be changed to its output
+    // format, same way as process would do.
+    // *ratio must be set to the max number of output frames per input frame,
+    // and *latency to the max number of frames which may be held back
+    // in one process call, and returned in a later one.
+    // plugins without negotiate get buffers for 24x output.
+    // either way, process must never return more than maxframes frames.
+    void (*negotiate) (ddb_dsp_context_t *ctx, ddb_waveformat_t *fmt, float *ratio, int *latency);
+
+    // can be NULL
+    // called by the streamer at the end of a track, after the last process
+    // call, to append the frames which are still held back (e.g. the tail of
+    // a filter) to samples. up to maxframes frames fit.
+    // fmt must be changed same way as process would do.
+    // returns the number of frames, the plugin starts from a clean state after
+    // that, same as after reset.
+    int (*flush) (ddb_dsp_context_t *ctx, float *samples, int maxframes, ddb_waveformat_t *fmt);
+#endif
 } DB_dsp_t;
 
 // misc plugin
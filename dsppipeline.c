@@ -0,0 +1,465 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2015 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+// Blocks go around in a loop: the streamer takes a free block, fills it with
+// decoded samples and submits it to the queue of the first stage. Each stage
+// runs its plugins on the block in place, and passes it to the queue of the
+// next stage; the last stage puts it into the output queue, from where the
+// streamer takes it, converts it to the output format, and releases it.
+//
+// The queues are single-producer/single-consumer ringbufs of block pointers,
+// so passing a block doesn't take any locks, unless the queue was empty: then
+// the consumer may be sleeping, and the producer takes the mutex to wake it up.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include "dsppipeline.h"
+#include "ringbuf.h"
+#include "threading.h"
+
+// enough for every stage to work on a block, while the streamer fills one
+// and drains another
+#define DSP_PIPELINE_BLOCKS 8
+
+// how often the stage load is updated, in seconds of audio
+#define DSP_STATS_INTERVAL 5
+
+typedef struct {
+    ddb_dsp_context_t *first; // plugins from first up to last run in this stage
+    ddb_dsp_context_t *last; // not included, NULL for the end of the chain
+    char name[100];
+    ringbuf_t queue; // input
+    char queue_data[DSP_PIPELINE_BLOCKS * sizeof (dsp_block_t *)];
+    uintptr_t cond;
+    intptr_t tid;
+    volatile int terminate;
+    int gen;
+    dsp_stats_t stats;
+} dsp_stage_t;
+
+static dsp_block_t blocks[DSP_PIPELINE_BLOCKS];
+
+// accessed by the streamer thread only
+static dsp_block_t *free_blocks[DSP_PIPELINE_BLOCKS];
+static int num_free;
+
+static dsp_stage_t stages[DSP_PIPELINE_MAX_STAGES];
+static int num_stages;
+
+static ringbuf_t out_queue;
+static char out_queue_data[DSP_PIPELINE_BLOCKS * sizeof (dsp_block_t *)];
+static uintptr_t out_cond;
+
+static uintptr_t mutex;
+static volatile int gen;
+static int profiling;
+
+static void
+queue_push (ringbuf_t *queue, uintptr_t cond, dsp_block_t *block) {
+    ringbuf_write (queue, (char *)&block, sizeof (block));
+    // the consumer only sleeps after seeing an empty queue under the mutex,
+    // so if there's more than this block, it will get to it without waking up
+    if (ringbuf_get_remaining (queue) == sizeof (block)) {
+        mutex_lock (mutex);
+        cond_signal (cond);
+        mutex_unlock (mutex);
+    }
+}
+
+// returns NULL after timeout_ms (or never, if it's -1), or when terminate
+// is set and the queue is empty
+static dsp_block_t *
+queue_pop (ringbuf_t *queue, uintptr_t cond, int timeout_ms, volatile int *terminate) {
+    dsp_block_t *block;
+    if (ringbuf_read (queue, (char *)&block, sizeof (block)) == sizeof (block)) {
+        return block;
+    }
+    if (!timeout_ms) {
+        return NULL;
+    }
+    mutex_lock (mutex);
+    while (ringbuf_get_remaining (queue) < sizeof (block)) {
+        if (terminate && *terminate) {
+            mutex_unlock (mutex);
+            return NULL;
+        }
+        int err = cond_wait_timeout (cond, mutex, timeout_ms < 0 ? 1000 : timeout_ms);
+        if (err == ETIMEDOUT && timeout_ms >= 0) {
+            break;
+        }
+    }
+    mutex_unlock (mutex);
+    if (ringbuf_read (queue, (char *)&block, sizeof (block)) == sizeof (block)) {
+        return block;
+    }
+    return NULL;
+}
+
+int64_t
+dsp_thread_cpu_ns (void) {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+    if (!clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts)) {
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+#endif
+    return 0;
+}
+
+void
+dsp_stats_add (dsp_stats_t *stats, const char *name, int64_t cpu_ns, int frames, int samplerate) {
+    if (samplerate <= 0) {
+        return;
+    }
+    if (stats->samplerate != samplerate) {
+        memset (stats, 0, sizeof (dsp_stats_t));
+        stats->samplerate = samplerate;
+    }
+    stats->cpu_ns += cpu_ns;
+    stats->frames += frames;
+    if (stats->frames >= (int64_t)samplerate * DSP_STATS_INTERVAL) {
+        // 100% means that the stage can barely keep up with realtime
+        double audio_ns = stats->frames * 1000000000.0 / samplerate;
+        if (strcmp (stats->name, name)) {
+            snprintf (stats->name, sizeof (stats->name), "%s", name);
+        }
+        stats->load = stats->cpu_ns * 100 / audio_ns;
+        fprintf (stderr, "dsp profile: %s: %.1f%% of realtime\n", stats->name, stats->load);
+        stats->cpu_ns = 0;
+        stats->frames = 0;
+    }
+}
+
+static void
+dsp_stage_thread (void *ctx) {
+    dsp_stage_t *stage = ctx;
+#ifdef __linux__
+    prctl (PR_SET_NAME, "deadbeef-dsp", 0, 0, 0, 0);
+#endif
+    dsp_stage_t *next = stage + 1 < stages + num_stages ? stage + 1 : NULL;
+
+    for (;;) {
+        dsp_block_t *block = queue_pop (&stage->queue, stage->cond, -1, &stage->terminate);
+        if (!block) {
+            break;
+        }
+
+        if (block->gen != stage->gen) {
+            for (ddb_dsp_context_t *dsp = stage->first; dsp != stage->last; dsp = dsp->next) {
+                if (dsp->plugin->reset) {
+                    dsp->plugin->reset (dsp);
+                }
+            }
+            stage->gen = block->gen;
+        }
+
+        // blocks from before a reset are dropped by the streamer anyway
+        // the last block of the track goes through even if it's empty, for
+        // the plugins to flush what they hold back
+        if (block->gen == gen && (block->nframes > 0 || block->eof)) {
+            int64_t cpu = profiling ? dsp_thread_cpu_ns () : 0;
+            int frames = block->nframes;
+            int samplerate = block->fmt.samplerate;
+            for (ddb_dsp_context_t *dsp = stage->first; dsp != stage->last && (block->nframes > 0 || block->eof); dsp = dsp->next) {
+                if (dsp->enabled) {
+                    float r = 1;
+                    block->nframes = dsp_plugin_process (dsp, block->samples, block->size, block->nframes, &block->fmt, &r, block->eof);
+                    block->ratio *= r;
+                }
+            }
+            if (block->nframes < 0) {
+                block->nframes = 0;
+            }
+            if (profiling) {
+                dsp_stats_add (&stage->stats, stage->name, dsp_thread_cpu_ns () - cpu, frames, samplerate);
+            }
+        }
+
+        if (next) {
+            queue_push (&next->queue, next->cond, block);
+        }
+        else {
+            queue_push (&out_queue, out_cond, block);
+        }
+    }
+}
+
+int
+dsp_pipeline_start (ddb_dsp_context_t *chain, int blocksize) {
+    dsp_pipeline_stop ();
+
+    int count = 0;
+    for (ddb_dsp_context_t *dsp = chain; dsp; dsp = dsp->next) {
+        if (dsp->enabled) {
+            count++;
+        }
+    }
+    if (count < 2) {
+        return -1;
+    }
+
+    // the threads are stopped, so the block which is being drained by the
+    // streamer can be grown too
+    for (int i = 0; i < DSP_PIPELINE_BLOCKS; i++) {
+        dsp_block_t *block = &blocks[i];
+        if (block->size >= blocksize) {
+            continue;
+        }
+        char *samples;
+        if (posix_memalign ((void **)&samples, 32, blocksize)) {
+            fprintf (stderr, "dsp_pipeline: failed to allocate %d bytes block\n", blocksize);
+            return -1;
+        }
+        if (block->samples) {
+            memcpy (samples, block->samples, block->size);
+            free (block->samples);
+        }
+        block->samples = samples;
+        block->size = blocksize;
+    }
+
+    // one stage per enabled plugin, and everything that's left for the last one
+    ddb_dsp_context_t *dsp = chain;
+    while (dsp) {
+        if (!dsp->enabled) {
+            dsp = dsp->next;
+            continue;
+        }
+        dsp_stage_t *stage = &stages[num_stages++];
+        memset (stage, 0, sizeof (dsp_stage_t));
+        stage->first = dsp;
+        stage->last = num_stages < DSP_PIPELINE_MAX_STAGES ? dsp->next : NULL;
+        for (; dsp != stage->last; dsp = dsp->next) {
+            if (dsp->enabled) {
+                size_t l = strlen (stage->name);
+                snprintf (stage->name + l, sizeof (stage->name) - l, "%s%s", l ? ", " : "", dsp->plugin->plugin.name);
+            }
+        }
+        ringbuf_init (&stage->queue, stage->queue_data, sizeof (stage->queue_data));
+        stage->gen = gen;
+        stage->cond = cond_create ();
+    }
+
+    for (int i = 0; i < num_stages; i++) {
+        stages[i].tid = thread_start (dsp_stage_thread, &stages[i]);
+        if (!stages[i].tid) {
+            fprintf (stderr, "dsp_pipeline: failed to start thread\n");
+            for (int j = i; j < num_stages; j++) {
+                cond_free (stages[j].cond);
+            }
+            num_stages = i;
+            dsp_pipeline_stop ();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void
+dsp_pipeline_stop (void) {
+    if (!num_stages) {
+        return;
+    }
+
+    // the blocks in flight were made for the old chain, so they're dropped:
+    // the stages pass them through without processing
+    dsp_pipeline_reset ();
+
+    // a stage only quits when its queue is empty, so stopping them in order
+    // moves every block to the output queue
+    for (int i = 0; i < num_stages; i++) {
+        mutex_lock (mutex);
+        stages[i].terminate = 1;
+        cond_signal (stages[i].cond);
+        mutex_unlock (mutex);
+        thread_join (stages[i].tid);
+        cond_free (stages[i].cond);
+    }
+    num_stages = 0;
+
+    dsp_block_t *block;
+    while (ringbuf_read (&out_queue, (char *)&block, sizeof (block)) == sizeof (block)) {
+        dsp_pipeline_release (block);
+    }
+}
+
+int
+dsp_pipeline_is_running (void) {
+    return num_stages > 0;
+}
+
+dsp_block_t *
+dsp_pipeline_get_free (void) {
+    if (!num_free) {
+        return NULL;
+    }
+    dsp_block_t *block = free_blocks[--num_free];
+    block->ratio = 1;
+    block->gen = gen;
+    block->eof = 0;
+    return block;
+}
+
+void
+dsp_pipeline_submit (dsp_block_t *block) {
+    queue_push (&stages[0].queue, stages[0].cond, block);
+}
+
+dsp_block_t *
+dsp_pipeline_get_output (int timeout_ms) {
+    return queue_pop (&out_queue, out_cond, timeout_ms, NULL);
+}
+
+void
+dsp_pipeline_release (dsp_block_t *block) {
+    free_blocks[num_free++] = block;
+}
+
+void
+dsp_pipeline_reset (void) {
+    __sync_fetch_and_add (&gen, 1);
+}
+
+int
+dsp_pipeline_get_gen (void) {
+    return gen;
+}
+
+void
+dsp_pipeline_set_profiling (int enable) {
+    profiling = enable;
+}
+
+int
+dsp_pipeline_get_profiling (void) {
+    return profiling;
+}
+
+int
+dsp_pipeline_get_stats (int stage, dsp_stats_t *stats) {
+    if (stage < 0 || stage >= num_stages) {
+        return -1;
+    }
+    memcpy (stats, &stages[stage].stats, sizeof (dsp_stats_t));
+    return 0;
+}
+
+int
+dsp_chain_negotiate (ddb_dsp_context_t *chain, ddb_waveformat_t *fmt, int nframes, float fallback_ratio, float *ratio) {
+    float frames = nframes;
+    float r = 1;
+    int size = nframes * fmt->channels * sizeof (float);
+    for (ddb_dsp_context_t *dsp = chain; dsp; dsp = dsp->next) {
+        if (!dsp->enabled) {
+            continue;
+        }
+        if (dsp->plugin->plugin.api_vminor >= 10 && dsp->plugin->negotiate) {
+            float plugin_ratio = 1;
+            int latency = 0;
+            dsp->plugin->negotiate (dsp, fmt, &plugin_ratio, &latency);
+            // +1 for rounding up to whole frames
+            frames = (frames + latency) * plugin_ratio + 1;
+            r *= plugin_ratio;
+        }
+        else if (frames < nframes * fallback_ratio) {
+            // unknown plugin, give it the same room as before negotiation existed
+            frames = nframes * fallback_ratio;
+        }
+        int stagesize = (int)frames * fmt->channels * sizeof (float);
+        if (stagesize > size) {
+            size = stagesize;
+        }
+    }
+    *ratio = r;
+    return size;
+}
+
+int
+dsp_plugin_process (ddb_dsp_context_t *dsp, char *samples, int size, int nframes, ddb_waveformat_t *fmt, float *ratio, int eof) {
+    if (nframes > 0) {
+        int maxframes = size / (fmt->channels * sizeof (float));
+        nframes = dsp->plugin->process (dsp, (float *)samples, nframes, maxframes, fmt, ratio);
+    }
+    if (eof && dsp->plugin->plugin.api_vminor >= 10 && dsp->plugin->flush) {
+        if (nframes < 0) {
+            nframes = 0;
+        }
+        int framesize = fmt->channels * sizeof (float);
+        int maxframes = size / framesize - nframes;
+        if (maxframes > 0) {
+            nframes += dsp->plugin->flush (dsp, (float *)(samples + nframes * framesize), maxframes, fmt);
+        }
+    }
+    return nframes;
+}
+
+int
+dsp_chain_can_bypass (ddb_dsp_context_t *chain, ddb_waveformat_t *fmt) {
+    for (ddb_dsp_context_t *dsp = chain; dsp; dsp = dsp->next) {
+        if (!dsp->enabled) {
+            continue;
+        }
+        if (dsp->plugin->plugin.api_vminor < 1 || !dsp->plugin->can_bypass || !dsp->plugin->can_bypass (dsp, fmt)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void
+dsp_pipeline_init (void) {
+    mutex = mutex_create_nonrecursive ();
+    out_cond = cond_create ();
+    ringbuf_init (&out_queue, out_queue_data, sizeof (out_queue_data));
+    for (int i = 0; i < DSP_PIPELINE_BLOCKS; i++) {
+        free_blocks[i] = &blocks[i];
+    }
+    num_free = DSP_PIPELINE_BLOCKS;
+}
+
+void
+dsp_pipeline_free (void) {
+    dsp_pipeline_stop ();
+    for (int i = 0; i < DSP_PIPELINE_BLOCKS; i++) {
+        free (blocks[i].samples);
+        blocks[i].samples = NULL;
+        blocks[i].size = 0;
+    }
+    if (out_cond) {
+        cond_free (out_cond);
+        out_cond = 0;
+    }
+    if (mutex) {
+        mutex_free (mutex);
+        mutex = 0;
+    }
+}
@@ -0,0 +1,143 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2015 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef __deadbeef__dsppipeline__
+#define __deadbeef__dsppipeline__
+
+#include <stdint.h>
+#include "deadbeef.h"
+
+// Pipelined dsp chain: each enabled plugin runs on its own thread, and
+// blocks of float samples are passed from one stage to the next through
+// lock-free queues. The streamer thread is the only producer and consumer,
+// the plugins process blocks in place.
+
+// max number of threads; the remaining plugins share the last stage
+#define DSP_PIPELINE_MAX_STAGES 6
+
+typedef struct {
+    char *samples;
+    int size; // allocated bytes
+    int nframes;
+    ddb_waveformat_t fmt; // format of the samples, updated by each stage
+    float ratio; // product of the ratios returned by the plugins
+    int gen; // blocks from before the last dsp_pipeline_reset are dropped
+    int eof; // last block of the track
+} dsp_block_t;
+
+// cpu time spent in one stage
+typedef struct {
+    int64_t cpu_ns;
+    int64_t frames;
+    int samplerate;
+    char name[100]; // plugins of the stage, as of the last interval
+    float load; // cpu load of the last interval, in percent of realtime
+} dsp_stats_t;
+
+// Starts the worker threads for the enabled plugins of the chain, with blocks
+// of blocksize bytes. A running pipeline is stopped first.
+// Returns -1 if the chain has less than 2 enabled plugins, so there's nothing
+// to gain, or on error.
+int
+dsp_pipeline_start (ddb_dsp_context_t *chain, int blocksize);
+
+// Stops the threads, and drops the blocks which are still in the pipeline,
+// by starting a new generation. The block being drained by the streamer is
+// kept until it's released.
+void
+dsp_pipeline_stop (void);
+
+int
+dsp_pipeline_is_running (void);
+
+// Returns a block to fill, or NULL if all blocks are in use.
+dsp_block_t *
+dsp_pipeline_get_free (void);
+
+void
+dsp_pipeline_submit (dsp_block_t *block);
+
+// Returns the next processed block, waiting up to timeout_ms for it.
+dsp_block_t *
+dsp_pipeline_get_output (int timeout_ms);
+
+// Returns a block, which was drained by the caller, to the free list.
+void
+dsp_pipeline_release (dsp_block_t *block);
+
+// Can be called from any thread: the stages reset their plugins before
+// processing the next block of the new generation.
+void
+dsp_pipeline_reset (void);
+
+int
+dsp_pipeline_get_gen (void);
+
+// Accounts cpu_ns spent on frames of input, and updates the load of the stage
+// every few seconds of audio, printing it to stderr. Only called when
+// profiling is enabled, see streamer.dsp_profile.
+void
+dsp_stats_add (dsp_stats_t *stats, const char *name, int64_t cpu_ns, int frames, int samplerate);
+
+// cpu time used by the calling thread
+int64_t
+dsp_thread_cpu_ns (void);
+
+void
+dsp_pipeline_set_profiling (int enable);
+
+int
+dsp_pipeline_get_profiling (void);
+
+// Copies the stats of a running stage, with profiling enabled; load is 0
+// until the first interval is complete. Returns -1 if there's no such stage.
+int
+dsp_pipeline_get_stats (int stage, dsp_stats_t *stats);
+
+void
+dsp_pipeline_init (void);
+
+// Walks the enabled plugins of the chain, to find out what they make of
+// nframes frames of float samples in fmt. Plugins without negotiate may
+// return up to fallback_ratio times the frames they get.
+// Updates fmt to the output format of the chain, sets *ratio to the max
+// number of output frames per input frame, and returns the size in bytes of
+// the largest buffer any of the plugins needs.
+int
+dsp_chain_negotiate (ddb_dsp_context_t *chain, ddb_waveformat_t *fmt, int nframes, float fallback_ratio, float *ratio);
+
+// Runs a plugin on nframes frames in samples, which is size bytes, and at
+// the end of the track (eof) also appends what the plugin holds back.
+// Returns the number of output frames.
+int
+dsp_plugin_process (ddb_dsp_context_t *dsp, char *samples, int size, int nframes, ddb_waveformat_t *fmt, float *ratio, int eof);
+
+// Returns 1 if all enabled plugins of the chain can be bypassed for fmt.
+// Plugins without can_bypass are never bypassed.
+int
+dsp_chain_can_bypass (ddb_dsp_context_t *chain, ddb_waveformat_t *fmt);
+
+void
+dsp_pipeline_free (void);
+
+#endif
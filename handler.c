@@ -47,6 +47,7 @@ typedef struct handler_s {
     message_t *mqtail;
     uintptr_t mutex;
     uintptr_t cond;
+    volatile int wakeup;
     message_t pool[1];
 } handler_t;
 
@@ -119,6 +120,33 @@ handler_wait (handler_t *h) {
     mutex_unlock (h->mutex);
 }
 
+void
+handler_wait_timeout (handler_t *h, int timeout_ms) {
+    mutex_lock (h->mutex);
+    if (!h->mqueue && !h->wakeup) {
+        cond_wait_timeout (h->cond, h->mutex, timeout_ms);
+    }
+    h->wakeup = 0;
+    mutex_unlock (h->mutex);
+}
+
+// called from the output thread, when the buffer crosses the low watermark.
+// if the mutex is free, the waiter is either inside cond_wait_timeout, or
+// hasn't checked the flag yet, so signaling under the mutex can't be lost.
+// if it's busy, the signal is sent anyway, and may come before the waiter
+// sleeps; handler_wait_timeout is always bounded, so that only delays it.
+void
+handler_wakeup (handler_t *h) {
+    __sync_lock_test_and_set (&h->wakeup, 1);
+    if (!mutex_trylock (h->mutex)) {
+        cond_signal (h->cond);
+        mutex_unlock (h->mutex);
+    }
+    else {
+        cond_signal (h->cond);
+    }
+}
+
 int
 handler_pop (handler_t *h, uint32_t *id, uintptr_t *ctx, uint32_t *p1, uint32_t *p2) {
     mutex_lock (h->mutex);
@@ -47,6 +47,17 @@ handler_pop (struct handler_s *h, uint32_t *id, uintptr_t *ctx, uint32_t *p1, ui
 void
 handler_wait (struct handler_s *h);
 
+// wait until a message is pushed, handler_wakeup is called, or timeout expires
+void
+handler_wait_timeout (struct handler_s *h, int timeout_ms);
+
+// interrupt handler_wait_timeout without pushing a message;
+// never blocks on the handler mutex, so it's safe to call from realtime
+// threads. when the mutex is busy, the wakeup may come too early, and the
+// waiter only wakes up when its timeout expires
+void
+handler_wakeup (struct handler_s *h);
+
 int
 handler_hasmessages (struct handler_s *h);
 
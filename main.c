@@ -70,6 +70,8 @@
 #endif
 #include "playqueue.h"
 #include "tf.h"
+#include "tagcache.h"
+#include "premix.h"
 
 #ifndef PREFIX
 #error PREFIX must be defined
@@ -117,6 +119,7 @@ print_help (void) {
     fprintf (stdout, _("   --random           Random song in playlist\n"));
     fprintf (stdout, _("   --queue            Append file(s) to existing playlist\n"));
     fprintf (stdout, _("   --gui PLUGIN       Tells which GUI plugin to use, default is \"GTK2\"\n"));
+    fprintf (stdout, _("   --rebuild-tag-cache  Remove the tag cache entries of changed and missing files\n"));
     fprintf (stdout, _("   --nowplaying FMT   Print formatted track name to stdout\n"));
     fprintf (stdout, _("                      FMT %%-syntax: [a]rtist, [t]itle, al[b]um,\n"
                 "                      [l]ength, track[n]umber, [y]ear, [c]omment,\n"
@@ -320,6 +323,9 @@ server_exec_command_line (const char *cmdline, int len, char *sendback, int sbsi
         else if (!strcmp (parg, "--quit")) {
             messagepump_push (DB_EV_TERMINATE, 0, 0, 0);
         }
+        else if (!strcmp (parg, "--rebuild-tag-cache")) {
+            tagcache_rebuild ();
+        }
         else if (!strcmp (parg, "--gui")) {
             // need to skip --gui here, it is handled in the client cmdline
             parg += strlen (parg);
@@ -1092,6 +1098,8 @@ main (int argc, char *argv[]) {
 
     volume_set_db (conf_get_float ("playback.volume", 0)); // volume need to be initialized before plugins start
 
+    pcm_convert_init (1);
+
     messagepump_init (); // required to push messages while handling commandline
     if (plug_load_all ()) { // required to add files to playlist from commandline
         exit (-1);
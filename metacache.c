@@ -25,112 +25,556 @@
   Alexey Yakovenko waker@users.sourceforge.net
 */
 #include <string.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "metacache.h"
+#include "threading.h"
+
+// The cache is split into independent stripes, each one with its own lock,
+// open-addressing table and node allocator, so that threads interning
+// unrelated strings don't contend.  The stripe is chosen by the top bits of
+// the hash, the slot by the low bits.
+#define METACACHE_STRIPE_BITS 6
+#define METACACHE_STRIPES (1<<METACACHE_STRIPE_BITS)
+#define METACACHE_MIN_CAPACITY 64
+
+// nodes up to METACACHE_SLAB_MAX bytes are carved out of slabs and recycled
+// via per-size-class free lists, bigger ones come from malloc
+#define METACACHE_SLAB_GRANULARITY 16
+#define METACACHE_SLAB_MAX 256
+#define METACACHE_SLAB_CLASSES (METACACHE_SLAB_MAX/METACACHE_SLAB_GRANULARITY)
+#define METACACHE_SLAB_SIZE 16384
 
 typedef struct metacache_str_s {
-    struct metacache_str_s *next;
-    size_t value_length;
+    union {
+        struct metacache_str_s *next_free; // only used while on a free list
+        size_t value_length;
+    };
+    uint32_t hash;
     uint32_t refcount;
     char cmpidx; // positive means "equals", negative means "notequals"
     char str[1];
 } metacache_str_t;
 
 typedef struct {
-//    uint32_t hash;
-    metacache_str_t *chain;
-} metacache_hash_t;
+    uint32_t hash;
+    metacache_str_t *data; // NULL for empty slots
+} metacache_slot_t;
+
+typedef struct metacache_slab_s {
+    struct metacache_slab_s *next;
+} metacache_slab_t;
+
+typedef struct {
+    uintptr_t mutex;
+    metacache_slot_t *slots;
+    uint32_t capacity; // power of 2
+    uint32_t count;
+    size_t bytes;
 
-#define HASH_SIZE 4096
+    metacache_str_t *free_nodes[METACACHE_SLAB_CLASSES];
+    metacache_slab_t *slabs;
+    char *slab_ptr;
+    char *slab_end;
+    size_t allocated;
+} metacache_stripe_t;
 
-static metacache_hash_t hash[HASH_SIZE];
+static metacache_stripe_t stripes[METACACHE_STRIPES];
 
+// murmur3 (x86, 32 bit), reading 4 bytes per step
 static uint32_t
-metacache_get_hash_sdbm (const char *str, size_t len) {
-    uint32_t hash = 0;
-    int c;
+metacache_get_hash (const char *str, size_t len) {
+    const uint32_t c1 = 0xcc9e2d51;
+    const uint32_t c2 = 0x1b873593;
+    const uint8_t *data = (const uint8_t *)str;
+    size_t nblocks = len / 4;
+    uint32_t h = 0x9747b28c;
 
-    const char *end = str+len;
+    for (size_t i = 0; i < nblocks; i++) {
+        uint32_t k;
+        memcpy (&k, data + i * 4, 4);
+        k *= c1;
+        k = (k << 15) | (k >> 17);
+        k *= c2;
+        h ^= k;
+        h = (h << 13) | (h >> 19);
+        h = h * 5 + 0xe6546b64;
+    }
 
-    while (str < end) {
-        c = *str++;
-        hash = c + (hash << 6) + (hash << 16) - hash;
+    const uint8_t *tail = data + nblocks * 4;
+    uint32_t k = 0;
+    switch (len & 3) {
+    case 3:
+        k ^= tail[2] << 16;
+    case 2:
+        k ^= tail[1] << 8;
+    case 1:
+        k ^= tail[0];
+        k *= c1;
+        k = (k << 15) | (k >> 17);
+        k *= c2;
+        h ^= k;
     }
 
-    return hash;
+    h ^= (uint32_t)len;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline metacache_stripe_t *
+metacache_stripe_for_hash (uint32_t h) {
+    return &stripes[h >> (32 - METACACHE_STRIPE_BITS)];
+}
+
+static inline size_t
+metacache_node_size (size_t len) {
+    return offsetof (metacache_str_t, str) + len;
+}
+
+static inline int
+metacache_size_class (size_t size) {
+    return (int)((size + METACACHE_SLAB_GRANULARITY - 1) / METACACHE_SLAB_GRANULARITY) - 1;
 }
 
 static metacache_str_t *
-metacache_find_in_bucket (uint32_t h, const char *value, size_t len) {
-    metacache_hash_t *bucket = &hash[h];
-    metacache_str_t *chain = bucket->chain;
-    while (chain) {
-        if (chain->value_length == len && !memcmp (chain->str, value, len)) {
-            return chain;
+metacache_node_alloc (metacache_stripe_t *s, size_t len) {
+    size_t size = metacache_node_size (len);
+    if (size > METACACHE_SLAB_MAX) {
+        s->allocated += size;
+        return malloc (size);
+    }
+    int cls = metacache_size_class (size);
+    metacache_str_t *node = s->free_nodes[cls];
+    if (node) {
+        s->free_nodes[cls] = node->next_free;
+        return node;
+    }
+    size_t alloc_size = (cls + 1) * METACACHE_SLAB_GRANULARITY;
+    if (s->slab_ptr + alloc_size > s->slab_end) {
+        metacache_slab_t *slab = malloc (METACACHE_SLAB_SIZE);
+        if (!slab) {
+            return NULL;
         }
-        chain = chain->next;
+        slab->next = s->slabs;
+        s->slabs = slab;
+        s->allocated += METACACHE_SLAB_SIZE;
+        // keep nodes aligned for the size_t/uint32_t fields
+        s->slab_ptr = (char *)slab + METACACHE_SLAB_GRANULARITY;
+        s->slab_end = (char *)slab + METACACHE_SLAB_SIZE;
     }
-    return NULL;
+    node = (metacache_str_t *)s->slab_ptr;
+    s->slab_ptr += alloc_size;
+    return node;
 }
 
-static int n_strings = 0;
-static int n_inserts = 0;
-static int n_buckets = 0;
+static void
+metacache_node_free (metacache_stripe_t *s, metacache_str_t *node) {
+    size_t size = metacache_node_size (node->value_length);
+    if (size > METACACHE_SLAB_MAX) {
+        s->allocated -= size;
+        free (node);
+        return;
+    }
+    int cls = metacache_size_class (size);
+    node->next_free = s->free_nodes[cls];
+    s->free_nodes[cls] = node;
+}
+
+// Key atoms: case-insensitive integer ids for metadata keys, see
+// metacache_key_atom. Atoms are never released. The table is read without
+// the lock: a slot is filled before its atom is published, and grown tables
+// replace the old ones, which stay allocated until metacache_free.
+#define METACACHE_ATOM_MIN_CAPACITY 256
+
+typedef struct {
+    uint32_t atom; // 0 for empty slots
+    uint32_t hash;
+    const char *name;
+} metacache_atom_slot_t;
+
+typedef struct metacache_atom_table_s {
+    struct metacache_atom_table_s *retired_next;
+    uint32_t capacity; // power of 2
+    metacache_atom_slot_t slots[];
+} metacache_atom_table_t;
+
+typedef struct {
+    const char *name;
+    uint32_t override; // atom of the '!' key overriding a ':' property
+} metacache_atom_info_t;
+
+typedef struct metacache_atom_names_s {
+    struct metacache_atom_names_s *retired_next;
+    uint32_t size;
+    metacache_atom_info_t info[];
+} metacache_atom_names_t;
+
+static metacache_atom_table_t *atom_table;
+static metacache_atom_names_t *atom_names; // indexed by atom
+static uintptr_t atom_mutex;
+static uint32_t atom_count;
+
+// must match the order of the META_ATOM_* constants
+static const char *well_known_keys[META_ATOM_COUNT] = {
+    [META_ATOM_TITLE] = "title",
+    [META_ATOM_ARTIST] = "artist",
+    [META_ATOM_ALBUM] = "album",
+    [META_ATOM_ALBUM_ARTIST] = "album artist",
+    [META_ATOM_ALBUMARTIST] = "albumartist",
+    [META_ATOM_BAND] = "band",
+    [META_ATOM_COMPOSER] = "composer",
+    [META_ATOM_PERFORMER] = "performer",
+    [META_ATOM_VENUE] = "venue",
+    [META_ATOM_TRACK] = "track",
+    [META_ATOM_NUMTRACKS] = "numtracks",
+    [META_ATOM_DISC] = "disc",
+    [META_ATOM_NUMDISCS] = "numdiscs",
+    [META_ATOM_YEAR] = "year",
+    [META_ATOM_GENRE] = "genre",
+    [META_ATOM_COMMENT] = "comment",
+    [META_ATOM_CUESHEET] = "cuesheet",
+    [META_ATOM_LOG] = "log",
+    [META_ATOM_URI] = ":URI",
+    [META_ATOM_DECODER] = ":DECODER",
+    [META_ATOM_TRACKNUM] = ":TRACKNUM",
+    [META_ATOM_DURATION] = ":DURATION",
+    [META_ATOM_FILETYPE] = ":FILETYPE",
+    [META_ATOM_BITRATE] = ":BITRATE",
+    [META_ATOM_SAMPLERATE] = ":SAMPLERATE",
+    [META_ATOM_CHANNELS] = ":CHANNELS",
+    [META_ATOM_BPS] = ":BPS",
+    [META_ATOM_FILE_SIZE] = ":FILE_SIZE",
+    [META_ATOM_REPLAYGAIN_ALBUMGAIN] = ":REPLAYGAIN_ALBUMGAIN",
+    [META_ATOM_REPLAYGAIN_ALBUMPEAK] = ":REPLAYGAIN_ALBUMPEAK",
+    [META_ATOM_REPLAYGAIN_TRACKGAIN] = ":REPLAYGAIN_TRACKGAIN",
+    [META_ATOM_REPLAYGAIN_TRACKPEAK] = ":REPLAYGAIN_TRACKPEAK",
+};
+
+static uint32_t
+metacache_get_key_hash (const char *key) {
+    // FNV-1a over ascii-lowercased bytes, to match strcasecmp
+    uint32_t h = 2166136261u;
+    for (const uint8_t *p = (const uint8_t *)key; *p; p++) {
+        uint8_t c = *p;
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+static metacache_atom_table_t *
+metacache_atom_table_alloc (uint32_t capacity) {
+    metacache_atom_table_t *t = calloc (1, sizeof (metacache_atom_table_t) + capacity * sizeof (metacache_atom_slot_t));
+    t->capacity = capacity;
+    return t;
+}
+
+// returns the slot with the key, or the empty slot where it belongs
+static metacache_atom_slot_t *
+metacache_atom_find_slot (metacache_atom_table_t *t, const char *key, uint32_t h) {
+    uint32_t mask = t->capacity - 1;
+    for (uint32_t i = h & mask;; i = (i + 1) & mask) {
+        metacache_atom_slot_t *slot = &t->slots[i];
+        if (!__atomic_load_n (&slot->atom, __ATOMIC_ACQUIRE)) {
+            return slot;
+        }
+        if (slot->hash == h && !strcasecmp (slot->name, key)) {
+            return slot;
+        }
+    }
+}
+
+uint32_t
+metacache_find_key_atom (const char *key) {
+    uint32_t h = metacache_get_key_hash (key);
+    metacache_atom_table_t *t = __atomic_load_n (&atom_table, __ATOMIC_ACQUIRE);
+    uint32_t atom = metacache_atom_find_slot (t, key, h)->atom;
+    if (!atom && t != atom_table) {
+        // the table has grown meanwhile
+        mutex_lock (atom_mutex);
+        atom = metacache_atom_find_slot (atom_table, key, h)->atom;
+        mutex_unlock (atom_mutex);
+    }
+    return atom;
+}
+
+uint32_t
+metacache_key_atom (const char *key) {
+    uint32_t atom = metacache_find_key_atom (key);
+    if (atom) {
+        return atom;
+    }
+
+    uint32_t h = metacache_get_key_hash (key);
+    mutex_lock (atom_mutex);
+    metacache_atom_table_t *t = atom_table;
+    metacache_atom_slot_t *slot = metacache_atom_find_slot (t, key, h);
+    if (slot->atom) {
+        atom = slot->atom;
+        mutex_unlock (atom_mutex);
+        return atom;
+    }
+
+    // keep load factor under 1/2
+    if ((atom_count + 1) * 2 > t->capacity) {
+        metacache_atom_table_t *grown = metacache_atom_table_alloc (t->capacity * 2);
+        uint32_t mask = grown->capacity - 1;
+        for (uint32_t i = 0; i < t->capacity; i++) {
+            if (t->slots[i].atom) {
+                uint32_t n = t->slots[i].hash & mask;
+                while (grown->slots[n].atom) {
+                    n = (n + 1) & mask;
+                }
+                grown->slots[n] = t->slots[i];
+            }
+        }
+        grown->retired_next = t;
+        t = grown;
+        slot = metacache_atom_find_slot (t, key, h);
+    }
+
+    slot->hash = h;
+    slot->name = metacache_add_string (key);
+    atom = ++atom_count;
+
+    // the info must be in place before the atom becomes visible
+    metacache_atom_names_t *names = atom_names;
+    if (!names || atom >= names->size) {
+        uint32_t size = names ? names->size * 2 : METACACHE_ATOM_MIN_CAPACITY;
+        metacache_atom_names_t *grown = calloc (1, sizeof (metacache_atom_names_t) + size * sizeof (metacache_atom_info_t));
+        grown->size = size;
+        if (names) {
+            memcpy (grown->info, names->info, names->size * sizeof (metacache_atom_info_t));
+        }
+        grown->retired_next = names;
+        names = grown;
+        __atomic_store_n (&atom_names, names, __ATOMIC_RELEASE);
+    }
+    names->info[atom].name = slot->name;
+
+    // link ':' properties and their '!' overrides, whichever comes first
+    if (key[0] == ':' || key[0] == '!') {
+        size_t l = strlen (key);
+        char other[l + 1];
+        memcpy (other, key, l + 1);
+        other[0] = key[0] == ':' ? '!' : ':';
+        uint32_t other_atom = metacache_atom_find_slot (t, other, metacache_get_key_hash (other))->atom;
+        if (other_atom && key[0] == ':') {
+            names->info[atom].override = other_atom;
+        }
+        else if (other_atom) {
+            __atomic_store_n (&names->info[other_atom].override, atom, __ATOMIC_RELEASE);
+        }
+    }
+
+    __atomic_store_n (&slot->atom, atom, __ATOMIC_RELEASE);
+    if (t != atom_table) {
+        __atomic_store_n (&atom_table, t, __ATOMIC_RELEASE);
+    }
+    mutex_unlock (atom_mutex);
+    return atom;
+}
+
+const char *
+metacache_key_atom_name (uint32_t atom) {
+    metacache_atom_names_t *names = __atomic_load_n (&atom_names, __ATOMIC_ACQUIRE);
+    return names->info[atom].name;
+}
+
+uint32_t
+metacache_key_atom_override (uint32_t atom) {
+    metacache_atom_names_t *names = __atomic_load_n (&atom_names, __ATOMIC_ACQUIRE);
+    return __atomic_load_n (&names->info[atom].override, __ATOMIC_ACQUIRE);
+}
+
+void
+metacache_init (void) {
+    for (int i = 0; i < METACACHE_STRIPES; i++) {
+        metacache_stripe_t *s = &stripes[i];
+        s->mutex = mutex_create_nonrecursive ();
+        s->capacity = METACACHE_MIN_CAPACITY;
+        s->slots = calloc (s->capacity, sizeof (metacache_slot_t));
+    }
+    atom_mutex = mutex_create_nonrecursive ();
+    atom_table = metacache_atom_table_alloc (METACACHE_ATOM_MIN_CAPACITY);
+    for (int i = 1; i < META_ATOM_COUNT; i++) {
+        uint32_t atom = metacache_key_atom (well_known_keys[i]);
+        if (atom != i) {
+            fprintf (stderr, "metacache: well-known key %s got atom %d instead of %d\n", well_known_keys[i], atom, i);
+        }
+    }
+}
+
+void
+metacache_free (void) {
+    while (atom_table) {
+        metacache_atom_table_t *next = atom_table->retired_next;
+        free (atom_table);
+        atom_table = next;
+    }
+    while (atom_names) {
+        metacache_atom_names_t *next = atom_names->retired_next;
+        free (atom_names);
+        atom_names = next;
+    }
+    mutex_free (atom_mutex);
+    atom_mutex = 0;
+    atom_count = 0;
+
+    for (int i = 0; i < METACACHE_STRIPES; i++) {
+        metacache_stripe_t *s = &stripes[i];
+        for (uint32_t n = 0; n < s->capacity; n++) {
+            metacache_str_t *data = s->slots[n].data;
+            if (data && metacache_node_size (data->value_length) > METACACHE_SLAB_MAX) {
+                free (data);
+            }
+        }
+        while (s->slabs) {
+            metacache_slab_t *next = s->slabs->next;
+            free (s->slabs);
+            s->slabs = next;
+        }
+        free (s->slots);
+        mutex_free (s->mutex);
+        memset (s, 0, sizeof (metacache_stripe_t));
+    }
+}
+
+// returns the slot holding the value, or the empty slot where it belongs
+static uint32_t
+metacache_find_slot (metacache_stripe_t *s, uint32_t h, const char *value, size_t len) {
+    uint32_t mask = s->capacity - 1;
+    uint32_t i = h & mask;
+    for (;;) {
+        metacache_slot_t *slot = &s->slots[i];
+        if (!slot->data) {
+            return i;
+        }
+        if (slot->hash == h && slot->data->value_length == len && !memcmp (slot->data->str, value, len)) {
+            return i;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+static void
+metacache_grow (metacache_stripe_t *s) {
+    uint32_t oldcap = s->capacity;
+    metacache_slot_t *old = s->slots;
+    metacache_slot_t *slots = calloc (oldcap * 2, sizeof (metacache_slot_t));
+    if (!slots) {
+        return;
+    }
+    s->capacity = oldcap * 2;
+    s->slots = slots;
+    uint32_t mask = s->capacity - 1;
+    for (uint32_t i = 0; i < oldcap; i++) {
+        if (old[i].data) {
+            uint32_t n = old[i].hash & mask;
+            while (slots[n].data) {
+                n = (n + 1) & mask;
+            }
+            slots[n] = old[i];
+        }
+    }
+    free (old);
+}
+
+// backward-shift deletion, keeps probe sequences intact without tombstones
+static void
+metacache_remove_slot (metacache_stripe_t *s, uint32_t i) {
+    uint32_t mask = s->capacity - 1;
+    uint32_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!s->slots[j].data) {
+            break;
+        }
+        uint32_t home = s->slots[j].hash & mask;
+        // move slot j into the hole at i, unless its home lies cyclically in (i, j]
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+            continue;
+        }
+        s->slots[i] = s->slots[j];
+        i = j;
+    }
+    s->slots[i].data = NULL;
+    s->slots[i].hash = 0;
+}
 
 const char *
 metacache_add_value (const char *value, size_t len) {
-    //    printf ("n_strings=%d, n_inserts=%d, n_buckets=%d\n", n_strings, n_inserts, n_buckets);
-    uint32_t h = metacache_get_hash_sdbm (value, len);
-    metacache_str_t *data = metacache_find_in_bucket (h % HASH_SIZE, value, len);
-    n_inserts++;
+    return metacache_add_value_refs (value, len, 1);
+}
+
+const char *
+metacache_add_value_refs (const char *value, size_t len, uint32_t refs) {
+    uint32_t h = metacache_get_hash (value, len);
+    metacache_stripe_t *s = metacache_stripe_for_hash (h);
+    mutex_lock (s->mutex);
+
+    uint32_t i = metacache_find_slot (s, h, value, len);
+    metacache_str_t *data = s->slots[i].data;
     if (data) {
-        data->refcount++;
+        data->refcount += refs;
+        mutex_unlock (s->mutex);
         return data->str;
     }
-    metacache_hash_t *bucket = &hash[h % HASH_SIZE];
-    if (!bucket->chain) {
-        n_buckets++;
+
+    data = metacache_node_alloc (s, len);
+    if (!data) {
+        mutex_unlock (s->mutex);
+        return NULL;
     }
-    data = malloc (sizeof (metacache_str_t) + len);
-    memset (data, 0, sizeof (metacache_str_t) + len);
-    data->refcount = 1;
-    memcpy (data->str, value, len);
     data->value_length = len;
-    data->next = bucket->chain;
-    bucket->chain = data;
-    n_strings++;
+    data->hash = h;
+    data->refcount = refs;
+    data->cmpidx = 0;
+    memcpy (data->str, value, len);
+
+    s->slots[i].hash = h;
+    s->slots[i].data = data;
+    s->count++;
+    s->bytes += len;
+    // keep load factor under 3/4
+    if (s->count * 4 > s->capacity * 3) {
+        metacache_grow (s);
+    }
+    mutex_unlock (s->mutex);
     return data->str;
 }
 
 const char *
 metacache_add_string (const char *str) {
-    return metacache_add_value (str, (int)strlen (str) + 1);
+    return metacache_add_value (str, strlen (str) + 1);
 }
 
 void
 metacache_remove_value (const char *value, size_t valuesize) {
-    uint32_t h = metacache_get_hash_sdbm (value, valuesize);
-    metacache_hash_t *bucket = &hash[h % HASH_SIZE];
-    metacache_str_t *chain = bucket->chain;
-    metacache_str_t *prev = NULL;
-    while (chain) {
-        if (chain->value_length == valuesize && !memcmp (chain->str, value, valuesize)) {
-            chain->refcount--;
-            if (chain->refcount == 0) {
-                if (prev) {
-                    prev->next = chain->next;
-                }
-                else {
-                    bucket->chain = chain->next;
-                }
-                free (chain);
-            }
-            break;
+    uint32_t h = metacache_get_hash (value, valuesize);
+    metacache_stripe_t *s = metacache_stripe_for_hash (h);
+    mutex_lock (s->mutex);
+
+    uint32_t i = metacache_find_slot (s, h, value, valuesize);
+    metacache_str_t *data = s->slots[i].data;
+    if (data) {
+        data->refcount--;
+        if (data->refcount == 0) {
+            metacache_remove_slot (s, i);
+            s->count--;
+            s->bytes -= valuesize;
+            metacache_node_free (s, data);
         }
-        prev = chain;
-        chain = chain->next;
     }
+    mutex_unlock (s->mutex);
 }
 
 void
@@ -147,3 +591,32 @@ void
 metacache_unref (const char *str) {
     // left for compatibility
 }
+
+void
+metacache_get_stats (ddb_metacache_stats_t *stats) {
+    // the caller may be built against an older, smaller version of the struct
+    size_t size = stats->_size;
+    if (size < sizeof (int)) {
+        return;
+    }
+    if (size > sizeof (ddb_metacache_stats_t)) {
+        size = sizeof (ddb_metacache_stats_t);
+    }
+
+    ddb_metacache_stats_t st;
+    memset (&st, 0, sizeof (st));
+    int64_t slots = 0;
+    for (int i = 0; i < METACACHE_STRIPES; i++) {
+        metacache_stripe_t *s = &stripes[i];
+        mutex_lock (s->mutex);
+        st.strings += s->count;
+        st.bytes += s->bytes;
+        st.allocated += s->allocated + s->capacity * sizeof (metacache_slot_t);
+        slots += s->capacity;
+        mutex_unlock (s->mutex);
+    }
+    st.slots = slots;
+    st.load_factor = slots ? (float)st.strings / slots : 0;
+    st._size = (int)size;
+    memcpy (stats, &st, size);
+}
@@ -27,6 +27,14 @@
 #ifndef __METACACHE_H
 #define __METACACHE_H
 
+#include "deadbeef.h"
+
+void
+metacache_init (void);
+
+void
+metacache_free (void);
+
 const char *
 metacache_add_string (const char *str);
 
@@ -36,6 +44,10 @@ metacache_remove_string (const char *str);
 const char *
 metacache_add_value (const char *value, size_t valuesize);
 
+// same as metacache_add_value, adding the given number of references at once
+const char *
+metacache_add_value_refs (const char *value, size_t valuesize, uint32_t refs);
+
 void
 metacache_remove_value (const char *value, size_t valuesize);
 
@@ -45,4 +57,63 @@ metacache_ref (const char *str);
 void
 metacache_unref (const char *str);
 
+// atoms of well-known keys, registered by metacache_init
+enum {
+    META_ATOM_NONE = 0,
+    META_ATOM_TITLE,
+    META_ATOM_ARTIST,
+    META_ATOM_ALBUM,
+    META_ATOM_ALBUM_ARTIST,
+    META_ATOM_ALBUMARTIST,
+    META_ATOM_BAND,
+    META_ATOM_COMPOSER,
+    META_ATOM_PERFORMER,
+    META_ATOM_VENUE,
+    META_ATOM_TRACK,
+    META_ATOM_NUMTRACKS,
+    META_ATOM_DISC,
+    META_ATOM_NUMDISCS,
+    META_ATOM_YEAR,
+    META_ATOM_GENRE,
+    META_ATOM_COMMENT,
+    META_ATOM_CUESHEET,
+    META_ATOM_LOG,
+    META_ATOM_URI,
+    META_ATOM_DECODER,
+    META_ATOM_TRACKNUM,
+    META_ATOM_DURATION,
+    META_ATOM_FILETYPE,
+    META_ATOM_BITRATE,
+    META_ATOM_SAMPLERATE,
+    META_ATOM_CHANNELS,
+    META_ATOM_BPS,
+    META_ATOM_FILE_SIZE,
+    META_ATOM_REPLAYGAIN_ALBUMGAIN,
+    META_ATOM_REPLAYGAIN_ALBUMPEAK,
+    META_ATOM_REPLAYGAIN_TRACKGAIN,
+    META_ATOM_REPLAYGAIN_TRACKPEAK,
+    META_ATOM_COUNT
+};
+
+// returns the atom for the metadata key, registering it if necessary;
+// atoms are non-zero integers, and keys which only differ in case share one
+uint32_t
+metacache_key_atom (const char *key);
+
+// same as metacache_key_atom, but returns 0 for unregistered keys
+uint32_t
+metacache_find_key_atom (const char *key);
+
+// returns the key the atom was registered with
+const char *
+metacache_key_atom_name (uint32_t atom);
+
+// for a ':' property, returns the atom of its '!' override key if it was
+// registered, otherwise 0
+uint32_t
+metacache_key_atom_override (uint32_t atom);
+
+void
+metacache_get_stats (ddb_metacache_stats_t *stats);
+
 #endif
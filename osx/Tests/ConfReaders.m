@@ -0,0 +1,158 @@
+//
+//  ConfReaders.m
+//  deadbeef
+//
+
+#import <Cocoa/Cocoa.h>
+#import <XCTest/XCTest.h>
+#include <pthread.h>
+#include "conf.h"
+
+@interface ConfReaders : XCTestCase
+@end
+
+@implementation ConfReaders
+
+- (void)setUp {
+    [super setUp];
+
+    conf_init ();
+    conf_enable_saving (0);
+}
+
+- (void)tearDown {
+    conf_free ();
+
+    [super tearDown];
+}
+
+- (void)test_SetStr_TypedGettersReturnParsedValue {
+    conf_set_str ("test.value", "42");
+    XCTAssertEqual(conf_get_int ("test.value", 0), 42);
+    XCTAssertEqual(conf_get_int64 ("test.value", 0), 42);
+    XCTAssertEqualWithAccuracy(conf_get_float ("test.value", 0), 42.f, 0.0001f);
+}
+
+- (void)test_SetStrFloat_IntGetterTruncates {
+    conf_set_str ("test.value", "3.75");
+    XCTAssertEqual(conf_get_int ("test.value", 0), 3);
+    XCTAssertEqualWithAccuracy(conf_get_float ("test.value", 0), 3.75f, 0.0001f);
+}
+
+- (void)test_SetInt64_ReturnsFullValue {
+    conf_set_int64 ("test.value", 0x123456789aLL);
+    XCTAssertEqual(conf_get_int64 ("test.value", 0), 0x123456789aLL);
+}
+
+- (void)test_MissingKey_ReturnsDefault {
+    conf_set_int ("test.value", 1);
+    XCTAssertEqual(conf_get_int ("test.other", 7), 7);
+    XCTAssertEqual(conf_get_int64 ("test.other", -8), -8);
+    XCTAssertEqualWithAccuracy(conf_get_float ("test.other", 0.5f), 0.5f, 0.0001f);
+}
+
+- (void)test_KeyCase_IsIgnored {
+    conf_set_int ("Test.MixedCase", 5);
+    XCTAssertEqual(conf_get_int ("test.mixedcase", 0), 5);
+    XCTAssertEqual(conf_get_int ("TEST.MIXEDCASE", 0), 5);
+}
+
+- (void)test_Overwrite_ReturnsNewValue {
+    conf_set_int ("test.value", 1);
+    conf_set_int ("test.value", 2);
+    XCTAssertEqual(conf_get_int ("test.value", 0), 2);
+}
+
+- (void)test_RemoveItems_ReturnsDefault {
+    conf_set_int ("test.group.a", 1);
+    conf_set_int ("test.group.b", 2);
+    conf_set_int ("test.keep", 3);
+    conf_remove_items ("test.group.");
+    XCTAssertEqual(conf_get_int ("test.group.a", -1), -1);
+    XCTAssertEqual(conf_get_int ("test.group.b", -1), -1);
+    XCTAssertEqual(conf_get_int ("test.keep", -1), 3);
+}
+
+- (void)test_ManyKeys_AllFoundAfterTableGrows {
+    char key[100];
+    for (int i = 0; i < 5000; i++) {
+        snprintf (key, sizeof (key), "test.key%d", i);
+        conf_set_int (key, i);
+    }
+    int errors = 0;
+    for (int i = 0; i < 5000; i++) {
+        snprintf (key, sizeof (key), "test.key%d", i);
+        if (conf_get_int (key, -1) != i) {
+            errors++;
+        }
+    }
+    XCTAssertEqual(errors, 0);
+}
+
+- (void)test_Find_ReturnsItemsInKeyOrder {
+    conf_set_str ("test.c", "3");
+    conf_set_str ("test.a", "1");
+    conf_set_str ("test.b", "2");
+    DB_conf_item_t *it = conf_find ("test.", NULL);
+    XCTAssert(it && !strcmp (it->key, "test.a"));
+    it = conf_find ("test.", it);
+    XCTAssert(it && !strcmp (it->key, "test.b"));
+    it = conf_find ("test.", it);
+    XCTAssert(it && !strcmp (it->key, "test.c"));
+    XCTAssert(!conf_find ("test.", it));
+}
+
+#define READER_ITERATIONS 200000
+
+static volatile int writer_done;
+static int reader_errors;
+
+// the value of test.pair is always one of these, so a torn read shows up
+// as any other value
+static const int64_t pair_values[2] = { 0x0000000100000001LL, 0x7fffffff7fffffffLL };
+
+static void *
+reader_thread (void *ctx) {
+    for (int i = 0; i < READER_ITERATIONS || !writer_done; i++) {
+        int64_t v = conf_get_int64 ("test.pair", 0);
+        if (v != pair_values[0] && v != pair_values[1]) {
+            __sync_add_and_fetch (&reader_errors, 1);
+        }
+        if (conf_get_int ("test.const", 0) != 12345) {
+            __sync_add_and_fetch (&reader_errors, 1);
+        }
+    }
+    return NULL;
+}
+
+- (void)test_ConcurrentReaders_SeeConsistentValues {
+    conf_set_int64 ("test.pair", pair_values[0]);
+    conf_set_int ("test.const", 12345);
+    writer_done = 0;
+    reader_errors = 0;
+
+    pthread_t tids[4];
+    for (int i = 0; i < 4; i++) {
+        pthread_create (&tids[i], NULL, reader_thread, NULL);
+    }
+
+    // overwrite the values, add keys to make the table grow, and remove
+    // them again, so that items and tables are retired under the readers
+    char key[100];
+    for (int i = 0; i < 20000; i++) {
+        conf_set_int64 ("test.pair", pair_values[i & 1]);
+        snprintf (key, sizeof (key), "test.tmp.%d", i);
+        conf_set_int (key, i);
+        if (!(i % 1000)) {
+            conf_remove_items ("test.tmp.");
+        }
+    }
+    writer_done = 1;
+
+    for (int i = 0; i < 4; i++) {
+        pthread_join (tids[i], NULL);
+    }
+    XCTAssertEqual(reader_errors, 0);
+}
+
+@end
@@ -0,0 +1,145 @@
+//
+//  DspNegotiate.m
+//  deadbeef
+//
+
+#import <Cocoa/Cocoa.h>
+#import <XCTest/XCTest.h>
+#include "deadbeef.h"
+#include "dsppipeline.h"
+
+@interface DspNegotiate : XCTestCase
+@end
+
+@implementation DspNegotiate
+
+// doubles the samplerate, with 8 frames of latency
+static void
+upsample_negotiate (ddb_dsp_context_t *ctx, ddb_waveformat_t *fmt, float *ratio, int *latency) {
+    *ratio = 2;
+    *latency = 8;
+    fmt->samplerate *= 2;
+}
+
+// mono to stereo
+static void
+stereo_negotiate (ddb_dsp_context_t *ctx, ddb_waveformat_t *fmt, float *ratio, int *latency) {
+    fmt->channels = 2;
+}
+
+static int
+bypass_if_stereo (ddb_dsp_context_t *ctx, ddb_waveformat_t *fmt) {
+    return fmt->channels >= 2;
+}
+
+static DB_dsp_t upsample_plugin = {
+    .plugin.api_vminor = 10,
+    .negotiate = upsample_negotiate,
+};
+
+static DB_dsp_t stereo_plugin = {
+    .plugin.api_vminor = 10,
+    .negotiate = stereo_negotiate,
+    .can_bypass = bypass_if_stereo,
+};
+
+// an old plugin, which knows nothing about negotiation
+static DB_dsp_t legacy_plugin = {
+    .plugin.api_vminor = 0,
+};
+
+static ddb_dsp_context_t ctx[3];
+
+static ddb_dsp_context_t *
+make_chain (DB_dsp_t *a, DB_dsp_t *b, DB_dsp_t *c) {
+    DB_dsp_t *plugins[3] = { a, b, c };
+    ddb_dsp_context_t *head = NULL;
+    ddb_dsp_context_t *tail = NULL;
+    memset (ctx, 0, sizeof (ctx));
+    for (int i = 0; i < 3; i++) {
+        if (!plugins[i]) {
+            break;
+        }
+        ctx[i].plugin = plugins[i];
+        ctx[i].enabled = 1;
+        if (tail) {
+            tail->next = &ctx[i];
+        }
+        else {
+            head = &ctx[i];
+        }
+        tail = &ctx[i];
+    }
+    return head;
+}
+
+static ddb_waveformat_t
+mono_44100 (void) {
+    ddb_waveformat_t fmt = { .bps = 32, .channels = 1, .samplerate = 44100, .is_float = 1 };
+    return fmt;
+}
+
+- (void)test_NegotiatingChain_ReturnsOutputFormatAndRatio {
+    ddb_dsp_context_t *chain = make_chain (&stereo_plugin, &upsample_plugin, NULL);
+    ddb_waveformat_t fmt = mono_44100 ();
+    float ratio = 0;
+    int size = dsp_chain_negotiate (chain, &fmt, 1024, 24, &ratio);
+
+    XCTAssertEqual(fmt.channels, 2);
+    XCTAssertEqual(fmt.samplerate, 88200);
+    XCTAssertEqualWithAccuracy(ratio, 2.f, 0.0001f);
+    // (1024 + 1) stereo frames after the first plugin, then ((1025 + 8) * 2 + 1)
+    XCTAssertEqual(size, 2067 * 2 * (int)sizeof (float));
+}
+
+- (void)test_LegacyPlugin_GetsFallbackRatio {
+    ddb_dsp_context_t *chain = make_chain (&legacy_plugin, NULL, NULL);
+    ddb_waveformat_t fmt = mono_44100 ();
+    float ratio = 0;
+    int size = dsp_chain_negotiate (chain, &fmt, 1024, 24, &ratio);
+
+    XCTAssertEqual(fmt.channels, 1);
+    XCTAssertEqual(fmt.samplerate, 44100);
+    XCTAssertEqualWithAccuracy(ratio, 1.f, 0.0001f);
+    XCTAssertEqual(size, 1024 * 24 * (int)sizeof (float));
+}
+
+- (void)test_DisabledPlugin_IsSkipped {
+    ddb_dsp_context_t *chain = make_chain (&upsample_plugin, &legacy_plugin, NULL);
+    ctx[0].enabled = 0;
+    ctx[1].enabled = 0;
+    ddb_waveformat_t fmt = mono_44100 ();
+    float ratio = 0;
+    int size = dsp_chain_negotiate (chain, &fmt, 1024, 24, &ratio);
+
+    XCTAssertEqual(fmt.samplerate, 44100);
+    XCTAssertEqualWithAccuracy(ratio, 1.f, 0.0001f);
+    XCTAssertEqual(size, 1024 * (int)sizeof (float));
+}
+
+- (void)test_CanBypass_AsksThePlugin {
+    ddb_dsp_context_t *chain = make_chain (&stereo_plugin, NULL, NULL);
+    ddb_waveformat_t fmt = mono_44100 ();
+    XCTAssertEqual(dsp_chain_can_bypass (chain, &fmt), 0);
+    fmt.channels = 2;
+    XCTAssertEqual(dsp_chain_can_bypass (chain, &fmt), 1);
+}
+
+- (void)test_NullCanBypass_IsNotBypassable {
+    ddb_waveformat_t fmt = mono_44100 ();
+    fmt.channels = 2;
+    ddb_dsp_context_t *chain = make_chain (&stereo_plugin, &upsample_plugin, NULL);
+    XCTAssertEqual(dsp_chain_can_bypass (chain, &fmt), 0);
+    chain = make_chain (&legacy_plugin, NULL, NULL);
+    XCTAssertEqual(dsp_chain_can_bypass (chain, &fmt), 0);
+}
+
+- (void)test_DisabledPlugins_AreBypassed {
+    ddb_dsp_context_t *chain = make_chain (&upsample_plugin, &legacy_plugin, NULL);
+    ctx[0].enabled = 0;
+    ctx[1].enabled = 0;
+    ddb_waveformat_t fmt = mono_44100 ();
+    XCTAssertEqual(dsp_chain_can_bypass (chain, &fmt), 1);
+}
+
+@end
@@ -0,0 +1,151 @@
+//
+//  DspPipeline.m
+//  deadbeef
+//
+
+#import <Cocoa/Cocoa.h>
+#import <XCTest/XCTest.h>
+#include <unistd.h>
+#include "deadbeef.h"
+#include "dsppipeline.h"
+
+@interface DspPipeline : XCTestCase
+@end
+
+@implementation DspPipeline
+
+#define BLOCK_FRAMES 256
+
+static int process_delay_us;
+
+// adds 1 to every sample
+static int
+add_one_process (ddb_dsp_context_t *ctx, float *samples, int nframes, int maxframes, ddb_waveformat_t *fmt, float *ratio) {
+    if (process_delay_us) {
+        usleep (process_delay_us);
+    }
+    for (int i = 0; i < nframes * fmt->channels; i++) {
+        samples[i] += 1;
+    }
+    return nframes;
+}
+
+static DB_dsp_t add_one_plugin = {
+    .plugin.api_vminor = 10,
+    .plugin.name = "add one",
+    .process = add_one_process,
+};
+
+static ddb_dsp_context_t ctx[2];
+
+- (void)setUp {
+    [super setUp];
+
+    dsp_pipeline_init ();
+    memset (ctx, 0, sizeof (ctx));
+    for (int i = 0; i < 2; i++) {
+        ctx[i].plugin = &add_one_plugin;
+        ctx[i].enabled = 1;
+    }
+    ctx[0].next = &ctx[1];
+    process_delay_us = 0;
+}
+
+- (void)tearDown {
+    dsp_pipeline_free ();
+
+    [super tearDown];
+}
+
+static void
+submit_block (float value) {
+    dsp_block_t *block = dsp_pipeline_get_free ();
+    block->fmt.channels = 1;
+    block->fmt.samplerate = 44100;
+    block->nframes = BLOCK_FRAMES;
+    for (int i = 0; i < BLOCK_FRAMES; i++) {
+        ((float *)block->samples)[i] = value;
+    }
+    dsp_pipeline_submit (block);
+}
+
+static int
+count_free_blocks (void) {
+    dsp_block_t *taken[100];
+    int n = 0;
+    while ((taken[n] = dsp_pipeline_get_free ())) {
+        n++;
+    }
+    for (int i = 0; i < n; i++) {
+        dsp_pipeline_release (taken[i]);
+    }
+    return n;
+}
+
+- (void)test_SubmittedBlocks_ComeOutProcessedInOrder {
+    XCTAssertEqual(dsp_pipeline_start (ctx, BLOCK_FRAMES * sizeof (float)), 0);
+    int total = count_free_blocks ();
+    for (int i = 0; i < total; i++) {
+        submit_block (i * 10);
+    }
+    int errors = 0;
+    for (int i = 0; i < total; i++) {
+        dsp_block_t *block = dsp_pipeline_get_output (1000);
+        XCTAssert(block != NULL);
+        if (!block) {
+            break;
+        }
+        if (((float *)block->samples)[0] != i * 10 + 2 || block->gen != dsp_pipeline_get_gen ()) {
+            errors++;
+        }
+        dsp_pipeline_release (block);
+    }
+    XCTAssertEqual(errors, 0);
+    dsp_pipeline_stop ();
+}
+
+- (void)test_Stop_DropsBlocksInFlight {
+    process_delay_us = 2000;
+    XCTAssertEqual(dsp_pipeline_start (ctx, BLOCK_FRAMES * sizeof (float)), 0);
+    int total = count_free_blocks ();
+    int gen = dsp_pipeline_get_gen ();
+    for (int i = 0; i < total; i++) {
+        submit_block (0);
+    }
+
+    dsp_pipeline_stop ();
+
+    // the old blocks aren't played when the chain is started again
+    XCTAssert(dsp_pipeline_get_gen () != gen);
+    XCTAssert(dsp_pipeline_get_output (0) == NULL);
+    XCTAssertEqual(count_free_blocks (), total);
+
+    XCTAssertEqual(dsp_pipeline_start (ctx, BLOCK_FRAMES * sizeof (float)), 0);
+    XCTAssert(dsp_pipeline_get_output (100) == NULL);
+    dsp_pipeline_stop ();
+}
+
+- (void)test_Stats_LoadIsQueryable {
+    dsp_stats_t stats;
+    memset (&stats, 0, sizeof (stats));
+    // half a second of cpu per second of audio, until the interval is complete
+    for (int i = 0; i < 4; i++) {
+        dsp_stats_add (&stats, "plugin", 500000000, 1000, 1000);
+    }
+    XCTAssertEqualWithAccuracy(stats.load, 0.f, 0.0001f);
+    dsp_stats_add (&stats, "plugin", 500000000, 1000, 1000);
+    XCTAssertEqualWithAccuracy(stats.load, 50.f, 0.0001f);
+    XCTAssert(!strcmp (stats.name, "plugin"));
+}
+
+- (void)test_GetStats_OnlyForRunningStages {
+    dsp_stats_t stats;
+    XCTAssertEqual(dsp_pipeline_get_stats (0, &stats), -1);
+    XCTAssertEqual(dsp_pipeline_start (ctx, BLOCK_FRAMES * sizeof (float)), 0);
+    XCTAssertEqual(dsp_pipeline_get_stats (1, &stats), 0);
+    XCTAssertEqual(dsp_pipeline_get_stats (2, &stats), -1);
+    dsp_pipeline_stop ();
+    XCTAssertEqual(dsp_pipeline_get_stats (0, &stats), -1);
+}
+
+@end
@@ -0,0 +1,181 @@
+//
+//  PlaylistImport.m
+//  deadbeef
+//
+
+#import <Cocoa/Cocoa.h>
+#import <XCTest/XCTest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "playlist.h"
+#include "plugins.h"
+#include "conf.h"
+
+@interface PlaylistImport : XCTestCase
+@end
+
+@implementation PlaylistImport
+
+static char root[PATH_MAX];
+static DB_decoder_t *saved_decoders[3];
+
+// the number of insert calls in progress, and the highest seen, per decoder
+static int active[2];
+static int max_active[2];
+
+static DB_playItem_t *
+test_insert (int idx, DB_decoder_t *dec, ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
+    int n = __sync_add_and_fetch (&active[idx], 1);
+    int m;
+    while ((m = max_active[idx]) < n && !__sync_bool_compare_and_swap (&max_active[idx], m, n));
+    usleep (2000);
+    __sync_sub_and_fetch (&active[idx], 1);
+
+    playItem_t *it = pl_item_alloc_init (fname, dec->plugin.id);
+    playItem_t *inserted = plt_insert_item ((playlist_t *)plt, (playItem_t *)after, it);
+    pl_item_unref (it);
+    return (DB_playItem_t *)inserted;
+}
+
+static DB_decoder_t threadsafe_dec;
+static DB_decoder_t serial_dec;
+
+static DB_playItem_t *
+threadsafe_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
+    return test_insert (0, &threadsafe_dec, plt, after, fname);
+}
+
+static DB_playItem_t *
+serial_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
+    return test_insert (1, &serial_dec, plt, after, fname);
+}
+
+static const char *threadsafe_exts[] = { "tsf", NULL };
+static const char *serial_exts[] = { "tsr", NULL };
+
+static DB_decoder_t threadsafe_dec = {
+    .plugin.type = DB_PLUGIN_DECODER,
+    .plugin.flags = DDB_PLUGIN_FLAG_THREADSAFE_INSERT,
+    .plugin.id = "threadsafe",
+    .insert = threadsafe_insert,
+    .exts = threadsafe_exts,
+};
+
+static DB_decoder_t serial_dec = {
+    .plugin.type = DB_PLUGIN_DECODER,
+    .plugin.id = "serial",
+    .insert = serial_insert,
+    .exts = serial_exts,
+};
+
+static void
+write_file (const char *fname) {
+    FILE *fp = fopen (fname, "wb");
+    fputs ("x", fp);
+    fclose (fp);
+}
+
+- (void)setUp {
+    [super setUp];
+
+    conf_init ();
+    conf_enable_saving (0);
+    conf_set_int ("tagcache.enable", 0);
+    pl_init ();
+
+    DB_decoder_t **decoders = plug_get_decoder_list ();
+    memcpy (saved_decoders, decoders, sizeof (saved_decoders));
+    decoders[0] = &threadsafe_dec;
+    decoders[1] = &serial_dec;
+    decoders[2] = NULL;
+
+    // 4 folders, each with the two kinds of files interleaved, and a file
+    // which no decoder accepts
+    snprintf (root, sizeof (root), "/tmp/deadbeef_import_%d", (int)getpid ());
+    mkdir (root, 0755);
+    for (int d = 0; d < 4; d++) {
+        char path[PATH_MAX];
+        snprintf (path, sizeof (path), "%s/d%d", root, d);
+        mkdir (path, 0755);
+        for (int f = 0; f < 20; f++) {
+            snprintf (path, sizeof (path), "%s/d%d/f%02d.%s", root, d, f, (f % 3) ? "tsf" : "tsr");
+            write_file (path);
+        }
+        snprintf (path, sizeof (path), "%s/d%d/readme.txt", root, d);
+        write_file (path);
+    }
+    memset (max_active, 0, sizeof (max_active));
+}
+
+- (void)tearDown {
+    char cmd[PATH_MAX + 10];
+    snprintf (cmd, sizeof (cmd), "rm -rf %s", root);
+    system (cmd);
+
+    DB_decoder_t **decoders = plug_get_decoder_list ();
+    memcpy (decoders, saved_decoders, sizeof (saved_decoders));
+    pl_free ();
+    conf_free ();
+
+    [super tearDown];
+}
+
+static int abort_at;
+static int ncallbacks;
+
+static int
+import_callback (playItem_t *it, void *user_data) {
+    ncallbacks++;
+    return (abort_at && ncallbacks >= abort_at) ? -1 : 0;
+}
+
+// imports the test tree, and returns the file names in playlist order,
+// separated with '|'
+static char *
+import_tree (int nthreads, int abort_after) {
+    conf_set_int ("add_folders_threads", nthreads);
+    abort_at = abort_after;
+    ncallbacks = 0;
+    playlist_t *plt = plt_alloc ("test");
+    int pabort = 0;
+    plt_insert_dir (plt, NULL, root, &pabort, import_callback, NULL);
+
+    char *out = calloc (1, 100 * 100);
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+        if (out[0]) {
+            strcat (out, "|");
+        }
+        strcat (out, pl_find_meta_raw (it, ":URI") + strlen (root));
+    }
+    plt_free (plt);
+    return out;
+}
+
+- (void)test_ParallelImport_KeepsSerialOrder {
+    char *serial = import_tree (1, 0);
+    char *parallel = import_tree (4, 0);
+    XCTAssert(!strncmp (serial, "/d0/f00.tsr|/d0/f01.tsf|/d0/f02.tsf|/d0/f03.tsr", 47), @"The actual output is: %s", serial);
+    XCTAssert(!strcmp (serial, parallel), @"The actual output is: %s", parallel);
+    XCTAssertEqual(ncallbacks, 80);
+    free (serial);
+    free (parallel);
+}
+
+- (void)test_ParallelImport_RunsOnlyThreadsafeInsertConcurrently {
+    char *res = import_tree (4, 0);
+    free (res);
+    XCTAssertEqual(max_active[1], 1);
+    XCTAssertGreaterThan(max_active[0], 1);
+}
+
+- (void)test_Abort_StopsAtSamePlaceAsSerialImport {
+    char *serial = import_tree (1, 25);
+    XCTAssertEqual(ncallbacks, 25);
+    char *parallel = import_tree (4, 25);
+    XCTAssertEqual(ncallbacks, 25);
+    XCTAssert(!strcmp (serial, parallel), @"The actual output is: %s", parallel);
+    free (serial);
+    free (parallel);
+}
+
+@end
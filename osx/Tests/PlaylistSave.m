@@ -0,0 +1,256 @@
+//
+//  PlaylistSave.m
+//  deadbeef
+//
+
+#import <Cocoa/Cocoa.h>
+#import <XCTest/XCTest.h>
+#include "playlist.h"
+#include "pltmeta.h"
+#include "conf.h"
+#include <sys/stat.h>
+
+@interface PlaylistSave : XCTestCase
+@end
+
+@implementation PlaylistSave
+
+static char fname[PATH_MAX];
+
+- (void)setUp {
+    [super setUp];
+
+    conf_init ();
+    conf_enable_saving (0);
+    pl_init ();
+    snprintf (fname, sizeof (fname), "/tmp/deadbeef_test_%d.dbpl", (int)getpid ());
+}
+
+- (void)tearDown {
+    unlink (fname);
+    pl_free ();
+    conf_free ();
+
+    [super tearDown];
+}
+
+static playlist_t *
+make_playlist (void) {
+    playlist_t *plt = plt_alloc ("test");
+    playItem_t *after = NULL;
+    for (int i = 0; i < 3; i++) {
+        char uri[100];
+        char title[100];
+        snprintf (uri, sizeof (uri), "/music/%d.flac", i);
+        snprintf (title, sizeof (title), "Title %d", i);
+        playItem_t *it = pl_item_alloc_init (uri, "stdflac");
+        pl_add_meta (it, "title", title);
+        pl_add_meta (it, ":FILETYPE", "FLAC");
+        pl_set_meta_int (it, ":TRACKNUM", i + 1);
+        pl_replace_meta (it, "artist", "Multi\nValue");
+        it->startsample = i * 1000;
+        it->endsample = i * 1000 + 999;
+        plt_set_item_duration (plt, it, 10.5f + i);
+        pl_set_item_replaygain (it, DDB_REPLAYGAIN_TRACKGAIN, -3.5f);
+        pl_set_item_flags (it, DDB_IS_SUBTRACK);
+        plt_insert_item (plt, after, it);
+        after = it;
+        pl_item_unref (it);
+    }
+    plt_add_meta (plt, "plt_meta", "value");
+    return plt;
+}
+
+// returns the number of differences between the two playlists
+static int
+compare_playlists (playlist_t *a, playlist_t *b) {
+    int errors = 0;
+    if (plt_get_item_count (a, PL_MAIN) != plt_get_item_count (b, PL_MAIN)) {
+        return 1;
+    }
+    const char *keys[] = { ":URI", ":DECODER", ":FILETYPE", ":TRACKNUM", "title", "artist", NULL };
+    playItem_t *ib = b->head[PL_MAIN];
+    for (playItem_t *ia = a->head[PL_MAIN]; ia; ia = ia->next[PL_MAIN], ib = ib->next[PL_MAIN]) {
+        for (int k = 0; keys[k]; k++) {
+            const char *va = pl_find_meta_raw (ia, keys[k]);
+            const char *vb = pl_find_meta_raw (ib, keys[k]);
+            if (!va || !vb || strcmp (va, vb)) {
+                errors++;
+            }
+        }
+        if (ia->startsample != ib->startsample
+            || ia->endsample != ib->endsample
+            || pl_get_item_duration (ia) != pl_get_item_duration (ib)
+            || pl_get_item_replaygain (ia, DDB_REPLAYGAIN_TRACKGAIN) != pl_get_item_replaygain (ib, DDB_REPLAYGAIN_TRACKGAIN)
+            || pl_get_item_flags (ia) != pl_get_item_flags (ib)) {
+            errors++;
+        }
+    }
+    const char *va = plt_find_meta (a, "plt_meta");
+    const char *vb = plt_find_meta (b, "plt_meta");
+    if (!va || !vb || strcmp (va, vb)) {
+        errors++;
+    }
+    return errors;
+}
+
+static ino_t
+saved_inode (void) {
+    struct stat st;
+    if (stat (fname, &st) != 0) {
+        return 0;
+    }
+    return st.st_ino;
+}
+
+static off_t
+saved_size (void) {
+    struct stat st;
+    if (stat (fname, &st) != 0) {
+        return -1;
+    }
+    return st.st_size;
+}
+
+static int
+saved_major_version (void) {
+    FILE *fp = fopen (fname, "rb");
+    if (!fp) {
+        return -1;
+    }
+    uint8_t hdr[5];
+    size_t n = fread (hdr, 1, 5, fp);
+    fclose (fp);
+    if (n != 5 || memcmp (hdr, "DBPL", 4)) {
+        return -1;
+    }
+    return hdr[4];
+}
+
+- (void)test_DefaultFormat_Writes1x {
+    playlist_t *plt = make_playlist ();
+    XCTAssertEqual(plt_save (plt, NULL, NULL, fname, NULL, NULL, NULL), 0);
+    XCTAssertEqual(saved_major_version (), 1);
+    plt_free (plt);
+}
+
+- (void)test_SaveFormat2_Writes2x {
+    conf_set_int ("playlist.save_format", 2);
+    playlist_t *plt = make_playlist ();
+    XCTAssertEqual(plt_save (plt, NULL, NULL, fname, NULL, NULL, NULL), 0);
+    XCTAssertEqual(saved_major_version (), 2);
+    plt_free (plt);
+}
+
+- (void)test_RoundTrip1x_KeepsItemsAndMetadata {
+    playlist_t *plt = make_playlist ();
+    XCTAssertEqual(plt_save (plt, NULL, NULL, fname, NULL, NULL, NULL), 0);
+
+    playlist_t *loaded = plt_alloc ("loaded");
+    XCTAssert(plt_load (loaded, NULL, fname, NULL, NULL, NULL) != NULL);
+    XCTAssertEqual(compare_playlists (plt, loaded), 0);
+
+    plt_free (loaded);
+    plt_free (plt);
+}
+
+- (void)test_RoundTrip2x_KeepsItemsAndMetadata {
+    conf_set_int ("playlist.save_format", 2);
+    playlist_t *plt = make_playlist ();
+    XCTAssertEqual(plt_save (plt, NULL, NULL, fname, NULL, NULL, NULL), 0);
+
+    playlist_t *loaded = plt_alloc ("loaded");
+    XCTAssert(plt_load (loaded, NULL, fname, NULL, NULL, NULL) != NULL);
+    XCTAssertEqual(compare_playlists (plt, loaded), 0);
+
+    plt_free (loaded);
+    plt_free (plt);
+}
+
+- (void)test_Load2x_DecodesMetadataOnFirstAccess {
+    conf_set_int ("playlist.save_format", 2);
+    playlist_t *plt = make_playlist ();
+    XCTAssertEqual(plt_save (plt, NULL, NULL, fname, NULL, NULL, NULL), 0);
+
+    playlist_t *loaded = plt_alloc ("loaded");
+    XCTAssert(plt_load (loaded, NULL, fname, NULL, NULL, NULL) != NULL);
+    playItem_t *it = loaded->head[PL_MAIN];
+    XCTAssertTrue(it->meta_lazy);
+    XCTAssertTrue(it->next[PL_MAIN]->meta_lazy);
+
+    const char *title = pl_find_meta_raw (it, "title");
+    XCTAssert(title && !strcmp (title, "Title 0"));
+    XCTAssertFalse(it->meta_lazy);
+    XCTAssertTrue(it->next[PL_MAIN]->meta_lazy);
+
+    plt_free (loaded);
+    plt_free (plt);
+}
+
+- (void)test_Resave2x_ChangedItem_UpdatesFileInPlace {
+    conf_set_int ("playlist.save_format", 2);
+    playlist_t *plt = make_playlist ();
+    XCTAssertEqual(plt_save (plt, NULL, NULL, fname, NULL, NULL, NULL), 0);
+    ino_t ino = saved_inode ();
+
+    playlist_t *loaded = plt_alloc ("loaded");
+    XCTAssert(plt_load (loaded, NULL, fname, NULL, NULL, NULL) != NULL);
+    pl_replace_meta (loaded->head[PL_MAIN]->next[PL_MAIN], "title", "Changed");
+    pl_replace_meta (plt->head[PL_MAIN]->next[PL_MAIN], "title", "Changed");
+    XCTAssertEqual(plt_save (loaded, NULL, NULL, fname, NULL, NULL, NULL), 0);
+    XCTAssertEqual(saved_inode (), ino);
+
+    playlist_t *reloaded = plt_alloc ("reloaded");
+    XCTAssert(plt_load (reloaded, NULL, fname, NULL, NULL, NULL) != NULL);
+    XCTAssertEqual(compare_playlists (plt, reloaded), 0);
+
+    plt_free (reloaded);
+    plt_free (loaded);
+    plt_free (plt);
+}
+
+- (void)test_Resave2x_RemovedItem_UpdatesFileInPlace {
+    conf_set_int ("playlist.save_format", 2);
+    playlist_t *plt = make_playlist ();
+    XCTAssertEqual(plt_save (plt, NULL, NULL, fname, NULL, NULL, NULL), 0);
+    ino_t ino = saved_inode ();
+
+    plt_remove_item (plt, plt->head[PL_MAIN]);
+    plt_add_meta (plt, "plt_meta2", "value2");
+    XCTAssertEqual(plt_save (plt, NULL, NULL, fname, NULL, NULL, NULL), 0);
+    XCTAssertEqual(saved_inode (), ino);
+
+    playlist_t *loaded = plt_alloc ("loaded");
+    XCTAssert(plt_load (loaded, NULL, fname, NULL, NULL, NULL) != NULL);
+    XCTAssertEqual(plt_get_item_count (loaded, PL_MAIN), 2);
+    XCTAssertEqual(compare_playlists (plt, loaded), 0);
+    const char *value = plt_find_meta (loaded, "plt_meta2");
+    XCTAssert(value && !strcmp (value, "value2"));
+
+    plt_free (loaded);
+    plt_free (plt);
+}
+
+- (void)test_Resave2x_ManyTimes_CompactsFile {
+    conf_set_int ("playlist.save_format", 2);
+    playlist_t *plt = make_playlist ();
+    XCTAssertEqual(plt_save (plt, NULL, NULL, fname, NULL, NULL, NULL), 0);
+    off_t size = saved_size ();
+
+    for (int i = 0; i < 1000; i++) {
+        char title[100];
+        snprintf (title, sizeof (title), "Title %d", i);
+        pl_replace_meta (plt->head[PL_MAIN], "title", title);
+        XCTAssertEqual(plt_save (plt, NULL, NULL, fname, NULL, NULL, NULL), 0);
+    }
+    XCTAssertLessThan(saved_size (), size + 64 * 1024);
+
+    playlist_t *loaded = plt_alloc ("loaded");
+    XCTAssert(plt_load (loaded, NULL, fname, NULL, NULL, NULL) != NULL);
+    XCTAssertEqual(compare_playlists (plt, loaded), 0);
+
+    plt_free (loaded);
+    plt_free (plt);
+}
+
+@end
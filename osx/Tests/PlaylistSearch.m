@@ -0,0 +1,197 @@
+//
+//  PlaylistSearch.m
+//  deadbeef
+//
+
+#import <Cocoa/Cocoa.h>
+#import <XCTest/XCTest.h>
+#include "playlist.h"
+#include "plsearch.h"
+#include "utf8.h"
+
+@interface PlaylistSearch : XCTestCase
+@end
+
+@implementation PlaylistSearch
+
+static playlist_t *plt;
+
+static const char *titles[] = {
+    "Beat It",
+    "Beautiful Day",
+    "Heartbeat",
+    "Yesterday",
+    "Ärger im Paradies",
+    "Let It Be",
+    NULL
+};
+
+- (void)setUp {
+    [super setUp];
+
+    pl_init ();
+    plt = plt_alloc ("test");
+
+    playItem_t *after = NULL;
+    for (int i = 0; titles[i]; i++) {
+        char fname[100];
+        snprintf (fname, sizeof (fname), "/music/%d.mp3", i);
+        playItem_t *it = pl_item_alloc_init (fname, "stdmpg");
+        pl_add_meta (it, "title", titles[i]);
+        plt_insert_item (plt, after, it);
+        after = it;
+        pl_item_unref (it);
+    }
+}
+
+- (void)tearDown {
+    plt_free (plt);
+    pl_free ();
+
+    [super tearDown];
+}
+
+// returns the titles of the search results, separated with '|'
+static const char *
+search_results (void) {
+    static char out[1000];
+    out[0] = 0;
+    for (playItem_t *it = plt->head[PL_SEARCH]; it; it = it->next[PL_SEARCH]) {
+        if (out[0]) {
+            strcat (out, "|");
+        }
+        strcat (out, pl_find_meta (it, "title"));
+    }
+    return out;
+}
+
+static playItem_t *
+find_item (const char *title) {
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+        if (!strcmp (pl_find_meta (it, "title"), title)) {
+            return it;
+        }
+    }
+    return NULL;
+}
+
+- (void)test_Search_ReturnsMatchesInPlaylistOrder {
+    plt_search_process2 (plt, "beat", 0);
+    XCTAssert(!strcmp (search_results (), "Beat It|Heartbeat"), @"The actual output is: %s", search_results ());
+    XCTAssertEqual(plt_get_item_count (plt, PL_SEARCH), 2);
+}
+
+- (void)test_RefinedQuery_ReturnsSubsetOfPreviousResults {
+    plt_search_process2 (plt, "bea", 0);
+    XCTAssert(!strcmp (search_results (), "Beat It|Beautiful Day|Heartbeat"), @"The actual output is: %s", search_results ());
+
+    plt_search_process2 (plt, "beau", 0);
+    XCTAssert(!strcmp (search_results (), "Beautiful Day"), @"The actual output is: %s", search_results ());
+}
+
+- (void)test_WidenedQuery_ReturnsAllMatches {
+    plt_search_process2 (plt, "beau", 0);
+    plt_search_process2 (plt, "be", 0);
+    XCTAssert(!strcmp (search_results (), "Beat It|Beautiful Day|Heartbeat|Let It Be"), @"The actual output is: %s", search_results ());
+}
+
+- (void)test_MetadataChangedBetweenQueries_IsFound {
+    plt_search_process2 (plt, "day", 0);
+    XCTAssert(!strcmp (search_results (), "Beautiful Day|Yesterday"), @"The actual output is: %s", search_results ());
+
+    pl_replace_meta (find_item ("Let It Be"), "title", "Day Tripper");
+    plt_search_process2 (plt, "day t", 0);
+    XCTAssert(!strcmp (search_results (), "Day Tripper"), @"The actual output is: %s", search_results ());
+}
+
+- (void)test_MetadataChangedTwice_IsFound {
+    plt_search_process2 (plt, "beat", 0);
+    playItem_t *it = find_item ("Yesterday");
+    pl_replace_meta (it, "title", "Beatles");
+    pl_replace_meta (it, "title", "Ticket to Ride");
+    plt_search_process2 (plt, "ticket", 0);
+    XCTAssert(!strcmp (search_results (), "Ticket to Ride"), @"The actual output is: %s", search_results ());
+    plt_search_process2 (plt, "beat", 0);
+    XCTAssert(!strcmp (search_results (), "Beat It|Heartbeat"), @"The actual output is: %s", search_results ());
+}
+
+- (void)test_UnrelatedItemChanged_KeepsIndexUpToDate {
+    plt_search_process2 (plt, "beat", 0);
+    unsigned changes = plt_search_index_get_changes (plt->search_index);
+    playItem_t *it = pl_item_alloc_init ("/music/other.mp3", "stdmpg");
+    pl_add_meta (it, "title", "Beat Goes On");
+    pl_item_unref (it);
+    XCTAssertEqual(plt_search_index_get_changes (plt->search_index), changes);
+}
+
+- (void)test_RemovedItemChanged_IsNotFound {
+    plt_search_process2 (plt, "it", 0);
+    playItem_t *it = find_item ("Beat It");
+    pl_item_ref (it);
+    plt_remove_item (plt, it);
+    pl_replace_meta (it, "title", "Hit It");
+    plt_search_process2 (plt, "it", 0);
+    XCTAssert(!strcmp (search_results (), "Let It Be"), @"The actual output is: %s", search_results ());
+    pl_item_unref (it);
+}
+
+- (void)test_RemovedItem_IsNotFound {
+    plt_search_process2 (plt, "it", 0);
+    XCTAssert(!strcmp (search_results (), "Beat It|Let It Be"), @"The actual output is: %s", search_results ());
+
+    plt_remove_item (plt, find_item ("Beat It"));
+    plt_search_process2 (plt, "it ", 0);
+    XCTAssert(!strcmp (search_results (), "Let It Be"), @"The actual output is: %s", search_results ());
+}
+
+- (void)test_InsertedItem_IsFound {
+    plt_search_process2 (plt, "yes", 0);
+    playItem_t *it = pl_item_alloc_init ("/music/new.mp3", "stdmpg");
+    pl_add_meta (it, "title", "Yes It Is");
+    plt_insert_item (plt, NULL, it);
+    pl_item_unref (it);
+
+    plt_search_process2 (plt, "yes", 0);
+    XCTAssert(!strcmp (search_results (), "Yes It Is|Yesterday"), @"The actual output is: %s", search_results ());
+}
+
+- (void)test_NonAsciiQuery_IgnoresCase {
+    plt_search_process2 (plt, "ÄRGER", 0);
+    XCTAssert(!strcmp (search_results (), "Ärger im Paradies"), @"The actual output is: %s", search_results ());
+}
+
+- (void)test_FileName_IsSearched {
+    plt_search_process2 (plt, "3.mp3", 0);
+    XCTAssert(!strcmp (search_results (), "Yesterday"), @"The actual output is: %s", search_results ());
+}
+
+- (void)test_SingleCharQuery_ScansAllItems {
+    plt_search_process2 (plt, "y", 0);
+    XCTAssert(!strcmp (search_results (), "Beautiful Day|Yesterday"), @"The actual output is: %s", search_results ());
+}
+
+- (void)test_SelectResults_SelectsOnlyMatches {
+    plt_search_process2 (plt, "heart", 1);
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+        XCTAssertEqual(it->selected, !strcmp (pl_find_meta (it, "title"), "Heartbeat"));
+    }
+}
+
+- (void)test_EmptyQuery_ReturnsNothing {
+    plt_search_process2 (plt, "beat", 0);
+    plt_search_process2 (plt, "", 0);
+    XCTAssertEqual(plt_get_item_count (plt, PL_SEARCH), 0);
+}
+
+- (void)test_ValueMatch_SameAsUtfcasestr {
+    const char *values[] = { "Beat It", "ÄRGER", "straße", "ÀÉÎÕÜ", "abcabd", "", NULL };
+    const char *queries[] = { "beat", "t i", "ärg", "ße", "àéî", "õü", "abd", "cab", "x", NULL };
+    for (int v = 0; values[v]; v++) {
+        for (int q = 0; queries[q]; q++) {
+            int expected = utfcasestr_fast (values[v], queries[q]) != NULL;
+            XCTAssertEqual(plt_search_value_match (values[v], queries[q]), expected, @"%s / %s", values[v], queries[q]);
+        }
+    }
+}
+
+@end
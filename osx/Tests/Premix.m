@@ -0,0 +1,247 @@
+//
+//  Premix.m
+//  deadbeef
+//
+
+#import <Cocoa/Cocoa.h>
+#import <XCTest/XCTest.h>
+#include "deadbeef.h"
+#include "premix.h"
+
+#define BENCH_FRAMES 192000
+
+@interface Premix : XCTestCase {
+    char *input;
+    char *output;
+}
+@end
+
+@implementation Premix
+
+static void
+set_format (ddb_waveformat_t *fmt, int bps, int is_float, int channels) {
+    memset (fmt, 0, sizeof (ddb_waveformat_t));
+    fmt->bps = bps;
+    fmt->is_float = is_float;
+    fmt->channels = channels;
+    fmt->channelmask = (1 << channels) - 1;
+    fmt->samplerate = 44100;
+}
+
+static void
+fill_random (char *buffer, const ddb_waveformat_t *fmt, int n) {
+    srand (1);
+    if (fmt->is_float) {
+        float *f = (float *)buffer;
+        for (int i = 0; i < n; i++) {
+            f[i] = (rand () % 200001 - 100000) / 90000.f;
+        }
+    }
+    else {
+        for (int i = 0; i < n * fmt->bps / 8; i++) {
+            buffer[i] = rand ();
+        }
+    }
+}
+
+- (void)setUp {
+    [super setUp];
+    pcm_convert_init (1);
+    input = malloc (BENCH_FRAMES * 8 * 4);
+    output = malloc (BENCH_FRAMES * 8 * 4);
+}
+
+- (void)tearDown {
+    free (input);
+    free (output);
+    [super tearDown];
+}
+
+- (void)test_FloatToS16_ClipsAndRounds {
+    float in[19] = { 0, 1.f, -1.f, 2.f, -2.f, 0.5f, -0.5f, 1.5f/0x8000, -1.4f/0x8000, 0.25f };
+    int16_t expected[19] = { 0, 0x7fff, -0x8000, 0x7fff, -0x8000, 0x4000, -0x4000, 2, -1, 0x2000 };
+    int16_t out[19];
+    ddb_waveformat_t infmt, outfmt;
+    set_format (&infmt, 32, 1, 1);
+    set_format (&outfmt, 16, 0, 1);
+
+    int size = pcm_convert (&infmt, (char *)in, &outfmt, (char *)out, sizeof (in));
+
+    XCTAssert(size == sizeof (out));
+    XCTAssert(!memcmp (out, expected, sizeof (out)));
+}
+
+- (void)test_FloatToS32_FullScaleDoesNotWrap {
+    float in[9] = { 1.f, -1.f, 0.5f, 3.f, -3.f, 0, 0, 0, 1.f };
+    int32_t expected[9] = { 0x7fffffff, -0x7fffffff-1, 0x40000000, 0x7fffffff, -0x7fffffff-1, 0, 0, 0, 0x7fffffff };
+    int32_t out[9];
+    ddb_waveformat_t infmt, outfmt;
+    set_format (&infmt, 32, 1, 1);
+    set_format (&outfmt, 32, 0, 1);
+
+    pcm_convert (&infmt, (char *)in, &outfmt, (char *)out, sizeof (in));
+
+    XCTAssert(!memcmp (out, expected, sizeof (out)));
+}
+
+- (void)test_S24ToFloatAndBack_GivesSameSamples {
+    const int n = 1001 * 6;
+    ddb_waveformat_t s24fmt, floatfmt;
+    set_format (&s24fmt, 24, 0, 6);
+    set_format (&floatfmt, 32, 1, 6);
+    fill_random (input, &s24fmt, n);
+
+    pcm_convert (&s24fmt, input, &floatfmt, output, n * 3);
+    char *back = malloc (n * 3);
+    pcm_convert (&floatfmt, output, &s24fmt, back, n * 4);
+
+    XCTAssert(!memcmp (input, back, n * 3));
+    free (back);
+}
+
+- (void)test_OptimizedConversions_MatchPlainC {
+    const int formats[4][2] = { {16, 0}, {24, 0}, {32, 0}, {32, 1} };
+    const int n = 1037 * 2;
+    char *expected = malloc (n * 4);
+
+    for (int i = 0; i < 4; i++) {
+        for (int o = 0; o < 4; o++) {
+            ddb_waveformat_t infmt, outfmt;
+            set_format (&infmt, formats[i][0], formats[i][1], 2);
+            set_format (&outfmt, formats[o][0], formats[o][1], 2);
+            fill_random (input, &infmt, n);
+
+            pcm_convert_init (0);
+            pcm_convert (&infmt, input, &outfmt, expected, n * infmt.bps / 8);
+            pcm_convert_init (1);
+            pcm_convert (&infmt, input, &outfmt, output, n * infmt.bps / 8);
+
+            XCTAssert(!memcmp (expected, output, n * outfmt.bps / 8), @"%d%s to %d%s", infmt.bps, infmt.is_float ? "f" : "", outfmt.bps, outfmt.is_float ? "f" : "");
+        }
+    }
+    free (expected);
+}
+
+- (void)test_Gain_SaturatesIntegerSamples {
+    int16_t samples[20] = { 0x7fff, -0x8000, 0x4000, -0x4000, 100, -100 };
+    int16_t expected[20] = { 0x7fff, -0x8000, 0x7fff, -0x8000, 300, -300 };
+    ddb_waveformat_t fmt;
+    set_format (&fmt, 16, 0, 2);
+    float gain = 3.f;
+
+    pcm_apply_gain (&fmt, (char *)samples, sizeof (samples), &gain, 3.f, 441);
+
+    XCTAssert(!memcmp (samples, expected, sizeof (samples)));
+}
+
+- (void)test_GainRamp_ReachesTargetAtRampEnd {
+    float samples[200 * 2];
+    for (int i = 0; i < 200 * 2; i++) {
+        samples[i] = 1.f;
+    }
+    ddb_waveformat_t fmt;
+    set_format (&fmt, 32, 1, 2);
+    float gain = 1.f;
+
+    pcm_apply_gain (&fmt, (char *)samples, 50 * 2 * sizeof (float), &gain, 0.f, 100);
+    XCTAssertEqualWithAccuracy(gain, 0.5f, 0.0001f);
+    pcm_apply_gain (&fmt, (char *)(samples + 50 * 2), 150 * 2 * sizeof (float), &gain, 0.f, 100);
+
+    XCTAssertEqual(gain, 0.f);
+    XCTAssert(samples[0] < 1.f && samples[0] > 0.98f);
+    XCTAssert(samples[0] == samples[1]);
+    XCTAssert(samples[150 * 2] == 0.f);
+    for (int i = 2; i < 200 * 2; i += 2) {
+        XCTAssert(samples[i] <= samples[i-2]);
+    }
+}
+
+- (void)test_OptimizedGain_MatchesPlainC {
+    const int formats[4][2] = { {16, 0}, {24, 0}, {32, 0}, {32, 1} };
+    const int n = 1037 * 2;
+    char *expected = malloc (n * 4);
+
+    for (int i = 0; i < 4; i++) {
+        ddb_waveformat_t fmt;
+        set_format (&fmt, formats[i][0], formats[i][1], 2);
+        fill_random (expected, &fmt, n);
+        memcpy (output, expected, n * fmt.bps / 8);
+
+        float gain = 1.f;
+        pcm_convert_init (0);
+        pcm_apply_gain (&fmt, expected, n * fmt.bps / 8, &gain, 1.3f, 100);
+        gain = 1.f;
+        pcm_convert_init (1);
+        pcm_apply_gain (&fmt, output, n * fmt.bps / 8, &gain, 1.3f, 100);
+
+        XCTAssert(!memcmp (expected, output, n * fmt.bps / 8), @"%d%s", fmt.bps, fmt.is_float ? "f" : "");
+    }
+    free (expected);
+}
+
+- (void)test_S16ToFloatStereo_Performance {
+    ddb_waveformat_t infmt, outfmt;
+    set_format (&infmt, 16, 0, 2);
+    set_format (&outfmt, 32, 1, 2);
+    fill_random (input, &infmt, BENCH_FRAMES * 2);
+
+    [self measureBlock:^{
+        for (int i = 0; i < 50; i++) {
+            pcm_convert (&infmt, input, &outfmt, output, BENCH_FRAMES * 2 * 2);
+        }
+    }];
+}
+
+- (void)test_FloatToS16Stereo_Performance {
+    ddb_waveformat_t infmt, outfmt;
+    set_format (&infmt, 32, 1, 2);
+    set_format (&outfmt, 16, 0, 2);
+    fill_random (input, &infmt, BENCH_FRAMES * 2);
+
+    [self measureBlock:^{
+        for (int i = 0; i < 50; i++) {
+            pcm_convert (&infmt, input, &outfmt, output, BENCH_FRAMES * 2 * 4);
+        }
+    }];
+}
+
+- (void)test_S24ToFloat8ch_Performance {
+    ddb_waveformat_t infmt, outfmt;
+    set_format (&infmt, 24, 0, 8);
+    set_format (&outfmt, 32, 1, 8);
+    fill_random (input, &infmt, BENCH_FRAMES * 8);
+
+    [self measureBlock:^{
+        for (int i = 0; i < 10; i++) {
+            pcm_convert (&infmt, input, &outfmt, output, BENCH_FRAMES * 8 * 3);
+        }
+    }];
+}
+
+- (void)test_FloatToS24_8ch_Performance {
+    ddb_waveformat_t infmt, outfmt;
+    set_format (&infmt, 32, 1, 8);
+    set_format (&outfmt, 24, 0, 8);
+    fill_random (input, &infmt, BENCH_FRAMES * 8);
+
+    [self measureBlock:^{
+        for (int i = 0; i < 10; i++) {
+            pcm_convert (&infmt, input, &outfmt, output, BENCH_FRAMES * 8 * 4);
+        }
+    }];
+}
+
+- (void)test_GainS16Stereo_Performance {
+    ddb_waveformat_t fmt;
+    set_format (&fmt, 16, 0, 2);
+    fill_random (input, &fmt, BENCH_FRAMES * 2);
+
+    [self measureBlock:^{
+        for (int i = 0; i < 50; i++) {
+            float gain = 0.5f;
+            pcm_apply_gain (&fmt, input, BENCH_FRAMES * 2 * 2, &gain, 0.5f, 0);
+        }
+    }];
+}
+
+@end
@@ -0,0 +1,162 @@
+//
+//  Resampler.m
+//  deadbeef
+//
+
+#import <Cocoa/Cocoa.h>
+#import <XCTest/XCTest.h>
+#include <math.h>
+#include "deadbeef.h"
+// the plugin isn't built by this project, so it's tested from source
+#include "plugins/resampler/resampler.c"
+
+@interface Resampler : XCTestCase
+@end
+
+@implementation Resampler
+
+#define CHUNK_FRAMES 1000
+#define TONE_HZ 1000.0
+
+static DB_output_t test_output;
+
+static DB_output_t *
+test_get_output (void) {
+    return &test_output;
+}
+
+static DB_functions_t test_api = {
+    .get_output = test_get_output,
+};
+
+static DB_dsp_t *rs_plugin;
+
+- (void)setUp {
+    [super setUp];
+
+    rs_plugin = (DB_dsp_t *)ddb_dsp_resampler_load (&test_api);
+}
+
+// resamples one second of stereo sine in chunks, flushes, and returns the
+// number of output frames; the left channel is stored to out
+static int
+resample_sine (int inrate, int outrate, int quality, float *out, int maxout) {
+    ddb_dsp_context_t *ctx = rs_plugin->open ();
+    char val[20];
+    snprintf (val, sizeof (val), "%d", outrate);
+    rs_plugin->set_param (ctx, RESAMPLER_PARAM_SAMPLERATE, val);
+    snprintf (val, sizeof (val), "%d", quality);
+    rs_plugin->set_param (ctx, RESAMPLER_PARAM_QUALITY, val);
+
+    // buffer for one chunk, sized the way the streamer does it
+    ddb_waveformat_t fmt = { .bps = 32, .is_float = 1, .channels = 2, .samplerate = inrate };
+    float ratio = 1;
+    int latency = 0;
+    rs_plugin->negotiate (ctx, &fmt, &ratio, &latency);
+    int maxframes = (CHUNK_FRAMES + latency) * ratio + 1;
+    if (maxframes < CHUNK_FRAMES) {
+        maxframes = CHUNK_FRAMES;
+    }
+    float *buffer = malloc (maxframes * 2 * sizeof (float));
+
+    int total = 0;
+    for (int i = 0; i < inrate; i += CHUNK_FRAMES) {
+        int n = inrate - i < CHUNK_FRAMES ? inrate - i : CHUNK_FRAMES;
+        for (int k = 0; k < n; k++) {
+            buffer[k*2] = buffer[k*2+1] = 0.5 * sin (2 * M_PI * TONE_HZ * (i + k) / inrate);
+        }
+        fmt.samplerate = inrate;
+        float r = 1;
+        int nout = rs_plugin->process (ctx, buffer, n, maxframes, &fmt, &r);
+        // the tail comes with the last chunk, as the streamer calls it
+        if (i + n >= inrate) {
+            nout += rs_plugin->flush (ctx, buffer + nout * 2, maxframes - nout, &fmt);
+        }
+        for (int k = 0; k < nout && total + k < maxout; k++) {
+            out[total + k] = buffer[k*2];
+        }
+        total += nout;
+    }
+
+    free (buffer);
+    rs_plugin->close (ctx);
+    return total;
+}
+
+// signal to error ratio against the ideal sine, in dB, leaving out the edges,
+// where the signal starts and ends abruptly
+static double
+sine_snr (const float *out, int nframes, int rate) {
+    double err = 0, sig = 0;
+    for (int k = nframes / 10; k < nframes - nframes / 10; k++) {
+        double ideal = 0.5 * sin (2 * M_PI * TONE_HZ * k / rate);
+        err += (out[k] - ideal) * (out[k] - ideal);
+        sig += ideal * ideal;
+    }
+    return 10 * log10 (sig / err);
+}
+
+static const int rates[][2] = {
+    { 44100, 48000 },
+    { 48000, 44100 },
+    { 44100, 96000 },
+    { 192000, 44100 },
+    { 44100, 44101 }, // interpolated phases
+};
+
+static const double min_snr[RESAMPLER_NUM_PRESETS] = { 90, 70, 55 };
+
+- (void)test_EveryPreset_OutputLengthMatchesRatio {
+    for (int q = 0; q < RESAMPLER_NUM_PRESETS; q++) {
+        for (int r = 0; r < (int)(sizeof (rates) / sizeof (rates[0])); r++) {
+            int outrate = rates[r][1];
+            float *out = calloc (outrate * 2, sizeof (float));
+            int nout = resample_sine (rates[r][0], outrate, q, out, outrate * 2);
+            // exactly one second of output, the position of the interpolated
+            // ratio may be off by a frame
+            XCTAssert(abs (nout - outrate) <= (r == 4 ? 1 : 0), @"q%d %d -> %d: %d frames", q, rates[r][0], outrate, nout);
+            free (out);
+        }
+    }
+}
+
+- (void)test_EveryPreset_ReproducesSine {
+    for (int q = 0; q < RESAMPLER_NUM_PRESETS; q++) {
+        for (int r = 0; r < (int)(sizeof (rates) / sizeof (rates[0])); r++) {
+            int outrate = rates[r][1];
+            float *out = calloc (outrate * 2, sizeof (float));
+            int nout = resample_sine (rates[r][0], outrate, q, out, outrate * 2);
+            double snr = sine_snr (out, nout, outrate);
+            XCTAssert(snr >= min_snr[q], @"q%d %d -> %d: %.1f dB", q, rates[r][0], outrate, snr);
+            free (out);
+        }
+    }
+}
+
+- (void)test_Flush_ReturnsTheLastFrames {
+    // the tail of the sine is there too, not silence
+    float *out = calloc (48000 * 2, sizeof (float));
+    int nout = resample_sine (44100, 48000, 1, out, 48000 * 2);
+    XCTAssertEqual(nout, 48000);
+    double err = 0;
+    for (int k = nout - 100; k < nout - 40; k++) {
+        double ideal = 0.5 * sin (2 * M_PI * TONE_HZ * k / 48000);
+        err = fmax (err, fabs (out[k] - ideal));
+    }
+    XCTAssertLessThan(err, 0.01);
+    free (out);
+}
+
+- (void)test_FlushAfterReset_ReturnsNothing {
+    ddb_dsp_context_t *ctx = rs_plugin->open ();
+    rs_plugin->set_param (ctx, RESAMPLER_PARAM_SAMPLERATE, "48000");
+    ddb_waveformat_t fmt = { .bps = 32, .is_float = 1, .channels = 2, .samplerate = 44100 };
+    float buffer[CHUNK_FRAMES * 2 * 2] = { 0 };
+    float r = 1;
+    rs_plugin->process (ctx, buffer, CHUNK_FRAMES, CHUNK_FRAMES * 2, &fmt, &r);
+    rs_plugin->reset (ctx);
+    XCTAssertEqual(rs_plugin->flush (ctx, buffer, CHUNK_FRAMES * 2, &fmt), 0);
+    rs_plugin->close (ctx);
+}
+
+@end
@@ -0,0 +1,296 @@
+//
+//  Ringbuf.m
+//  deadbeef
+//
+
+#import <Cocoa/Cocoa.h>
+#import <XCTest/XCTest.h>
+#include <pthread.h>
+#include "ringbuf.h"
+#include "streambuffer.h"
+
+@interface Ringbuf : XCTestCase
+@end
+
+@implementation Ringbuf
+
+static void
+fill_pattern (char *buffer, int size, int start) {
+    for (int i = 0; i < size; i++) {
+        buffer[i] = (char)(start + i);
+    }
+}
+
+static int
+check_pattern (const char *buffer, int size, int start) {
+    for (int i = 0; i < size; i++) {
+        if (buffer[i] != (char)(start + i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+- (void)test_WriteRead_ReturnsSameBytes {
+    char data[16];
+    ringbuf_t rb;
+    ringbuf_init (&rb, data, sizeof (data));
+    char in[10], out[10];
+    fill_pattern (in, 10, 0);
+
+    XCTAssertEqual(ringbuf_write (&rb, in, 10), 0);
+    XCTAssertEqual(ringbuf_get_remaining (&rb), 10);
+    XCTAssertEqual(ringbuf_get_free (&rb), 6);
+    XCTAssertEqual(ringbuf_read (&rb, out, 10), 10);
+
+    XCTAssert(check_pattern (out, 10, 0));
+    XCTAssertEqual(ringbuf_get_remaining (&rb), 0);
+}
+
+- (void)test_WriteMoreThanFree_WritesNothing {
+    char data[16];
+    ringbuf_t rb;
+    ringbuf_init (&rb, data, sizeof (data));
+    char in[12];
+    fill_pattern (in, 12, 0);
+
+    XCTAssertEqual(ringbuf_write (&rb, in, 12), 0);
+    XCTAssertEqual(ringbuf_write (&rb, in, 5), -1);
+
+    XCTAssertEqual(ringbuf_get_remaining (&rb), 12);
+}
+
+- (void)test_WriteAcrossEnd_WrapsAround {
+    char data[16];
+    ringbuf_t rb;
+    ringbuf_init (&rb, data, sizeof (data));
+    char in[16], out[16];
+
+    // move the positions close to the end of the buffer
+    fill_pattern (in, 13, 0);
+    ringbuf_write (&rb, in, 13);
+    ringbuf_read (&rb, out, 13);
+
+    fill_pattern (in, 10, 13);
+    XCTAssertEqual(ringbuf_write (&rb, in, 10), 0);
+
+    // the first span ends at the end of the buffer
+    char *ptr;
+    XCTAssertEqual(ringbuf_read_span (&rb, &ptr), 3);
+    XCTAssert(ptr == data + 13);
+
+    XCTAssertEqual(ringbuf_read (&rb, out, 16), 10);
+    XCTAssert(check_pattern (out, 10, 13));
+}
+
+- (void)test_ManyWraparounds_KeepOrder {
+    char data[64];
+    ringbuf_t rb;
+    ringbuf_init (&rb, data, sizeof (data));
+    char in[37], out[37];
+    int w = 0, r = 0;
+
+    for (int i = 0; i < 1000; i++) {
+        fill_pattern (in, 37, w);
+        XCTAssertEqual(ringbuf_write (&rb, in, 37), 0);
+        w += 37;
+        XCTAssertEqual(ringbuf_read (&rb, out, 37), 37);
+        XCTAssert(check_pattern (out, 37, r));
+        r += 37;
+    }
+    XCTAssertEqual(ringbuf_get_remaining (&rb), 0);
+}
+
+- (void)test_WriteSpanCommit_IsVisibleToReader {
+    char data[16];
+    ringbuf_t rb;
+    ringbuf_init (&rb, data, sizeof (data));
+    char out[4];
+
+    char *ptr;
+    size_t n = ringbuf_write_span (&rb, &ptr);
+    XCTAssertEqual(n, 16);
+    fill_pattern (ptr, 4, 100);
+    XCTAssertEqual(ringbuf_get_remaining (&rb), 0);
+    ringbuf_write_commit (&rb, 4);
+
+    XCTAssertEqual(ringbuf_read (&rb, out, 4), 4);
+    XCTAssert(check_pattern (out, 4, 100));
+}
+
+- (void)test_Flush_DiscardsWrittenData {
+    char data[16];
+    ringbuf_t rb;
+    ringbuf_init (&rb, data, sizeof (data));
+    char in[10], out[10];
+    fill_pattern (in, 10, 0);
+    ringbuf_write (&rb, in, 10);
+
+    ringbuf_flush (&rb);
+
+    XCTAssertEqual(ringbuf_get_remaining (&rb), 0);
+    XCTAssertEqual(ringbuf_get_free (&rb), 16);
+    XCTAssertEqual(ringbuf_read (&rb, out, 10), 0);
+
+    // data written after the flush is kept
+    fill_pattern (in, 5, 50);
+    ringbuf_write (&rb, in, 5);
+    XCTAssertEqual(ringbuf_read (&rb, out, 10), 5);
+    XCTAssert(check_pattern (out, 5, 50));
+}
+
+#define THREADED_BYTES 4000000
+
+static ringbuf_t threaded_rb;
+static int threaded_errors;
+
+static void *
+consumer_thread (void *ctx) {
+    char out[333];
+    int pos = 0;
+    while (pos < THREADED_BYTES) {
+        int n = ringbuf_read (&threaded_rb, out, sizeof (out));
+        if (!check_pattern (out, n, pos)) {
+            threaded_errors++;
+        }
+        pos += n;
+    }
+    return NULL;
+}
+
+- (void)test_ConcurrentProducerConsumer_KeepOrder {
+    char data[4096];
+    ringbuf_init (&threaded_rb, data, sizeof (data));
+    threaded_errors = 0;
+    pthread_t tid;
+    pthread_create (&tid, NULL, consumer_thread, NULL);
+
+    char in[500];
+    int pos = 0;
+    while (pos < THREADED_BYTES) {
+        int n = rand () % 500 + 1;
+        if (pos + n > THREADED_BYTES) {
+            n = THREADED_BYTES - pos;
+        }
+        fill_pattern (in, n, pos);
+        if (!ringbuf_write (&threaded_rb, in, n)) {
+            pos += n;
+        }
+    }
+    pthread_join (tid, NULL);
+
+    XCTAssertEqual(threaded_errors, 0);
+    XCTAssertEqual(ringbuf_get_remaining (&threaded_rb), 0);
+}
+
+- (void)test_StreambufferResize_KeepsDataInOrder {
+    streambuffer_t sb;
+    streambuffer_init (&sb, 64);
+    char in[40], out[100];
+    fill_pattern (in, 40, 0);
+    ringbuf_write (streambuffer_get_target (&sb), in, 40);
+
+    XCTAssertEqual(streambuffer_resize (&sb, 128), 0);
+    ringbuf_t *target = streambuffer_get_target (&sb);
+    XCTAssertEqual(target->size, 128);
+    fill_pattern (in, 40, 40);
+    ringbuf_write (target, in, 40);
+    XCTAssertEqual(streambuffer_get_fill (&sb), 80);
+
+    // the old buffer is drained first, then the reader switches over
+    XCTAssertEqual(streambuffer_read (&sb, out, 100), 80);
+    XCTAssert(check_pattern (out, 80, 0));
+    XCTAssert(sb.cur == target);
+    XCTAssert(sb.retired != NULL);
+    XCTAssertEqual(streambuffer_get_fill (&sb), 0);
+
+    streambuffer_free (&sb);
+}
+
+- (void)test_StreambufferResize_FreesRetiredWhenNoReaders {
+    streambuffer_t sb;
+    streambuffer_init (&sb, 64);
+    char out[10];
+    streambuffer_resize (&sb, 128);
+    streambuffer_read (&sb, out, 10);
+    XCTAssert(sb.retired != NULL);
+
+    // a thread may still be looking at the old buffer
+    sb.readers = 1;
+    streambuffer_resize (&sb, 256);
+    XCTAssert(sb.retired != NULL);
+    XCTAssert(sb.next == NULL);
+
+    sb.readers = 0;
+    streambuffer_resize (&sb, 256);
+    XCTAssert(sb.retired == NULL);
+    XCTAssertEqual(streambuffer_get_target (&sb)->size, 256);
+
+    streambuffer_free (&sb);
+}
+
+- (void)test_StreambufferFlush_FlushesBothBuffers {
+    streambuffer_t sb;
+    streambuffer_init (&sb, 64);
+    char in[40], out[10];
+    fill_pattern (in, 40, 0);
+    ringbuf_write (streambuffer_get_target (&sb), in, 40);
+    streambuffer_resize (&sb, 128);
+    ringbuf_write (streambuffer_get_target (&sb), in, 40);
+
+    streambuffer_flush (&sb);
+
+    XCTAssertEqual(streambuffer_get_fill (&sb), 0);
+    XCTAssertEqual(streambuffer_read (&sb, out, 10), 0);
+    streambuffer_free (&sb);
+}
+
+#define RESIZE_BYTES 2000000
+
+static streambuffer_t threaded_sb;
+
+static void *
+streambuffer_consumer_thread (void *ctx) {
+    char out[333];
+    int pos = 0;
+    while (pos < RESIZE_BYTES) {
+        int n = streambuffer_read (&threaded_sb, out, sizeof (out));
+        if (!check_pattern (out, n, pos)) {
+            threaded_errors++;
+        }
+        pos += n;
+        streambuffer_get_fill (&threaded_sb);
+    }
+    return NULL;
+}
+
+- (void)test_StreambufferConcurrentResize_KeepsOrder {
+    streambuffer_init (&threaded_sb, 1024);
+    threaded_errors = 0;
+    pthread_t tid;
+    pthread_create (&tid, NULL, streambuffer_consumer_thread, NULL);
+
+    char in[500];
+    int pos = 0;
+    int i = 0;
+    while (pos < RESIZE_BYTES) {
+        if (!(i++ % 100)) {
+            streambuffer_resize (&threaded_sb, 1024 << (rand () % 4));
+        }
+        int n = rand () % 500 + 1;
+        if (pos + n > RESIZE_BYTES) {
+            n = RESIZE_BYTES - pos;
+        }
+        fill_pattern (in, n, pos);
+        if (!ringbuf_write (streambuffer_get_target (&threaded_sb), in, n)) {
+            pos += n;
+        }
+    }
+    pthread_join (tid, NULL);
+
+    XCTAssertEqual(threaded_errors, 0);
+    XCTAssertEqual(streambuffer_get_fill (&threaded_sb), 0);
+    streambuffer_free (&threaded_sb);
+}
+
+@end
@@ -0,0 +1,152 @@
+//
+//  TagCache.m
+//  deadbeef
+//
+
+#import <Cocoa/Cocoa.h>
+#import <XCTest/XCTest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "playlist.h"
+#include "plugins.h"
+#include "conf.h"
+#include "common.h"
+
+@interface TagCache : XCTestCase
+@end
+
+@implementation TagCache
+
+static char root[PATH_MAX];
+static DB_decoder_t *saved_decoders[3];
+
+// the number of insert calls per decoder
+static int picky_calls;
+static int fallback_calls;
+
+static DB_decoder_t picky_dec;
+static DB_decoder_t fallback_dec;
+
+static DB_playItem_t *
+test_insert (DB_decoder_t *dec, ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
+    playItem_t *it = pl_item_alloc_init (fname, dec->plugin.id);
+    pl_add_meta (it, "title", dec->plugin.id);
+    playItem_t *inserted = plt_insert_item ((playlist_t *)plt, (playItem_t *)after, it);
+    pl_item_unref (it);
+    return (DB_playItem_t *)inserted;
+}
+
+// accepts only the files named ok.tst, like a decoder which declines files
+// it can't parse
+static DB_playItem_t *
+picky_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
+    picky_calls++;
+    const char *fn = strrchr (fname, '/');
+    if (strcmp (fn, "/ok.tst")) {
+        return NULL;
+    }
+    return test_insert (&picky_dec, plt, after, fname);
+}
+
+static DB_playItem_t *
+fallback_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
+    fallback_calls++;
+    return test_insert (&fallback_dec, plt, after, fname);
+}
+
+static const char *exts[] = { "tst", NULL };
+
+static DB_decoder_t picky_dec = {
+    .plugin.type = DB_PLUGIN_DECODER,
+    .plugin.id = "picky",
+    .insert = picky_insert,
+    .exts = exts,
+};
+
+static DB_decoder_t fallback_dec = {
+    .plugin.type = DB_PLUGIN_DECODER,
+    .plugin.id = "fallback",
+    .insert = fallback_insert,
+    .exts = exts,
+};
+
+- (void)setUp {
+    [super setUp];
+
+    snprintf (root, sizeof (root), "/tmp/deadbeef_tagcache_%d", (int)getpid ());
+    mkdir (root, 0755);
+    strcpy (dbconfdir, root);
+
+    conf_init ();
+    conf_enable_saving (0);
+    pl_init ();
+
+    DB_decoder_t **decoders = plug_get_decoder_list ();
+    memcpy (saved_decoders, decoders, sizeof (saved_decoders));
+    decoders[0] = &picky_dec;
+    decoders[1] = &fallback_dec;
+    decoders[2] = NULL;
+    picky_calls = 0;
+    fallback_calls = 0;
+}
+
+- (void)tearDown {
+    DB_decoder_t **decoders = plug_get_decoder_list ();
+    memcpy (decoders, saved_decoders, sizeof (saved_decoders));
+    pl_free ();
+    conf_free ();
+
+    char cmd[PATH_MAX + 10];
+    snprintf (cmd, sizeof (cmd), "rm -rf %s", root);
+    system (cmd);
+    dbconfdir[0] = 0;
+
+    [super tearDown];
+}
+
+static void
+write_file (const char *name) {
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/%s", root, name);
+    FILE *fp = fopen (path, "wb");
+    fputs ("x", fp);
+    fclose (fp);
+}
+
+// adds the file to a new playlist, and returns the title of the item
+static const char *
+add_file (const char *name) {
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/%s", root, name);
+    playlist_t *plt = plt_alloc ("test");
+    int pabort = 0;
+    plt_insert_file (plt, NULL, path, &pabort, NULL, NULL);
+    static char title[100];
+    title[0] = 0;
+    if (plt->head[PL_MAIN]) {
+        pl_get_meta (plt->head[PL_MAIN], "title", title, sizeof (title));
+    }
+    plt_free (plt);
+    return title;
+}
+
+- (void)test_AddTwice_FirstDecoder_IsCached {
+    write_file ("ok.tst");
+    XCTAssert(!strcmp (add_file ("ok.tst"), "picky"));
+    XCTAssert(!strcmp (add_file ("ok.tst"), "picky"));
+    XCTAssertEqual(picky_calls, 1);
+    XCTAssertEqual(fallback_calls, 0);
+}
+
+- (void)test_AddTwice_FallbackDecoder_IsCached {
+    write_file ("other.tst");
+    XCTAssert(!strcmp (add_file ("other.tst"), "fallback"));
+    XCTAssertEqual(picky_calls, 1);
+    XCTAssertEqual(fallback_calls, 1);
+
+    XCTAssert(!strcmp (add_file ("other.tst"), "fallback"));
+    XCTAssertEqual(picky_calls, 1);
+    XCTAssertEqual(fallback_calls, 1);
+}
+
+@end
@@ -151,6 +151,78 @@ static DB_output_t fake_out = {
     tf_free (bc);
 }
 
+- (void)test_PlaylistColumns_Performance {
+    pl_add_meta (it, "artist", "TheArtist");
+    pl_add_meta (it, "album artist", "TheAlbumArtist");
+    pl_add_meta (it, "album", "TheNameOfAlbum");
+    pl_add_meta (it, "title", "TheTitle");
+    pl_add_meta (it, "track", "5");
+    pl_add_meta (it, "year", "1999");
+    pl_add_meta (it, ":FILETYPE", "FLAC");
+    pl_add_meta (it, ":BITRATE", "1000");
+
+    const char *scripts[] = {
+        "%artist% - %title%",
+        "[%album artist% - ]%album%[ (%date%)]",
+        "%tracknumber%. %title%[ // %track artist%]",
+        "%length% | %codec% | %bitrate% kbps",
+        "$if(%ispaused%,paused,$if(%isplaying%,playing,)) %title%",
+    };
+    const int count = sizeof (scripts) / sizeof (scripts[0]);
+    char *bc[count];
+    for (int i = 0; i < count; i++) {
+        bc[i] = tf_compile (scripts[i]);
+    }
+
+    [self measureBlock:^{
+        for (int n = 0; n < 10000; n++) {
+            for (int i = 0; i < count; i++) {
+                tf_eval (&ctx, bc[i], buffer, sizeof (buffer));
+            }
+        }
+    }];
+
+    for (int i = 0; i < count; i++) {
+        tf_free (bc[i]);
+    }
+}
+
+- (void)test_LiteralDoesntFitBuffer_CutAtCharBoundary {
+    char *bc = tf_compile("АБВГД");
+    tf_eval (&ctx, bc, buffer, 6);
+    tf_free (bc);
+    XCTAssert(!strcmp ("АБ", buffer), @"The actual output is: %s", buffer);
+}
+
+- (void)test_ConstantFunctionInIf_KeepsBoolResult {
+    char *bc = tf_compile("$if($and(),yes,no) $if($greater(1,2),yes,no) $add(1,2)");
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    tf_free (bc);
+    XCTAssert(!strcmp ("yes no 3", buffer), @"The actual output is: %s", buffer);
+}
+
+- (void)test_ReplaceMetaAfterEval_ReturnsNewValue {
+    pl_replace_meta (it, "title", "OldTitle");
+    char *bc = tf_compile("%title%");
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    pl_replace_meta (it, "title", "NewTitle");
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    tf_free (bc);
+    XCTAssert(!strcmp ("NewTitle", buffer), @"The actual output is: %s", buffer);
+}
+
+- (void)test_IsPlayingAfterStateChange_ReturnsNewValue {
+    streamer_set_playing_track (it);
+    plug_set_output (&fake_out);
+    fake_out_state_value = OUTPUT_STATE_STOPPED;
+    char *bc = tf_compile("%isplaying%");
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    fake_out_state_value = OUTPUT_STATE_PLAYING;
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    tf_free (bc);
+    XCTAssert(!strcmp ("1", buffer), @"The actual output is: %s", buffer);
+}
+
 - (void)test_LongCommentOverflowBuffer_DoesntCrash {
     char longcomment[2048];
     for (int i = 0; i < sizeof (longcomment) - 1; i++) {
@@ -38,6 +38,8 @@
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <assert.h>
 #include <time.h>
@@ -66,6 +68,8 @@
 #include "strdupa.h"
 #include "tf.h"
 #include "playqueue.h"
+#include "plsearch.h"
+#include "tagcache.h"
 
 // disable custom title function, until we have new title formatting (0.7)
 #define DISABLE_CUSTOM_TITLE
@@ -85,6 +89,16 @@
 //    removed legacy data used for compat with 0.4.4
 //    note: ddb-0.5.0 should keep using 1.2 playlist format
 //    1.3 support is designed for transition to ddb-0.6.0
+// 1.x->2.0 changelog:
+//    fixed-size records and a string pool, for loading via mmap (see
+//    dbpl_header_t); legacy fields are only kept in the metadata
+//    note: older versions can't load 2.0, so 1.2 is written unless the
+//    playlist.save_format config option is set to 2
+// 2.0->2.1 changelog:
+//    strings are referenced by file offset, so data can be appended;
+//    saving updates the file in place, appending the changed metadata and
+//    patching the item records, see plt_save_dbpl2_update
+//    note: 2.0 is still loaded, but no longer written
 #define PLAYLIST_MAJOR_VER 1
 #define PLAYLIST_MINOR_VER 2
 
@@ -92,6 +106,9 @@
 #error writing playlists in format <1.2 is not supported
 #endif
 
+#define PLAYLIST_DBPL2_MAJOR_VER 2
+#define PLAYLIST_DBPL2_MINOR_VER 1
+
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
 #define trace(fmt,...)
 
@@ -169,6 +186,8 @@ pl_init (void) {
         return 0; // avoid double init
     }
     playlist = &dummy_playlist;
+    metacache_init ();
+    tagcache_init ();
 #if !DISABLE_LOCKING
     mutex = mutex_create ();
 #endif
@@ -201,6 +220,9 @@ pl_free (void) {
         mutex = 0;
     }
 #endif
+    tf_cache_free ();
+    tagcache_free ();
+    metacache_free ();
     playlist = NULL;
 }
 
@@ -212,10 +234,14 @@ static pthread_t tids[1000];
 static int ntids = 0;
 pthread_t pl_lock_tid = 0;
 #endif
+// how many times the current thread has locked the playlist
+static __thread int pl_lock_depth;
+
 void
 pl_lock (void) {
 #if !DISABLE_LOCKING
     mutex_lock (mutex);
+    pl_lock_depth++;
 #if DETECT_PL_LOCK_RC
     pl_lock_tid = pthread_self ();
     tids[ntids++] = pl_lock_tid;
@@ -242,6 +268,7 @@ pl_unlock (void) {
         pl_lock_tid = 0;
     }
 #endif
+    pl_lock_depth--;
     mutex_unlock (mutex);
 #if DEBUG_LOCKING
     pl_lock_cnt--;
@@ -250,9 +277,17 @@ pl_unlock (void) {
 #endif
 }
 
+int
+pl_lock_held (void) {
+    return pl_lock_depth > 0;
+}
+
 static void
 pl_item_free (playItem_t *it);
 
+static void
+dbpl_file_unref (struct dbpl_file_s *f);
+
 static void
 plt_gen_conf (void) {
     if (plt_loading) {
@@ -310,20 +345,18 @@ plt_get_for_idx (int idx) {
 
 void
 plt_ref (playlist_t *plt) {
-    LOCK;
-    plt->refc++;
-    UNLOCK;
+    __sync_add_and_fetch (&plt->refc, 1);
 }
 
 void
 plt_unref (playlist_t *plt) {
     LOCK;
     assert (plt->refc > 0);
-    plt->refc--;
-    if (plt->refc < 0) {
+    int refc = __sync_sub_and_fetch (&plt->refc, 1);
+    if (refc < 0) {
         trace ("\033[0;31mplaylist: bad refcount on playlist %p (%s)\033[37;0m\n", plt, plt->title);
     }
-    if (plt->refc <= 0) {
+    if (refc <= 0) {
         plt_free (plt);
     }
     UNLOCK;
@@ -650,6 +683,16 @@ plt_free (playlist_t *plt) {
     LOCK;
     plt_clear (plt);
     free (plt->title);
+    for (int iter = 0; iter < PL_MAX_ITERATORS; iter++) {
+        free (plt->index[iter]);
+    }
+    if (plt->search_index) {
+        plt_search_index_free (plt->search_index);
+    }
+    free (plt->search_query);
+    if (plt->dbpl) {
+        dbpl_file_unref (plt->dbpl);
+    }
 
     while (plt->meta) {
         DB_metaInfo_t *m = plt->meta;
@@ -1321,6 +1364,84 @@ plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playIte
 static playItem_t *
 plt_load_int (int visibility, playlist_t *plt, playItem_t *after, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data);
 
+static void
+plt_file_added (int visibility, playlist_t *playlist, playItem_t *inserted, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    if (cb && cb (inserted, user_data) < 0) {
+        *pabort = 1;
+    }
+    if (file_add_listeners) {
+        ddb_fileadd_data_t d;
+        memset (&d, 0, sizeof (d));
+        d.visibility = visibility;
+        d.plt = (ddb_playlist_t *)playlist;
+        d.track = (ddb_playItem_t *)inserted;
+        for (ddb_fileadd_listener_t *l = file_add_listeners; l; l = l->next) {
+            if (l->callback (&d, l->user_data) < 0) {
+                *pabort = 1;
+                break;
+            }
+        }
+    }
+}
+
+// runs the insert function of the first decoder which accepts the file, fn is
+// the name of the file without the folder
+static playItem_t *
+plt_insert_file_with_decoders (playlist_t *playlist, playItem_t *after, const char *fname, const char *fn) {
+    // detect decoder
+    const char *eol = strrchr (fname, '.');
+    if (!eol) {
+        return NULL;
+    }
+    eol++;
+
+    // unchanged files which were added before don't need to be parsed again
+    struct stat st;
+    int cacheable = tagcache_can_cache (fname, &st);
+    if (cacheable) {
+        playItem_t *inserted = tagcache_insert (playlist, after, fname, &st);
+        if (inserted) {
+            return inserted;
+        }
+    }
+
+    DB_decoder_t **decoders = plug_get_decoder_list ();
+    // match by decoder
+    for (int i = 0; decoders[i]; i++) {
+        trace ("matching decoder %d(%s)...\n", i, decoders[i]->plugin.id);
+        if (decoders[i]->exts && decoders[i]->insert) {
+            const char **exts = decoders[i]->exts;
+            for (int e = 0; exts[e]; e++) {
+                if (!strcasecmp (exts[e], eol) || !strcmp (exts[e], "*")) {
+                    playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
+                    if (inserted != NULL) {
+                        trace ("file has been added by decoder: %s\n", decoders[i]->plugin.id);
+                        if (cacheable) {
+                            tagcache_add (playlist, after, inserted, fname, &st, decoders[i]->plugin.id);
+                        }
+                        return inserted;
+                    }
+                }
+            }
+        }
+        if (decoders[i]->prefixes && decoders[i]->insert) {
+            const char **prefixes = decoders[i]->prefixes;
+            for (int e = 0; prefixes[e]; e++) {
+                if (!strncasecmp (prefixes[e], fn, strlen(prefixes[e])) && *(fn + strlen (prefixes[e])) == '.') {
+                    playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
+                    if (inserted != NULL) {
+                        if (cacheable) {
+                            tagcache_add (playlist, after, inserted, fname, &st, decoders[i]->plugin.id);
+                        }
+                        return inserted;
+                    }
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
 static playItem_t *
 plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
     trace ("count: %d\n", playlist->count[PL_MAIN]);
@@ -1421,72 +1542,13 @@ plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, co
         fname += 7;
     }
 
-    // detect decoder
-    const char *eol = strrchr (fname, '.');
-    if (!eol) {
+    playItem_t *inserted = plt_insert_file_with_decoders (playlist, after, fname, fn);
+    if (!inserted) {
+        trace ("no decoder found for %s\n", fname);
         return NULL;
     }
-    eol++;
-
-    ddb_fileadd_data_t d;
-    memset (&d, 0, sizeof (d));
-    d.visibility = visibility;
-    d.plt = (ddb_playlist_t *)playlist;
-
-    DB_decoder_t **decoders = plug_get_decoder_list ();
-    // match by decoder
-    for (int i = 0; decoders[i]; i++) {
-        trace ("matching decoder %d(%s)...\n", i, decoders[i]->plugin.id);
-        if (decoders[i]->exts && decoders[i]->insert) {
-            const char **exts = decoders[i]->exts;
-            for (int e = 0; exts[e]; e++) {
-                if (!strcasecmp (exts[e], eol) || !strcmp (exts[e], "*")) {
-                    playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
-                    if (inserted != NULL) {
-                        if (cb && cb (inserted, user_data) < 0) {
-                            *pabort = 1;
-                        }
-                        if (file_add_listeners) {
-                            d.track = (ddb_playItem_t *)inserted;
-                            for (ddb_fileadd_listener_t *l = file_add_listeners; l; l = l->next) {
-                                if (l->callback (&d, l->user_data) < 0) {
-                                    *pabort = 1;
-                                    break;
-                                }
-                            }
-                        }
-                        trace ("file has been added by decoder: %s\n", decoders[i]->plugin.id);
-                        return inserted;
-                    }
-                }
-            }
-        }
-        if (decoders[i]->prefixes && decoders[i]->insert) {
-            const char **prefixes = decoders[i]->prefixes;
-            for (int e = 0; prefixes[e]; e++) {
-                if (!strncasecmp (prefixes[e], fn, strlen(prefixes[e])) && *(fn + strlen (prefixes[e])) == '.') {
-                    playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
-                    if (inserted != NULL) {
-                        if (cb && cb (inserted, user_data) < 0) {
-                            *pabort = 1;
-                        }
-                        if (file_add_listeners) {
-                            d.track = (ddb_playItem_t *)inserted;
-                            for (ddb_fileadd_listener_t *l = file_add_listeners; l; l = l->next) {
-                                if (l->callback (&d, l->user_data) < 0) {
-                                    *pabort = 1;
-                                    break;
-                                }
-                            }
-                        }
-                        return inserted;
-                    }
-                }
-            }
-        }
-    }
-    trace ("no decoder found for %s\n", fname);
-    return NULL;
+    plt_file_added (visibility, playlist, inserted, pabort, cb, user_data);
+    return inserted;
 }
 
 playItem_t *
@@ -1577,18 +1639,350 @@ plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playIte
     return after;
 }
 
-playItem_t *
-plt_insert_dir (playlist_t *playlist, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+// Folders are imported in a pipeline: a walker thread scans the tree and
+// queues the files in the same order as plt_insert_dir_int, a pool of
+// workers runs the decoders on them, each worker into its own private
+// playlist, and the calling thread links the resulting items into the
+// target playlist in queue order, calling the callbacks as it goes.
+// Files are read in parallel, which matters most on slow disks and network
+// shares, while the playlist sees the same sequence of inserts as before.
+// Only decoders with DDB_PLUGIN_FLAG_THREADSAFE_INSERT run on the workers,
+// the files which other decoders may accept are inserted by the calling
+// thread, like containers.
+#define PLT_IMPORT_QUEUE_SIZE 256
+// the calling thread also wakes up on this interval to check *pabort, which
+// the UI sets without signalling
+#define PLT_IMPORT_WAIT_MS 100
+
+enum {
+    PLT_IMPORT_QUEUED,
+    PLT_IMPORT_BUSY,
+    PLT_IMPORT_DONE,
+};
+
+typedef struct plt_import_task_s {
+    struct plt_import_task_s *next;
+    char *fname;
+    int state;
+    int serial; // inserted by the calling thread
+    playItem_t **items; // referenced, not in any playlist
+    int count;
+    int inserted; // index of the item returned by the decoder, or -1
+} plt_import_task_t;
+
+typedef struct {
+    uintptr_t mutex;
+    uintptr_t cond;
+    const char *dirname;
+    int *pabort;
+    int abort;
+    int walker_done;
+    int walker_failed; // dirname is not a folder
+    plt_import_task_t *head;
+    plt_import_task_t *tail;
+    plt_import_task_t *next_work; // first task not taken by a worker
+    int queued;
+} plt_importer_t;
+
+static void
+plt_import_task_free (plt_import_task_t *task) {
+    for (int i = 0; i < task->count; i++) {
+        pl_item_unref (task->items[i]);
+    }
+    free (task->items);
+    free (task->fname);
+    free (task);
+}
+
+// returns 0 if the file may be accepted by a decoder whose insert is not
+// thread-safe, matching the same way as plt_insert_file_with_decoders
+static int
+plt_import_can_insert_in_parallel (const char *fname) {
+    const char *eol = strrchr (fname, '.');
+    if (!eol) {
+        return 1;
+    }
+    eol++;
+    const char *fn = strrchr (fname, '/');
+    fn = fn ? fn + 1 : fname;
+
+    DB_decoder_t **decoders = plug_get_decoder_list ();
+    for (int i = 0; decoders[i]; i++) {
+        if (!decoders[i]->insert || (decoders[i]->plugin.flags & DDB_PLUGIN_FLAG_THREADSAFE_INSERT)) {
+            continue;
+        }
+        if (decoders[i]->exts) {
+            const char **exts = decoders[i]->exts;
+            for (int e = 0; exts[e]; e++) {
+                if (!strcasecmp (exts[e], eol) || !strcmp (exts[e], "*")) {
+                    return 0;
+                }
+            }
+        }
+        if (decoders[i]->prefixes) {
+            const char **prefixes = decoders[i]->prefixes;
+            for (int e = 0; prefixes[e]; e++) {
+                if (!strncasecmp (prefixes[e], fn, strlen(prefixes[e])) && *(fn + strlen (prefixes[e])) == '.') {
+                    return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+static void
+plt_import_enqueue (plt_importer_t *imp, const char *fname) {
+    plt_import_task_t *task = calloc (1, sizeof (plt_import_task_t));
+    task->fname = strdup (fname);
+    task->inserted = -1;
+    task->serial = !plt_import_can_insert_in_parallel (fname);
+    if (!ignore_archives && !task->serial) {
+        DB_vfs_t **vfsplugs = plug_get_vfs_list ();
+        for (int i = 0; vfsplugs[i]; i++) {
+            if (vfsplugs[i]->is_container && vfsplugs[i]->is_container (fname)) {
+                task->serial = 1;
+                break;
+            }
+        }
+    }
+
+    mutex_lock (imp->mutex);
+    while (imp->queued >= PLT_IMPORT_QUEUE_SIZE && !imp->abort) {
+        cond_wait_timeout (imp->cond, imp->mutex, PLT_IMPORT_WAIT_MS);
+    }
+    if (imp->abort) {
+        mutex_unlock (imp->mutex);
+        plt_import_task_free (task);
+        return;
+    }
+    if (imp->tail) {
+        imp->tail->next = task;
+    }
+    else {
+        imp->head = task;
+    }
+    imp->tail = task;
+    if (!imp->next_work) {
+        imp->next_work = task;
+    }
+    imp->queued++;
+    cond_broadcast (imp->cond);
+    mutex_unlock (imp->mutex);
+}
+
+// same traversal as plt_insert_dir_int, returns -1 if dirname is not a folder
+static int
+plt_import_walk (plt_importer_t *imp, const char *dirname) {
+    if (!follow_symlinks) {
+        struct stat buf;
+        lstat (dirname, &buf);
+        if (S_ISLNK(buf.st_mode)) {
+            return -1;
+        }
+    }
+    struct dirent **namelist = NULL;
+    int n = scandir (dirname, &namelist, NULL, dirent_alphasort);
+    if (n < 0) {
+        if (namelist) {
+            free (namelist);
+        }
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        // no hidden files
+        if (namelist[i]->d_name[0] != '.' && !imp->abort && !*imp->pabort) {
+            char fullname[PATH_MAX];
+            snprintf (fullname, sizeof (fullname), "%s/%s", dirname, namelist[i]->d_name);
+            if (plt_import_walk (imp, fullname) < 0) {
+                plt_import_enqueue (imp, fullname);
+            }
+        }
+        free (namelist[i]);
+    }
+    free (namelist);
+    return 0;
+}
+
+static void
+plt_import_walker_thread (void *ctx) {
+    plt_importer_t *imp = ctx;
+    int res = plt_import_walk (imp, imp->dirname);
+    mutex_lock (imp->mutex);
+    imp->walker_failed = res < 0;
+    imp->walker_done = 1;
+    cond_broadcast (imp->cond);
+    mutex_unlock (imp->mutex);
+}
+
+// moves the items out of the worker's playlist, which the streamer and the
+// play queue never saw, keeping the references the playlist held
+static void
+plt_import_take_items (playlist_t *plt, plt_import_task_t *task, playItem_t *inserted) {
+    LOCK;
+    if (plt->count[PL_MAIN] > 0) {
+        task->items = malloc (plt->count[PL_MAIN] * sizeof (playItem_t *));
+    }
+    for (playItem_t *it = plt->head[PL_MAIN]; it; ) {
+        playItem_t *next = it->next[PL_MAIN];
+        it->prev[PL_MAIN] = it->next[PL_MAIN] = NULL;
+        it->in_playlist = 0;
+        if (it == inserted) {
+            task->inserted = task->count;
+        }
+        task->items[task->count++] = it;
+        it = next;
+    }
+    plt->head[PL_MAIN] = plt->tail[PL_MAIN] = NULL;
+    plt->count[PL_MAIN] = 0;
+    plt->index_valid[PL_MAIN] = 0;
+    plt->totaltime = 0;
+    UNLOCK;
+}
+
+static void
+plt_import_worker_thread (void *ctx) {
+    plt_importer_t *imp = ctx;
+    playlist_t *plt = plt_alloc ("import");
+
+    mutex_lock (imp->mutex);
+    for (;;) {
+        while (imp->next_work && imp->next_work->serial) {
+            imp->next_work = imp->next_work->next;
+        }
+        plt_import_task_t *task = imp->next_work;
+        if (imp->abort || (!task && imp->walker_done)) {
+            break;
+        }
+        if (!task) {
+            cond_wait_timeout (imp->cond, imp->mutex, PLT_IMPORT_WAIT_MS);
+            continue;
+        }
+        imp->next_work = task->next;
+        task->state = PLT_IMPORT_BUSY;
+        mutex_unlock (imp->mutex);
+
+        const char *fn = strrchr (task->fname, '/');
+        fn = fn ? fn + 1 : task->fname;
+        playItem_t *inserted = plt_insert_file_with_decoders (plt, NULL, task->fname, fn);
+        plt_import_take_items (plt, task, inserted);
+
+        mutex_lock (imp->mutex);
+        task->state = PLT_IMPORT_DONE;
+        cond_broadcast (imp->cond);
+    }
+    mutex_unlock (imp->mutex);
+
+    plt_free (plt);
+}
+
+static playItem_t *
+plt_import_dir (int visibility, playlist_t *playlist, playItem_t *after, const char *dirname, int nthreads, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    if (!strncmp (dirname, "file://", 7)) {
+        dirname += 7;
+    }
+    plt_importer_t imp;
+    memset (&imp, 0, sizeof (imp));
+    imp.mutex = mutex_create_nonrecursive ();
+    imp.cond = cond_create ();
+    imp.dirname = dirname;
+    imp.pabort = pabort;
+
+    intptr_t walker = thread_start (plt_import_walker_thread, &imp);
+    intptr_t workers[nthreads];
+    for (int i = 0; i < nthreads; i++) {
+        workers[i] = thread_start (plt_import_worker_thread, &imp);
+    }
+
+    // commit the results in queue order
+    mutex_lock (imp.mutex);
+    for (;;) {
+        if (*pabort && !imp.abort) {
+            imp.abort = 1;
+            cond_broadcast (imp.cond);
+        }
+        plt_import_task_t *task = imp.head;
+        if (!task) {
+            if (imp.walker_done) {
+                break;
+            }
+            cond_wait_timeout (imp.cond, imp.mutex, PLT_IMPORT_WAIT_MS);
+            continue;
+        }
+        // after an abort, the tasks not taken by the workers are dropped
+        int ready = task->serial || task->state == PLT_IMPORT_DONE || (imp.abort && task->state == PLT_IMPORT_QUEUED);
+        if (!ready) {
+            cond_wait_timeout (imp.cond, imp.mutex, PLT_IMPORT_WAIT_MS);
+            continue;
+        }
+        imp.head = task->next;
+        if (!imp.head) {
+            imp.tail = NULL;
+        }
+        if (imp.next_work == task) {
+            imp.next_work = task->next;
+        }
+        imp.queued--;
+        cond_broadcast (imp.cond);
+        mutex_unlock (imp.mutex);
+
+        if (!imp.abort) {
+            playItem_t *inserted = NULL;
+            if (task->serial) {
+                inserted = plt_insert_file_int (visibility, playlist, after, task->fname, pabort, cb, user_data);
+            }
+            else if (task->count > 0) {
+                playItem_t *prev = after;
+                for (int i = 0; i < task->count; i++) {
+                    prev = plt_insert_item (playlist, prev, task->items[i]);
+                }
+                inserted = task->items[task->inserted >= 0 ? task->inserted : task->count - 1];
+                plt_file_added (visibility, playlist, inserted, pabort, cb, user_data);
+            }
+            if (inserted) {
+                after = inserted;
+            }
+        }
+        plt_import_task_free (task);
+        mutex_lock (imp.mutex);
+    }
+    int failed = imp.walker_failed;
+    mutex_unlock (imp.mutex);
+
+    thread_join (walker);
+    for (int i = 0; i < nthreads; i++) {
+        thread_join (workers[i]);
+    }
+    cond_free (imp.cond);
+    mutex_free (imp.mutex);
+    return failed ? NULL : after;
+}
+
+static playItem_t *
+plt_insert_dir_top (int visibility, playlist_t *playlist, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
     follow_symlinks = conf_get_int ("add_folders_follow_symlinks", 0);
     ignore_archives = conf_get_int ("ignore_archives", 1);
 
-    playItem_t *ret = plt_insert_dir_int (0, playlist, NULL, after, dirname, pabort, cb, user_data);
+    // the workers need the playlist lock, which the caller must not hold
+    int nthreads = conf_get_int ("add_folders_threads", 4);
+    playItem_t *ret;
+    if (nthreads > 1 && !pl_lock_depth) {
+        ret = plt_import_dir (visibility, playlist, after, dirname, min (nthreads, 32), pabort, cb, user_data);
+    }
+    else {
+        ret = plt_insert_dir_int (visibility, playlist, NULL, after, dirname, pabort, cb, user_data);
+    }
 
     ignore_archives = 0;
 
     return ret;
 }
 
+playItem_t *
+plt_insert_dir (playlist_t *playlist, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    return plt_insert_dir_top (0, playlist, after, dirname, pabort, cb, user_data);
+}
+
 static int
 plt_add_file_int (int visibility, playlist_t *plt, const char *fname, int (*cb)(playItem_t *it, void *data), void *user_data) {
     int abort = 0;
@@ -1626,6 +2020,57 @@ pl_add_files_end (void) {
     return plt_add_files_end (addfiles_playlist, 0);
 }
 
+// returns the row of the item if it's within the valid part of the index,
+// -1 otherwise
+static inline int
+plt_index_lookup (playlist_t *playlist, playItem_t *it, int iter) {
+    int row = it->row[iter];
+    if (row >= 0 && row < playlist->index_valid[iter] && playlist->index[iter][row] == it) {
+        return row;
+    }
+    return -1;
+}
+
+void
+plt_index_invalidate (playlist_t *playlist, int iter, int row) {
+    if (row < playlist->index_valid[iter]) {
+        playlist->index_valid[iter] = row;
+    }
+}
+
+// extend the valid part of the index up to and including the given row,
+// walking the linked list from the last known item
+static void
+plt_index_update (playlist_t *playlist, int iter, int upto) {
+    int count = playlist->count[iter];
+    if (upto >= count) {
+        upto = count-1;
+    }
+    int valid = playlist->index_valid[iter];
+    if (upto < valid) {
+        return;
+    }
+    if (playlist->index_size[iter] < count) {
+        int size = playlist->index_size[iter] ? playlist->index_size[iter] : 256;
+        while (size < count) {
+            size *= 2;
+        }
+        playItem_t **index = realloc (playlist->index[iter], size * sizeof (playItem_t *));
+        if (!index) {
+            return;
+        }
+        playlist->index[iter] = index;
+        playlist->index_size[iter] = size;
+    }
+    playItem_t **index = playlist->index[iter];
+    playItem_t *it = valid > 0 ? index[valid-1]->next[iter] : playlist->head[iter];
+    for (; it && valid <= upto; it = it->next[iter], valid++) {
+        index[valid] = it;
+        it->row[iter] = valid;
+    }
+    playlist->index_valid[iter] = valid;
+}
+
 int
 plt_remove_item (playlist_t *playlist, playItem_t *it) {
     if (!it)
@@ -1638,10 +2083,20 @@ plt_remove_item (playlist_t *playlist, playItem_t *it) {
 
     // remove from both lists
     LOCK;
+    if (playlist->search_index) {
+        plt_search_index_remove (playlist->search_index, it);
+    }
     for (int iter = PL_MAIN; iter <= PL_SEARCH; iter++) {
-        if (it->prev[iter] || it->next[iter] || playlist->head[iter] == it || playlist->tail[iter] == it) {
-            playlist->count[iter]--;
+        if (!it->prev[iter] && !it->next[iter] && playlist->head[iter] != it && playlist->tail[iter] != it) {
+            // not in this list
+            continue;
+        }
+        // if the item is in the stale part, the valid part is unaffected
+        int row = plt_index_lookup (playlist, it, iter);
+        if (row >= 0) {
+            plt_index_invalidate (playlist, iter, row);
         }
+        playlist->count[iter]--;
         if (it->prev[iter]) {
             it->prev[iter]->next[iter] = it->next[iter];
         }
@@ -1708,20 +2163,29 @@ pl_getselcount (void) {
     return cnt;
 }
 
+void
+plt_index_update_all (playlist_t *playlist) {
+    LOCK;
+    for (int iter = 0; iter < PL_MAX_ITERATORS; iter++) {
+        plt_index_update (playlist, iter, playlist->count[iter]-1);
+    }
+    UNLOCK;
+}
+
 playItem_t *
 plt_get_item_for_idx (playlist_t *playlist, int idx, int iter) {
     LOCK;
-    playItem_t *it = playlist->head[iter];
-    while (idx--) {
-        if (!it) {
-            UNLOCK;
-            return NULL;
-        }
-        it = it->next[iter];
+    if (idx < 0 || idx >= playlist->count[iter]) {
+        UNLOCK;
+        return NULL;
     }
-    if (it) {
-        pl_item_ref (it);
+    plt_index_update (playlist, iter, idx);
+    if (idx >= playlist->index_valid[iter]) {
+        UNLOCK;
+        return NULL;
     }
+    playItem_t *it = playlist->index[iter][idx];
+    pl_item_ref (it);
     UNLOCK;
     return it;
 }
@@ -1742,15 +2206,10 @@ pl_get_for_idx (int idx) {
 int
 plt_get_item_idx (playlist_t *playlist, playItem_t *it, int iter) {
     LOCK;
-    playItem_t *c = playlist->head[iter];
-    int idx = 0;
-    while (c && c != it) {
-        c = c->next[iter];
-        idx++;
-    }
-    if (!c) {
-        UNLOCK;
-        return -1;
+    int idx = plt_index_lookup (playlist, it, iter);
+    if (idx < 0 && playlist->index_valid[iter] < playlist->count[iter]) {
+        plt_index_update (playlist, iter, playlist->count[iter]-1);
+        idx = plt_index_lookup (playlist, it, iter);
     }
     UNLOCK;
     return idx;
@@ -1773,6 +2232,17 @@ playItem_t *
 plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
     LOCK;
     pl_item_ref (it);
+    pl_meta_add_size_sample (it);
+    if (!after) {
+        plt_index_invalidate (playlist, PL_MAIN, 0);
+    }
+    else {
+        // if 'after' is in the stale part, the new row is stale already
+        int row = plt_index_lookup (playlist, after, PL_MAIN);
+        if (row >= 0) {
+            plt_index_invalidate (playlist, PL_MAIN, row+1);
+        }
+    }
     if (!after) {
         it->next[PL_MAIN] = playlist->head[PL_MAIN];
         it->prev[PL_MAIN] = NULL;
@@ -1798,11 +2268,16 @@ plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
     it->in_playlist = 1;
 
     playlist->count[PL_MAIN]++;
+    if (playlist->search_index) {
+        plt_search_index_insert (playlist->search_index, it);
+    }
 
     // shuffle
     playItem_t *prev = it->prev[PL_MAIN];
     const char *aa = NULL, *prev_aa = NULL;
-    if (prev) {
+    // the metadata is only needed to keep albums together, and isn't
+    // decoded otherwise, for items loaded from DBPL 2.1
+    if (prev && pl_order == PLAYBACK_ORDER_SHUFFLE_ALBUMS) {
         aa = pl_find_meta_raw (it, "band");
         if (!aa) {
             aa = pl_find_meta_raw (it, "album artist");
@@ -1856,7 +2331,7 @@ pl_item_copy (playItem_t *out, playItem_t *it) {
     out->prev[PL_SEARCH] = it->prev[PL_SEARCH];
     out->_refc = 1;
 
-    for (DB_metaInfo_t *meta = it->meta; meta; meta = meta->next) {
+    for (DB_metaInfo_t *meta = pl_get_metadata_head (it); meta; meta = meta->next) {
         pl_add_meta_copy (out, meta);
     }
     UNLOCK;
@@ -1881,22 +2356,18 @@ pl_item_alloc_init (const char *fname, const char *decoder_id) {
 
 void
 pl_item_ref (playItem_t *it) {
-    LOCK;
-    it->_refc++;
+    __sync_add_and_fetch (&it->_refc, 1);
     //fprintf (stderr, "\033[0;34m+it %p: refc=%d: %s\033[37;0m\n", it, it->_refc, pl_find_meta_raw (it, ":URI"));
-    UNLOCK;
 }
 
 static void
 pl_item_free (playItem_t *it) {
     LOCK;
     if (it) {
-        while (it->meta) {
-            pl_meta_free_values (it->meta);
-            DB_metaInfo_t *m = it->meta;
-            it->meta = m->next;
-            free (m);
+        if (it->dbpl) {
+            dbpl_file_unref (it->dbpl);
         }
+        pl_item_free_meta (it);
         free (it);
     }
     UNLOCK;
@@ -1905,12 +2376,12 @@ pl_item_free (playItem_t *it) {
 void
 pl_item_unref (playItem_t *it) {
     LOCK;
-    it->_refc--;
+    int refc = __sync_sub_and_fetch (&it->_refc, 1);
     //trace ("\033[0;31m-it %p: refc=%d: %s\033[37;0m\n", it, it->_refc, pl_find_meta_raw (it, ":URI"));
-    if (it->_refc < 0) {
+    if (refc < 0) {
         trace ("\033[0;31mplaylist: bad refcount on item %p\033[37;0m\n", it);
     }
-    if (it->_refc <= 0) {
+    if (refc <= 0) {
         //printf ("\033[0;31mdeleted %s\033[37;0m\n", pl_find_meta_raw (it, ":URI"));
         pl_item_free (it);
     }
@@ -1970,52 +2441,330 @@ pl_crop_selected (void) {
     UNLOCK;
 }
 
-// FIXME: multivalue support
-int
-plt_save (playlist_t *plt, playItem_t *first, playItem_t *last, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
-    LOCK;
-    plt->last_save_modification_idx = plt->last_save_modification_idx;
-    const char *ext = strrchr (fname, '.');
-    if (ext) {
-        DB_playlist_t **plug = deadbeef->plug_get_playlist_list ();
-        for (int i = 0; plug[i]; i++) {
-            if (plug[i]->extensions && plug[i]->load) {
-                const char **exts = plug[i]->extensions;
-                if (exts && plug[i]->save) {
-                    for (int e = 0; exts[e]; e++) {
-                        if (!strcasecmp (exts[e], ext+1)) {
-                            int res = plug[i]->save ((ddb_playlist_t *)plt, fname, (DB_playItem_t *)playlist->head[PL_MAIN], NULL);
-                            UNLOCK;
-                            return res;
-                        }
-                    }
-                }
+// DBPL 2.x is laid out to be mapped into memory and read in place, instead of
+// being parsed field by field. Numbers are stored in host byte order, as in
+// 1.x.
+//
+// 2.0, which is still loaded, but not written: the header is followed by
+// arrays of fixed-size records for the items, the metadata entries of all
+// items, the playlist metadata, and the distinct strings, which point into
+// the string pool at the end of the file. Metadata entries refer to strings
+// by index.
+//
+// 2.1: item records and metadata entries refer to their data by file offset.
+// A string is stored as its size (including the terminating 0, multivalue
+// fields have more), followed by its bytes, padded to 4 bytes. Equal strings
+// are stored once per save.
+// When the playlist is saved again, the metadata of new and modified items
+// is appended to the file, and the item records are patched in place, or
+// appended when items were added, removed or moved. The file is rewritten
+// only when most of it is replaced data. Data is never overwritten, only the
+// header and item records are, so the metadata of items which weren't
+// decoded yet stays valid in the mapped file.
+typedef struct {
+    char magic[4];
+    uint8_t majorver;
+    uint8_t minorver;
+    uint16_t header_size;
+    uint32_t count;
+    uint32_t items_offset;
+    uint32_t plt_meta_count;
+    uint32_t plt_meta_offset;
+    uint32_t meta_written; // entries written to the file, including replaced ones
+} dbpl_header_t;
+
+typedef struct {
+    int32_t startsample;
+    int32_t endsample;
+    float duration;
+    uint32_t flags;
+    uint32_t meta_offset; // of the first metadata entry
+    uint32_t meta_count;
+} dbpl_item_t;
+
+typedef struct {
+    uint32_t key; // 2.0: string indexes, 2.1: file offsets of the strings
+    uint32_t value;
+} dbpl_meta_t;
+
+typedef struct {
+    char magic[4];
+    uint8_t majorver;
+    uint8_t minorver;
+    uint16_t header_size;
+    uint32_t count;
+    uint32_t items_offset;
+    uint32_t meta_count;
+    uint32_t meta_offset;
+    uint32_t plt_meta_count;
+    uint32_t plt_meta_offset;
+    uint32_t strings_count;
+    uint32_t strings_offset;
+    uint32_t pool_size;
+    uint32_t pool_offset;
+} dbpl20_header_t;
+
+typedef struct {
+    int32_t startsample;
+    int32_t endsample;
+    float duration;
+    uint32_t flags;
+    uint32_t meta_first; // index of the first entry in the metadata table
+    uint32_t meta_count;
+} dbpl20_item_t;
+
+typedef struct {
+    uint32_t offset; // in the pool
+    uint32_t size; // including the terminating 0, multivalue fields have more
+} dbpl20_string_t;
+
+// A mapped DBPL 2.1 file. It's referenced by the playlist which was loaded
+// from or last saved to it, and by the items whose metadata it has, see
+// playItem_t::dbpl. The file is mapped shared and read only. It must not be
+// truncated by anything else while it's mapped.
+struct dbpl_file_s {
+    int refc;
+    const uint8_t *data;
+    size_t size;
+    char *fname;
+    dev_t dev;
+    ino_t ino;
+};
+
+typedef struct dbpl_file_s dbpl_file_t;
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} dbpl_buffer_t;
+
+// Builds the data appended to a 2.1 file, or the whole file after the
+// header: the item records, if any, then the metadata entries, then the
+// strings. Offsets are relative to the start of the entries and strings
+// while building, see dbpl_writer_finish.
+typedef struct {
+    uint32_t base; // file offset of the data
+    dbpl_file_t *file; // which the data is appended to, NULL for a new file
+    dbpl_buffer_t items;
+    dbpl_buffer_t meta;
+    dbpl_buffer_t pool;
+    // maps the metacache pointers of keys and values to string offsets,
+    // since equal strings share one pointer
+    const char **hash_ptrs;
+    uint32_t *hash_offsets;
+    uint32_t hash_count;
+    uint32_t hash_size; // power of 2
+} dbpl_writer_t;
+
+static void *
+dbpl_buffer_append (dbpl_buffer_t *b, size_t size) {
+    if (b->size + size > b->capacity) {
+        size_t capacity = b->capacity ? b->capacity * 2 : 4096;
+        while (capacity < b->size + size) {
+            capacity *= 2;
+        }
+        char *data = realloc (b->data, capacity);
+        if (!data) {
+            return NULL;
+        }
+        b->data = data;
+        b->capacity = capacity;
+    }
+    void *res = b->data + b->size;
+    b->size += size;
+    return res;
+}
+
+static void
+dbpl_writer_free (dbpl_writer_t *w) {
+    free (w->items.data);
+    free (w->meta.data);
+    free (w->pool.data);
+    free (w->hash_ptrs);
+    free (w->hash_offsets);
+}
+
+static inline uint32_t
+dbpl_ptr_hash (const char *ptr) {
+    uintptr_t p = (uintptr_t)ptr;
+    return (uint32_t)((p >> 3) * 2654435761u);
+}
+
+static int
+dbpl_writer_grow_hash (dbpl_writer_t *w) {
+    uint32_t size = w->hash_size ? w->hash_size * 2 : 1024;
+    const char **ptrs = calloc (size, sizeof (const char *));
+    uint32_t *offsets = malloc (size * sizeof (uint32_t));
+    if (!ptrs || !offsets) {
+        free (ptrs);
+        free (offsets);
+        return -1;
+    }
+    for (uint32_t i = 0; i < w->hash_size; i++) {
+        if (w->hash_ptrs[i]) {
+            uint32_t n = dbpl_ptr_hash (w->hash_ptrs[i]) & (size - 1);
+            while (ptrs[n]) {
+                n = (n + 1) & (size - 1);
             }
+            ptrs[n] = w->hash_ptrs[i];
+            offsets[n] = w->hash_offsets[i];
         }
     }
+    free (w->hash_ptrs);
+    free (w->hash_offsets);
+    w->hash_ptrs = ptrs;
+    w->hash_offsets = offsets;
+    w->hash_size = size;
+    return 0;
+}
 
-    char tempfile[PATH_MAX];
-    snprintf (tempfile, sizeof (tempfile), "%s.tmp", fname);
+// returns the offset of the string in the pool, adding it on first use
+static int64_t
+dbpl_writer_add_string (dbpl_writer_t *w, const char *str, uint32_t size) {
+    // keep load factor under 1/2
+    if ((w->hash_count + 1) * 2 > w->hash_size && dbpl_writer_grow_hash (w) < 0) {
+        return -1;
+    }
+    uint32_t mask = w->hash_size - 1;
+    uint32_t n = dbpl_ptr_hash (str) & mask;
+    while (w->hash_ptrs[n]) {
+        if (w->hash_ptrs[n] == str) {
+            return w->hash_offsets[n];
+        }
+        n = (n + 1) & mask;
+    }
+
+    uint32_t offset = (uint32_t)w->pool.size;
+    uint32_t padded = (size + 3) & ~3;
+    char *data = dbpl_buffer_append (&w->pool, sizeof (uint32_t) + padded);
+    if (!data) {
+        return -1;
+    }
+    memcpy (data, &size, sizeof (uint32_t));
+    memcpy (data + sizeof (uint32_t), str, size);
+    memset (data + sizeof (uint32_t) + size, 0, padded - size);
+    w->hash_ptrs[n] = str;
+    w->hash_offsets[n] = offset;
+    w->hash_count++;
+    return offset;
+}
+
+static int
+dbpl_writer_add_meta (dbpl_writer_t *w, const char *key, uint32_t keysize, const char *value, uint32_t valuesize) {
+    int64_t k = dbpl_writer_add_string (w, key, keysize);
+    int64_t v = dbpl_writer_add_string (w, value, valuesize);
+    dbpl_meta_t *m = dbpl_buffer_append (&w->meta, sizeof (dbpl_meta_t));
+    if (k < 0 || v < 0 || !m) {
+        return -1;
+    }
+    m->key = (uint32_t)k;
+    m->value = (uint32_t)v;
+    return 0;
+}
+
+// finds a string in a mapped 2.1 file; keys must not be multivalue
+static const char *
+dbpl_file_get_string (const dbpl_file_t *f, uint32_t offset, uint32_t *size, int is_key) {
+    if ((offset & 3) || (uint64_t)offset + sizeof (uint32_t) > f->size) {
+        return NULL;
+    }
+    memcpy (size, f->data + offset, sizeof (uint32_t));
+    const char *str = (const char *)f->data + offset + sizeof (uint32_t);
+    if (*size == 0 || (uint64_t)offset + sizeof (uint32_t) + *size > f->size || str[*size - 1]) {
+        return NULL;
+    }
+    if (is_key && strlen (str) + 1 != *size) {
+        return NULL;
+    }
+    return str;
+}
+
+// Writes the metadata of the item, unless the file which is appended to has
+// it already, and fills the record. The meta_offset of the record is relative
+// to the entries, if they were written.
+static int
+dbpl_writer_add_item (dbpl_writer_t *w, playItem_t *it, dbpl_item_t *rec, int *written) {
+    rec->startsample = it->startsample;
+    rec->endsample = it->endsample;
+    rec->duration = it->_duration;
+    rec->flags = it->_flags;
+    if (w->file && it->dbpl == w->file) {
+        rec->meta_offset = it->dbpl_meta_offset;
+        rec->meta_count = it->dbpl_meta_count;
+        *written = 0;
+        return 0;
+    }
+    *written = 1;
+    rec->meta_offset = (uint32_t)w->meta.size;
+    rec->meta_count = 0;
+    if (it->meta_lazy) {
+        // copy from the file it was loaded from, without decoding
+        const dbpl_file_t *f = it->dbpl;
+        const dbpl_meta_t *meta = (const dbpl_meta_t *)(f->data + it->dbpl_meta_offset);
+        for (uint32_t i = 0; i < it->dbpl_meta_count; i++) {
+            uint32_t keysize, valuesize;
+            const char *key = dbpl_file_get_string (f, meta[i].key, &keysize, 1);
+            const char *value = dbpl_file_get_string (f, meta[i].value, &valuesize, 0);
+            if (!key || !value) {
+                continue;
+            }
+            if (dbpl_writer_add_meta (w, key, keysize, value, valuesize) < 0) {
+                return -1;
+            }
+            rec->meta_count++;
+        }
+        return 0;
+    }
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        if (m->key[0] == '_' || m->key[0] == '!' || !m->value) {
+            continue; // skip reserved names
+        }
+        if (dbpl_writer_add_meta (w, m->key, (uint32_t)strlen (m->key) + 1, m->value, m->valuesize) < 0) {
+            return -1;
+        }
+        rec->meta_count++;
+    }
+    return 0;
+}
+
+// Converts the offsets of the written entries and strings to file offsets.
+// written[i] tells whether the entries of the item i were written.
+static void
+dbpl_writer_finish (dbpl_writer_t *w, dbpl_item_t *recs, const char *written, uint32_t count) {
+    uint32_t meta_base = w->base + (uint32_t)w->items.size;
+    uint32_t pool_base = meta_base + (uint32_t)w->meta.size;
+    dbpl_meta_t *meta = (dbpl_meta_t *)w->meta.data;
+    for (size_t i = 0; i < w->meta.size / sizeof (dbpl_meta_t); i++) {
+        meta[i].key += pool_base;
+        meta[i].value += pool_base;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (written[i]) {
+            recs[i].meta_offset += meta_base;
+        }
+    }
+}
+
+// FIXME: multivalue support
+// writes the playlist in DBPL 1.2 format
+static int
+plt_save_dbpl1 (playlist_t *plt, FILE *fp, int (*cb)(playItem_t *it, void *data), void *user_data) {
     const char magic[] = "DBPL";
     uint8_t majorver = PLAYLIST_MAJOR_VER;
     uint8_t minorver = PLAYLIST_MINOR_VER;
-    FILE *fp = fopen (tempfile, "w+b");
-    if (!fp) {
-        UNLOCK;
-        return -1;
-    }
     if (fwrite (magic, 1, 4, fp) != 4) {
-        goto save_fail;
+        return -1;
     }
     if (fwrite (&majorver, 1, 1, fp) != 1) {
-        goto save_fail;
+        return -1;
     }
     if (fwrite (&minorver, 1, 1, fp) != 1) {
-        goto save_fail;
+        return -1;
     }
     uint32_t cnt = plt->count[PL_MAIN];
     if (fwrite (&cnt, 1, 4, fp) != 4) {
-        goto save_fail;
+        return -1;
     }
     for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
         uint16_t l;
@@ -2027,41 +2776,41 @@ plt_save (playlist_t *plt, playItem_t *first, playItem_t *last, const char *fnam
         const char *fname = pl_find_meta_raw (it, ":URI");
         l = strlen (fname);
         if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
+            return -1;
         }
         if (fwrite (fname, 1, l, fp) != l) {
-            goto save_fail;
+            return -1;
         }
         const char *decoder_id = pl_find_meta_raw (it, ":DECODER");
         if (decoder_id) {
             ll = strlen (decoder_id);
             if (fwrite (&ll, 1, 1, fp) != 1) {
-                goto save_fail;
+                return -1;
             }
             if (fwrite (decoder_id, 1, ll, fp) != ll) {
-                goto save_fail;
+                return -1;
             }
         }
         else
         {
             ll = 0;
             if (fwrite (&ll, 1, 1, fp) != 1) {
-                goto save_fail;
+                return -1;
             }
         }
         l = pl_find_meta_int (it, ":TRACKNUM", 0);
         if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
+            return -1;
         }
 #endif
         if (fwrite (&it->startsample, 1, 4, fp) != 4) {
-            goto save_fail;
+            return -1;
         }
         if (fwrite (&it->endsample, 1, 4, fp) != 4) {
-            goto save_fail;
+            return -1;
         }
         if (fwrite (&it->_duration, 1, 4, fp) != 4) {
-            goto save_fail;
+            return -1;
         }
 #if (PLAYLIST_MINOR_VER==2)
         const char *filetype = pl_find_meta_raw (it, ":FILETYPE");
@@ -2070,11 +2819,11 @@ plt_save (playlist_t *plt, playItem_t *first, playItem_t *last, const char *fnam
         }
         uint8_t ft = strlen (filetype);
         if (fwrite (&ft, 1, 1, fp) != 1) {
-            goto save_fail;
+            return -1;
         }
         if (ft) {
             if (fwrite (filetype, 1, ft, fp) != ft) {
-                goto save_fail;
+                return -1;
             }
         }
         float rg_albumgain = pl_get_item_replaygain (it, DDB_REPLAYGAIN_ALBUMGAIN);
@@ -2082,103 +2831,538 @@ plt_save (playlist_t *plt, playItem_t *first, playItem_t *last, const char *fnam
         float rg_trackgain = pl_get_item_replaygain (it, DDB_REPLAYGAIN_TRACKGAIN);
         float rg_trackpeak = pl_get_item_replaygain (it, DDB_REPLAYGAIN_TRACKPEAK);
         if (fwrite (&rg_albumgain, 1, 4, fp) != 4) {
-            goto save_fail;
+            return -1;
         }
         if (fwrite (&rg_albumpeak, 1, 4, fp) != 4) {
-            goto save_fail;
+            return -1;
         }
         if (fwrite (&rg_trackgain, 1, 4, fp) != 4) {
-            goto save_fail;
+            return -1;
         }
         if (fwrite (&rg_trackpeak, 1, 4, fp) != 4) {
-            goto save_fail;
+            return -1;
         }
 #endif
         if (fwrite (&it->_flags, 1, 4, fp) != 4) {
-            goto save_fail;
+            return -1;
         }
 
         int16_t nm = 0;
         DB_metaInfo_t *m;
-        for (m = it->meta; m; m = m->next) {
+        for (m = pl_get_metadata_head (it); m; m = m->next) {
             if (m->key[0] == '_' || m->key[0] == '!') {
                 continue; // skip reserved names
             }
             nm++;
         }
         if (fwrite (&nm, 1, 2, fp) != 2) {
-            goto save_fail;
+            return -1;
         }
         for (m = it->meta; m; m = m->next) {
             if (m->key[0] == '_' || m->key[0] == '!') {
                 continue; // skip reserved names
             }
 
-            l = strlen (m->key);
-            if (fwrite (&l, 1, 2, fp) != 2) {
-                goto save_fail;
-            }
-            if (l) {
-                if (fwrite (m->key, 1, l, fp) != l) {
-                    goto save_fail;
-                }
+            l = strlen (m->key);
+            if (fwrite (&l, 1, 2, fp) != 2) {
+                return -1;
+            }
+            if (l) {
+                if (fwrite (m->key, 1, l, fp) != l) {
+                    return -1;
+                }
+            }
+            l = m->valuesize-1;
+            if (fwrite (&l, 1, 2, fp) != 2) {
+                return -1;
+            }
+            if (l) {
+                if (fwrite (m->value, 1, l, fp) != l) {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    // write playlist metadata
+    int16_t nm = 0;
+    DB_metaInfo_t *m;
+    for (m = plt->meta; m; m = m->next) {
+        nm++;
+    }
+    if (fwrite (&nm, 1, 2, fp) != 2) {
+        return -1;
+    }
+
+    for (m = plt->meta; m; m = m->next) {
+        uint16_t l;
+        l = strlen (m->key);
+        if (fwrite (&l, 1, 2, fp) != 2) {
+            return -1;
+        }
+        if (l) {
+            if (fwrite (m->key, 1, l, fp) != l) {
+                return -1;
+            }
+        }
+        l = strlen (m->value);
+        if (fwrite (&l, 1, 2, fp) != 2) {
+            return -1;
+        }
+        if (l) {
+            if (fwrite (m->value, 1, l, fp) != l) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void
+dbpl_file_unref (dbpl_file_t *f) {
+    if (--f->refc > 0) {
+        return;
+    }
+    munmap ((void *)f->data, f->size);
+    free (f->fname);
+    free (f);
+}
+
+// maps a 2.1 file, and checks the header and the ranges of all records;
+// strings are checked when they're read
+static dbpl_file_t *
+dbpl_file_open (const char *fname) {
+    int fd = open (fname, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat (fd, &st) != 0 || st.st_size < sizeof (dbpl_header_t) || st.st_size > UINT32_MAX) {
+        close (fd);
+        return NULL;
+    }
+    void *data = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    size_t size = st.st_size;
+    const dbpl_header_t *hdr = data;
+    int valid = !memcmp (hdr->magic, "DBPL", 4)
+        && hdr->majorver == PLAYLIST_DBPL2_MAJOR_VER
+        && hdr->minorver >= PLAYLIST_DBPL2_MINOR_VER
+        && hdr->header_size >= sizeof (dbpl_header_t) && hdr->header_size <= size
+        && (hdr->items_offset & 3) == 0
+        && (uint64_t)hdr->items_offset + (uint64_t)hdr->count * sizeof (dbpl_item_t) <= size
+        && (hdr->plt_meta_offset & 3) == 0
+        && (uint64_t)hdr->plt_meta_offset + (uint64_t)hdr->plt_meta_count * sizeof (dbpl_meta_t) <= size;
+    const dbpl_item_t *items = (const dbpl_item_t *)((const uint8_t *)data + hdr->items_offset);
+    for (uint32_t i = 0; valid && i < hdr->count; i++) {
+        valid = (items[i].meta_offset & 3) == 0
+            && (uint64_t)items[i].meta_offset + (uint64_t)items[i].meta_count * sizeof (dbpl_meta_t) <= size;
+    }
+    dbpl_file_t *f = valid ? calloc (1, sizeof (dbpl_file_t)) : NULL;
+    if (!f) {
+        munmap (data, size);
+        return NULL;
+    }
+    f->refc = 1;
+    f->data = data;
+    f->size = size;
+    f->fname = strdup (fname);
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    return f;
+}
+
+void
+pl_item_load_meta (playItem_t *it) {
+    LOCK;
+    if (!it->meta_lazy) {
+        UNLOCK;
+        return;
+    }
+    it->meta_lazy = 0;
+    const dbpl_file_t *f = it->dbpl;
+    const dbpl_meta_t *meta = (const dbpl_meta_t *)(f->data + it->dbpl_meta_offset);
+    for (uint32_t i = 0; i < it->dbpl_meta_count; i++) {
+        uint32_t keysize, valuesize;
+        const char *key = dbpl_file_get_string (f, meta[i].key, &keysize, 1);
+        const char *value = dbpl_file_get_string (f, meta[i].value, &valuesize, 0);
+        if (!key || !value || !*value) {
+            continue;
+        }
+        uint32_t atom = metacache_key_atom (key);
+        key = metacache_add_value (key, keysize);
+        value = metacache_add_value (value, valuesize);
+        if (pl_add_meta_interned (it, atom, key, value, valuesize) < 0) {
+            metacache_remove_value (key, keysize);
+            metacache_remove_value (value, valuesize);
+        }
+    }
+    UNLOCK;
+}
+
+void
+pl_item_unlink_dbpl (playItem_t *it) {
+    if (!it->dbpl) {
+        return;
+    }
+    LOCK;
+    pl_item_load_meta (it);
+    if (it->dbpl) {
+        dbpl_file_unref (it->dbpl);
+        it->dbpl = NULL;
+    }
+    UNLOCK;
+}
+
+// the items of the playlist have their metadata in f, at the offsets in
+// recs; takes over the reference to f
+static void
+plt_attach_dbpl (playlist_t *plt, dbpl_file_t *f, const dbpl_item_t *recs) {
+    uint32_t i = 0;
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN], i++) {
+        // items which weren't decoded yet read the same entries from f
+        f->refc++;
+        if (it->dbpl) {
+            dbpl_file_unref (it->dbpl);
+        }
+        it->dbpl = f;
+        it->dbpl_meta_offset = recs[i].meta_offset;
+        it->dbpl_meta_count = recs[i].meta_count;
+    }
+    if (plt->dbpl) {
+        dbpl_file_unref (plt->dbpl);
+    }
+    plt->dbpl = f;
+}
+
+// checks whether the playlist metadata in the file is the same as in memory
+static int
+dbpl_file_plt_meta_equal (const dbpl_file_t *f, playlist_t *plt) {
+    const dbpl_header_t *hdr = (const dbpl_header_t *)f->data;
+    const dbpl_meta_t *meta = (const dbpl_meta_t *)(f->data + hdr->plt_meta_offset);
+    uint32_t i = 0;
+    for (DB_metaInfo_t *m = plt->meta; m; m = m->next, i++) {
+        uint32_t keysize, valuesize;
+        if (i >= hdr->plt_meta_count) {
+            return 0;
+        }
+        const char *key = dbpl_file_get_string (f, meta[i].key, &keysize, 1);
+        const char *value = dbpl_file_get_string (f, meta[i].value, &valuesize, 1);
+        if (!key || !value || strcmp (key, m->key) || strcmp (value, m->value)) {
+            return 0;
+        }
+    }
+    return i == hdr->plt_meta_count;
+}
+
+// Adds the records of all items, and the metadata which needs to be written.
+// Returns the number of entries of the items, or -1 on error.
+static int64_t
+dbpl_writer_add_items (dbpl_writer_t *w, playlist_t *plt, dbpl_item_t *recs, char *written, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    int64_t entries = 0;
+    uint32_t i = 0;
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN], i++) {
+        if (cb) {
+            cb(it, user_data);
+        }
+        int wr;
+        if (dbpl_writer_add_item (w, it, &recs[i], &wr) < 0) {
+            return -1;
+        }
+        written[i] = wr;
+        entries += recs[i].meta_count;
+    }
+    return entries;
+}
+
+// returns the offset of the playlist metadata relative to the entries
+static int64_t
+dbpl_writer_add_plt_meta (dbpl_writer_t *w, playlist_t *plt, uint32_t *count) {
+    int64_t offset = w->meta.size;
+    *count = 0;
+    for (DB_metaInfo_t *m = plt->meta; m; m = m->next) {
+        if (dbpl_writer_add_meta (w, m->key, (uint32_t)strlen (m->key) + 1, m->value, (uint32_t)strlen (m->value) + 1) < 0) {
+            return -1;
+        }
+        (*count)++;
+    }
+    return offset;
+}
+
+static int
+dbpl_pwrite (int fd, const void *data, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t res = pwrite (fd, data, size, offset);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            return -1;
+        }
+        data = (const char *)data + res;
+        size -= res;
+        offset += res;
+    }
+    return 0;
+}
+
+// Writes the whole playlist to a new file, which then replaces fname.
+static int
+plt_save_dbpl2 (playlist_t *plt, const char *fname, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    int res = -1;
+    uint32_t count = plt->count[PL_MAIN];
+    dbpl_item_t *recs = malloc (count * sizeof (dbpl_item_t) + 1);
+    char *written = malloc (count + 1);
+    dbpl_writer_t w;
+    memset (&w, 0, sizeof (w));
+    w.base = sizeof (dbpl_header_t);
+    FILE *fp = NULL;
+    char tempfile[PATH_MAX];
+    snprintf (tempfile, sizeof (tempfile), "%s.tmp", fname);
+
+    uint32_t plt_meta_count;
+    int64_t plt_meta_offset;
+    if (!recs || !written
+        || dbpl_writer_add_items (&w, plt, recs, written, cb, user_data) < 0
+        || (plt_meta_offset = dbpl_writer_add_plt_meta (&w, plt, &plt_meta_count)) < 0
+        || !dbpl_buffer_append (&w.items, count * sizeof (dbpl_item_t))
+        || (uint64_t)w.base + w.items.size + w.meta.size + w.pool.size > UINT32_MAX) {
+        goto out;
+    }
+    dbpl_writer_finish (&w, recs, written, count);
+    memcpy (w.items.data, recs, count * sizeof (dbpl_item_t));
+
+    dbpl_header_t hdr;
+    memset (&hdr, 0, sizeof (hdr));
+    memcpy (hdr.magic, "DBPL", 4);
+    hdr.majorver = PLAYLIST_DBPL2_MAJOR_VER;
+    hdr.minorver = PLAYLIST_DBPL2_MINOR_VER;
+    hdr.header_size = sizeof (dbpl_header_t);
+    hdr.count = count;
+    hdr.items_offset = w.base;
+    hdr.plt_meta_count = plt_meta_count;
+    hdr.plt_meta_offset = w.base + (uint32_t)(w.items.size + plt_meta_offset);
+    hdr.meta_written = (uint32_t)(w.meta.size / sizeof (dbpl_meta_t));
+
+    fp = fopen (tempfile, "w+b");
+    if (!fp) {
+        goto out;
+    }
+    int err = fwrite (&hdr, 1, sizeof (hdr), fp) != sizeof (hdr)
+        || fwrite (w.items.data, 1, w.items.size, fp) != w.items.size
+        || fwrite (w.meta.data, 1, w.meta.size, fp) != w.meta.size
+        || fwrite (w.pool.data, 1, w.pool.size, fp) != w.pool.size;
+    if (fclose (fp) != 0 || err) {
+        unlink (tempfile);
+        goto out;
+    }
+    if (rename (tempfile, fname) != 0) {
+        fprintf (stderr, "playlist rename %s -> %s failed: %s\n", tempfile, fname, strerror (errno));
+        goto out;
+    }
+    res = 0;
+
+    // the next save appends to the new file
+    dbpl_file_t *f = dbpl_file_open (fname);
+    if (f) {
+        plt_attach_dbpl (plt, f, recs);
+    }
+out:
+    dbpl_writer_free (&w);
+    free (recs);
+    free (written);
+    return res;
+}
+
+// Updates the file the playlist was loaded from or saved to: the metadata of
+// items which the file doesn't have is appended, then the item records are
+// patched, or appended along with the header if the items changed, so a crash
+// leaves either the old or the new record of each item.
+// Returns 1 if the file needs to be rewritten instead.
+static int
+plt_save_dbpl2_update (playlist_t *plt, dbpl_file_t *f, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    int fd = open (f->fname, O_RDWR);
+    if (fd < 0) {
+        return 1;
+    }
+    struct stat st;
+    if (fstat (fd, &st) != 0 || st.st_dev != f->dev || st.st_ino != f->ino || st.st_size != f->size) {
+        // replaced by something else
+        close (fd);
+        return 1;
+    }
+
+    int res = -1;
+    const dbpl_header_t *old = (const dbpl_header_t *)f->data;
+    uint32_t count = plt->count[PL_MAIN];
+    dbpl_item_t *recs = malloc (count * sizeof (dbpl_item_t) + 1);
+    char *written = malloc (count + 1);
+    dbpl_writer_t w;
+    memset (&w, 0, sizeof (w));
+    w.file = f;
+    w.base = (uint32_t)((f->size + 3) & ~3);
+
+    dbpl_header_t hdr = *old;
+    int64_t entries;
+    if (!recs || !written
+        || (entries = dbpl_writer_add_items (&w, plt, recs, written, cb, user_data)) < 0) {
+        goto out;
+    }
+    int64_t plt_meta_offset = -1;
+    if (!dbpl_file_plt_meta_equal (f, plt)) {
+        plt_meta_offset = dbpl_writer_add_plt_meta (&w, plt, &hdr.plt_meta_count);
+        if (plt_meta_offset < 0) {
+            goto out;
+        }
+    }
+    entries += hdr.plt_meta_count;
+    uint64_t meta_written = (uint64_t)old->meta_written + w.meta.size / sizeof (dbpl_meta_t);
+
+    // rewrite once most of the file is replaced data
+    int patch = old->count == count;
+    if (meta_written > (uint64_t)entries * 2 + 1024
+        || (!patch && !dbpl_buffer_append (&w.items, count * sizeof (dbpl_item_t)))
+        || (uint64_t)w.base + w.items.size + w.meta.size + w.pool.size > UINT32_MAX) {
+        res = 1;
+        goto out;
+    }
+    dbpl_writer_finish (&w, recs, written, count);
+
+    uint32_t offset = w.base;
+    if (!patch) {
+        memcpy (w.items.data, recs, count * sizeof (dbpl_item_t));
+        hdr.items_offset = offset;
+    }
+    offset += (uint32_t)w.items.size;
+    if (plt_meta_offset >= 0) {
+        hdr.plt_meta_offset = offset + (uint32_t)plt_meta_offset;
+    }
+    hdr.count = count;
+    hdr.meta_written = (uint32_t)meta_written;
+
+    static const char zeros[4];
+    if (dbpl_pwrite (fd, zeros, w.base - f->size, f->size) < 0
+        || dbpl_pwrite (fd, w.items.data, w.items.size, w.base) < 0
+        || dbpl_pwrite (fd, w.meta.data, w.meta.size, offset) < 0
+        || dbpl_pwrite (fd, w.pool.data, w.pool.size, offset + w.meta.size) < 0
+        || fsync (fd) != 0) {
+        goto out;
+    }
+    if (patch) {
+        // write the runs of changed records
+        const dbpl_item_t *items = (const dbpl_item_t *)(f->data + old->items_offset);
+        for (uint32_t i = 0; i < count; ) {
+            if (!memcmp (&recs[i], &items[i], sizeof (dbpl_item_t))) {
+                i++;
+                continue;
             }
-            l = m->valuesize-1;
-            if (fwrite (&l, 1, 2, fp) != 2) {
-                goto save_fail;
+            uint32_t n = 1;
+            while (i + n < count && memcmp (&recs[i+n], &items[i+n], sizeof (dbpl_item_t))) {
+                n++;
             }
-            if (l) {
-                if (fwrite (m->value, 1, l, fp) != l) {
-                    goto save_fail;
-                }
+            if (dbpl_pwrite (fd, &recs[i], n * sizeof (dbpl_item_t), old->items_offset + i * sizeof (dbpl_item_t)) < 0) {
+                goto out;
             }
+            i += n;
         }
     }
-
-    // write playlist metadata
-    int16_t nm = 0;
-    DB_metaInfo_t *m;
-    for (m = plt->meta; m; m = m->next) {
-        nm++;
+    if (dbpl_pwrite (fd, &hdr, sizeof (hdr), 0) < 0 || fsync (fd) != 0) {
+        goto out;
     }
-    if (fwrite (&nm, 1, 2, fp) != 2) {
-        goto save_fail;
+    res = 0;
+
+    // map the appended data too
+    dbpl_file_t *nf = dbpl_file_open (f->fname);
+    if (nf) {
+        plt_attach_dbpl (plt, nf, recs);
     }
+out:
+    close (fd);
+    dbpl_writer_free (&w);
+    free (recs);
+    free (written);
+    return res;
+}
 
-    for (m = plt->meta; m; m = m->next) {
-        uint16_t l;
-        l = strlen (m->key);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-        if (l) {
-            if (fwrite (m->key, 1, l, fp) != l) {
-                goto save_fail;
+int
+plt_save (playlist_t *plt, playItem_t *first, playItem_t *last, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    LOCK;
+    const char *ext = strrchr (fname, '.');
+    if (ext) {
+        DB_playlist_t **plug = deadbeef->plug_get_playlist_list ();
+        for (int i = 0; plug[i]; i++) {
+            if (plug[i]->extensions && plug[i]->load) {
+                const char **exts = plug[i]->extensions;
+                if (exts && plug[i]->save) {
+                    for (int e = 0; exts[e]; e++) {
+                        if (!strcasecmp (exts[e], ext+1)) {
+                            int res = plug[i]->save ((ddb_playlist_t *)plt, fname, (DB_playItem_t *)playlist->head[PL_MAIN], NULL);
+                            UNLOCK;
+                            return res;
+                        }
+                    }
+                }
             }
         }
-        l = strlen (m->value);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
+    }
+
+    if (conf_get_int ("playlist.save_format", 1) >= 2) {
+        int res = 1;
+        if (plt->dbpl && !strcmp (plt->dbpl->fname, fname)) {
+            res = plt_save_dbpl2_update (plt, plt->dbpl, cb, user_data);
         }
-        if (l) {
-            if (fwrite (m->value, 1, l, fp) != l) {
-                goto save_fail;
-            }
+        if (res > 0) {
+            res = plt_save_dbpl2 (plt, fname, cb, user_data);
         }
+        UNLOCK;
+        return res;
     }
 
+    char tempfile[PATH_MAX];
+    snprintf (tempfile, sizeof (tempfile), "%s.tmp", fname);
+    FILE *fp = fopen (tempfile, "w+b");
+    if (!fp) {
+        UNLOCK;
+        return -1;
+    }
+    int res = plt_save_dbpl1 (plt, fp, cb, user_data);
     UNLOCK;
-    fclose (fp);
+    if (fclose (fp) != 0) {
+        res = -1;
+    }
+    if (res < 0) {
+        unlink (tempfile);
+        return -1;
+    }
     if (rename (tempfile, fname) != 0) {
         fprintf (stderr, "playlist rename %s -> %s failed: %s\n", tempfile, fname, strerror (errno));
         return -1;
     }
     return 0;
-save_fail:
-    UNLOCK;
-    fclose (fp);
-    unlink (tempfile);
-    return -1;
+}
+
+// metadata changes don't always bump the modification index, so the item
+// serials are checked too
+static int
+plt_needs_save (playlist_t *plt) {
+    if (plt->last_save_modification_idx != plt->modification_idx) {
+        return 1;
+    }
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+        if ((int)(it->meta_serial - plt->last_save_meta_serial) > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void
+plt_set_saved (playlist_t *plt) {
+    plt->last_save_modification_idx = plt->modification_idx;
+    plt->last_save_meta_serial = pl_get_meta_serial ();
 }
 
 int
@@ -2205,6 +3389,9 @@ plt_save_n (int n) {
     playlist_t *plt;
     for (i = 0, plt = playlists_head; plt && i < n; i++, plt = plt->next);
     err = plt_save (plt, NULL, NULL, path, NULL, NULL, NULL);
+    if (!err) {
+        plt_set_saved (plt);
+    }
     plt_loading = 0;
     UNLOCK;
     return err;
@@ -2241,19 +3428,266 @@ pl_save_all (void) {
             err = -1;
             break;
         }
-        if (p->last_save_modification_idx == p->modification_idx) {
+        if (!plt_needs_save (p)) {
             continue;
         }
         err = plt_save (p, NULL, NULL, path, NULL, NULL, NULL);
         if (err < 0) {
             break;
         }
+        plt_set_saved (p);
     }
     plt_loading = 0;
     UNLOCK;
     return err;
 }
 
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    const dbpl20_header_t *hdr;
+    const dbpl20_string_t *strings;
+    const char *pool;
+    uint32_t *refs; // number of entries using each string
+    const char **interned; // metacache copies, added on first use
+    uint32_t *atoms; // key atoms, for the strings used as keys
+} dbpl20_reader_t;
+
+static int
+dbpl20_section_valid (dbpl20_reader_t *r, uint32_t offset, uint32_t count, size_t recsize) {
+    return (offset & 3) == 0 && (uint64_t)offset + (uint64_t)count * recsize <= r->size;
+}
+
+// string for a metadata entry, either key or value
+static int
+dbpl20_string_valid (dbpl20_reader_t *r, uint32_t idx, int is_key) {
+    if (idx >= r->hdr->strings_count) {
+        return 0;
+    }
+    const dbpl20_string_t *s = &r->strings[idx];
+    if (s->size == 0 || (uint64_t)s->offset + s->size > r->hdr->pool_size || r->pool[s->offset + s->size - 1]) {
+        return 0;
+    }
+    return !is_key || strlen (r->pool + s->offset) + 1 == s->size;
+}
+
+// checks all offsets and indexes of the file, and counts the uses of each
+// string, so that they can be interned with all their references at once
+static int
+dbpl20_reader_validate (dbpl20_reader_t *r) {
+    const dbpl20_header_t *hdr = r->hdr;
+    if (hdr->header_size < sizeof (dbpl20_header_t) || hdr->header_size > r->size
+        || !dbpl20_section_valid (r, hdr->items_offset, hdr->count, sizeof (dbpl20_item_t))
+        || !dbpl20_section_valid (r, hdr->meta_offset, hdr->meta_count, sizeof (dbpl_meta_t))
+        || !dbpl20_section_valid (r, hdr->plt_meta_offset, hdr->plt_meta_count, sizeof (dbpl_meta_t))
+        || !dbpl20_section_valid (r, hdr->strings_offset, hdr->strings_count, sizeof (dbpl20_string_t))
+        || (uint64_t)hdr->pool_offset + hdr->pool_size > r->size) {
+        return -1;
+    }
+    r->strings = (const dbpl20_string_t *)(r->data + hdr->strings_offset);
+    r->pool = (const char *)(r->data + hdr->pool_offset);
+
+    r->refs = calloc (hdr->strings_count, sizeof (uint32_t));
+    r->interned = calloc (hdr->strings_count, sizeof (const char *));
+    r->atoms = calloc (hdr->strings_count, sizeof (uint32_t));
+    if (hdr->strings_count && (!r->refs || !r->interned || !r->atoms)) {
+        return -1;
+    }
+
+    const dbpl20_item_t *items = (const dbpl20_item_t *)(r->data + hdr->items_offset);
+    const dbpl_meta_t *meta = (const dbpl_meta_t *)(r->data + hdr->meta_offset);
+    for (uint32_t i = 0; i < hdr->count; i++) {
+        if ((uint64_t)items[i].meta_first + items[i].meta_count > hdr->meta_count) {
+            return -1;
+        }
+    }
+    for (uint32_t i = 0; i < hdr->meta_count; i++) {
+        if (!dbpl20_string_valid (r, meta[i].key, 1) || !dbpl20_string_valid (r, meta[i].value, 0)) {
+            return -1;
+        }
+        // empty values are not added
+        if (r->pool[r->strings[meta[i].value].offset]) {
+            r->refs[meta[i].key]++;
+            r->refs[meta[i].value]++;
+        }
+    }
+    meta = (const dbpl_meta_t *)(r->data + hdr->plt_meta_offset);
+    for (uint32_t i = 0; i < hdr->plt_meta_count; i++) {
+        if (!dbpl20_string_valid (r, meta[i].key, 1) || !dbpl20_string_valid (r, meta[i].value, 1)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static const char *
+dbpl20_reader_intern (dbpl20_reader_t *r, uint32_t idx) {
+    if (!r->interned[idx]) {
+        const dbpl20_string_t *s = &r->strings[idx];
+        r->interned[idx] = metacache_add_value_refs (r->pool + s->offset, s->size, r->refs[idx]);
+    }
+    return r->interned[idx];
+}
+
+static playItem_t *
+plt_load_dbpl20 (playlist_t *plt, const char *fname) {
+    playItem_t *last_added = NULL;
+    dbpl20_reader_t r;
+    memset (&r, 0, sizeof (r));
+
+    int fd = open (fname, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat (fd, &st) != 0 || st.st_size < sizeof (dbpl20_header_t) || st.st_size > UINT32_MAX) {
+        close (fd);
+        goto load_fail;
+    }
+    r.size = st.st_size;
+    void *data = mmap (NULL, r.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (data == MAP_FAILED) {
+        goto load_fail;
+    }
+    r.data = data;
+    r.hdr = data;
+    if (dbpl20_reader_validate (&r) < 0) {
+        goto load_fail;
+    }
+
+    const dbpl20_item_t *items = (const dbpl20_item_t *)(r.data + r.hdr->items_offset);
+    const dbpl_meta_t *meta = (const dbpl_meta_t *)(r.data + r.hdr->meta_offset);
+    for (uint32_t i = 0; i < r.hdr->count; i++) {
+        const dbpl20_item_t *rec = &items[i];
+        playItem_t *it = pl_item_alloc ();
+        it->startsample = rec->startsample;
+        it->endsample = rec->endsample;
+        it->_duration = rec->duration;
+        // :TAGS and other properties derived from the flags are in the metadata
+        it->_flags = rec->flags;
+
+        for (uint32_t m = rec->meta_first; m < rec->meta_first + rec->meta_count; m++) {
+            uint32_t k = meta[m].key;
+            uint32_t v = meta[m].value;
+            if (!r.pool[r.strings[v].offset]) {
+                continue;
+            }
+            const char *key = dbpl20_reader_intern (&r, k);
+            const char *value = dbpl20_reader_intern (&r, v);
+            if (!r.atoms[k]) {
+                r.atoms[k] = metacache_key_atom (key);
+            }
+            if (pl_add_meta_interned (it, r.atoms[k], key, value, r.strings[v].size) < 0) {
+                metacache_remove_value (key, r.strings[k].size);
+                metacache_remove_value (value, r.strings[v].size);
+            }
+        }
+        if (!pl_meta_for_atom (it, META_ATOM_DURATION)) {
+            char s[100];
+            pl_format_time (it->_duration, s, sizeof(s));
+            pl_replace_meta (it, ":DURATION", s);
+        }
+        pl_meta_modified (it);
+
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        if (last_added) {
+            pl_item_unref (last_added);
+        }
+        last_added = it;
+    }
+
+    meta = (const dbpl_meta_t *)(r.data + r.hdr->plt_meta_offset);
+    for (uint32_t i = 0; i < r.hdr->plt_meta_count; i++) {
+        // FIXME: multivalue support
+        plt_add_meta (plt, r.pool + r.strings[meta[i].key].offset, r.pool + r.strings[meta[i].value].offset);
+    }
+
+    munmap (data, r.size);
+    free (r.refs);
+    free (r.interned);
+    free (r.atoms);
+    if (last_added) {
+        pl_item_unref (last_added);
+    }
+    return last_added;
+load_fail:
+    fprintf (stderr, "playlist load fail (%s)!\n", fname);
+    if (r.data) {
+        munmap ((void *)r.data, r.size);
+    }
+    free (r.refs);
+    free (r.interned);
+    free (r.atoms);
+    return NULL;
+}
+
+static playItem_t *
+plt_load_dbpl21 (playlist_t *plt, const char *fname) {
+    dbpl_file_t *f = dbpl_file_open (fname);
+    if (!f) {
+        fprintf (stderr, "playlist load fail (%s)!\n", fname);
+        return NULL;
+    }
+    const dbpl_header_t *hdr = (const dbpl_header_t *)f->data;
+    playItem_t *last_added = NULL;
+
+    LOCK;
+    int empty = !plt->head[PL_MAIN];
+    const dbpl_item_t *items = (const dbpl_item_t *)(f->data + hdr->items_offset);
+    for (uint32_t i = 0; i < hdr->count; i++) {
+        const dbpl_item_t *rec = &items[i];
+        playItem_t *it = pl_item_alloc ();
+        it->startsample = rec->startsample;
+        it->endsample = rec->endsample;
+        it->_duration = rec->duration;
+        // :TAGS and other properties derived from the flags are in the metadata
+        it->_flags = rec->flags;
+        pl_meta_modified (it);
+
+        // the metadata is decoded on first access, see pl_item_load_meta
+        f->refc++;
+        it->dbpl = f;
+        it->dbpl_meta_offset = rec->meta_offset;
+        it->dbpl_meta_count = rec->meta_count;
+        it->meta_lazy = rec->meta_count > 0;
+
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        if (last_added) {
+            pl_item_unref (last_added);
+        }
+        last_added = it;
+    }
+
+    const dbpl_meta_t *meta = (const dbpl_meta_t *)(f->data + hdr->plt_meta_offset);
+    for (uint32_t i = 0; i < hdr->plt_meta_count; i++) {
+        uint32_t keysize, valuesize;
+        const char *key = dbpl_file_get_string (f, meta[i].key, &keysize, 1);
+        const char *value = dbpl_file_get_string (f, meta[i].value, &valuesize, 1);
+        if (key && value) {
+            // FIXME: multivalue support
+            plt_add_meta (plt, key, value);
+        }
+    }
+
+    // saving can only update the file in place if it has all the items
+    if (empty) {
+        if (plt->dbpl) {
+            dbpl_file_unref (plt->dbpl);
+        }
+        plt->dbpl = f;
+    }
+    else {
+        dbpl_file_unref (f);
+    }
+    UNLOCK;
+
+    if (last_added) {
+        pl_item_unref (last_added);
+    }
+    return last_added;
+}
+
 static playItem_t *
 plt_load_int (int visibility, playlist_t *plt, playItem_t *after, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
     // try plugins 1st
@@ -2302,7 +3736,18 @@ plt_load_int (int visibility, playlist_t *plt, playItem_t *after, const char *fn
     if (fread (&majorver, 1, 1, fp) != 1) {
         goto load_fail;
     }
-    if (majorver != PLAYLIST_MAJOR_VER) {
+    if (majorver == 2) {
+        int res = fread (&minorver, 1, 1, fp);
+        fclose (fp);
+        if (res != 1) {
+            return NULL;
+        }
+        if (minorver == 0) {
+            return plt_load_dbpl20 (plt, fname);
+        }
+        return plt_load_dbpl21 (plt, fname);
+    }
+    if (majorver != 1) {
         trace ("bad majorver=%d\n", majorver);
         goto load_fail;
     }
@@ -2603,6 +4048,7 @@ pl_load_all (void) {
             snprintf (conf, sizeof (conf), "playlist.scroll.%d", i);
             plt->scroll = deadbeef->conf_get_int (conf, 0);
             plt->last_save_modification_idx = plt->modification_idx = 0;
+            plt->last_save_meta_serial = pl_get_meta_serial ();
             plt_unref (plt);
 
             if (!it) {
@@ -3515,9 +4961,9 @@ plt_copy_items (playlist_t *to, int iter, playlist_t *from, playItem_t *before,
 
     playItem_t **items = malloc (cnt * sizeof(playItem_t *));
     for (int i = 0; i < cnt; i++) {
-        playItem_t *it = from->head[iter];
-        for (int idx = 0; it && idx < indices[i]; idx++) {
-            it = it->next[iter];
+        playItem_t *it = plt_get_item_for_idx (from, indices[i], iter);
+        if (it) {
+            pl_item_unref (it);
         }
         items[i] = it;
         if (!it) {
@@ -3553,19 +4999,74 @@ plt_search_reset_int (playlist_t *playlist, int clear_selection) {
     }
     playlist->tail[PL_SEARCH] = NULL;
     playlist->count[PL_SEARCH] = 0;
+    plt_index_invalidate (playlist, PL_SEARCH, 0);
     UNLOCK;
 }
 
 void
 plt_search_reset (playlist_t *playlist) {
+    LOCK;
     plt_search_reset_int (playlist, 1);
+    free (playlist->search_query);
+    playlist->search_query = NULL;
+    UNLOCK;
+}
+
+// returns 1 if any of the searchable fields of the item contain the
+// lowercase string lc, which must be valid UTF-8
+static int
+plt_search_match (playItem_t *it, const char *lc, int cmpidx) {
+    for (DB_metaInfo_t *m = pl_get_metadata_head (it); m; m = m->next) {
+        int stop;
+        const char *value = plt_search_get_meta_value (m, &stop);
+        if (stop) {
+            break;
+        }
+        if (!value) {
+            continue;
+        }
+        // the result for each metacache value is remembered in the byte
+        // before it, for the duration of one search
+        char cmp = *(m->value-1);
+
+        if (abs (cmp) == cmpidx) {
+            if (cmp > 0) {
+                return 1;
+            }
+        }
+        else if (u8_valid(value, strlen(value), NULL) && plt_search_value_match (value, lc)) {
+            //fprintf (stderr, "%s -> %s match (%s.%s)\n", text, value, pl_find_meta_raw (it, ":URI"), m->key);
+            *((char *)m->value-1) = cmpidx;
+            return 1;
+        }
+        else {
+            *((char *)m->value-1) = -cmpidx;
+        }
+    }
+    return 0;
+}
+
+static void
+plt_search_add_result (playlist_t *playlist, playItem_t *it, int select_results) {
+    it->next[PL_SEARCH] = NULL;
+    it->prev[PL_SEARCH] = playlist->tail[PL_SEARCH];
+    if (playlist->tail[PL_SEARCH]) {
+        playlist->tail[PL_SEARCH]->next[PL_SEARCH] = it;
+        playlist->tail[PL_SEARCH] = it;
+    }
+    else {
+        playlist->head[PL_SEARCH] = playlist->tail[PL_SEARCH] = it;
+    }
+    if (select_results) {
+        it->selected = 1;
+    }
+    playlist->count[PL_SEARCH]++;
 }
 
 // FIXME: multivalue support
 void
 plt_search_process2 (playlist_t *playlist, const char *text, int select_results) {
     LOCK;
-    plt_search_reset_int (playlist, select_results);
 
     // convert text to lowercase, to save some cycles
     char lc[1000];
@@ -3588,80 +5089,67 @@ plt_search_process2 (playlist_t *playlist, const char *text, int select_results)
     }
     *out = 0;
 
+    // if nothing changed since the last search, and the new query contains
+    // the previous one, only the previous results can match
+    playItem_t **prev_results = NULL;
+    int prev_count = 0;
+    if (*text && playlist->search_query && strstr (lc, playlist->search_query)
+        && playlist->search_modification_idx == playlist->modification_idx
+        && playlist->search_index
+        && playlist->search_changes == plt_search_index_get_changes (playlist->search_index)) {
+        prev_results = malloc ((playlist->count[PL_SEARCH] + 1) * sizeof (playItem_t *));
+        for (playItem_t *it = playlist->head[PL_SEARCH]; it; it = it->next[PL_SEARCH]) {
+            prev_results[prev_count++] = it;
+        }
+    }
+
+    plt_search_reset_int (playlist, select_results);
+
     static int cmpidx = 0;
     cmpidx++;
     if (cmpidx > 127) {
         cmpidx = 1;
     }
 
-    for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
-        if (select_results) {
+    if (select_results) {
+        for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
             it->selected = 0;
         }
-        if (*text) {
-            DB_metaInfo_t *m = NULL;
-            for (m = it->meta; m; m = m->next) {
-                int is_uri = !strcmp (m->key, ":URI");
-                if ((m->key[0] == ':' && !is_uri) || m->key[0] == '_' || m->key[0] == '!') {
-                    break;
-                }
-                const char *value = m->value;
-                if (is_uri) {
-                    value = strrchr (value, '/');
-                    if (value) {
-                        value++;
-                    }
-                    else {
-                        value = m->value;
-                    }
+    }
+
+    // nothing can match an invalid query
+    if (*text && u8_valid (lc, strlen (lc), NULL)) {
+        playItem_t **candidates = prev_results;
+        int count = prev_count;
+        if (strlen (lc) >= PL_SEARCH_MIN_INDEXED_QUERY) {
+            candidates = plt_search_index_lookup (playlist, lc, prev_results, &count);
+        }
+        if (candidates) {
+            for (int i = 0; i < count; i++) {
+                if (plt_search_match (candidates[i], lc, cmpidx)) {
+                    plt_search_add_result (playlist, candidates[i], select_results);
                 }
-                if (strcasecmp(m->key, "cuesheet") && strcasecmp (m->key, "log")) {
-                    char cmp = *(m->value-1);
-
-                    if (abs (cmp) == cmpidx) {
-                        if (cmp > 0) {
-                            it->next[PL_SEARCH] = NULL;
-                            it->prev[PL_SEARCH] = playlist->tail[PL_SEARCH];
-                            if (playlist->tail[PL_SEARCH]) {
-                                playlist->tail[PL_SEARCH]->next[PL_SEARCH] = it;
-                                playlist->tail[PL_SEARCH] = it;
-                            }
-                            else {
-                                playlist->head[PL_SEARCH] = playlist->tail[PL_SEARCH] = it;
-                            }
-                            if (select_results) {
-                                it->selected = 1;
-                            }
-                            playlist->count[PL_SEARCH]++;
-                            break;
-                        }
-                    }
-                    else if (u8_valid(value, strlen(value), NULL) && u8_valid(lc, strlen(lc), NULL) && utfcasestr_fast (value, lc)) {
-                        //fprintf (stderr, "%s -> %s match (%s.%s)\n", text, value, pl_find_meta_raw (it, ":URI"), m->key);
-                        // add to list
-                        it->next[PL_SEARCH] = NULL;
-                        it->prev[PL_SEARCH] = playlist->tail[PL_SEARCH];
-                        if (playlist->tail[PL_SEARCH]) {
-                            playlist->tail[PL_SEARCH]->next[PL_SEARCH] = it;
-                            playlist->tail[PL_SEARCH] = it;
-                        }
-                        else {
-                            playlist->head[PL_SEARCH] = playlist->tail[PL_SEARCH] = it;
-                        }
-                        if (select_results) {
-                            it->selected = 1;
-                        }
-                        playlist->count[PL_SEARCH]++;
-                        *((char *)m->value-1) = cmpidx;
-                        break;
-                    }
-                    else {
-                        *((char *)m->value-1) = -cmpidx;
-                    }
+            }
+            if (candidates != prev_results) {
+                free (candidates);
+            }
+        }
+        else {
+            for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+                if (plt_search_match (it, lc, cmpidx)) {
+                    plt_search_add_result (playlist, it, select_results);
                 }
             }
         }
     }
+    free (prev_results);
+
+    free (playlist->search_query);
+    playlist->search_query = *lc ? strdup (lc) : NULL;
+    playlist->search_modification_idx = playlist->modification_idx;
+    // the index is created by the first lookup, the next search can't be
+    // refined without it
+    playlist->search_changes = playlist->search_index ? plt_search_index_get_changes (playlist->search_index) : 0;
     UNLOCK;
 }
 
@@ -3683,7 +5171,7 @@ send_trackinfochanged (playItem_t *track) {
 void
 pl_items_copy_junk (playItem_t *from, playItem_t *first, playItem_t *last) {
     LOCK;
-    DB_metaInfo_t *meta = from->meta;
+    DB_metaInfo_t *meta = pl_get_metadata_head (from);
     while (meta) {
         playItem_t *i;
         for (i = first; i; i = i->next[PL_MAIN]) {
@@ -3894,10 +5382,8 @@ plt_add_file2 (int visibility, playlist_t *plt, const char *fname, int (*callbac
 
 int
 plt_add_dir2 (int visibility, playlist_t *plt, const char *dirname, int (*callback)(playItem_t *it, void *user_data), void *user_data) {
-    follow_symlinks = conf_get_int ("add_folders_follow_symlinks", 0);
-    ignore_archives = conf_get_int ("ignore_archives", 1);
     int abort = 0;
-    playItem_t *it = plt_insert_dir_int (visibility, plt, NULL, plt->tail[PL_MAIN], dirname, &abort, callback, user_data);
+    playItem_t *it = plt_insert_dir_top (visibility, plt, plt->tail[PL_MAIN], dirname, &abort, callback, user_data);
     if (it) {
         // pl_insert_file doesn't hold reference, don't unref here
         return 0;
@@ -3912,12 +5398,7 @@ plt_insert_file2 (int visibility, playlist_t *playlist, playItem_t *after, const
 
 playItem_t *
 plt_insert_dir2 (int visibility, playlist_t *plt, playItem_t *after, const char *dirname, int *pabort, int (*callback)(playItem_t *it, void *user_data), void *user_data) {
-    follow_symlinks = conf_get_int ("add_folders_follow_symlinks", 0);
-    ignore_archives = conf_get_int ("ignore_archives", 1);
-
-    playItem_t *ret = plt_insert_dir_int (visibility, plt, NULL, after, dirname, pabort, callback, user_data);
-    ignore_archives = 0;
-    return ret;
+    return plt_insert_dir_top (visibility, plt, after, dirname, pabort, callback, user_data);
 }
 
 int
@@ -50,7 +50,18 @@ typedef struct playItem_s {
     int _refc;
     struct playItem_s *next[PL_MAX_ITERATORS]; // next item in linked list
     struct playItem_s *prev[PL_MAX_ITERATORS]; // prev item in linked list
-    struct DB_metaInfo_s *meta; // linked list storing metainfo
+    struct DB_metaInfo_s *meta; // linked list storing metainfo, threaded through meta_blocks
+    struct DB_metaInfo_s *meta_tail; // last entry of the list
+    struct DB_metaInfo_s *meta_normal_tail; // last entry before the properties, or NULL
+    struct pl_meta_block_s *meta_blocks; // storage of the metainfo entries, see plmeta.c
+    int row[PL_MAX_ITERATORS]; // cached index in list, see playlist_t::index
+    unsigned meta_serial; // value of pl_get_meta_serial at the last metadata change
+    int search_slot; // slot in the search index of the playlist
+    struct plt_search_index_s *search_index; // the index which has the item, NULL if none
+    struct dbpl_file_s *dbpl; // DBPL 2.1 file with an up to date copy of the metadata, or NULL
+    uint32_t dbpl_meta_offset; // metadata entries of the item in dbpl
+    uint32_t dbpl_meta_count;
+    uint8_t meta_lazy; // the metadata wasn't decoded from dbpl yet, see pl_item_load_meta
     unsigned selected : 1;
     unsigned played : 1; // mark as played in shuffle mode
     unsigned in_playlist : 1; // 1 if item is in playlist
@@ -63,9 +74,20 @@ typedef struct playlist_s {
     float totaltime;
     int modification_idx;
     int last_save_modification_idx;
+    unsigned last_save_meta_serial; // pl_get_meta_serial at the last save
     playItem_t *head[PL_MAX_ITERATORS]; // head of linked list
     playItem_t *tail[PL_MAX_ITERATORS]; // tail of linked list
     int current_row[PL_MAX_ITERATORS]; // current row (cursor)
+    // row index: index[iter][i] and index[iter][i]->row[iter] are valid for
+    // i < index_valid[iter], the rest is rebuilt on demand from the linked list
+    playItem_t **index[PL_MAX_ITERATORS];
+    int index_size[PL_MAX_ITERATORS];
+    int index_valid[PL_MAX_ITERATORS];
+    struct plt_search_index_s *search_index; // created on the first search
+    struct dbpl_file_s *dbpl; // DBPL 2.1 file the playlist was loaded from or last saved to
+    char *search_query; // last search query, lowercase, NULL if there were no results to refine
+    int search_modification_idx; // modification_idx at the last search
+    unsigned search_changes; // plt_search_index_get_changes at the last search
     int scroll;
     struct DB_metaInfo_s *meta; // linked list storing metainfo
     int refc;
@@ -87,6 +109,10 @@ pl_lock (void);
 void
 pl_unlock (void);
 
+// returns 1 if the calling thread holds the playlist lock
+int
+pl_lock_held (void);
+
 //void
 //plt_lock (void);
 //
@@ -239,6 +265,15 @@ pl_get_for_idx_and_iter (int idx, int iter);
 int
 plt_get_item_idx (playlist_t *playlist, playItem_t *it, int iter);
 
+// mark row index as stale starting from the given row
+// must be called after relinking items outside of plt_insert_item/plt_remove_item
+void
+plt_index_invalidate (playlist_t *playlist, int iter, int row);
+
+// make the row index valid for all rows
+void
+plt_index_update_all (playlist_t *playlist);
+
 int
 pl_get_idx_of (playItem_t *it);
 
@@ -298,6 +333,18 @@ pl_delete_meta (playItem_t *it, const char *key);
 void
 pl_delete_all_meta (playItem_t *it);
 
+// metadata of any item changed if the value differs from the last call
+unsigned
+pl_get_meta_serial (void);
+
+// to be called after modifying the metadata list of the item directly
+void
+pl_meta_modified (playItem_t *it);
+
+// changes each time the metadata of the item is modified
+unsigned
+pl_get_item_meta_serial (playItem_t *it);
+
 // returns index of 1st deleted item
 int
 plt_delete_selected (playlist_t *plt);
@@ -542,10 +589,46 @@ pl_configchanged (void);
 DB_metaInfo_t *
 pl_meta_for_key (playItem_t *it, const char *key);
 
+// same as pl_meta_for_key, pl_find_meta and pl_find_meta_raw, with the key
+// given as an atom from metacache_key_atom (or one of META_ATOM_*)
+DB_metaInfo_t *
+pl_meta_for_atom (playItem_t *it, uint32_t atom);
+
+const char *
+pl_find_meta_atom (playItem_t *it, uint32_t atom);
+
+const char *
+pl_find_meta_raw_atom (playItem_t *it, uint32_t atom);
+
 void
 pl_meta_free_values (DB_metaInfo_t *meta);
 
 void
 pl_add_meta_copy (playItem_t *it, DB_metaInfo_t *meta);
 
+// adds an entry whose key and value were already added to the metacache,
+// taking over these references; fails on duplicate keys, leaving the
+// references to the caller. The caller must call pl_meta_modified.
+int
+pl_add_meta_interned (playItem_t *it, uint32_t atom, const char *key, const char *value, int valuesize);
+
+// release all metadata of the item, when the item is freed
+void
+pl_item_free_meta (playItem_t *it);
+
+// record the number of metadata entries of a track which was added to a
+// playlist, to size the metadata storage of new tracks
+void
+pl_meta_add_size_sample (playItem_t *it);
+
+// decode the metadata of an item loaded from a DBPL 2.1 file, which is
+// deferred until it's first accessed; does nothing if it was decoded already
+void
+pl_item_load_meta (playItem_t *it);
+
+// forget the copy of the item's metadata in its DBPL 2.1 file, which is out
+// of date after the metadata was modified
+void
+pl_item_unlink_dbpl (playItem_t *it);
+
 #endif // __PLAYLIST_H
@@ -26,28 +26,227 @@
 */
 
 #include <string.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include "playlist.h"
 #include "deadbeef.h"
 #include "metacache.h"
+#include "plsearch.h"
 
 #define LOCK {pl_lock();}
 #define UNLOCK {pl_unlock();}
 
+static unsigned pl_meta_serial;
+
+unsigned
+pl_get_meta_serial (void) {
+    return pl_meta_serial;
+}
+
+void
+pl_meta_modified (playItem_t *it) {
+    pl_item_unlink_dbpl (it);
+    plt_search_index_item_modified (it);
+    it->meta_serial = __sync_add_and_fetch (&pl_meta_serial, 1);
+}
+
+unsigned
+pl_get_item_meta_serial (playItem_t *it) {
+    return it->meta_serial;
+}
+
+// Metadata entries are stored in per-item blocks instead of being allocated
+// one by one. Next to the entries, each block keeps the key atoms in a
+// separate array, so lookups scan a few cache lines of integers without
+// touching the key strings. The public DB_metaInfo_t list is threaded
+// through the entries via their next pointers, and entries never move, so
+// pointers returned by pl_meta_for_key and pl_get_metadata_head stay valid
+// until the entry is deleted.
+#define PL_META_BLOCK_SIZE 4
+#define PL_META_MAX_FIRST_BLOCK_SIZE 64
+
+// size of the first block of new items, see pl_meta_add_size_sample
+static int pl_meta_first_block_size = 16;
+
+// number of entries of recently inserted items
+static int pl_meta_size_hist[PL_META_MAX_FIRST_BLOCK_SIZE+1];
+static int pl_meta_size_samples;
+
+typedef struct pl_meta_block_s {
+    struct pl_meta_block_s *next;
+    uint16_t size; // number of entries
+    uint16_t used; // entries handed out so far, including the freed ones
+    uint16_t nfree; // freed entries below used, with atom 0
+    DB_metaInfo_t meta[];
+    // followed by uint32_t atoms[size]
+} pl_meta_block_t;
+
+static inline uint32_t *
+pl_meta_block_atoms (pl_meta_block_t *b) {
+    return (uint32_t *)(b->meta + b->size);
+}
 
 DB_metaInfo_t *
-pl_meta_for_key (playItem_t *it, const char *key) {
-    pl_ensure_lock ();
-    DB_metaInfo_t *m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
-            return m;
+pl_meta_for_atom (playItem_t *it, uint32_t atom) {
+    if (it->meta_lazy) {
+        pl_item_load_meta (it);
+    }
+    for (pl_meta_block_t *b = it->meta_blocks; b; b = b->next) {
+        uint32_t *atoms = pl_meta_block_atoms (b);
+        for (int i = 0; i < b->used; i++) {
+            if (atoms[i] == atom) {
+                return &b->meta[i];
+            }
         }
-        m = m->next;
     }
     return NULL;
 }
 
+static DB_metaInfo_t *
+pl_meta_alloc (playItem_t *it, uint32_t atom) {
+    pl_meta_block_t *last = NULL;
+    for (pl_meta_block_t *b = it->meta_blocks; b; b = b->next) {
+        uint32_t *atoms = pl_meta_block_atoms (b);
+        if (b->nfree) {
+            for (int i = 0; i < b->used; i++) {
+                if (!atoms[i]) {
+                    b->nfree--;
+                    atoms[i] = atom;
+                    return &b->meta[i];
+                }
+            }
+        }
+        if (b->used < b->size) {
+            atoms[b->used] = atom;
+            return &b->meta[b->used++];
+        }
+        last = b;
+    }
+
+    int size = last ? PL_META_BLOCK_SIZE : pl_meta_first_block_size;
+    pl_meta_block_t *b = calloc (1, sizeof (pl_meta_block_t) + size * (sizeof (DB_metaInfo_t) + sizeof (uint32_t)));
+    if (!b) {
+        return NULL;
+    }
+    b->size = size;
+    if (last) {
+        last->next = b;
+    }
+    else {
+        it->meta_blocks = b;
+    }
+    pl_meta_block_atoms (b)[0] = atom;
+    b->used = 1;
+    return &b->meta[0];
+}
+
+// approximate heap usage of a block of the given size, with malloc overhead
+static inline int
+pl_meta_block_bytes (int size) {
+    return (int)(sizeof (pl_meta_block_t) + sizeof (size_t) + size * (sizeof (DB_metaInfo_t) + sizeof (uint32_t)));
+}
+
+// Called when a track is added to a playlist, which is when its metadata is
+// usually complete. The first block size is picked to minimize the memory
+// used by recently added tracks: too small a block means extra blocks with
+// their own headers, too large a block leaves unused entries.
+void
+pl_meta_add_size_sample (playItem_t *it) {
+    if (it->meta_lazy) {
+        return; // the entries aren't allocated yet
+    }
+    int count = 0;
+    for (pl_meta_block_t *b = it->meta_blocks; b; b = b->next) {
+        count += b->used - b->nfree;
+    }
+    if (count > PL_META_MAX_FIRST_BLOCK_SIZE) {
+        count = PL_META_MAX_FIRST_BLOCK_SIZE;
+    }
+    pl_meta_size_hist[count]++;
+    pl_meta_size_samples++;
+    if (pl_meta_size_samples & 0xff) {
+        return;
+    }
+
+    int64_t best_bytes = INT64_MAX;
+    for (int size = 1; size <= PL_META_MAX_FIRST_BLOCK_SIZE; size++) {
+        int64_t bytes = 0;
+        for (int c = 0; c <= PL_META_MAX_FIRST_BLOCK_SIZE; c++) {
+            if (!pl_meta_size_hist[c]) {
+                continue;
+            }
+            int extra = c > size ? (c - size + PL_META_BLOCK_SIZE - 1) / PL_META_BLOCK_SIZE : 0;
+            bytes += (int64_t)pl_meta_size_hist[c] * (pl_meta_block_bytes (size) + extra * pl_meta_block_bytes (PL_META_BLOCK_SIZE));
+        }
+        if (bytes < best_bytes) {
+            best_bytes = bytes;
+            pl_meta_first_block_size = size;
+        }
+    }
+
+    // forget old samples gradually, to follow the tracks being added now
+    if (pl_meta_size_samples >= 4096) {
+        for (int c = 0; c <= PL_META_MAX_FIRST_BLOCK_SIZE; c++) {
+            pl_meta_size_hist[c] /= 2;
+        }
+        pl_meta_size_samples /= 2;
+    }
+}
+
+// unlinks the entry from the list and returns it to its block
+static void
+pl_meta_remove (playItem_t *it, DB_metaInfo_t *m, DB_metaInfo_t *prev) {
+    if (prev) {
+        prev->next = m->next;
+    }
+    else {
+        it->meta = m->next;
+    }
+    if (it->meta_tail == m) {
+        it->meta_tail = prev;
+    }
+    if (it->meta_normal_tail == m) {
+        it->meta_normal_tail = prev;
+    }
+
+    for (pl_meta_block_t *b = it->meta_blocks; b; b = b->next) {
+        if (m >= b->meta && m < b->meta + b->size) {
+            pl_meta_block_atoms (b)[m - b->meta] = 0;
+            b->nfree++;
+            break;
+        }
+    }
+    // next is left intact for callers deleting entries while iterating
+    m->key = NULL;
+    m->value = NULL;
+    m->valuesize = 0;
+}
+
+void
+pl_item_free_meta (playItem_t *it) {
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        pl_meta_free_values (m);
+    }
+    while (it->meta_blocks) {
+        pl_meta_block_t *next = it->meta_blocks->next;
+        free (it->meta_blocks);
+        it->meta_blocks = next;
+    }
+    it->meta = it->meta_tail = it->meta_normal_tail = NULL;
+}
+
+static inline int
+pl_meta_is_property (const char *key) {
+    return key[0] == ':' || key[0] == '_' || key[0] == '!';
+}
+
+DB_metaInfo_t *
+pl_meta_for_key (playItem_t *it, const char *key) {
+    pl_ensure_lock ();
+    uint32_t atom = metacache_find_key_atom (key);
+    return atom ? pl_meta_for_atom (it, atom) : NULL;
+}
+
 void
 pl_meta_free_values (DB_metaInfo_t *meta) {
     metacache_remove_value (meta->value, meta->valuesize);
@@ -55,53 +254,58 @@ pl_meta_free_values (DB_metaInfo_t *meta) {
     meta->valuesize = 0;
 }
 
+// links a new entry into the list, at its position depending on the key
+static void
+pl_meta_link (playItem_t *it, DB_metaInfo_t *m, const char *key) {
+    // properties go to the end of the list, other keys go before them
+    DB_metaInfo_t *prev = pl_meta_is_property (key) ? it->meta_tail : it->meta_normal_tail;
+    if (prev) {
+        m->next = prev->next;
+        prev->next = m;
+    }
+    else {
+        m->next = it->meta;
+        it->meta = m;
+    }
+    if (!m->next) {
+        it->meta_tail = m;
+    }
+    if (!pl_meta_is_property (key)) {
+        it->meta_normal_tail = m;
+    }
+}
+
 DB_metaInfo_t *
 pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
-    // check if it's already set
-    DB_metaInfo_t *normaltail = NULL;
-    DB_metaInfo_t *propstart = NULL;
-    DB_metaInfo_t *tail = NULL;
-    DB_metaInfo_t *m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
-            // duplicate key
-            return NULL;
-        }
-        // find end of normal metadata
-        if (!normaltail && (!m->next || m->key[0] == ':' || m->key[0] == '_' || m->key[0] == '!')) {
-            normaltail = tail;
-            propstart = m;
-            if (key[0] != ':' && key[0] != '_' && key[0] != '!') {
-                break;
-            }
-        }
-        // find end of properties
-        tail = m;
-        m = m->next;
+    uint32_t atom = metacache_key_atom (key);
+    if (pl_meta_for_atom (it, atom)) {
+        // duplicate key
+        return NULL;
+    }
+    DB_metaInfo_t *m = pl_meta_alloc (it, atom);
+    if (!m) {
+        return NULL;
     }
-    // add
-    m = calloc (1, sizeof (DB_metaInfo_t));
     m->key = metacache_add_string (key);
+    pl_meta_modified (it);
+    pl_meta_link (it, m, key);
+    return m;
+}
 
-    if (key[0] == ':' || key[0] == '_' || key[0] == '!') {
-        if (tail) {
-            tail->next = m;
-        }
-        else {
-            it->meta = m;
-        }
+int
+pl_add_meta_interned (playItem_t *it, uint32_t atom, const char *key, const char *value, int valuesize) {
+    if (pl_meta_for_atom (it, atom)) {
+        return -1;
     }
-    else {
-        m->next = propstart;
-        if (normaltail) {
-            normaltail->next = m;
-        }
-        else {
-            it->meta = m;
-        }
+    DB_metaInfo_t *m = pl_meta_alloc (it, atom);
+    if (!m) {
+        return -1;
     }
-
-    return m;
+    m->key = key;
+    m->value = value;
+    m->valuesize = valuesize;
+    pl_meta_link (it, m, key);
+    return 0;
 }
 
 static char *
@@ -225,6 +429,7 @@ pl_append_meta_full (playItem_t *it, const char *key, const char *value, int siz
 
     if (!m->value) {
         _meta_set_value (m, value, size);
+        pl_meta_modified (it);
         pl_unlock ();
         return;
     }
@@ -241,6 +446,7 @@ pl_append_meta_full (playItem_t *it, const char *key, const char *value, int siz
     m->value = metacache_add_value (buf, buflen);
     m->valuesize = (int)buflen;
     free (buf);
+    pl_meta_modified (it);
     pl_unlock ();
 }
 
@@ -260,6 +466,7 @@ pl_replace_meta (playItem_t *it, const char *key, const char *value) {
         int l = (int)strlen (value) + 1;
         m->value = metacache_add_value(value, l);
         m->valuesize = l;
+        pl_meta_modified (it);
         UNLOCK;
         return;
     }
@@ -287,49 +494,47 @@ void
 pl_delete_meta (playItem_t *it, const char *key) {
     pl_lock ();
     DB_metaInfo_t *prev = NULL;
+    uint32_t atom = metacache_find_key_atom (key);
+    DB_metaInfo_t *meta = atom ? pl_meta_for_atom (it, atom) : NULL;
+    if (!meta) {
+        pl_unlock ();
+        return;
+    }
     DB_metaInfo_t *m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
-            if (prev) {
-                prev->next = m->next;
-            }
-            else {
-                it->meta = m->next;
-            }
-            metacache_remove_string (m->key);
-            pl_meta_free_values(m);
-            free (m);
-            break;
-        }
+    while (m != meta) {
         prev = m;
         m = m->next;
     }
+    metacache_remove_string (m->key);
+    pl_meta_free_values (m);
+    pl_meta_remove (it, m, prev);
+    pl_meta_modified (it);
     pl_unlock ();
 }
 
 const char *
 pl_find_meta (playItem_t *it, const char *key) {
     pl_ensure_lock ();
-    DB_metaInfo_t *m = it->meta;
+    uint32_t atom = metacache_find_key_atom (key);
+    return atom ? pl_find_meta_atom (it, atom) : NULL;
+}
 
-    if (key && key[0] == ':') {
-        // try to find an override
-        while (m) {
-            if (m->key[0] == '!' && !strcasecmp (key+1, m->key+1)) {
-                return m->value;
-            }
-            m = m->next;
-        }
+const char *
+pl_find_meta_atom (playItem_t *it, uint32_t atom) {
+    pl_ensure_lock ();
+    DB_metaInfo_t *m;
+    uint32_t override = metacache_key_atom_override (atom);
+    if (override && (m = pl_meta_for_atom (it, override))) {
+        return m->value;
     }
+    m = pl_meta_for_atom (it, atom);
+    return m ? m->value : NULL;
+}
 
-    m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
-            return m->value;
-        }
-        m = m->next;
-    }
-    return NULL;
+const char *
+pl_find_meta_raw_atom (playItem_t *it, uint32_t atom) {
+    DB_metaInfo_t *m = pl_meta_for_atom (it, atom);
+    return m ? m->value : NULL;
 }
 
 const char *
@@ -358,6 +563,9 @@ pl_find_meta_float (playItem_t *it, const char *key, float def) {
 
 DB_metaInfo_t *
 pl_get_metadata_head (playItem_t *it) {
+    if (it->meta_lazy) {
+        pl_item_load_meta (it);
+    }
     return it->meta;
 }
 
@@ -365,18 +573,13 @@ void
 pl_delete_metadata (playItem_t *it, DB_metaInfo_t *meta) {
     pl_lock ();
     DB_metaInfo_t *prev = NULL;
-    DB_metaInfo_t *m = it->meta;
+    DB_metaInfo_t *m = pl_get_metadata_head (it);
     while (m) {
         if (m == meta) {
-            if (prev) {
-                prev->next = m->next;
-            }
-            else {
-                it->meta = m->next;
-            }
             metacache_remove_string (m->key);
             pl_meta_free_values(m);
-            free (m);
+            pl_meta_remove (it, m, prev);
+            pl_meta_modified (it);
             break;
         }
         prev = m;
@@ -388,26 +591,21 @@ pl_delete_metadata (playItem_t *it, DB_metaInfo_t *meta) {
 void
 pl_delete_all_meta (playItem_t *it) {
     LOCK;
-    DB_metaInfo_t *m = it->meta;
+    DB_metaInfo_t *m = pl_get_metadata_head (it);
     DB_metaInfo_t *prev = NULL;
     while (m) {
         DB_metaInfo_t *next = m->next;
-        if (m->key[0] == ':'  || m->key[0] == '_' || m->key[0] == '!') {
+        if (pl_meta_is_property (m->key)) {
             prev = m;
         }
         else {
-            if (prev) {
-                prev->next = next;
-            }
-            else {
-                it->meta = next;
-            }
             metacache_remove_string (m->key);
             pl_meta_free_values (m);
-            free (m);
+            pl_meta_remove (it, m, prev);
         }
         m = next;
     }
+    pl_meta_modified (it);
     uint32_t f = pl_get_item_flags (it);
     f &= ~DDB_TAG_MASK;
     pl_set_item_flags (it, f);
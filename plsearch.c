@@ -0,0 +1,342 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2015 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+// Search index of a playlist.
+//
+// Every item gets a fixed size signature: a bitmap with one bit set for
+// each trigram (3 bytes) and bigram of its case-folded searchable metadata.
+// An item can only contain the query if its signature has all bits of the
+// query n-grams set, so only such items need to be checked with the slow
+// case-insensitive substring search.
+//
+// Signatures are stored in a contiguous array, in slots which are assigned
+// to items when they're added to the playlist, and freed when they're
+// removed. When the metadata of an item changes, its slot is queued, and
+// only the queued signatures are rebuilt on the next lookup. The meta_serial
+// of the item is compared with the one the signature was built for, to
+// skip the slots which were rebuilt, freed or reused meanwhile.
+
+#include <stdlib.h>
+#include <string.h>
+#include "plsearch.h"
+#include "utf8.h"
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(fmt,...)
+
+// 512 bits for trigrams, followed by 256 bits for bigrams
+#define SIG_TRIGRAM_WORDS 8
+#define SIG_BIGRAM_WORDS 4
+#define SIG_WORDS (SIG_TRIGRAM_WORDS + SIG_BIGRAM_WORDS)
+
+struct plt_search_index_s {
+    playItem_t **items; // slot -> item, NULL if the slot is free
+    unsigned *serials; // slot -> meta_serial of the item when its signature was built
+    uint64_t *sigs; // SIG_WORDS per slot
+    int count; // number of slots in use, including free slots
+    int size;
+    int *free_slots;
+    int free_count;
+    int *dirty_slots; // slots whose signature needs to be rebuilt
+    int dirty_count;
+    int dirty_size;
+    unsigned changes; // insertions, removals and metadata changes
+};
+
+const char *
+plt_search_get_meta_value (DB_metaInfo_t *m, int *stop) {
+    *stop = 0;
+    int is_uri = !strcmp (m->key, ":URI");
+    if ((m->key[0] == ':' && !is_uri) || m->key[0] == '_' || m->key[0] == '!') {
+        *stop = 1;
+        return NULL;
+    }
+    if (!strcasecmp (m->key, "cuesheet") || !strcasecmp (m->key, "log")) {
+        return NULL;
+    }
+    const char *value = m->value;
+    if (is_uri) {
+        value = strrchr (value, '/');
+        if (value) {
+            value++;
+        }
+        else {
+            value = m->value;
+        }
+    }
+    return value;
+}
+
+static inline void
+sig_set (uint64_t *sig, uint32_t ngram, int bits) {
+    int bit = (ngram * 2654435761u) >> (32 - bits);
+    sig[bit >> 6] |= (uint64_t)1 << (bit & 63);
+}
+
+static void
+sig_add_string (uint64_t *sig, const uint8_t *s, int len) {
+    for (int i = 0; i + 1 < len; i++) {
+        sig_set (sig + SIG_TRIGRAM_WORDS, (s[i] << 8) | s[i+1], 8);
+        if (i + 2 < len) {
+            sig_set (sig, (s[i] << 16) | (s[i+1] << 8) | s[i+2], 9);
+        }
+    }
+}
+
+// Lowercase the value the same way utfcasestr_fast does: when the lowercase
+// form of a character is more than one character, only the first one is
+// compared with the query.
+// Then utfcasestr_fast (value, lc) is the same as a plain substring search
+// of lc in the result, as long as both strings are valid UTF-8.
+// Returns -1 if the output doesn't fit.
+static int
+search_lowercase (const char *value, char *out, int size) {
+    int n = 0;
+    while (*value) {
+        if ((uint8_t)*value < 0x80) {
+            // same as u8_tolower
+            if (n == size) {
+                return -1;
+            }
+            char c = *value++;
+            out[n++] = (c >= 'A' && c <= 'Z') ? c + 0x20 : c;
+            continue;
+        }
+        int32_t i = 0;
+        char lw[10];
+        u8_nextchar (value, &i);
+        int l = u8_tolower ((const signed char *)value, i, lw);
+        int32_t first = 0;
+        u8_nextchar (lw, &first);
+        if (first < l) {
+            l = first;
+        }
+        if (n + l > size) {
+            return -1;
+        }
+        memcpy (out + n, lw, l);
+        n += l;
+        value += i;
+    }
+    return n;
+}
+
+int
+plt_search_value_match (const char *value, const char *lc) {
+    char buf[1024];
+    int l = search_lowercase (value, buf, sizeof (buf) - 1);
+    if (l < 0) {
+        return utfcasestr_fast (value, lc) != NULL;
+    }
+    buf[l] = 0;
+    return strstr (buf, lc) != NULL;
+}
+
+static void
+sig_build (uint64_t *sig, playItem_t *it) {
+    memset (sig, 0, SIG_WORDS * sizeof (uint64_t));
+    for (DB_metaInfo_t *m = pl_get_metadata_head (it); m; m = m->next) {
+        int stop;
+        const char *value = plt_search_get_meta_value (m, &stop);
+        if (stop) {
+            break;
+        }
+        if (!value) {
+            continue;
+        }
+        int len = (int)strlen (value);
+        if (!u8_valid (value, len, NULL)) {
+            // never matches
+            continue;
+        }
+        char buf[1024];
+        int l = search_lowercase (value, buf, sizeof (buf));
+        if (l < 0) {
+            // long values, like lyrics, would fill the whole signature anyway
+            memset (sig, 0xff, SIG_WORDS * sizeof (uint64_t));
+            return;
+        }
+        sig_add_string (sig, (const uint8_t *)buf, l);
+    }
+}
+
+plt_search_index_t *
+plt_search_index_alloc (void) {
+    return calloc (1, sizeof (plt_search_index_t));
+}
+
+void
+plt_search_index_free (plt_search_index_t *index) {
+    for (int slot = 0; slot < index->count; slot++) {
+        if (index->items[slot]) {
+            index->items[slot]->search_index = NULL;
+        }
+    }
+    free (index->items);
+    free (index->serials);
+    free (index->sigs);
+    free (index->free_slots);
+    free (index->dirty_slots);
+    free (index);
+}
+
+void
+plt_search_index_insert (plt_search_index_t *index, playItem_t *it) {
+    int slot;
+    if (index->free_count > 0) {
+        slot = index->free_slots[--index->free_count];
+    }
+    else {
+        if (index->count == index->size) {
+            int size = index->size ? index->size * 2 : 1024;
+            index->items = realloc (index->items, size * sizeof (playItem_t *));
+            index->serials = realloc (index->serials, size * sizeof (unsigned));
+            index->sigs = realloc (index->sigs, size * SIG_WORDS * sizeof (uint64_t));
+            index->free_slots = realloc (index->free_slots, size * sizeof (int));
+            index->size = size;
+        }
+        slot = index->count++;
+    }
+    index->items[slot] = it;
+    index->serials[slot] = it->meta_serial;
+    sig_build (index->sigs + slot * SIG_WORDS, it);
+    it->search_slot = slot;
+    it->search_index = index;
+    index->changes++;
+}
+
+void
+plt_search_index_remove (plt_search_index_t *index, playItem_t *it) {
+    int slot = it->search_slot;
+    if (slot < 0 || slot >= index->count || index->items[slot] != it) {
+        return;
+    }
+    index->items[slot] = NULL;
+    index->free_slots[index->free_count++] = slot;
+    it->search_index = NULL;
+    index->changes++;
+}
+
+void
+plt_search_index_item_modified (playItem_t *it) {
+    plt_search_index_t *index = it->search_index;
+    if (!index) {
+        return;
+    }
+    int slot = it->search_slot;
+    index->changes++;
+    // the signature is up to date, unless the slot is queued already
+    if (index->serials[slot] != it->meta_serial) {
+        return;
+    }
+    if (index->dirty_count == index->dirty_size) {
+        index->dirty_size = index->dirty_size ? index->dirty_size * 2 : 64;
+        index->dirty_slots = realloc (index->dirty_slots, index->dirty_size * sizeof (int));
+    }
+    index->dirty_slots[index->dirty_count++] = slot;
+}
+
+unsigned
+plt_search_index_get_changes (plt_search_index_t *index) {
+    return index->changes;
+}
+
+// rebuild signatures of items which were modified since the last update
+static void
+plt_search_index_update (plt_search_index_t *index) {
+    for (int i = 0; i < index->dirty_count; i++) {
+        int slot = index->dirty_slots[i];
+        playItem_t *it = index->items[slot];
+        if (it && it->meta_serial != index->serials[slot]) {
+            index->serials[slot] = it->meta_serial;
+            sig_build (index->sigs + slot * SIG_WORDS, it);
+        }
+    }
+    index->dirty_count = 0;
+}
+
+static int
+cmp_row (const void *a, const void *b) {
+    const playItem_t *aa = *(playItem_t * const *)a;
+    const playItem_t *bb = *(playItem_t * const *)b;
+    return aa->row[PL_MAIN] - bb->row[PL_MAIN];
+}
+
+static inline int
+sig_test (const uint64_t *sig, const uint64_t *qsig) {
+    for (int i = 0; i < SIG_WORDS; i++) {
+        if ((sig[i] & qsig[i]) != qsig[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+playItem_t **
+plt_search_index_lookup (playlist_t *plt, const char *lc, playItem_t **items, int *count) {
+    pl_lock ();
+    plt_search_index_t *index = plt->search_index;
+    if (!index) {
+        index = plt->search_index = plt_search_index_alloc ();
+        for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+            plt_search_index_insert (index, it);
+        }
+    }
+    else {
+        plt_search_index_update (index);
+    }
+
+    uint64_t qsig[SIG_WORDS];
+    memset (qsig, 0, sizeof (qsig));
+    sig_add_string (qsig, (const uint8_t *)lc, (int)strlen (lc));
+
+    int n = 0;
+    if (items) {
+        // filter in place, keeping the order
+        for (int i = 0; i < *count; i++) {
+            int slot = items[i]->search_slot;
+            if (slot >= 0 && slot < index->count && index->items[slot] == items[i]
+                && sig_test (index->sigs + slot * SIG_WORDS, qsig)) {
+                items[n++] = items[i];
+            }
+        }
+    }
+    else {
+        items = malloc ((plt->count[PL_MAIN] + 1) * sizeof (playItem_t *));
+        const uint64_t *sig = index->sigs;
+        for (int slot = 0; slot < index->count; slot++, sig += SIG_WORDS) {
+            if (sig_test (sig, qsig) && index->items[slot]) {
+                items[n++] = index->items[slot];
+            }
+        }
+
+        // slots are in insertion order, return the items in playlist order
+        plt_index_update_all (plt);
+        qsort (items, n, sizeof (playItem_t *), cmp_row);
+    }
+
+    trace ("plt_search_index_lookup: %d candidates of %d\n", n, plt->count[PL_MAIN]);
+    pl_unlock ();
+    *count = n;
+    return items;
+}
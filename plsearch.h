@@ -0,0 +1,78 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2015 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef __deadbeef__plsearch__
+#define __deadbeef__plsearch__
+
+#include "playlist.h"
+
+// shortest query (in bytes) which can be looked up in the search index
+#define PL_SEARCH_MIN_INDEXED_QUERY 2
+
+typedef struct plt_search_index_s plt_search_index_t;
+
+plt_search_index_t *
+plt_search_index_alloc (void);
+
+void
+plt_search_index_free (plt_search_index_t *index);
+
+// the index must be kept in sync with the main list of the playlist
+void
+plt_search_index_insert (plt_search_index_t *index, playItem_t *it);
+
+void
+plt_search_index_remove (plt_search_index_t *index, playItem_t *it);
+
+// Queues the signature of the item to be rebuilt on the next lookup.
+// Must be called before the meta_serial of the item changes.
+void
+plt_search_index_item_modified (playItem_t *it);
+
+// Returns the number of insertions, removals and metadata changes of the
+// indexed items. Search results are up to date while it stays the same.
+unsigned
+plt_search_index_get_changes (plt_search_index_t *index);
+
+// Returns the items which may contain the lowercase query lc, in playlist
+// order. Some of them may not match, they need to be checked by the caller.
+// If items is NULL, all items of the playlist are looked up, and the
+// returned array must be freed by the caller.
+// Otherwise, items must contain *count items of the playlist, which are
+// filtered in place.
+// Creates the index of the playlist on the first call.
+playItem_t **
+plt_search_index_lookup (playlist_t *plt, const char *lc, playItem_t **items, int *count);
+
+// Returns the value which will be matched against the query for the given
+// metadata field, or NULL if the field is not searched.
+// Sets *stop when no more fields of the item need to be searched.
+const char *
+plt_search_get_meta_value (DB_metaInfo_t *m, int *stop);
+
+// Same as utfcasestr_fast (value, lc) != NULL for valid UTF-8 strings,
+// but much faster.
+int
+plt_search_value_match (const char *value, const char *lc);
+
+#endif /* defined(__deadbeef__plsearch__) */
@@ -30,6 +30,7 @@ static DB_functions_t *deadbeef;
 
 #define SRC_BUFFER 16000
 #define SRC_MAX_CHANNELS 8
+#define SRC_LATENCY 16
 
 static DB_dsp_t plugin;
 
@@ -46,7 +47,8 @@ typedef struct {
     float *outbuf;
     int outsize;
     int buffersize;
-    __attribute__((__aligned__(16))) char in_fbuffer[sizeof(float)*SRC_BUFFER*SRC_MAX_CHANNELS];
+    char *in_fbuffer;
+    int in_fbuffer_size; // in bytes, grows when the leftover input doesn't fit
     unsigned quality_changed : 1;
     unsigned need_reset : 1;
 } ddb_src_libsamplerate_t;
@@ -59,6 +61,8 @@ ddb_src_open (void) {
     src->samplerate = 44100;
     src->quality = 2;
     src->channels = -1;
+    src->in_fbuffer_size = sizeof(float)*SRC_BUFFER*SRC_MAX_CHANNELS;
+    src->in_fbuffer = malloc (src->in_fbuffer_size);
     return (ddb_dsp_context_t *)src;
 }
 
@@ -69,6 +73,10 @@ ddb_src_close (ddb_dsp_context_t *_src) {
         src_delete (src->src);
         src->src = NULL;
     }
+    if (src->outbuf) {
+        free (src->outbuf);
+    }
+    free (src->in_fbuffer);
     free (src);
 }
 
@@ -104,6 +112,30 @@ ddb_src_can_bypass (ddb_dsp_context_t *_src, ddb_waveformat_t *fmt) {
     return 0;
 }
 
+void
+ddb_src_negotiate (ddb_dsp_context_t *_src, ddb_waveformat_t *fmt, float *ratio, int *latency) {
+    ddb_src_libsamplerate_t *src = (ddb_src_libsamplerate_t*)_src;
+
+    float samplerate = src->samplerate;
+    if (src->autosamplerate) {
+        DB_output_t *output = deadbeef->get_output ();
+        if (output->fmt.samplerate <= 0) {
+            return;
+        }
+        samplerate = output->fmt.samplerate;
+    }
+
+    if (fmt->samplerate == samplerate) {
+        return;
+    }
+
+    *ratio = samplerate / fmt->samplerate;
+    // libsamplerate may produce a few frames more than the exact ratio,
+    // when the fractional position catches up
+    *latency = SRC_LATENCY;
+    fmt->samplerate = samplerate;
+}
+
 int
 ddb_src_process (ddb_dsp_context_t *_src, float *samples, int nframes, int maxframes, ddb_waveformat_t *fmt, float *r) {
     ddb_src_libsamplerate_t *src = (ddb_src_libsamplerate_t*)_src;
@@ -138,9 +170,9 @@ ddb_src_process (ddb_dsp_context_t *_src, float *samples, int nframes, int maxfr
     fmt->samplerate = samplerate;
 
     int numoutframes = 0;
-    int outsize = nframes*24;
+    int outsize = maxframes;
     int buffersize = outsize * fmt->channels * sizeof (float);
-    if (!src->outbuf || src->outsize != outsize || src->buffersize != buffersize) {
+    if (!src->outbuf || src->buffersize < buffersize) {
         if (src->outbuf) {
             free (src->outbuf);
             src->outbuf = NULL;
@@ -150,7 +182,6 @@ ddb_src_process (ddb_dsp_context_t *_src, float *samples, int nframes, int maxfr
         src->outbuf = malloc (buffersize);
     }
     char *output = (char *)src->outbuf;
-    memset (output, 0, buffersize);
     float *input = samples;
     int inputsize = nframes;
 
@@ -159,8 +190,9 @@ ddb_src_process (ddb_dsp_context_t *_src, float *samples, int nframes, int maxfr
     do {
         // add more frames to input SRC buffer
         int n = inputsize;
-        if (n >= SRC_BUFFER - src->remaining) {
-            n = SRC_BUFFER - src->remaining;
+        int avail = src->in_fbuffer_size / samplesize - src->remaining;
+        if (n > avail) {
+            n = avail > 0 ? avail : 0;
         }
 
         if (n > 0) {
@@ -208,6 +240,23 @@ ddb_src_process (ddb_dsp_context_t *_src, float *samples, int nframes, int maxfr
         }
     } while (inputsize > 0 && outsize > 0);
 
+    // keep the input which didn't fit into the output for the next call,
+    // growing the SRC buffer if needed, since the caller won't resend it
+    if (inputsize > 0) {
+        int size = (src->remaining + inputsize) * samplesize;
+        if (size > src->in_fbuffer_size) {
+            char *buf = realloc (src->in_fbuffer, size);
+            if (!buf) {
+                fprintf (stderr, "src: failed to grow input buffer to %d bytes\n", size);
+                return -1;
+            }
+            src->in_fbuffer = buf;
+            src->in_fbuffer_size = size;
+        }
+        memcpy (&src->in_fbuffer[src->remaining*samplesize], samples, inputsize * samplesize);
+        src->remaining += inputsize;
+    }
+
     memcpy (input, src->outbuf, numoutframes * fmt->channels * sizeof (float));
     //static FILE *out = NULL;
     //if (!out) {
@@ -288,9 +337,9 @@ static const char settings_dlg[] =
 ;
 
 static DB_dsp_t plugin = {
-    // need 1.1 api for pass_through
+    // need 1.1 api for pass_through, 1.10 for negotiate
     .plugin.api_vmajor = 1,
-    .plugin.api_vminor = 1,
+    .plugin.api_vminor = 10,
     .open = ddb_src_open,
     .close = ddb_src_close,
     .process = ddb_src_process,
@@ -325,6 +374,7 @@ static DB_dsp_t plugin = {
     .reset = ddb_src_reset,
     .configdialog = settings_dlg,
     .can_bypass = ddb_src_can_bypass,
+    .negotiate = ddb_src_negotiate,
 };
 
 DB_plugin_t *
@@ -107,6 +107,10 @@ static void
 ddb_listview_resize_groups (DdbListview *listview);
 static void
 ddb_listview_free_groups (DdbListview *listview);
+static void
+ddb_listview_free_group_titles (DdbListview *listview);
+static void
+ddb_listview_draw_group_titles_progress (DdbListview *listview, cairo_t *cr, int x, int y, int width, int height);
 
 static void
 ddb_listview_update_fonts (DdbListview *ps);
@@ -354,6 +358,12 @@ ddb_listview_init(DdbListview *listview)
     listview->lock_columns = -1;
     listview->groups = NULL;
     listview->plt = NULL;
+    listview->group_titles = NULL;
+    listview->group_title_strings = NULL;
+    listview->group_titles_format = NULL;
+    listview->group_titles_stamp = 0;
+    listview->group_titles_fill_id = 0;
+    listview->group_titles_fill_idx = 0;
 
     listview->calculated_grouptitle_height = DEFAULT_GROUP_TITLE_HEIGHT;
 
@@ -527,6 +537,7 @@ ddb_listview_destroy(GObject *object)
     listview = DDB_LISTVIEW(object);
 
     ddb_listview_free_groups (listview);
+    ddb_listview_free_group_titles (listview);
 
     while (listview->columns) {
         DdbListviewColumn *next = listview->columns->next;
@@ -897,14 +908,20 @@ ddb_listview_list_render (DdbListview *listview, cairo_t *cr, GdkRectangle *clip
             // draw pinned group title
             fill_list_background(listview, cr, scrollx, 0, total_width, min(title_height, grp_next_y), clip);
 //            render_treeview_background(listview, cr, FALSE, TRUE, scrollx, 0, total_width, min(title_height, grp_next_y), clip);
-            if (listview->binding->draw_group_title && title_height > 0) {
+            if (listview->group_titles_fill_id && title_height > 0) {
+                ddb_listview_draw_group_titles_progress(listview, cr, scrollx, min(0, grp_next_y-title_height), total_width, title_height);
+            }
+            else if (listview->binding->draw_group_title && title_height > 0) {
                 listview->binding->draw_group_title(listview, cr, grp->head, scrollx, min(0, grp_next_y-title_height), total_width, title_height);
             }
         }
         else if (clip->y <= grp_y + title_height) {
             // draw normal group title
 //            render_treeview_background(listview, cr, FALSE, TRUE, scrollx, grp_y, total_width, title_height, clip);
-            if (listview->binding->draw_group_title && title_height > 0) {
+            if (listview->group_titles_fill_id && title_height > 0) {
+                ddb_listview_draw_group_titles_progress(listview, cr, scrollx, grp_y, total_width, title_height);
+            }
+            else if (listview->binding->draw_group_title && title_height > 0) {
                 listview->binding->draw_group_title(listview, cr, grp->head, scrollx, grp_y, total_width, title_height);
             }
         }
@@ -3242,6 +3259,137 @@ new_group (DdbListview *listview, DdbListviewIter it) {
     return grp;
 }
 
+// number of missing group titles which are formatted while building the
+// groups, above that they're formatted from an idle callback, showing progress
+#define GROUP_TITLES_SYNC_LIMIT 5000
+// number of tracks formatted per call of the idle callback
+#define GROUP_TITLES_FILL_CHUNK 2000
+
+typedef struct {
+    unsigned meta_serial;
+    int stamp;
+    const char *title; // stored in group_title_strings
+} DdbListviewGroupTitle;
+
+static void
+ddb_listview_group_title_free (gpointer data) {
+    g_slice_free (DdbListviewGroupTitle, data);
+}
+
+static void
+ddb_listview_free_group_titles (DdbListview *listview) {
+    if (listview->group_titles_fill_id) {
+        g_source_remove (listview->group_titles_fill_id);
+        listview->group_titles_fill_id = 0;
+    }
+    if (listview->group_titles) {
+        g_hash_table_destroy (listview->group_titles);
+        listview->group_titles = NULL;
+    }
+    if (listview->group_title_strings) {
+        g_string_chunk_free (listview->group_title_strings);
+        listview->group_title_strings = NULL;
+    }
+    if (listview->group_titles_format) {
+        free (listview->group_titles_format);
+        listview->group_titles_format = NULL;
+    }
+}
+
+// drop the titles if the group format has changed
+static void
+ddb_listview_validate_group_titles (DdbListview *listview) {
+    if (listview->group_titles && !strcmp (listview->group_titles_format, listview->group_format)) {
+        return;
+    }
+    ddb_listview_free_group_titles (listview);
+    // the tracks are referenced by the keys, so that their addresses can't be reused
+    listview->group_titles = g_hash_table_new_full (g_direct_hash, g_direct_equal, (GDestroyNotify)deadbeef->pl_item_unref, ddb_listview_group_title_free);
+    listview->group_title_strings = g_string_chunk_new (4096);
+    listview->group_titles_format = strdup (listview->group_format);
+}
+
+// removes the titles of the tracks which were not seen by the last build
+static void
+ddb_listview_prune_group_titles (DdbListview *listview) {
+    GStringChunk *strings = g_string_chunk_new (4096);
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init (&iter, listview->group_titles);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        DdbListviewGroupTitle *t = value;
+        if (t->stamp != listview->group_titles_stamp) {
+            g_hash_table_iter_remove (&iter);
+        }
+        else {
+            t->title = g_string_chunk_insert_const (strings, t->title);
+        }
+    }
+    g_string_chunk_free (listview->group_title_strings);
+    listview->group_title_strings = strings;
+}
+
+// returns the group title of the track, formatting it if it's not known yet;
+// equal titles are returned as the same pointer
+static const char *
+ddb_listview_get_group_title (DdbListview *listview, DdbListviewIter it, int *formatted) {
+    unsigned meta_serial = deadbeef->pl_get_item_meta_serial (it);
+    DdbListviewGroupTitle *t = g_hash_table_lookup (listview->group_titles, it);
+    if (!t || t->meta_serial != meta_serial) {
+        char title[1024];
+        listview->binding->get_group (listview, it, title, sizeof (title));
+        if (!t) {
+            t = g_slice_new (DdbListviewGroupTitle);
+            deadbeef->pl_item_ref (it);
+            g_hash_table_insert (listview->group_titles, it, t);
+        }
+        t->meta_serial = meta_serial;
+        t->title = g_string_chunk_insert_const (listview->group_title_strings, title);
+        (*formatted)++;
+    }
+    t->stamp = listview->group_titles_stamp;
+    return t->title;
+}
+
+static gboolean
+ddb_listview_fill_group_titles_cb (gpointer p) {
+    DdbListview *listview = DDB_LISTVIEW (p);
+    deadbeef->pl_lock ();
+    int count = listview->binding->count ();
+    int end = min (count, listview->group_titles_fill_idx + GROUP_TITLES_FILL_CHUNK);
+    int formatted = 0;
+    for (int i = listview->group_titles_fill_idx; i < end; i++) {
+        DdbListviewIter it = listview->binding->get_for_idx (i);
+        if (!it) {
+            break;
+        }
+        ddb_listview_get_group_title (listview, it, &formatted);
+        listview->binding->unref (it);
+    }
+    listview->group_titles_fill_idx = end;
+    deadbeef->pl_unlock ();
+
+    if (end < count) {
+        gtk_widget_queue_draw (listview->list);
+        return TRUE;
+    }
+    listview->group_titles_fill_id = 0;
+    ddb_listview_build_groups (listview);
+    gtk_widget_queue_draw (listview->list);
+    return FALSE;
+}
+
+// a single group with all tracks, used when grouping is disabled,
+// and while the group titles are being formatted
+static int
+build_single_group (DdbListview *listview, DdbListviewIter it) {
+    listview->groups = calloc(1, sizeof(DdbListviewGroup));
+    listview->groups->head = it;
+    listview->groups->num_items = listview->binding->count();
+    listview->groups->height = listview->grouptitle_height + listview->groups->num_items * listview->rowheight;
+    return listview->groups->height;
+}
+
 static int
 build_groups (DdbListview *listview) {
     listview->groups_build_idx = listview->binding->modification_idx();
@@ -3249,36 +3397,104 @@ build_groups (DdbListview *listview) {
     listview->plt = deadbeef->plt_get_curr();
 
     DdbListviewIter it = listview->binding->head();
-    if (!it) {
-        return 0;
-    }
     if (!listview->group_format || !listview->group_format[0]) {
+        ddb_listview_free_group_titles (listview);
         listview->grouptitle_height = 0;
-        listview->groups = calloc(1, sizeof(DdbListviewGroup));
-        listview->groups->head = it;
-        listview->groups->num_items = listview->binding->count();
-        listview->groups->height = listview->groups->num_items * listview->rowheight;
-        return listview->groups->height;
+        return it ? build_single_group (listview, it) : 0;
+    }
+    ddb_listview_validate_group_titles (listview);
+    if (!it) {
+        return 0;
     }
     listview->grouptitle_height = listview->calculated_grouptitle_height;
+    if (listview->group_titles_fill_id) {
+        return build_single_group (listview, it);
+    }
+
+    // titles are remembered only when they depend on nothing but the track
+    int reuse_titles = deadbeef->tf_is_cacheable (listview->group_title_bytecode);
+    if (!reuse_titles) {
+        g_hash_table_remove_all (listview->group_titles);
+        g_string_chunk_clear (listview->group_title_strings);
+    }
+    listview->group_titles_stamp++;
+
     listview->groups = new_group(listview, it);
+    DdbListviewGroup *grp = listview->groups;
+    int formatted = 0;
+    int count = 0;
+    const char *group_title = ddb_listview_get_group_title (listview, it, &formatted);
+    for (;;) {
+        grp->num_items++;
+        count++;
+        it = next_playitem(listview, it);
+        if (!it) {
+            break;
+        }
+        if (reuse_titles && formatted > GROUP_TITLES_SYNC_LIMIT) {
+            // too many new tracks, format the rest of the titles in the background
+            listview->binding->unref (it);
+            ddb_listview_free_groups (listview);
+            listview->plt = deadbeef->plt_get_curr();
+            listview->group_titles_fill_idx = count;
+            listview->group_titles_fill_id = g_idle_add (ddb_listview_fill_group_titles_cb, listview);
+            return build_single_group (listview, listview->binding->head ());
+        }
+        const char *title = ddb_listview_get_group_title (listview, it, &formatted);
+        if (title != group_title) {
+            grp->next = new_group(listview, it);
+            grp = grp->next;
+            group_title = title;
+        }
+    }
+
     int min_height = ddb_listview_min_group_height(listview->columns);
     int full_height = 0;
-    for (DdbListviewGroup *grp = listview->groups; grp; grp = grp->next) {
-        char group_title[1024];
-        char next_title[1024];
-        listview->binding->get_group(listview, it, group_title, sizeof(group_title));
-        do {
-            grp->num_items++;
-            it = next_playitem(listview, it);
-        } while (it && listview->binding->get_group(listview, it, next_title, sizeof(next_title)) != -1 && !strcmp(group_title, next_title));
+    for (grp = listview->groups; grp; grp = grp->next) {
         grp->height = listview->grouptitle_height + max(grp->num_items * listview->rowheight, min_height);
         full_height += grp->height;
-        grp->next = it ? new_group(listview, it) : NULL;
+    }
+
+    // release the tracks which are no longer in the list
+    if (reuse_titles && g_hash_table_size (listview->group_titles) > count) {
+        ddb_listview_prune_group_titles (listview);
     }
     return full_height;
 }
 
+static void
+ddb_listview_draw_group_titles_progress (DdbListview *listview, cairo_t *cr, int x, int y, int width, int height) {
+    int count = listview->binding->count ();
+    int percent = count > 0 ? min (100, listview->group_titles_fill_idx * 100 / count) : 100;
+    char text[200];
+    snprintf (text, sizeof (text), _("Grouping tracks... %d%%"), percent);
+
+    float rgb[3];
+    if (!gtkui_override_listview_colors ()) {
+#if GTK_CHECK_VERSION(3,0,0)
+        GdkRGBA rgba;
+        gtk_style_context_get_color (gtk_widget_get_style_context (theme_treeview), GTK_STATE_FLAG_NORMAL, &rgba);
+        rgb[0] = rgba.red;
+        rgb[1] = rgba.green;
+        rgb[2] = rgba.blue;
+#else
+        GdkColor *clr = &gtk_widget_get_style(theme_treeview)->fg[GTK_STATE_NORMAL];
+        rgb[0] = clr->red/65535.;
+        rgb[1] = clr->green/65535.;
+        rgb[2] = clr->blue/65535.;
+#endif
+    }
+    else {
+        GdkColor clr;
+        gtkui_get_listview_group_text_color (&clr);
+        rgb[0] = clr.red/65535.;
+        rgb[1] = clr.green/65535.;
+        rgb[2] = clr.blue/65535.;
+    }
+    draw_set_fg_color (&listview->grpctx, rgb);
+    draw_text_custom (&listview->grpctx, x + 5, y + height/2 - draw_get_listview_rowheight (&listview->grpctx)/2 + 3, -1, 0, DDB_GROUP_FONT, 0, 1, text);
+}
+
 static void
 ddb_listview_build_groups (DdbListview *listview) {
     deadbeef->pl_lock();
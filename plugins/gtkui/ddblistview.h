@@ -200,6 +200,15 @@ struct _DdbListview {
     // tf bytecode for group title
     char *group_title_bytecode;
 
+    // group titles of the tracks, valid until the track metadata changes,
+    // so that only new and modified tracks are formatted when regrouping
+    GHashTable *group_titles; // DdbListviewIter -> DdbListviewGroupTitle
+    GStringChunk *group_title_strings; // the titles, each stored once
+    char *group_titles_format; // group_format the titles were made with
+    int group_titles_stamp; // incremented on each build, to find removed tracks
+    guint group_titles_fill_id; // idle source formatting the missing titles, 0 if not running
+    int group_titles_fill_idx; // index of the next track to be formatted by the idle source
+
     guint tf_redraw_timeout_id;
     int tf_redraw_track_idx;
     DdbListviewIter tf_redraw_track;
@@ -21,208 +21,852 @@
     3. This notice may not be removed or altered from any source distribution.
 */
 
-#include <sys/time.h>
+// The library is a hidden playlist with all tracks found in the configured
+// folders, and a hash index for each of the album, artist, genre and folder
+// fields.
+//
+// The playlist is saved to medialib.dbpl in the config dir after each scan,
+// and loaded on startup, so the library is available immediately. Rescans
+// go through plt_insert_dir, which reuses the tag cache for the files that
+// didn't change, so they mostly cost a stat per file.
+//
+// The scanner builds a new db off-lock, and swaps it with the current one
+// under the library lock.
+//
+// Between the scans, the library folders are watched for changes (see
+// watcher.c), and only the changed files are read again. The scan on startup
+// catches up with the changes made while the player was not running.
+
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
-#include "../../deadbeef.h"
+#include <strings.h>
+#include <stdio.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "medialib.h"
+#include "watcher.h"
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(fmt,...)
+
+// not shown in the GUI
+#define ML_FILEADD_VISIBILITY -1
+
+#define ML_MAX_LISTENERS 10
+
+#define ML_INITIAL_HASH_SIZE 256
+
+#define ML_MAX_ROOTS 100
+
+#define ML_DEFAULT_WATCH_DELAY_MS 1000
 
 DB_functions_t *deadbeef;
 
-typedef struct ml_string_s {
-    const char *text;
-    struct ml_string_s *next;
-} ml_string_t;
-
-typedef struct ml_entry_s {
-    const char *file;
-    const char *title;
-    int subtrack;
-    ml_string_t *artist;
-    ml_string_t *album;
-    ml_string_t *genre;
-    ml_string_t *folder;
-    struct ml_entry_s *next;
-} ml_entry_t;
+// all tracks with the same value of an indexed field
+typedef struct ml_collection_s {
+    const char *text; // metacache string
+    uint32_t hash;
+    int count;
+    int alloc;
+    DB_playItem_t **tracks;
+    struct ml_collection_s *next; // next in the hash bucket
+} ml_collection_t;
 
 typedef struct {
-    ml_entry_t *tracks;
+    ml_collection_t **hash;
+    uint32_t hash_size; // power of 2
+    int count;
+    ml_collection_t **sorted;
+} ml_index_t;
 
-    // index tables
-    ml_string_t *album;
-    ml_string_t *artist;
-    ml_string_t *genre;
-    ml_string_t *folder;
+typedef struct {
+    ddb_playlist_t *plt;
+    int track_count;
+    DB_playItem_t **tracks;
+    ml_index_t indexes[DDB_MEDIALIB_INDEX_COUNT];
 } ml_db_t;
 
-#define REG_COL(col)\
-ml_string_t *\
-ml_reg_##col (ml_db_t *db, const char *col) {\
-    ml_string_t *s;\
-    int release = 0;\
-    if (!col) {\
-        col = deadbeef->metacache_add_string ("Unknown");\
-        release = 1;\
-    }\
-    for (s = db->col; s; s = s->next) {\
-        if (s->text == col) {\
-            if (release) {\
-                deadbeef->metacache_unref (col);\
-            }\
-            return s;\
-        }\
-    }\
-    if (!release) {\
-        deadbeef->metacache_ref (col);\
-    }\
-    s = malloc (sizeof (ml_string_t));\
-    memset (s, 0, sizeof (ml_string_t));\
-    s->text = col;\
-    s->next = db->col;\
-    db->col = s;\
-    return s;\
-}
-
-REG_COL(album);
-REG_COL(artist);
-REG_COL(genre);
-REG_COL(folder);
-
-DB_playItem_t *(*plt_insert_dir) (ddb_playlist_t *plt, DB_playItem_t *after, const char *dirname, int *pabort, int (*cb)(DB_playItem_t *it, void *data), void *user_data);
-
-uintptr_t tid;
-int scanner_terminate;
+static const char *ml_index_fields[DDB_MEDIALIB_INDEX_COUNT] = {
+    "album",
+    "artist",
+    "genre",
+    NULL, // folder, from the :URI
+};
+
+static ml_db_t *db;
+static uintptr_t db_mutex;
+
+static intptr_t tid;
+static int scanner_terminate;
+static int scanner_busy;
+static int scan_requested;
+static uintptr_t scanner_mutex;
+static uintptr_t scanner_cond;
+static char *scanned_paths; // medialib.paths at the last scan request
+static ml_changes_t *changes_head; // batches from the watcher
+static ml_changes_t *changes_tail;
+
+// owned by the scanner thread
+static ml_watcher_t *watcher;
+static char *watched_paths;
+
+// guarded by scanner_mutex
+static struct {
+    ddb_medialib_listener_t listener;
+    void *user_data;
+} listeners[ML_MAX_LISTENERS];
+
+static DB_playItem_t *(*plt_insert_dir2) (int visibility, ddb_playlist_t *plt, ddb_playItem_t *after, const char *dirname, int *pabort, int (*callback)(DB_playItem_t *it, void *user_data), void *user_data);
+
+static uint32_t
+ml_hash (const char *text) {
+    uint32_t h = 2166136261u;
+    for (const uint8_t *p = (const uint8_t *)text; *p; p++) {
+        h = (h ^ *p) * 16777619u;
+    }
+    return h;
+}
+
+static ml_collection_t *
+ml_index_find (ml_index_t *index, const char *text, uint32_t hash) {
+    if (!index->hash) {
+        return NULL;
+    }
+    for (ml_collection_t *c = index->hash[hash & (index->hash_size-1)]; c; c = c->next) {
+        if (c->hash == hash && !strcmp (c->text, text)) {
+            return c;
+        }
+    }
+    return NULL;
+}
 
 static int
-add_file_info_cb (DB_playItem_t *it, void *data) {
-//    fprintf (stderr, "added %s                                 \r", deadbeef->pl_find_meta (it, ":URI"));
+ml_index_grow (ml_index_t *index) {
+    uint32_t size = index->hash_size ? index->hash_size * 2 : ML_INITIAL_HASH_SIZE;
+    ml_collection_t **hash = calloc (size, sizeof (ml_collection_t *));
+    if (!hash) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < index->hash_size; i++) {
+        ml_collection_t *c = index->hash[i];
+        while (c) {
+            ml_collection_t *next = c->next;
+            c->next = hash[c->hash & (size-1)];
+            hash[c->hash & (size-1)] = c;
+            c = next;
+        }
+    }
+    free (index->hash);
+    index->hash = hash;
+    index->hash_size = size;
     return 0;
 }
 
 static void
-scanner_thread (void *none) {
-    return;
-    // create invisible playlist
-    ddb_playlist_t *plt = deadbeef->plt_alloc ("scanner");
+ml_index_add (ml_index_t *index, const char *text, DB_playItem_t *it) {
+    uint32_t hash = ml_hash (text);
+    ml_collection_t *c = ml_index_find (index, text, hash);
+    if (!c) {
+        if (index->count >= index->hash_size && ml_index_grow (index) < 0) {
+            return;
+        }
+        // a collection is only added with its first track, so that it's
+        // never empty
+        c = calloc (1, sizeof (ml_collection_t));
+        if (c) {
+            c->tracks = malloc (4 * sizeof (DB_playItem_t *));
+        }
+        if (!c || !c->tracks) {
+            free (c);
+            return;
+        }
+        c->alloc = 4;
+        c->text = deadbeef->metacache_add_string (text);
+        c->hash = hash;
+        c->next = index->hash[hash & (index->hash_size-1)];
+        index->hash[hash & (index->hash_size-1)] = c;
+        index->count++;
+    }
+    else if (c->count && c->tracks[c->count-1] == it) {
+        return; // repeated value of a multivalue field
+    }
+    if (c->count == c->alloc) {
+        int alloc = c->alloc ? c->alloc * 2 : 4;
+        DB_playItem_t **tracks = realloc (c->tracks, alloc * sizeof (DB_playItem_t *));
+        if (!tracks) {
+            return;
+        }
+        c->tracks = tracks;
+        c->alloc = alloc;
+    }
+    c->tracks[c->count++] = it;
+}
+
+static int
+ml_collection_cmp (const void *a, const void *b) {
+    const ml_collection_t *ca = *(const ml_collection_t **)a;
+    const ml_collection_t *cb = *(const ml_collection_t **)b;
+    int res = strcasecmp (ca->text, cb->text);
+    return res ? res : strcmp (ca->text, cb->text);
+}
 
-    struct timeval tm1;
-    gettimeofday (&tm1, NULL);
+static void
+ml_index_sort (ml_index_t *index) {
+    if (!index->count) {
+        return;
+    }
+    index->sorted = malloc (index->count * sizeof (ml_collection_t *));
+    if (!index->sorted) {
+        return;
+    }
+    int n = 0;
+    for (uint32_t i = 0; i < index->hash_size; i++) {
+        for (ml_collection_t *c = index->hash[i]; c; c = c->next) {
+            index->sorted[n++] = c;
+        }
+    }
+    qsort (index->sorted, n, sizeof (ml_collection_t *), ml_collection_cmp);
+}
 
-    plt_insert_dir (plt, NULL, "/backup/mus/en", &scanner_terminate, add_file_info_cb, NULL);
+static void
+ml_index_free (ml_index_t *index) {
+    for (uint32_t i = 0; i < index->hash_size; i++) {
+        while (index->hash[i]) {
+            ml_collection_t *next = index->hash[i]->next;
+            deadbeef->metacache_remove_string (index->hash[i]->text);
+            free (index->hash[i]->tracks);
+            free (index->hash[i]);
+            index->hash[i] = next;
+        }
+    }
+    free (index->hash);
+    free (index->sorted);
+    memset (index, 0, sizeof (ml_index_t));
+}
 
-    struct timeval tm2;
-    gettimeofday (&tm2, NULL);
-    int ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
-    fprintf (stderr, "initial scan time: %f seconds (%d tracks)\n", ms / 1000.f, deadbeef->plt_get_item_count (plt, PL_MAIN));
+// adds each value of a multivalue field
+static void
+ml_index_add_field (ml_index_t *index, DB_playItem_t *it, const char *key) {
+    DB_metaInfo_t *m = deadbeef->pl_meta_for_key (it, key);
+    if (!m || !m->value[0]) {
+        ml_index_add (index, "Unknown", it);
+        return;
+    }
+    const char *v = m->value;
+    const char *end = m->value + m->valuesize;
+    while (v < end) {
+        if (*v) {
+            ml_index_add (index, v, it);
+        }
+        v += strlen (v) + 1;
+    }
+}
+
+static void
+ml_index_add_folder (ml_index_t *index, DB_playItem_t *it) {
+    const char *uri = deadbeef->pl_find_meta_raw (it, ":URI");
+    const char *fn = uri ? strrchr (uri, '/') : NULL;
+    if (!fn) {
+        ml_index_add (index, "Unknown", it);
+        return;
+    }
+    char folder[fn-uri+1];
+    memcpy (folder, uri, fn-uri);
+    folder[fn-uri] = 0;
+    ml_index_add (index, folder, it);
+}
+
+static ml_db_t *
+ml_db_alloc (void) {
+    ml_db_t *newdb = calloc (1, sizeof (ml_db_t));
+    if (!newdb) {
+        return NULL;
+    }
+    newdb->plt = deadbeef->plt_alloc ("medialib");
+    if (!newdb->plt) {
+        free (newdb);
+        return NULL;
+    }
+    return newdb;
+}
 
-    fprintf (stderr, "building index...\n");
-    gettimeofday (&tm1, NULL);
-    ml_db_t db;
-    memset (&db, 0, sizeof (db));
+static void
+ml_db_free_indexes (ml_db_t *olddb) {
+    for (int i = 0; i < DDB_MEDIALIB_INDEX_COUNT; i++) {
+        ml_index_free (&olddb->indexes[i]);
+    }
+    free (olddb->tracks);
+    olddb->tracks = NULL;
+    olddb->track_count = 0;
+}
 
-    ml_entry_t *tail = NULL;
+static void
+ml_db_free (ml_db_t *olddb) {
+    ml_db_free_indexes (olddb);
+    deadbeef->plt_free (olddb->plt);
+    free (olddb);
+}
 
-    DB_playItem_t *it = deadbeef->plt_get_first (plt, PL_MAIN);
+static void
+ml_db_build_indexes (ml_db_t *newdb) {
+    deadbeef->pl_lock ();
+    int count = deadbeef->plt_get_item_count (newdb->plt, PL_MAIN);
+    newdb->tracks = count ? malloc (count * sizeof (DB_playItem_t *)) : NULL;
+    if (count && !newdb->tracks) {
+        deadbeef->pl_unlock ();
+        return;
+    }
+    DB_playItem_t *it = deadbeef->plt_get_first (newdb->plt, PL_MAIN);
     while (it) {
+        // the playlist keeps the tracks referenced
+        newdb->tracks[newdb->track_count++] = it;
+        for (int i = 0; i < DDB_MEDIALIB_INDEX_COUNT; i++) {
+            if (ml_index_fields[i]) {
+                ml_index_add_field (&newdb->indexes[i], it, ml_index_fields[i]);
+            }
+            else {
+                ml_index_add_folder (&newdb->indexes[i], it);
+            }
+        }
+        DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+        deadbeef->pl_item_unref (it);
+        it = next;
+    }
+    deadbeef->pl_unlock ();
+    for (int i = 0; i < DDB_MEDIALIB_INDEX_COUNT; i++) {
+        ml_index_sort (&newdb->indexes[i]);
+    }
+}
 
-        ml_entry_t *en = malloc (sizeof (ml_entry_t));
-        memset (en, 0, sizeof (ml_entry_t));
-
-        const char *uri = deadbeef->pl_find_meta (it, ":URI");
-        const char *title = deadbeef->pl_find_meta (it, "title");
-        const char *artist = deadbeef->pl_find_meta (it, "artist");
-        const char *album = deadbeef->pl_find_meta (it, "album");
-        const char *genre = deadbeef->pl_find_meta (it, "genre");
-
-        ml_string_t *alb = ml_reg_album (&db, album);
-        ml_string_t *art = ml_reg_artist (&db, artist);
-        ml_string_t *gnr = ml_reg_genre (&db, genre);
-
-        char *fn = strrchr (uri, '/');
-        ml_string_t *fld = NULL;
-        if (fn) {
-            char folder[fn-uri+1];
-            memcpy (folder, uri, fn-uri);
-            folder[fn-uri] = 0;
-            const char *s = deadbeef->metacache_add_string (folder);
-            fld = ml_reg_folder (&db, s);
-            deadbeef->metacache_unref (s); // there should be at least 1 ref left, so it's safe
+// the listeners are called with scanner_mutex held, so that a listener
+// can't be called anymore once remove_listener has returned
+static void
+ml_notify (int event) {
+    deadbeef->mutex_lock (scanner_mutex);
+    for (int i = 0; i < ML_MAX_LISTENERS; i++) {
+        if (listeners[i].listener) {
+            listeners[i].listener (event, listeners[i].user_data);
         }
+    }
+    deadbeef->mutex_unlock (scanner_mutex);
+}
+
+// makes newdb the current library
+static void
+ml_db_publish (ml_db_t *newdb) {
+    ml_db_build_indexes (newdb);
+    deadbeef->mutex_lock (db_mutex);
+    ml_db_t *olddb = db;
+    db = newdb;
+    deadbeef->mutex_unlock (db_mutex);
+    if (olddb) {
+        ml_db_free (olddb);
+    }
+    ml_notify (DDB_MEDIALIB_EVENT_CHANGED);
+}
+
+static void
+ml_get_db_filename (char *out, size_t size) {
+    snprintf (out, size, "%s/medialib.dbpl", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+}
+
+static void
+ml_load (void) {
+    char fname[PATH_MAX];
+    ml_get_db_filename (fname, sizeof (fname));
+    ml_db_t *newdb = ml_db_alloc ();
+    if (!newdb) {
+        return;
+    }
+    deadbeef->plt_load2 (ML_FILEADD_VISIBILITY, newdb->plt, NULL, fname, &scanner_terminate, NULL, NULL);
+    ml_db_publish (newdb);
+    trace ("medialib: loaded %d tracks\n", newdb->track_count);
+}
 
-        deadbeef->metacache_ref (uri);
-        en->file = uri;
-        deadbeef->metacache_ref (title);
-        if (deadbeef->pl_get_item_flags (it) & DDB_IS_SUBTRACK) {
-            en->subtrack = deadbeef->pl_find_meta_int (it, ":TRACKNUM", -1);
+// splits the semicolon separated list in place
+static int
+ml_split_paths (char *paths, char **roots, int max) {
+    int n = 0;
+    char *saveptr = NULL;
+    for (char *root = strtok_r (paths, ";", &saveptr); root && n < max; root = strtok_r (NULL, ";", &saveptr)) {
+        // trim
+        while (*root == ' ') {
+            root++;
         }
-        else {
-            en->subtrack = -1;
+        char *e = root + strlen (root);
+        while (e > root && (e[-1] == ' ' || e[-1] == '/')) {
+            *--e = 0;
+        }
+        if (*root) {
+            roots[n++] = root;
         }
-        en->title = title;
-        en->artist = art;
-        en->album = alb;
-        en->genre = gnr;
-        en->folder = fld;
-
-        if (tail) {
-            tail->next = en;
-            tail = en;
+    }
+    return n;
+}
+
+static void
+ml_save (ml_db_t *savedb) {
+    char fname[PATH_MAX];
+    ml_get_db_filename (fname, sizeof (fname));
+    deadbeef->plt_save (savedb->plt, NULL, NULL, fname, NULL, NULL, NULL);
+}
+
+static void
+ml_watcher_changed (ml_changes_t *changes, void *user_data) {
+    deadbeef->mutex_lock (scanner_mutex);
+    if (changes->rescan) {
+        ml_changes_free (changes);
+        scan_requested = 1;
+    }
+    else {
+        if (changes_tail) {
+            changes_tail->next = changes;
         }
         else {
-            tail = db.tracks = en;
+            changes_head = changes;
         }
+        changes_tail = changes;
+    }
+    deadbeef->cond_signal (scanner_cond);
+    deadbeef->mutex_unlock (scanner_mutex);
+}
 
+// (re)starts watching the folders, if they differ from the watched ones
+static void
+ml_watch (const char *paths, char **roots, int nroots) {
+    int enabled = deadbeef->conf_get_int ("medialib.watch", 1);
+    if (watcher && enabled && !strcmp (watched_paths, paths)) {
+        return;
+    }
+    if (watcher) {
+        ml_watcher_stop (watcher);
+        watcher = NULL;
+        free (watched_paths);
+        watched_paths = NULL;
+    }
+    if (enabled && nroots) {
+        int delay = deadbeef->conf_get_int ("medialib.watch_delay_ms", ML_DEFAULT_WATCH_DELAY_MS);
+        watcher = ml_watcher_start (roots, nroots, delay, ml_watcher_changed, NULL);
+        if (watcher) {
+            watched_paths = strdup (paths);
+        }
+    }
+}
+
+static void
+ml_scan (const char *paths) {
+    char *p = strdup (paths);
+    char *roots[ML_MAX_ROOTS];
+    int nroots = ml_split_paths (p, roots, ML_MAX_ROOTS);
+
+    // start watching first, so that nothing changed during the scan is missed
+    ml_watch (paths, roots, nroots);
+
+    // no folders configured: keep the library and its file as they are
+    if (!nroots) {
+        free (p);
+        return;
+    }
+
+    ml_db_t *newdb = ml_db_alloc ();
+    if (!newdb) {
+        free (p);
+        return;
+    }
+
+    DB_playItem_t *after = NULL;
+    for (int i = 0; i < nroots && !scanner_terminate; i++) {
+        DB_playItem_t *inserted = plt_insert_dir2 (ML_FILEADD_VISIBILITY, newdb->plt, after, roots[i], &scanner_terminate, NULL, NULL);
+        if (inserted) {
+            after = inserted;
+        }
+    }
+    free (p);
+
+    if (scanner_terminate) {
+        ml_db_free (newdb);
+        return;
+    }
+
+    trace ("medialib: scanned %d tracks\n", deadbeef->plt_get_item_count (newdb->plt, PL_MAIN));
+
+    ml_save (newdb);
+    ml_db_publish (newdb);
+}
+
+// returns 1 if any of the folders containing path has changed
+static int
+ml_parent_changed (ml_changes_t *changes, const char *path) {
+    for (const char *p = strchr (path + 1, '/'); p; p = strchr (p + 1, '/')) {
+        if (ml_changes_find (changes, path, p - path)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void
+ml_db_apply_moves (ml_db_t *curdb, ml_changes_t *changes) {
+    for (int m = 0; m < changes->nmoves; m++) {
+        const char *from = changes->moves[m].from;
+        const char *to = changes->moves[m].to;
+        size_t fromlen = strlen (from);
+        size_t tolen = strlen (to);
+        DB_playItem_t *it = deadbeef->plt_get_first (curdb->plt, PL_MAIN);
+        while (it) {
+            DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+            const char *uri = deadbeef->pl_find_meta_raw (it, ":URI");
+            if (uri && ml_path_is_under (uri, to, tolen)) {
+                // replaced by the move
+                deadbeef->plt_remove_item (curdb->plt, it);
+            }
+            else if (uri && ml_path_is_under (uri, from, fromlen)) {
+                char newuri[PATH_MAX];
+                snprintf (newuri, sizeof (newuri), "%s%s", to, uri + fromlen);
+                deadbeef->pl_replace_meta (it, ":URI", newuri);
+            }
+            deadbeef->pl_item_unref (it);
+            it = next;
+        }
+    }
+}
+
+// updates the library in place: renames the moved tracks, and replaces the
+// tracks of the changed files and folders
+static void
+ml_apply_changes (ml_changes_t *changes) {
+    ddb_playlist_t *plt = deadbeef->plt_alloc ("medialib-changes");
+    if (!plt) {
+        return;
+    }
+
+    // read the changed files without locking the library; a folder is read
+    // with everything in it
+    for (uint32_t i = 0; i < changes->hash_size && !scanner_terminate; i++) {
+        for (ml_change_t *c = changes->hash[i]; c && !scanner_terminate; c = c->next) {
+            struct stat st;
+            if (c->kind != ML_CHANGE_UPDATE || ml_parent_changed (changes, c->path) || stat (c->path, &st) < 0) {
+                continue;
+            }
+            DB_playItem_t *after = deadbeef->plt_get_last (plt, PL_MAIN);
+            if (S_ISDIR (st.st_mode)) {
+                plt_insert_dir2 (ML_FILEADD_VISIBILITY, plt, after, c->path, &scanner_terminate, NULL, NULL);
+            }
+            else {
+                deadbeef->plt_insert_file2 (ML_FILEADD_VISIBILITY, plt, after, c->path, &scanner_terminate, NULL, NULL);
+            }
+            if (after) {
+                deadbeef->pl_item_unref (after);
+            }
+        }
+    }
+    if (scanner_terminate) {
+        deadbeef->plt_free (plt);
+        return;
+    }
+
+    deadbeef->mutex_lock (db_mutex);
+    deadbeef->pl_lock ();
+
+    ml_db_apply_moves (db, changes);
+
+    int removed = 0;
+    DB_playItem_t *it = deadbeef->plt_get_first (db->plt, PL_MAIN);
+    while (it) {
         DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+        const char *uri = deadbeef->pl_find_meta_raw (it, ":URI");
+        if (uri && (ml_changes_find (changes, uri, strlen (uri)) || ml_parent_changed (changes, uri))) {
+            deadbeef->plt_remove_item (db->plt, it);
+            removed++;
+        }
         deadbeef->pl_item_unref (it);
         it = next;
     }
-    ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
 
-    int nalb = 0;
-    int nart = 0;
-    int ngnr = 0;
-    int nfld = 0;
-    ml_string_t *s;
-    for (s = db.album; s; s = s->next, nalb++);
-    for (s = db.artist; s; s = s->next, nart++);
-    for (s = db.genre; s; s = s->next, ngnr++);
-    for (s = db.folder; s; s = s->next, nfld++);
+    int added = 0;
+    DB_playItem_t *after = deadbeef->plt_get_last (db->plt, PL_MAIN);
+    it = deadbeef->plt_get_first (plt, PL_MAIN);
+    while (it) {
+        DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+        deadbeef->plt_remove_item (plt, it);
+        deadbeef->plt_insert_item (db->plt, after, it);
+        if (after) {
+            deadbeef->pl_item_unref (after);
+        }
+        after = it;
+        added++;
+        it = next;
+    }
+    if (after) {
+        deadbeef->pl_item_unref (after);
+    }
+
+    deadbeef->pl_unlock ();
 
-    fprintf (stderr, "index build time: %f seconds (%d albums, %d artists, %d genres, %d folders)\n", ms / 1000.f, nalb, nart, ngnr, nfld);
+    ml_db_free_indexes (db);
+    ml_db_build_indexes (db);
+    deadbeef->mutex_unlock (db_mutex);
 
+    trace ("medialib: %d moves, %d tracks removed, %d added\n", changes->nmoves, removed, added);
     deadbeef->plt_free (plt);
+
+    ml_save (db);
+    ml_notify (DDB_MEDIALIB_EVENT_CHANGED);
+}
+
+static void
+ml_free_changes_queue (void) {
+    while (changes_head) {
+        ml_changes_t *next = changes_head->next;
+        ml_changes_free (changes_head);
+        changes_head = next;
+    }
+    changes_tail = NULL;
+}
+
+static void
+scanner_thread (void *none) {
+    ml_load ();
+
+    deadbeef->mutex_lock (scanner_mutex);
+    while (!scanner_terminate) {
+        if (scan_requested) {
+            scan_requested = 0;
+            // the scan picks up all the changes made until now
+            ml_free_changes_queue ();
+            char *paths = scanned_paths ? strdup (scanned_paths) : NULL;
+            scanner_busy = 1;
+            deadbeef->mutex_unlock (scanner_mutex);
+
+            ml_notify (DDB_MEDIALIB_EVENT_SCANNER);
+            if (paths) {
+                ml_scan (paths);
+                free (paths);
+            }
+
+            deadbeef->mutex_lock (scanner_mutex);
+            scanner_busy = 0;
+            deadbeef->mutex_unlock (scanner_mutex);
+            ml_notify (DDB_MEDIALIB_EVENT_SCANNER);
+            deadbeef->mutex_lock (scanner_mutex);
+        }
+        else if (changes_head) {
+            ml_changes_t *changes = changes_head;
+            changes_head = changes->next;
+            if (!changes_head) {
+                changes_tail = NULL;
+            }
+            deadbeef->mutex_unlock (scanner_mutex);
+
+            ml_apply_changes (changes);
+            ml_changes_free (changes);
+
+            deadbeef->mutex_lock (scanner_mutex);
+        }
+        else {
+            // deadbeef->cond_wait locks the mutex itself, so a signal sent
+            // between unlocking and waiting would be lost; wait with the
+            // mutex held (once) instead, and recheck the conditions
+            while (!scanner_terminate && !scan_requested && !changes_head) {
+                pthread_cond_wait ((pthread_cond_t *)scanner_cond, (pthread_mutex_t *)scanner_mutex);
+            }
+        }
+    }
+    deadbeef->mutex_unlock (scanner_mutex);
+
+    if (watcher) {
+        ml_watcher_stop (watcher);
+        watcher = NULL;
+    }
+    free (watched_paths);
+    watched_paths = NULL;
+}
+
+// requests a scan if the configured paths differ from the scanned ones, or
+// if force is set
+static void
+ml_request_scan (int force) {
+    char paths[4096];
+    deadbeef->conf_get_str ("medialib.paths", "", paths, sizeof (paths));
+    deadbeef->mutex_lock (scanner_mutex);
+    if (force || !scanned_paths || strcmp (scanned_paths, paths)) {
+        free (scanned_paths);
+        scanned_paths = strdup (paths);
+        scan_requested = 1;
+        deadbeef->cond_signal (scanner_cond);
+    }
+    deadbeef->mutex_unlock (scanner_mutex);
+}
+
+static void
+ml_scan_api (void) {
+    ml_request_scan (1);
+}
+
+static int
+ml_is_scanning (void) {
+    deadbeef->mutex_lock (scanner_mutex);
+    int res = scanner_busy || scan_requested;
+    deadbeef->mutex_unlock (scanner_mutex);
+    return res;
+}
+
+static int
+ml_add_listener (ddb_medialib_listener_t listener, void *user_data) {
+    int res = -1;
+    deadbeef->mutex_lock (scanner_mutex);
+    for (int i = 0; i < ML_MAX_LISTENERS; i++) {
+        if (!listeners[i].listener) {
+            listeners[i].listener = listener;
+            listeners[i].user_data = user_data;
+            res = i;
+            break;
+        }
+    }
+    deadbeef->mutex_unlock (scanner_mutex);
+    return res;
+}
+
+static void
+ml_remove_listener (int listener_id) {
+    if (listener_id >= 0 && listener_id < ML_MAX_LISTENERS) {
+        deadbeef->mutex_lock (scanner_mutex);
+        listeners[listener_id].listener = NULL;
+        listeners[listener_id].user_data = NULL;
+        deadbeef->mutex_unlock (scanner_mutex);
+    }
+}
+
+static void
+ml_lock (void) {
+    deadbeef->mutex_lock (db_mutex);
+}
+
+static void
+ml_unlock (void) {
+    deadbeef->mutex_unlock (db_mutex);
+}
+
+static int
+ml_get_track_count (void) {
+    return db ? db->track_count : 0;
+}
+
+static DB_playItem_t *
+ml_get_track (int n) {
+    if (!db || n < 0 || n >= db->track_count) {
+        return NULL;
+    }
+    return db->tracks[n];
+}
+
+static int
+ml_get_value_count (int index) {
+    if (!db || index < 0 || index >= DDB_MEDIALIB_INDEX_COUNT || !db->indexes[index].sorted) {
+        return 0;
+    }
+    return db->indexes[index].count;
+}
+
+static const char *
+ml_get_value (int index, int n) {
+    if (n < 0 || n >= ml_get_value_count (index)) {
+        return NULL;
+    }
+    return db->indexes[index].sorted[n]->text;
+}
+
+static ml_collection_t *
+ml_find_collection (int index, const char *value) {
+    if (!db || index < 0 || index >= DDB_MEDIALIB_INDEX_COUNT || !value) {
+        return NULL;
+    }
+    return ml_index_find (&db->indexes[index], value, ml_hash (value));
+}
+
+static int
+ml_get_value_track_count (int index, const char *value) {
+    ml_collection_t *c = ml_find_collection (index, value);
+    return c ? c->count : 0;
+}
+
+static DB_playItem_t *
+ml_get_value_track (int index, const char *value, int n) {
+    ml_collection_t *c = ml_find_collection (index, value);
+    if (!c || n < 0 || n >= c->count) {
+        return NULL;
+    }
+    return c->tracks[n];
 }
 
 static int
 ml_connect (void) {
+    db_mutex = deadbeef->mutex_create ();
+    scanner_mutex = deadbeef->mutex_create ();
+    scanner_cond = deadbeef->cond_create ();
+    scanner_terminate = 0;
     tid = deadbeef->thread_start_low_priority (scanner_thread, NULL);
+    ml_request_scan (0);
     return 0;
 }
 
 static int
 ml_stop (void) {
     if (tid) {
+        deadbeef->mutex_lock (scanner_mutex);
         scanner_terminate = 1;
+        deadbeef->cond_signal (scanner_cond);
+        deadbeef->mutex_unlock (scanner_mutex);
         deadbeef->thread_join (tid);
         tid = 0;
     }
-
+    if (db) {
+        ml_db_free (db);
+        db = NULL;
+    }
+    free (scanned_paths);
+    scanned_paths = NULL;
+    ml_free_changes_queue ();
+    if (scanner_cond) {
+        deadbeef->cond_free (scanner_cond);
+        scanner_cond = 0;
+    }
+    if (scanner_mutex) {
+        deadbeef->mutex_free (scanner_mutex);
+        scanner_mutex = 0;
+    }
+    if (db_mutex) {
+        deadbeef->mutex_free (db_mutex);
+        db_mutex = 0;
+    }
     return 0;
 }
 
 static int
 ml_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+    switch (id) {
+    case DB_EV_CONFIGCHANGED:
+        if (tid) {
+            ml_request_scan (0);
+        }
+        break;
+    }
     return 0;
 }
 
-typedef struct {
-    DB_misc_t plugin;
-} ddb_medialib_plugin_t;
+static const char settings_dlg[] =
+    "property \"Music folders (separated by ;)\" entry medialib.paths \"\";\n"
+    "property \"Watch the folders for changes\" checkbox medialib.watch 1;\n"
+;
 
 // define plugin interface
 static ddb_medialib_plugin_t plugin = {
     .plugin.plugin.api_vmajor = 1,
-    .plugin.plugin.api_vminor = 0,
+    .plugin.plugin.api_vminor = 10,
     .plugin.plugin.version_major = 0,
-    .plugin.plugin.version_minor = 1,
+    .plugin.plugin.version_minor = 2,
     .plugin.plugin.type = DB_PLUGIN_MISC,
     .plugin.plugin.id = "medialib",
     .plugin.plugin.name = "Media Library",
@@ -252,8 +896,20 @@ static ddb_medialib_plugin_t plugin = {
     .plugin.plugin.website = "http://deadbeef.sf.net",
     .plugin.plugin.connect = ml_connect,
     .plugin.plugin.stop = ml_stop,
-//    .plugin.plugin.configdialog = settings_dlg,
+    .plugin.plugin.configdialog = settings_dlg,
     .plugin.plugin.message = ml_message,
+    .add_listener = ml_add_listener,
+    .remove_listener = ml_remove_listener,
+    .scan = ml_scan_api,
+    .is_scanning = ml_is_scanning,
+    .lock = ml_lock,
+    .unlock = ml_unlock,
+    .get_track_count = ml_get_track_count,
+    .get_track = ml_get_track,
+    .get_value_count = ml_get_value_count,
+    .get_value = ml_get_value,
+    .get_value_track_count = ml_get_value_track_count,
+    .get_value_track = ml_get_value_track,
 };
 
 DB_plugin_t *
@@ -261,6 +917,6 @@ medialib_load (DB_functions_t *api) {
     deadbeef = api;
 
     // hack: we need original function without overrides
-    plt_insert_dir = deadbeef->plt_insert_dir;
+    plt_insert_dir2 = deadbeef->plt_insert_dir2;
     return DB_PLUGIN (&plugin);
 }
@@ -0,0 +1,82 @@
+/*
+    Media Library plugin for DeaDBeeF Player
+    Copyright (C) 2009-2014 Alexey Yakovenko
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef __MEDIALIB_H
+#define __MEDIALIB_H
+
+#include "../../deadbeef.h"
+
+// the library indexes, each one maps the distinct values of a field to the
+// tracks which have the value
+enum {
+    DDB_MEDIALIB_INDEX_ALBUM,
+    DDB_MEDIALIB_INDEX_ARTIST,
+    DDB_MEDIALIB_INDEX_GENRE,
+    DDB_MEDIALIB_INDEX_FOLDER,
+    DDB_MEDIALIB_INDEX_COUNT
+};
+
+enum {
+    // the library contents have been replaced, all values and tracks
+    // obtained before are invalid
+    DDB_MEDIALIB_EVENT_CHANGED = 1,
+    // the scanner has started or finished, see is_scanning
+    DDB_MEDIALIB_EVENT_SCANNER = 2,
+};
+
+typedef void (*ddb_medialib_listener_t) (int event, void *user_data);
+
+typedef struct {
+    DB_misc_t plugin;
+
+    // the listeners are called from the scanner thread, without the library
+    // being locked
+    // returns listener id, or -1 on error
+    int (*add_listener) (ddb_medialib_listener_t listener, void *user_data);
+    void (*remove_listener) (int listener_id);
+
+    // rescan the folders from the medialib.paths config var (separated by
+    // semicolons) in background
+    void (*scan) (void);
+    int (*is_scanning) (void);
+
+    // the library must be locked while the functions below are called, and
+    // while their results are used.
+    // the tracks are not referenced, use pl_item_ref to keep them after
+    // unlocking.
+    void (*lock) (void);
+    void (*unlock) (void);
+
+    int (*get_track_count) (void);
+    DB_playItem_t *(*get_track) (int n);
+
+    // distinct values of an index, in alphabetical order
+    int (*get_value_count) (int index);
+    const char *(*get_value) (int index, int n);
+
+    // tracks with the value, in the library order, the lookup is exact and
+    // O(1); returns 0/NULL if there's no such value
+    int (*get_value_track_count) (int index, const char *value);
+    DB_playItem_t *(*get_value_track) (int index, const char *value, int n);
+} ddb_medialib_plugin_t;
+
+#endif
@@ -0,0 +1,554 @@
+/*
+    Media Library plugin for DeaDBeeF Player
+    Copyright (C) 2009-2014 Alexey Yakovenko
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+// Watches the library folders with inotify.
+//
+// The events are collected into a batch until there are none for delay_ms
+// (or for up to 10 times that during a long burst), so that copying an album
+// results in a single library update. Within a batch, each path is recorded
+// once with its latest state, and a move carries the pending change of its
+// source along.
+//
+// Every folder needs its own inotify watch: the existing ones are added when
+// the watcher starts, the created and moved in ones when their events
+// arrive.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "watcher.h"
+#include "../../deadbeef.h"
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(fmt,...)
+
+#define ML_CHANGES_INITIAL_HASH_SIZE 64
+
+extern DB_functions_t *deadbeef;
+
+static uint32_t
+ml_changes_hash (const char *path, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)path[i]) * 16777619u;
+    }
+    return h;
+}
+
+ml_changes_t *
+ml_changes_alloc (void) {
+    ml_changes_t *changes = calloc (1, sizeof (ml_changes_t));
+    if (!changes) {
+        return NULL;
+    }
+    changes->hash = calloc (ML_CHANGES_INITIAL_HASH_SIZE, sizeof (ml_change_t *));
+    if (!changes->hash) {
+        free (changes);
+        return NULL;
+    }
+    changes->hash_size = ML_CHANGES_INITIAL_HASH_SIZE;
+    return changes;
+}
+
+void
+ml_changes_free (ml_changes_t *changes) {
+    for (uint32_t i = 0; i < changes->hash_size; i++) {
+        while (changes->hash[i]) {
+            ml_change_t *next = changes->hash[i]->next;
+            free (changes->hash[i]->path);
+            free (changes->hash[i]);
+            changes->hash[i] = next;
+        }
+    }
+    for (int i = 0; i < changes->nmoves; i++) {
+        free (changes->moves[i].from);
+        free (changes->moves[i].to);
+    }
+    free (changes->moves);
+    free (changes->hash);
+    free (changes);
+}
+
+ml_change_t *
+ml_changes_find (ml_changes_t *changes, const char *path, size_t len) {
+    uint32_t hash = ml_changes_hash (path, len);
+    for (ml_change_t *c = changes->hash[hash & (changes->hash_size-1)]; c; c = c->next) {
+        if (c->hash == hash && !strncmp (c->path, path, len) && !c->path[len]) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static void
+ml_changes_grow (ml_changes_t *changes) {
+    uint32_t size = changes->hash_size * 2;
+    ml_change_t **hash = calloc (size, sizeof (ml_change_t *));
+    if (!hash) {
+        return;
+    }
+    for (uint32_t i = 0; i < changes->hash_size; i++) {
+        ml_change_t *c = changes->hash[i];
+        while (c) {
+            ml_change_t *next = c->next;
+            c->next = hash[c->hash & (size-1)];
+            hash[c->hash & (size-1)] = c;
+            c = next;
+        }
+    }
+    free (changes->hash);
+    changes->hash = hash;
+    changes->hash_size = size;
+}
+
+// takes the ownership of path
+static void
+ml_changes_insert (ml_changes_t *changes, char *path, int kind) {
+    size_t len = strlen (path);
+    ml_change_t *c = ml_changes_find (changes, path, len);
+    if (c) {
+        c->kind = kind;
+        free (path);
+        return;
+    }
+    c = calloc (1, sizeof (ml_change_t));
+    if (!c) {
+        free (path);
+        return;
+    }
+    if (changes->count >= changes->hash_size) {
+        ml_changes_grow (changes);
+    }
+    c->path = path;
+    c->hash = ml_changes_hash (path, len);
+    c->kind = kind;
+    c->next = changes->hash[c->hash & (changes->hash_size-1)];
+    changes->hash[c->hash & (changes->hash_size-1)] = c;
+    changes->count++;
+}
+
+static void
+ml_changes_set (ml_changes_t *changes, const char *path, int kind) {
+    char *p = strdup (path);
+    if (p) {
+        ml_changes_insert (changes, p, kind);
+    }
+}
+
+int
+ml_path_is_under (const char *path, const char *dir, size_t dirlen) {
+    return !strncmp (path, dir, dirlen) && (path[dirlen] == 0 || path[dirlen] == '/');
+}
+
+// the changes at the destination of a move are replaced by the changes of
+// the source
+static void
+ml_changes_move (ml_changes_t *changes, const char *from, const char *to) {
+    size_t fromlen = strlen (from);
+    size_t tolen = strlen (to);
+    ml_change_t *moved = NULL;
+    for (uint32_t i = 0; i < changes->hash_size; i++) {
+        ml_change_t **pc = &changes->hash[i];
+        while (*pc) {
+            ml_change_t *c = *pc;
+            int is_to = ml_path_is_under (c->path, to, tolen);
+            int is_from = ml_path_is_under (c->path, from, fromlen);
+            if (is_to || is_from) {
+                *pc = c->next;
+                changes->count--;
+                if (is_from) {
+                    c->next = moved;
+                    moved = c;
+                }
+                else {
+                    free (c->path);
+                    free (c);
+                }
+                continue;
+            }
+            pc = &c->next;
+        }
+    }
+    while (moved) {
+        ml_change_t *next = moved->next;
+        size_t len = tolen + strlen (moved->path + fromlen) + 1;
+        char *path = malloc (len);
+        if (path) {
+            snprintf (path, len, "%s%s", to, moved->path + fromlen);
+            ml_changes_insert (changes, path, moved->kind);
+        }
+        free (moved->path);
+        free (moved);
+        moved = next;
+    }
+
+    if (changes->nmoves == changes->alloc_moves) {
+        int alloc = changes->alloc_moves ? changes->alloc_moves * 2 : 8;
+        ml_move_t *moves = realloc (changes->moves, alloc * sizeof (ml_move_t));
+        if (!moves) {
+            changes->rescan = 1;
+            return;
+        }
+        changes->moves = moves;
+        changes->alloc_moves = alloc;
+    }
+    changes->moves[changes->nmoves].from = strdup (from);
+    changes->moves[changes->nmoves].to = strdup (to);
+    changes->nmoves++;
+}
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#define ML_WATCH_MASK (IN_CREATE | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DONT_FOLLOW | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+// how often the watcher thread checks for termination
+#define ML_WATCHER_POLL_MS 200
+
+// during a continuous burst, the events are delivered at least this often
+#define ML_MAX_DELAY_FACTOR 10
+
+struct ml_watcher_s {
+    int fd;
+    intptr_t tid;
+    int terminate;
+    int delay_ms;
+    char **roots;
+    int nroots;
+
+    // folder paths by watch descriptor
+    char **watches;
+    int nwatches;
+
+    ml_changes_t *changes;
+    int64_t first_event;
+    int64_t last_event;
+
+    // IN_MOVED_FROM waiting for its IN_MOVED_TO
+    char *move_from;
+    uint32_t move_cookie;
+    int move_isdir;
+
+    ml_watcher_callback_t callback;
+    void *user_data;
+};
+
+static int64_t
+ml_time_ms (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+ml_watcher_set_watch (ml_watcher_t *w, int wd, const char *path) {
+    if (wd >= w->nwatches) {
+        int n = w->nwatches ? w->nwatches : 256;
+        while (n <= wd) {
+            n *= 2;
+        }
+        char **watches = realloc (w->watches, n * sizeof (char *));
+        if (!watches) {
+            return;
+        }
+        memset (watches + w->nwatches, 0, (n - w->nwatches) * sizeof (char *));
+        w->watches = watches;
+        w->nwatches = n;
+    }
+    free (w->watches[wd]);
+    w->watches[wd] = path ? strdup (path) : NULL;
+}
+
+static void
+ml_watcher_add_dir (ml_watcher_t *w, const char *path) {
+    int wd = inotify_add_watch (w->fd, path, ML_WATCH_MASK);
+    if (wd < 0) {
+        if (errno == ENOSPC) {
+            fprintf (stderr, "medialib: out of inotify watches, please increase fs.inotify.max_user_watches\n");
+        }
+        return;
+    }
+    ml_watcher_set_watch (w, wd, path);
+
+    DIR *dir = opendir (path);
+    if (!dir) {
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir (dir))) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        char fullname[PATH_MAX];
+        if (snprintf (fullname, sizeof (fullname), "%s/%s", path, de->d_name) >= sizeof (fullname)) {
+            continue;
+        }
+        int isdir = de->d_type == DT_DIR;
+        if (de->d_type == DT_UNKNOWN) {
+            struct stat st;
+            isdir = !lstat (fullname, &st) && S_ISDIR (st.st_mode);
+        }
+        if (isdir) {
+            ml_watcher_add_dir (w, fullname);
+        }
+    }
+    closedir (dir);
+}
+
+static void
+ml_watcher_remove_dir (ml_watcher_t *w, const char *path) {
+    size_t len = strlen (path);
+    for (int wd = 0; wd < w->nwatches; wd++) {
+        if (w->watches[wd] && ml_path_is_under (w->watches[wd], path, len)) {
+            inotify_rm_watch (w->fd, wd);
+            ml_watcher_set_watch (w, wd, NULL);
+        }
+    }
+}
+
+// the moved folder keeps its watches
+static void
+ml_watcher_rename_dir (ml_watcher_t *w, const char *from, const char *to) {
+    size_t fromlen = strlen (from);
+    for (int wd = 0; wd < w->nwatches; wd++) {
+        if (w->watches[wd] && ml_path_is_under (w->watches[wd], from, fromlen)) {
+            char path[PATH_MAX];
+            snprintf (path, sizeof (path), "%s%s", to, w->watches[wd] + fromlen);
+            ml_watcher_set_watch (w, wd, path);
+        }
+    }
+}
+
+// IN_MOVED_FROM without IN_MOVED_TO: moved out of the watched folders
+static void
+ml_watcher_flush_move (ml_watcher_t *w) {
+    if (!w->move_from) {
+        return;
+    }
+    if (w->move_isdir) {
+        ml_watcher_remove_dir (w, w->move_from);
+    }
+    ml_changes_set (w->changes, w->move_from, ML_CHANGE_REMOVE);
+    free (w->move_from);
+    w->move_from = NULL;
+}
+
+static void
+ml_watcher_event (ml_watcher_t *w, const struct inotify_event *ev) {
+    if (ev->mask & IN_Q_OVERFLOW) {
+        w->changes->rescan = 1;
+        return;
+    }
+    if (ev->wd < 0 || ev->wd >= w->nwatches || !w->watches[ev->wd]) {
+        return;
+    }
+    if (ev->mask & IN_IGNORED) {
+        ml_watcher_set_watch (w, ev->wd, NULL);
+        return;
+    }
+    if (!ev->len || ev->name[0] == '.') {
+        return;
+    }
+
+    char path[PATH_MAX];
+    if (snprintf (path, sizeof (path), "%s/%s", w->watches[ev->wd], ev->name) >= sizeof (path)) {
+        return;
+    }
+    int isdir = (ev->mask & IN_ISDIR) ? 1 : 0;
+    trace ("medialib: event %08x %s\n", ev->mask, path);
+
+    if (ev->mask & IN_MOVED_TO) {
+        if (w->move_from && w->move_cookie == ev->cookie) {
+            ml_changes_move (w->changes, w->move_from, path);
+            if (isdir) {
+                ml_watcher_rename_dir (w, w->move_from, path);
+            }
+            free (w->move_from);
+            w->move_from = NULL;
+            return;
+        }
+        ml_watcher_flush_move (w);
+        if (isdir) {
+            ml_watcher_add_dir (w, path);
+        }
+        ml_changes_set (w->changes, path, ML_CHANGE_UPDATE);
+        return;
+    }
+
+    ml_watcher_flush_move (w);
+    if (ev->mask & IN_MOVED_FROM) {
+        w->move_from = strdup (path);
+        w->move_cookie = ev->cookie;
+        w->move_isdir = isdir;
+    }
+    else if (ev->mask & (IN_CREATE | IN_CLOSE_WRITE)) {
+        if (isdir) {
+            // the files which were created before the watch was added are
+            // found by reading the whole folder
+            ml_watcher_add_dir (w, path);
+        }
+        ml_changes_set (w->changes, path, ML_CHANGE_UPDATE);
+    }
+    else if (ev->mask & IN_DELETE) {
+        ml_changes_set (w->changes, path, ML_CHANGE_REMOVE);
+    }
+}
+
+static int
+ml_watcher_has_changes (ml_watcher_t *w) {
+    return w->changes->count || w->changes->nmoves || w->changes->rescan || w->move_from;
+}
+
+static void
+ml_watcher_deliver (ml_watcher_t *w) {
+    ml_watcher_flush_move (w);
+    ml_changes_t *changes = w->changes;
+    w->changes = ml_changes_alloc ();
+    if (!w->changes) {
+        // keep collecting into the old batch
+        w->changes = changes;
+        return;
+    }
+    trace ("medialib: delivering %d changes, %d moves\n", changes->count, changes->nmoves);
+    w->callback (changes, w->user_data);
+}
+
+static void
+ml_watcher_thread (void *ctx) {
+    ml_watcher_t *w = ctx;
+    for (int i = 0; i < w->nroots && !w->terminate; i++) {
+        ml_watcher_add_dir (w, w->roots[i]);
+    }
+
+    char buf[sizeof (struct inotify_event) + NAME_MAX + 1] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    while (!w->terminate) {
+        int timeout = ML_WATCHER_POLL_MS;
+        if (ml_watcher_has_changes (w)) {
+            int64_t now = ml_time_ms ();
+            int64_t deadline = w->last_event + w->delay_ms;
+            if (deadline > w->first_event + w->delay_ms * ML_MAX_DELAY_FACTOR) {
+                deadline = w->first_event + w->delay_ms * ML_MAX_DELAY_FACTOR;
+            }
+            if (now >= deadline) {
+                ml_watcher_deliver (w);
+                continue;
+            }
+            if (deadline - now < timeout) {
+                timeout = (int)(deadline - now);
+            }
+        }
+
+        struct pollfd pfd = { .fd = w->fd, .events = POLLIN };
+        if (poll (&pfd, 1, timeout) <= 0) {
+            continue;
+        }
+        ssize_t len = read (w->fd, buf, sizeof (buf));
+        if (len <= 0) {
+            continue;
+        }
+        int64_t now = ml_time_ms ();
+        if (!ml_watcher_has_changes (w)) {
+            w->first_event = now;
+        }
+        w->last_event = now;
+        for (char *p = buf; p < buf + len; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            ml_watcher_event (w, ev);
+            p += sizeof (struct inotify_event) + ev->len;
+        }
+    }
+}
+
+ml_watcher_t *
+ml_watcher_start (char **roots, int nroots, int delay_ms, ml_watcher_callback_t callback, void *user_data) {
+    ml_watcher_t *w = calloc (1, sizeof (ml_watcher_t));
+    if (!w) {
+        return NULL;
+    }
+    w->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    w->changes = ml_changes_alloc ();
+    w->roots = calloc (nroots + 1, sizeof (char *));
+    if (w->fd < 0 || !w->changes || !w->roots) {
+        goto error;
+    }
+    for (int i = 0; i < nroots; i++) {
+        w->roots[i] = strdup (roots[i]);
+    }
+    w->nroots = nroots;
+    w->delay_ms = delay_ms;
+    w->callback = callback;
+    w->user_data = user_data;
+    w->tid = deadbeef->thread_start_low_priority (ml_watcher_thread, w);
+    if (!w->tid) {
+        goto error;
+    }
+    return w;
+error:
+    ml_watcher_stop (w);
+    return NULL;
+}
+
+void
+ml_watcher_stop (ml_watcher_t *w) {
+    if (w->tid) {
+        w->terminate = 1;
+        deadbeef->thread_join (w->tid);
+    }
+    if (w->fd >= 0) {
+        close (w->fd);
+    }
+    for (int i = 0; i < w->nwatches; i++) {
+        free (w->watches[i]);
+    }
+    free (w->watches);
+    for (int i = 0; i < w->nroots; i++) {
+        free (w->roots[i]);
+    }
+    free (w->roots);
+    free (w->move_from);
+    if (w->changes) {
+        ml_changes_free (w->changes);
+    }
+    free (w);
+}
+
+#else
+
+ml_watcher_t *
+ml_watcher_start (char **roots, int nroots, int delay_ms, ml_watcher_callback_t callback, void *user_data) {
+    return NULL;
+}
+
+void
+ml_watcher_stop (ml_watcher_t *w) {
+}
+
+#endif
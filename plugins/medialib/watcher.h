@@ -0,0 +1,92 @@
+/*
+    Media Library plugin for DeaDBeeF Player
+    Copyright (C) 2009-2014 Alexey Yakovenko
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef __MEDIALIB_WATCHER_H
+#define __MEDIALIB_WATCHER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum {
+    // created or modified, needs to be read again
+    ML_CHANGE_UPDATE = 1,
+    // deleted, or moved out of the watched folders
+    ML_CHANGE_REMOVE = 2,
+};
+
+typedef struct ml_change_s {
+    char *path;
+    uint32_t hash;
+    int kind;
+    struct ml_change_s *next;
+} ml_change_t;
+
+typedef struct {
+    char *from;
+    char *to;
+} ml_move_t;
+
+// A batch of coalesced filesystem events.
+// The moves must be applied first, in order, then every track at a changed
+// path, or under a changed folder, must be dropped, and the paths with
+// ML_CHANGE_UPDATE read again.
+typedef struct ml_changes_s {
+    ml_change_t **hash;
+    uint32_t hash_size;
+    int count;
+    ml_move_t *moves;
+    int nmoves;
+    int alloc_moves;
+    // events were lost, everything needs to be scanned again
+    int rescan;
+    struct ml_changes_s *next;
+} ml_changes_t;
+
+typedef struct ml_watcher_s ml_watcher_t;
+
+// the callback is called from the watcher thread, and takes the ownership of
+// the changes
+typedef void (*ml_watcher_callback_t) (ml_changes_t *changes, void *user_data);
+
+ml_changes_t *
+ml_changes_alloc (void);
+
+void
+ml_changes_free (ml_changes_t *changes);
+
+ml_change_t *
+ml_changes_find (ml_changes_t *changes, const char *path, size_t len);
+
+// returns 1 if path is dir, or is inside of it
+int
+ml_path_is_under (const char *path, const char *dir, size_t dirlen);
+
+// watches the folders and all their subfolders, the callback gets the events
+// when there were none for delay_ms;
+// returns NULL if watching is not supported
+ml_watcher_t *
+ml_watcher_start (char **roots, int nroots, int delay_ms, ml_watcher_callback_t callback, void *user_data);
+
+void
+ml_watcher_stop (ml_watcher_t *watcher);
+
+#endif
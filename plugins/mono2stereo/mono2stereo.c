@@ -83,6 +83,20 @@ m2s_process (ddb_dsp_context_t *ctx, float *samples, int nframes, int maxframes,
     return nframes;
 }
 
+void
+m2s_negotiate (ddb_dsp_context_t *ctx, ddb_waveformat_t *fmt, float *ratio, int *latency) {
+    if (fmt->channels < 2) {
+        fmt->channels = 2;
+        fmt->channelmask = 3;
+    }
+}
+
+// stereo and multichannel input is passed through as is
+int
+m2s_can_bypass (ddb_dsp_context_t *ctx, ddb_waveformat_t *fmt) {
+    return fmt->channels >= 2;
+}
+
 const char *
 m2s_get_param_name (int p) {
     switch (p) {
@@ -138,10 +152,12 @@ static const char settings_dlg[] =
 
 static DB_dsp_t plugin = {
     .plugin.api_vmajor = 1,
-    .plugin.api_vminor = 0,
+    .plugin.api_vminor = 10,
     .open = m2s_open,
     .close = m2s_close,
     .process = m2s_process,
+    .negotiate = m2s_negotiate,
+    .can_bypass = m2s_can_bypass,
     .plugin.version_major = 1,
     .plugin.version_minor = 0,
     .plugin.type = DB_PLUGIN_DSP,
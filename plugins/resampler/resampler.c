@@ -0,0 +1,705 @@
+/*
+    Polyphase resampler DSP plugin for DeaDBeeF Player
+    Copyright (C) 2009-2016 Alexey Yakovenko
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+// Windowed-sinc polyphase resampler.
+//
+// When the ratio of the samplerates reduces to up/down with a small enough
+// up (which covers all the usual rates: 44.1, 48, 88.2, 96, 192 kHz and
+// their halves), the filter bank has one row of coefficients per output
+// phase, and the position is tracked with integers, so there's no drift.
+// Other ratios use a fixed number of phases, and interpolate between the
+// two nearest rows.
+//
+// Input is appended to per-channel history buffers, so every output sample
+// is an inner product of a coefficient row with a contiguous run of input,
+// which is done with avx2 or neon where available.
+
+#ifdef HAVE_CONFIG_H
+#  include "../../config.h"
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "../../deadbeef.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define RESAMPLER_X86 1
+#include <immintrin.h>
+#include <cpuid.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RESAMPLER_NEON 1
+#include <arm_neon.h>
+#endif
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(fmt,...)
+
+enum {
+    RESAMPLER_PARAM_SAMPLERATE,
+    RESAMPLER_PARAM_QUALITY,
+    RESAMPLER_PARAM_AUTOSAMPLERATE,
+    RESAMPLER_PARAM_COUNT
+};
+
+// max number of phases for the exact ratios
+#define RESAMPLER_MAX_PHASES 1024
+// number of phases for the other ratios
+#define RESAMPLER_INTERP_PHASES 256
+// the filter gets longer when downsampling, this limits it for extreme ratios
+#define RESAMPLER_MAX_TAPS 1024
+// max size of the filter bank, in floats
+#define RESAMPLER_MAX_COEFS (1<<18)
+
+typedef struct {
+    int taps; // filter length when upsampling, multiple of 8
+    float beta; // kaiser window shape
+    float cutoff; // relative to the lower nyquist frequency
+} resampler_preset_t;
+
+static const resampler_preset_t presets[] = {
+    { 64, 9.f, 0.945f }, // best
+    { 32, 7.f, 0.91f }, // medium
+    { 16, 5.f, 0.85f }, // fast
+};
+
+#define RESAMPLER_NUM_PRESETS (int)(sizeof (presets) / sizeof (presets[0]))
+
+static DB_functions_t *deadbeef;
+static DB_dsp_t plugin;
+
+// n is a multiple of 8, coefs are aligned to 32 bytes
+static float (*resampler_dot) (const float *samples, const float *coefs, int n);
+
+typedef struct {
+    ddb_dsp_context_t ctx;
+
+    int samplerate;
+    int quality;
+    int autosamplerate;
+
+    // the filter bank is built for these
+    int inrate;
+    int outrate;
+    int bank_quality;
+    float *coefs; // nphases rows of ntaps, +1 row for interpolation
+    int ntaps;
+    int nphases;
+    int exact;
+    int up; // exact ratio is up/down
+    int down;
+    double step; // input frames per output frame, for the other ratios
+
+    // planar input, channels runs of histsize floats
+    float *history;
+    int channels;
+    int histsize;
+    int histlen;
+    int pos; // first input frame for the next output frame
+    int phase; // of the next output frame, exact ratios only
+    double frac; // position between pos and pos+1, other ratios only
+
+    unsigned need_reset : 1;
+} ddb_resampler_t;
+
+static float
+resampler_dot_c (const float *samples, const float *coefs, int n) {
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int i = 0; i < n; i += 4) {
+        s0 += samples[i+0] * coefs[i+0];
+        s1 += samples[i+1] * coefs[i+1];
+        s2 += samples[i+2] * coefs[i+2];
+        s3 += samples[i+3] * coefs[i+3];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+#if RESAMPLER_X86
+
+#define RESAMPLER_CPU_SSE2 0x01
+#define RESAMPLER_CPU_AVX2 0x02
+
+static int
+resampler_cpu_features (void) {
+    unsigned int eax, ebx, ecx, edx;
+    int flags = 0;
+
+    unsigned int max_level = __get_cpuid_max (0, NULL);
+    if (max_level < 1) {
+        return 0;
+    }
+
+    __cpuid (1, eax, ebx, ecx, edx);
+    if (edx & (1<<26)) {
+        flags |= RESAMPLER_CPU_SSE2;
+    }
+
+    // avx2 and fma also need the OS to preserve the ymm registers
+    if (max_level >= 7 && (ecx & (1<<12)) && (ecx & (1<<27)) && (ecx & (1<<28))) {
+        unsigned int xcr0, xcr0_hi;
+        __asm__ volatile ("xgetbv" : "=a" (xcr0), "=d" (xcr0_hi) : "c" (0));
+        if ((xcr0 & 6) == 6) {
+            __cpuid_count (7, 0, eax, ebx, ecx, edx);
+            if (ebx & (1<<5)) {
+                flags |= RESAMPLER_CPU_AVX2;
+            }
+        }
+    }
+
+    return flags;
+}
+
+static float __attribute__ ((target ("sse2")))
+resampler_dot_sse2 (const float *samples, const float *coefs, int n) {
+    __m128 s0 = _mm_setzero_ps ();
+    __m128 s1 = _mm_setzero_ps ();
+    for (int i = 0; i < n; i += 8) {
+        s0 = _mm_add_ps (s0, _mm_mul_ps (_mm_loadu_ps (samples + i), _mm_load_ps (coefs + i)));
+        s1 = _mm_add_ps (s1, _mm_mul_ps (_mm_loadu_ps (samples + i + 4), _mm_load_ps (coefs + i + 4)));
+    }
+    s0 = _mm_add_ps (s0, s1);
+    s0 = _mm_add_ps (s0, _mm_movehl_ps (s0, s0));
+    s0 = _mm_add_ss (s0, _mm_shuffle_ps (s0, s0, 1));
+    return _mm_cvtss_f32 (s0);
+}
+
+static float __attribute__ ((target ("avx2,fma")))
+resampler_dot_avx2 (const float *samples, const float *coefs, int n) {
+    __m256 s0 = _mm256_setzero_ps ();
+    __m256 s1 = _mm256_setzero_ps ();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        s0 = _mm256_fmadd_ps (_mm256_loadu_ps (samples + i), _mm256_load_ps (coefs + i), s0);
+        s1 = _mm256_fmadd_ps (_mm256_loadu_ps (samples + i + 8), _mm256_load_ps (coefs + i + 8), s1);
+    }
+    if (i < n) {
+        s0 = _mm256_fmadd_ps (_mm256_loadu_ps (samples + i), _mm256_load_ps (coefs + i), s0);
+    }
+    s0 = _mm256_add_ps (s0, s1);
+    __m128 s = _mm_add_ps (_mm256_castps256_ps128 (s0), _mm256_extractf128_ps (s0, 1));
+    s = _mm_add_ps (s, _mm_movehl_ps (s, s));
+    s = _mm_add_ss (s, _mm_shuffle_ps (s, s, 1));
+    return _mm_cvtss_f32 (s);
+}
+
+#elif RESAMPLER_NEON
+
+static float
+resampler_dot_neon (const float *samples, const float *coefs, int n) {
+    float32x4_t s0 = vdupq_n_f32 (0);
+    float32x4_t s1 = vdupq_n_f32 (0);
+    for (int i = 0; i < n; i += 8) {
+        s0 = vmlaq_f32 (s0, vld1q_f32 (samples + i), vld1q_f32 (coefs + i));
+        s1 = vmlaq_f32 (s1, vld1q_f32 (samples + i + 4), vld1q_f32 (coefs + i + 4));
+    }
+    s0 = vaddq_f32 (s0, s1);
+    float32x2_t s = vadd_f32 (vget_low_f32 (s0), vget_high_f32 (s0));
+    return vget_lane_f32 (vpadd_f32 (s, s), 0);
+}
+
+#endif
+
+static int
+gcd (int a, int b) {
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// modified bessel function of the first kind, for the kaiser window
+static double
+bessel_i0 (double x) {
+    double sum = 1;
+    double term = 1;
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+static void
+resampler_free_bank (ddb_resampler_t *rs) {
+    free (rs->coefs);
+    rs->coefs = NULL;
+    rs->inrate = 0;
+    rs->outrate = 0;
+}
+
+// when downsampling, the cutoff goes down with the output nyquist
+// frequency, and the filter needs to be longer to keep the same slope
+static int
+resampler_get_ntaps (int quality, double ratio) {
+    int ntaps = presets[quality].taps;
+    if (ratio < 1) {
+        ntaps = (int)ceil (ntaps / ratio);
+        ntaps = (ntaps + 7) & ~7;
+        if (ntaps > RESAMPLER_MAX_TAPS) {
+            ntaps = RESAMPLER_MAX_TAPS;
+        }
+    }
+    return ntaps;
+}
+
+static int
+resampler_build_bank (ddb_resampler_t *rs, int inrate, int outrate) {
+    resampler_free_bank (rs);
+
+    const resampler_preset_t *preset = &presets[rs->quality];
+    double ratio = (double)outrate / inrate;
+
+    double fc = preset->cutoff;
+    if (ratio < 1) {
+        fc *= ratio;
+    }
+    int ntaps = resampler_get_ntaps (rs->quality, ratio);
+
+    int g = gcd (inrate, outrate);
+    int up = outrate / g;
+    int down = inrate / g;
+    int exact = up <= RESAMPLER_MAX_PHASES && (int64_t)up * ntaps <= RESAMPLER_MAX_COEFS;
+    int nphases = exact ? up : RESAMPLER_INTERP_PHASES;
+    int nrows = exact ? nphases : nphases + 1;
+
+    if (posix_memalign ((void **)&rs->coefs, 32, nrows * ntaps * sizeof (float))) {
+        rs->coefs = NULL;
+        fprintf (stderr, "resampler: failed to allocate filter bank\n");
+        return -1;
+    }
+
+    // tap k of the row for phase p is applied to the input frame, which is
+    // (k - center - p/nphases) frames away from the output frame
+    int center = ntaps / 2 - 1;
+    double half = ntaps / 2;
+    double i0beta = bessel_i0 (preset->beta);
+    for (int p = 0; p < nrows; p++) {
+        float *row = rs->coefs + p * ntaps;
+        double sum = 0;
+        for (int k = 0; k < ntaps; k++) {
+            double x = k - center - (double)p / nphases;
+            double h = fc;
+            if (x != 0) {
+                h = sin (M_PI * fc * x) / (M_PI * x);
+            }
+            double w = x / half;
+            w = w >= 1 || w <= -1 ? 0 : bessel_i0 (preset->beta * sqrt (1 - w * w)) / i0beta;
+            row[k] = h * w;
+            sum += row[k];
+        }
+        // unity gain at dc for every phase
+        for (int k = 0; k < ntaps; k++) {
+            row[k] /= sum;
+        }
+    }
+
+    rs->inrate = inrate;
+    rs->outrate = outrate;
+    rs->bank_quality = rs->quality;
+    rs->ntaps = ntaps;
+    rs->nphases = nphases;
+    rs->exact = exact;
+    rs->up = up;
+    rs->down = down;
+    rs->step = (double)inrate / outrate;
+    trace ("resampler: %d -> %d, %d taps, %d phases%s\n", inrate, outrate, ntaps, nphases, exact ? "" : " (interpolated)");
+    return 0;
+}
+
+// starts from silence, with the first input frame at the center of the filter
+static void
+resampler_clear_history (ddb_resampler_t *rs) {
+    rs->histlen = rs->ntaps / 2 - 1;
+    for (int c = 0; c < rs->channels; c++) {
+        memset (rs->history + c * rs->histsize, 0, rs->histlen * sizeof (float));
+    }
+    rs->pos = 0;
+    rs->phase = 0;
+    rs->frac = 0;
+}
+
+// keeps the history, which is compacted to the start of each channel
+static int
+resampler_grow_history (ddb_resampler_t *rs, int histsize) {
+    float *history;
+    if (posix_memalign ((void **)&history, 32, rs->channels * histsize * sizeof (float))) {
+        fprintf (stderr, "resampler: failed to allocate %d frames\n", histsize);
+        return -1;
+    }
+    if (rs->history) {
+        for (int c = 0; c < rs->channels; c++) {
+            memcpy (history + c * histsize, rs->history + c * rs->histsize, rs->histlen * sizeof (float));
+        }
+        free (rs->history);
+    }
+    rs->history = history;
+    rs->histsize = histsize;
+    return 0;
+}
+
+static int
+resampler_get_samplerate (ddb_resampler_t *rs) {
+    if (rs->autosamplerate) {
+        DB_output_t *output = deadbeef->get_output ();
+        return output->fmt.samplerate;
+    }
+    return rs->samplerate;
+}
+
+ddb_dsp_context_t*
+resampler_open (void) {
+    ddb_resampler_t *rs = malloc (sizeof (ddb_resampler_t));
+    DDB_INIT_DSP_CONTEXT (rs,ddb_resampler_t,&plugin);
+
+    rs->samplerate = 48000;
+    rs->quality = 1;
+    return (ddb_dsp_context_t *)rs;
+}
+
+void
+resampler_close (ddb_dsp_context_t *ctx) {
+    ddb_resampler_t *rs = (ddb_resampler_t *)ctx;
+    resampler_free_bank (rs);
+    free (rs->history);
+    free (rs);
+}
+
+void
+resampler_reset (ddb_dsp_context_t *ctx) {
+    ddb_resampler_t *rs = (ddb_resampler_t *)ctx;
+    rs->need_reset = 1;
+}
+
+int
+resampler_can_bypass (ddb_dsp_context_t *ctx, ddb_waveformat_t *fmt) {
+    ddb_resampler_t *rs = (ddb_resampler_t *)ctx;
+    return fmt->samplerate == resampler_get_samplerate (rs);
+}
+
+void
+resampler_negotiate (ddb_dsp_context_t *ctx, ddb_waveformat_t *fmt, float *ratio, int *latency) {
+    ddb_resampler_t *rs = (ddb_resampler_t *)ctx;
+    int samplerate = resampler_get_samplerate (rs);
+    if (samplerate <= 0 || fmt->samplerate == samplerate) {
+        return;
+    }
+
+    *ratio = (float)samplerate / fmt->samplerate;
+    // the last half of the filter is held back until the next call, or the
+    // flush; the fractional position can give one frame more than the exact ratio
+    *latency = resampler_get_ntaps (rs->quality, *ratio) / 2 + 2;
+    fmt->samplerate = samplerate;
+}
+
+// makes output frames from the history, as long as the filter fits into it,
+// and the position of the output frame is before end, in input frames;
+// returns the number of frames
+static int
+resampler_run (ddb_resampler_t *rs, float *out, int maxframes, int end) {
+    int channels = rs->channels;
+    int ntaps = rs->ntaps;
+    // output frames are centered on the tap at pos + center
+    int last = end - (ntaps / 2 - 1);
+    if (last > rs->histlen - ntaps + 1) {
+        last = rs->histlen - ntaps + 1;
+    }
+    int nout = 0;
+    if (rs->exact) {
+        int pos = rs->pos;
+        int phase = rs->phase;
+        while (nout < maxframes && pos < last) {
+            const float *row = rs->coefs + phase * ntaps;
+            for (int c = 0; c < channels; c++) {
+                *out++ = resampler_dot (rs->history + c * rs->histsize + pos, row, ntaps);
+            }
+            nout++;
+            phase += rs->down;
+            pos += phase / rs->up;
+            phase %= rs->up;
+        }
+        rs->pos = pos;
+        rs->phase = phase;
+    }
+    else {
+        int pos = rs->pos;
+        double frac = rs->frac;
+        while (nout < maxframes && pos < last) {
+            // the extra row at the end is the first one delayed by a frame,
+            // so row+1 is always there
+            double p = frac * rs->nphases;
+            int row = (int)p;
+            float a = p - row;
+            const float *row0 = rs->coefs + row * ntaps;
+            const float *row1 = row0 + ntaps;
+            for (int c = 0; c < channels; c++) {
+                const float *h = rs->history + c * rs->histsize + pos;
+                float s0 = resampler_dot (h, row0, ntaps);
+                float s1 = resampler_dot (h, row1, ntaps);
+                *out++ = s0 + (s1 - s0) * a;
+            }
+            nout++;
+            frac += rs->step;
+            int n = (int)frac;
+            pos += n;
+            frac -= n;
+        }
+        rs->pos = pos;
+        rs->frac = frac;
+    }
+    return nout;
+}
+
+int
+resampler_process (ddb_dsp_context_t *ctx, float *samples, int nframes, int maxframes, ddb_waveformat_t *fmt, float *r) {
+    ddb_resampler_t *rs = (ddb_resampler_t *)ctx;
+
+    int samplerate = resampler_get_samplerate (rs);
+    if (samplerate <= 0) {
+        return -1;
+    }
+    if (fmt->samplerate == samplerate) {
+        return nframes;
+    }
+
+    if (!rs->coefs || rs->inrate != fmt->samplerate || rs->outrate != samplerate || rs->bank_quality != rs->quality) {
+        if (resampler_build_bank (rs, fmt->samplerate, samplerate) < 0) {
+            return nframes;
+        }
+        rs->need_reset = 1;
+    }
+    if (rs->channels != fmt->channels) {
+        free (rs->history);
+        rs->history = NULL;
+        rs->histsize = 0;
+        rs->histlen = 0;
+        rs->channels = fmt->channels;
+        rs->need_reset = 1;
+    }
+
+    int channels = fmt->channels;
+    int ntaps = rs->ntaps;
+    int histsize = (rs->histlen > ntaps ? rs->histlen : ntaps) + nframes;
+    if (rs->histsize < histsize) {
+        if (resampler_grow_history (rs, histsize) < 0) {
+            return nframes;
+        }
+    }
+    if (rs->need_reset) {
+        resampler_clear_history (rs);
+        rs->need_reset = 0;
+    }
+
+    // all the input goes to the history, so the output can overwrite it
+    for (int c = 0; c < channels; c++) {
+        float *h = rs->history + c * rs->histsize + rs->histlen;
+        for (int i = 0; i < nframes; i++) {
+            h[i] = samples[i * channels + c];
+        }
+    }
+    rs->histlen += nframes;
+
+    int nout = resampler_run (rs, samples, maxframes, rs->histlen);
+
+    // drop the input which is no longer needed
+    int drop = rs->pos < rs->histlen ? rs->pos : rs->histlen;
+    if (drop > 0) {
+        for (int c = 0; c < channels; c++) {
+            float *h = rs->history + c * rs->histsize;
+            memmove (h, h + drop, (rs->histlen - drop) * sizeof (float));
+        }
+        rs->histlen -= drop;
+        rs->pos -= drop;
+    }
+
+    fmt->samplerate = samplerate;
+    trace ("resampler: in=%d, out=%d\n", nframes, nout);
+    return nout;
+}
+
+int
+resampler_flush (ddb_dsp_context_t *ctx, float *samples, int maxframes, ddb_waveformat_t *fmt) {
+    ddb_resampler_t *rs = (ddb_resampler_t *)ctx;
+    if (rs->need_reset || !rs->coefs || !rs->history || rs->channels != fmt->channels) {
+        return 0;
+    }
+
+    // pad with silence, so that the filter reaches past the last input frame
+    int end = rs->histlen;
+    int pad = rs->ntaps / 2;
+    if (rs->histsize < rs->histlen + pad) {
+        if (resampler_grow_history (rs, rs->histlen + pad) < 0) {
+            rs->need_reset = 1;
+            return 0;
+        }
+    }
+    for (int c = 0; c < rs->channels; c++) {
+        memset (rs->history + c * rs->histsize + rs->histlen, 0, pad * sizeof (float));
+    }
+    rs->histlen += pad;
+
+    int nout = resampler_run (rs, samples, maxframes, end);
+    rs->need_reset = 1;
+    fmt->samplerate = rs->outrate;
+    trace ("resampler: flushed %d\n", nout);
+    return nout;
+}
+
+int
+resampler_num_params (void) {
+    return RESAMPLER_PARAM_COUNT;
+}
+
+const char *
+resampler_get_param_name (int p) {
+    switch (p) {
+    case RESAMPLER_PARAM_SAMPLERATE:
+        return "Samplerate";
+    case RESAMPLER_PARAM_QUALITY:
+        return "Quality";
+    case RESAMPLER_PARAM_AUTOSAMPLERATE:
+        return "Auto samplerate";
+    default:
+        fprintf (stderr, "resampler_get_param_name: invalid param index (%d)\n", p);
+    }
+    return NULL;
+}
+
+void
+resampler_set_param (ddb_dsp_context_t *ctx, int p, const char *val) {
+    ddb_resampler_t *rs = (ddb_resampler_t *)ctx;
+    switch (p) {
+    case RESAMPLER_PARAM_SAMPLERATE:
+        rs->samplerate = atoi (val);
+        if (rs->samplerate < 8000) {
+            rs->samplerate = 8000;
+        }
+        if (rs->samplerate > 192000) {
+            rs->samplerate = 192000;
+        }
+        break;
+    case RESAMPLER_PARAM_QUALITY:
+        rs->quality = atoi (val);
+        if (rs->quality < 0 || rs->quality >= RESAMPLER_NUM_PRESETS) {
+            rs->quality = 1;
+        }
+        break;
+    case RESAMPLER_PARAM_AUTOSAMPLERATE:
+        rs->autosamplerate = atoi (val);
+        break;
+    default:
+        fprintf (stderr, "resampler_set_param: invalid param index (%d)\n", p);
+    }
+}
+
+void
+resampler_get_param (ddb_dsp_context_t *ctx, int p, char *val, int sz) {
+    ddb_resampler_t *rs = (ddb_resampler_t *)ctx;
+    switch (p) {
+    case RESAMPLER_PARAM_SAMPLERATE:
+        snprintf (val, sz, "%d", rs->samplerate);
+        break;
+    case RESAMPLER_PARAM_QUALITY:
+        snprintf (val, sz, "%d", rs->quality);
+        break;
+    case RESAMPLER_PARAM_AUTOSAMPLERATE:
+        snprintf (val, sz, "%d", rs->autosamplerate);
+        break;
+    default:
+        fprintf (stderr, "resampler_get_param: invalid param index (%d)\n", p);
+    }
+}
+
+static const char settings_dlg[] =
+    "property \"Automatic Samplerate (overrides Target Samplerate)\" checkbox 2 0;\n"
+    "property \"Target Samplerate\" spinbtn[8000,192000,1] 0 48000;\n"
+    "property \"Quality\" select[3] 1 1 Best Medium Fast;\n"
+;
+
+static DB_dsp_t plugin = {
+    .plugin.api_vmajor = 1,
+    .plugin.api_vminor = 10,
+    .open = resampler_open,
+    .close = resampler_close,
+    .process = resampler_process,
+    .negotiate = resampler_negotiate,
+    .flush = resampler_flush,
+    .plugin.version_major = 1,
+    .plugin.version_minor = 0,
+    .plugin.type = DB_PLUGIN_DSP,
+    .plugin.id = "resampler",
+    .plugin.name = "Resampler (polyphase)",
+    .plugin.descr = "Fast windowed-sinc samplerate converter, with exact phases for the common samplerates",
+    .plugin.copyright =
+        "Polyphase resampler DSP plugin for DeaDBeeF Player\n"
+        "Copyright (C) 2009-2016 Alexey Yakovenko\n"
+        "\n"
+        "This software is provided 'as-is', without any express or implied\n"
+        "warranty.  In no event will the authors be held liable for any damages\n"
+        "arising from the use of this software.\n"
+        "\n"
+        "Permission is granted to anyone to use this software for any purpose,\n"
+        "including commercial applications, and to alter it and redistribute it\n"
+        "freely, subject to the following restrictions:\n"
+        "\n"
+        "1. The origin of this software must not be misrepresented; you must not\n"
+        " claim that you wrote the original software. If you use this software\n"
+        " in a product, an acknowledgment in the product documentation would be\n"
+        " appreciated but is not required.\n"
+        "\n"
+        "2. Altered source versions must be plainly marked as such, and must not be\n"
+        " misrepresented as being the original software.\n"
+        "\n"
+        "3. This notice may not be removed or altered from any source distribution.\n"
+    ,
+    .plugin.website = "http://deadbeef.sf.net",
+    .num_params = resampler_num_params,
+    .get_param_name = resampler_get_param_name,
+    .set_param = resampler_set_param,
+    .get_param = resampler_get_param,
+    .reset = resampler_reset,
+    .configdialog = settings_dlg,
+    .can_bypass = resampler_can_bypass,
+};
+
+DB_plugin_t *
+ddb_dsp_resampler_load (DB_functions_t *f) {
+    deadbeef = f;
+    resampler_dot = resampler_dot_c;
+#if RESAMPLER_X86
+    int cpu = resampler_cpu_features ();
+    if (cpu & RESAMPLER_CPU_AVX2) {
+        resampler_dot = resampler_dot_avx2;
+    }
+    else if (cpu & RESAMPLER_CPU_SSE2) {
+        resampler_dot = resampler_dot_sse2;
+    }
+#elif RESAMPLER_NEON
+    resampler_dot = resampler_dot_neon;
+#endif
+    return &plugin.plugin;
+}
@@ -53,6 +53,19 @@ typedef struct {
     int changed;
 } ddb_soundtouch_t;
 
+// soundtouch is only bypassed when it wouldn't change tempo, pitch or rate
+int
+st_can_bypass (ddb_dsp_context_t *_src, ddb_waveformat_t *fmt) {
+    ddb_soundtouch_t *st = (ddb_soundtouch_t *)_src;
+    if (st->tempo != 0 || st->pitch != 0) {
+        return 0;
+    }
+    if (st->set_output_samplerate > 0) {
+        return st->set_output_samplerate == fmt->samplerate;
+    }
+    return st->rate == 0;
+}
+
 ddb_dsp_context_t*
 st_open (void) {
     ddb_soundtouch_t *st = malloc (sizeof (ddb_soundtouch_t));
@@ -131,6 +144,30 @@ st_process (ddb_dsp_context_t *_src, float *samples, int nframes, int maxframes,
     return nout;
 }
 
+void
+st_negotiate (ddb_dsp_context_t *_src, ddb_waveformat_t *fmt, float *ratio, int *latency) {
+    ddb_soundtouch_t *st = (ddb_soundtouch_t *)_src;
+    float speed = (1.f + 0.01f * st->tempo);
+    int samplerate = fmt->samplerate;
+
+    if (st->set_output_samplerate > 0) {
+        samplerate = st->set_output_samplerate;
+    }
+    else {
+        speed *= (1.f + 0.01f * st->rate);
+    }
+
+    // soundtouch never returns more than maxframes, and keeps the rest,
+    // so very slow speeds don't need to get the whole output at once
+    *ratio = 24;
+    if (speed * 24 > samplerate / (float)fmt->samplerate) {
+        *ratio = samplerate / (float)fmt->samplerate / speed;
+    }
+    // time stretching holds back up to a sequence and a seek window
+    *latency = (st->sequence_ms + st->seekwindow_ms) * fmt->samplerate / 1000;
+    fmt->samplerate = samplerate;
+}
+
 const char *
 st_get_param_name (int p) {
     switch (p) {
@@ -263,10 +300,12 @@ static const char settings_dlg[] =
 
 static DB_dsp_t plugin = {
     .plugin.api_vmajor = 1,
-    .plugin.api_vminor = 0,
+    .plugin.api_vminor = 10,
     .open = st_open,
     .close = st_close,
     .process = st_process,
+    .negotiate = st_negotiate,
+    .can_bypass = st_can_bypass,
     .plugin.version_major = 0,
     .plugin.version_minor = 1,
     .plugin.type = DB_PLUGIN_DSP,
@@ -106,6 +106,24 @@ supereq_process (ddb_dsp_context_t *ctx, float *samples, int frames, int maxfram
 	return frames;
 }
 
+void
+supereq_negotiate (ddb_dsp_context_t *ctx, ddb_waveformat_t *fmt, float *ratio, int *latency) {
+    // processing is in place, with the same number of frames out
+}
+
+// the eq is only bypassed when all bands and the preamp are at 0 dB
+int
+supereq_can_bypass (ddb_dsp_context_t *ctx, ddb_waveformat_t *fmt) {
+    ddb_supereq_ctx_t *supereq = (ddb_supereq_ctx_t *)ctx;
+    deadbeef->mutex_lock (supereq->mutex);
+    int res = supereq->preamp == 1;
+    for (int i = 0; i < 18 && res; i++) {
+        res = supereq->bands[i] == 1;
+    }
+    deadbeef->mutex_unlock (supereq->mutex);
+    return res;
+}
+
 float
 supereq_get_band (ddb_dsp_context_t *ctx, int band) {
     ddb_supereq_ctx_t *supereq = (ddb_supereq_ctx_t *)ctx;
@@ -274,7 +292,7 @@ static const char settings_dlg[] =
 
 static DB_dsp_t plugin = {
     .plugin.api_vmajor = 1,
-    .plugin.api_vminor = 0,
+    .plugin.api_vminor = 10,
     .plugin.version_major = 1,
     .plugin.version_minor = 0,
     .plugin.type = DB_PLUGIN_DSP,
@@ -347,6 +365,8 @@ static DB_dsp_t plugin = {
     .set_param = supereq_set_param,
     .get_param = supereq_get_param,
     .configdialog = settings_dlg,
+    .negotiate = supereq_negotiate,
+    .can_bypass = supereq_can_bypass,
 };
 
 DB_plugin_t *
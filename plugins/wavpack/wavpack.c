@@ -435,6 +435,7 @@ static DB_decoder_t plugin = {
     .plugin.version_major = 1,
     .plugin.version_minor = 0,
     .plugin.type = DB_PLUGIN_DECODER,
+    .plugin.flags = DDB_PLUGIN_FLAG_THREADSAFE_INSERT,
     .plugin.id = "wv",
     .plugin.name = "WavPack decoder",
     .plugin.descr = "WavPack (.wv, .iso.wv) player",
@@ -25,6 +25,9 @@
   Alexey Yakovenko waker@users.sourceforge.net
 */
 
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
@@ -32,6 +35,21 @@
 #include "premix.h"
 #include "fastftoi.h"
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && (HAVE_SSE2 || defined(__SSE2__))
+#define PREMIX_X86 1
+// avx2 routines are built with target attributes, older compilers can't do that with intrinsics
+#if defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define PREMIX_AVX2 1
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+#include <cpuid.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PREMIX_NEON 1
+#include <arm_neon.h>
+#endif
+
 #define trace(...) { fprintf(stderr, __VA_ARGS__); }
 //#define trace(fmt,...)
 
@@ -227,7 +245,7 @@ pcm_write_samples_24_to_float (const ddb_waveformat_t * restrict inputfmt, const
         for (int c = 0; c < outputfmt->channels; c++) {
             float *out = (float *)(output + 4 * c);
             const char *in = input + 3 * channelmap[c];
-            int32_t sample = ((unsigned char)in[0]) | ((unsigned char)in[1]<<8) | (in[2]<<16);
+            int32_t sample = ((unsigned char)in[0]) | ((unsigned char)in[1]<<8) | ((int8_t)in[2]<<16);
             *out = sample / (float)0x800000;
         }
         input += inputfmt->channels * 3;
@@ -377,13 +395,17 @@ pcm_write_samples_float_to_32 (const ddb_waveformat_t * restrict inputfmt, const
     for (int s = 0; s < nsamples; s++) {
         for (int c = 0; c < outputfmt->channels; c++) {
             float fsample = (*((float*)(input + channelmap[c] * 4)));
-            if (fsample > (float)0x7fffffff/0x80000000) {
-                fsample = (float)0x7fffffff/0x80000000;
+            int32_t sample;
+            // 0x7fffffff can't be represented as float, so 1.0 has to be clamped after scaling
+            if (fsample >= 1.f) {
+                sample = 0x7fffffff;
             }
             else if (fsample < -1.f) {
-                fsample = -1.f;
+                sample = -0x7fffffff - 1;
+            }
+            else {
+                sample = fsample * (float)0x80000000;
             }
-            int32_t sample = fsample * (float)0x80000000;
             *((int32_t *)(output + 4 * c)) = sample;
         }
         input += 4 * inputfmt->channels;
@@ -453,6 +475,941 @@ remap_fn_t remappers[8][8] = {
     }
 };
 
+// Converters for interleaved data where the output has the same channel
+// layout as the input, which is the case for most blocks going into and out
+// of the dsp chain. n is the number of samples of all channels together.
+typedef void (*convert_fn_t) (const char * restrict input, char * restrict output, int n);
+
+static void
+pcm_convert_16_to_16_c (const char * restrict input, char * restrict output, int n) {
+    memcpy (output, input, n * 2);
+}
+
+static void
+pcm_convert_16_to_24_c (const char * restrict input, char * restrict output, int n) {
+    for (int i = 0; i < n; i++) {
+        output[0] = 0;
+        output[1] = input[0];
+        output[2] = input[1];
+        input += 2;
+        output += 3;
+    }
+}
+
+static void
+pcm_convert_16_to_32_c (const char * restrict input, char * restrict output, int n) {
+    const int16_t *in = (const int16_t *)input;
+    int32_t *out = (int32_t *)output;
+    for (int i = 0; i < n; i++) {
+        out[i] = in[i] * 0x10000;
+    }
+}
+
+static void
+pcm_convert_16_to_float_c (const char * restrict input, char * restrict output, int n) {
+    const int16_t *in = (const int16_t *)input;
+    float *out = (float *)output;
+    for (int i = 0; i < n; i++) {
+        out[i] = in[i] / (float)0x8000;
+    }
+}
+
+static void
+pcm_convert_24_to_16_c (const char * restrict input, char * restrict output, int n) {
+    for (int i = 0; i < n; i++) {
+        output[0] = input[1];
+        output[1] = input[2];
+        input += 3;
+        output += 2;
+    }
+}
+
+static void
+pcm_convert_24_to_24_c (const char * restrict input, char * restrict output, int n) {
+    memcpy (output, input, n * 3);
+}
+
+static void
+pcm_convert_24_to_32_c (const char * restrict input, char * restrict output, int n) {
+    for (int i = 0; i < n; i++) {
+        output[0] = 0;
+        output[1] = input[0];
+        output[2] = input[1];
+        output[3] = input[2];
+        input += 3;
+        output += 4;
+    }
+}
+
+static void
+pcm_convert_24_to_float_c (const char * restrict input, char * restrict output, int n) {
+    float *out = (float *)output;
+    for (int i = 0; i < n; i++) {
+        int32_t sample = ((unsigned char)input[0]) | ((unsigned char)input[1]<<8) | ((int8_t)input[2]<<16);
+        out[i] = sample / (float)0x800000;
+        input += 3;
+    }
+}
+
+static void
+pcm_convert_32_to_16_c (const char * restrict input, char * restrict output, int n) {
+    const int32_t *in = (const int32_t *)input;
+    int16_t *out = (int16_t *)output;
+    for (int i = 0; i < n; i++) {
+        out[i] = (int16_t)(in[i]>>16);
+    }
+}
+
+static void
+pcm_convert_32_to_24_c (const char * restrict input, char * restrict output, int n) {
+    for (int i = 0; i < n; i++) {
+        output[0] = input[1];
+        output[1] = input[2];
+        output[2] = input[3];
+        input += 4;
+        output += 3;
+    }
+}
+
+static void
+pcm_convert_32_to_32_c (const char * restrict input, char * restrict output, int n) {
+    memcpy (output, input, n * 4);
+}
+
+static void
+pcm_convert_32_to_float_c (const char * restrict input, char * restrict output, int n) {
+    const int32_t *in = (const int32_t *)input;
+    float *out = (float *)output;
+    for (int i = 0; i < n; i++) {
+        out[i] = in[i] / (float)0x80000000;
+    }
+}
+
+static void
+pcm_convert_float_to_16_c (const char * restrict input, char * restrict output, int n) {
+    const float *in = (const float *)input;
+    int16_t *out = (int16_t *)output;
+    fpu_control ctl;
+    fpu_setround (&ctl);
+    for (int i = 0; i < n; i++) {
+        int isample = ftoi (in[i]*0x8000);
+        if (isample > 0x7fff) {
+            isample = 0x7fff;
+        }
+        else if (isample < -0x8000) {
+            isample = -0x8000;
+        }
+        out[i] = (int16_t)isample;
+    }
+    fpu_restore (ctl);
+}
+
+static void
+pcm_convert_float_to_24_c (const char * restrict input, char * restrict output, int n) {
+    const float *in = (const float *)input;
+    fpu_control ctl;
+    fpu_setround (&ctl);
+    for (int i = 0; i < n; i++) {
+        int32_t outsample = (int32_t)ftoi (in[i] * 0x800000);
+        if (outsample >= 0x7fffff) {
+            outsample = 0x7fffff;
+        }
+        else if (outsample < -0x800000) {
+            outsample = -0x800000;
+        }
+        output[0] = (outsample&0x0000ff);
+        output[1] = (outsample&0x00ff00)>>8;
+        output[2] = (outsample&0xff0000)>>16;
+        output += 3;
+    }
+    fpu_restore (ctl);
+}
+
+static void
+pcm_convert_float_to_32_c (const char * restrict input, char * restrict output, int n) {
+    const float *in = (const float *)input;
+    int32_t *out = (int32_t *)output;
+    for (int i = 0; i < n; i++) {
+        float fsample = in[i];
+        if (fsample >= 1.f) {
+            out[i] = 0x7fffffff;
+        }
+        else if (fsample < -1.f) {
+            out[i] = -0x7fffffff - 1;
+        }
+        else {
+            out[i] = fsample * (float)0x80000000;
+        }
+    }
+}
+
+static const convert_fn_t converters_c[8][8] = {
+    [1] = {
+        [1] = pcm_convert_16_to_16_c,
+        [2] = pcm_convert_16_to_24_c,
+        [3] = pcm_convert_16_to_32_c,
+        [7] = pcm_convert_16_to_float_c,
+    },
+    [2] = {
+        [1] = pcm_convert_24_to_16_c,
+        [2] = pcm_convert_24_to_24_c,
+        [3] = pcm_convert_24_to_32_c,
+        [7] = pcm_convert_24_to_float_c,
+    },
+    [3] = {
+        [1] = pcm_convert_32_to_16_c,
+        [2] = pcm_convert_32_to_24_c,
+        [3] = pcm_convert_32_to_32_c,
+        [7] = pcm_convert_32_to_float_c,
+    },
+    [7] = {
+        [1] = pcm_convert_float_to_16_c,
+        [2] = pcm_convert_float_to_24_c,
+        [3] = pcm_convert_float_to_32_c,
+        [7] = pcm_convert_32_to_32_c,
+    },
+};
+
+// filled by pcm_convert_init; until then everything goes through remappers
+static convert_fn_t converters[8][8];
+
+#if PREMIX_X86
+
+// The vector loops below handle whole vectors and leave the rest to the C
+// versions. They give the same results as the C versions, bit for bit.
+
+#define PCM_CPU_SSE2 0x01
+#define PCM_CPU_AVX2 0x02
+
+static int
+pcm_cpu_features (void) {
+    unsigned int eax, ebx, ecx, edx;
+    int flags = 0;
+
+    unsigned int max_level = __get_cpuid_max (0, NULL);
+    if (max_level < 1) {
+        return 0;
+    }
+
+    __cpuid (1, eax, ebx, ecx, edx);
+    if (edx & (1<<26)) {
+        flags |= PCM_CPU_SSE2;
+    }
+
+    // avx2 also needs the OS to preserve the ymm registers
+    if (max_level >= 7 && (ecx & (1<<27)) && (ecx & (1<<28))) {
+        unsigned int xcr0, xcr0_hi;
+        __asm__ volatile ("xgetbv" : "=a" (xcr0), "=d" (xcr0_hi) : "c" (0));
+        if ((xcr0 & 6) == 6) {
+            __cpuid_count (7, 0, eax, ebx, ecx, edx);
+            if (ebx & (1<<5)) {
+                flags |= PCM_CPU_AVX2;
+            }
+        }
+    }
+
+    return flags;
+}
+
+static void __attribute__ ((target ("sse2")))
+pcm_convert_16_to_32_sse2 (const char * restrict input, char * restrict output, int n) {
+    const __m128i zero = _mm_setzero_si128 ();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *)(input + i * 2));
+        _mm_storeu_si128 ((__m128i *)(output + i * 4), _mm_unpacklo_epi16 (zero, s));
+        _mm_storeu_si128 ((__m128i *)(output + i * 4 + 16), _mm_unpackhi_epi16 (zero, s));
+    }
+    pcm_convert_16_to_32_c (input + i * 2, output + i * 4, n - i);
+}
+
+static void __attribute__ ((target ("sse2")))
+pcm_convert_16_to_float_sse2 (const char * restrict input, char * restrict output, int n) {
+    const __m128 scale = _mm_set1_ps (1.f / 0x8000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *)(input + i * 2));
+        __m128i lo = _mm_srai_epi32 (_mm_unpacklo_epi16 (s, s), 16);
+        __m128i hi = _mm_srai_epi32 (_mm_unpackhi_epi16 (s, s), 16);
+        _mm_storeu_ps ((float *)(output + i * 4), _mm_mul_ps (_mm_cvtepi32_ps (lo), scale));
+        _mm_storeu_ps ((float *)(output + i * 4 + 16), _mm_mul_ps (_mm_cvtepi32_ps (hi), scale));
+    }
+    pcm_convert_16_to_float_c (input + i * 2, output + i * 4, n - i);
+}
+
+static void __attribute__ ((target ("sse2")))
+pcm_convert_32_to_16_sse2 (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo = _mm_srai_epi32 (_mm_loadu_si128 ((const __m128i *)(input + i * 4)), 16);
+        __m128i hi = _mm_srai_epi32 (_mm_loadu_si128 ((const __m128i *)(input + i * 4 + 16)), 16);
+        _mm_storeu_si128 ((__m128i *)(output + i * 2), _mm_packs_epi32 (lo, hi));
+    }
+    pcm_convert_32_to_16_c (input + i * 4, output + i * 2, n - i);
+}
+
+static void __attribute__ ((target ("sse2")))
+pcm_convert_32_to_float_sse2 (const char * restrict input, char * restrict output, int n) {
+    const __m128 scale = _mm_set1_ps (1.f / 0x80000000);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *)(input + i * 4));
+        _mm_storeu_ps ((float *)(output + i * 4), _mm_mul_ps (_mm_cvtepi32_ps (s), scale));
+    }
+    pcm_convert_32_to_float_c (input + i * 4, output + i * 4, n - i);
+}
+
+static void __attribute__ ((target ("sse2")))
+pcm_convert_float_to_16_sse2 (const char * restrict input, char * restrict output, int n) {
+    const __m128 scale = _mm_set1_ps (0x8000);
+    int i = 0;
+    // rounds to nearest like ftoi; out of range values come out as 0x80000000 from the
+    // conversion in both versions, and end up as -0x8000
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo = _mm_cvtps_epi32 (_mm_mul_ps (_mm_loadu_ps ((const float *)(input + i * 4)), scale));
+        __m128i hi = _mm_cvtps_epi32 (_mm_mul_ps (_mm_loadu_ps ((const float *)(input + i * 4 + 16)), scale));
+        _mm_storeu_si128 ((__m128i *)(output + i * 2), _mm_packs_epi32 (lo, hi));
+    }
+    pcm_convert_float_to_16_c (input + i * 4, output + i * 2, n - i);
+}
+
+static void __attribute__ ((target ("sse2")))
+pcm_convert_float_to_32_sse2 (const char * restrict input, char * restrict output, int n) {
+    const __m128 scale = _mm_set1_ps ((float)0x80000000);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 f = _mm_mul_ps (_mm_loadu_ps ((const float *)(input + i * 4)), scale);
+        __m128i s = _mm_cvttps_epi32 (f);
+        // 1.0 and above overflow to 0x80000000, flip those to 0x7fffffff
+        s = _mm_xor_si128 (s, _mm_castps_si128 (_mm_cmpge_ps (f, scale)));
+        _mm_storeu_si128 ((__m128i *)(output + i * 4), s);
+    }
+    pcm_convert_float_to_32_c (input + i * 4, output + i * 4, n - i);
+}
+
+#if PREMIX_AVX2
+
+// loads 8 packed 24-bit samples, as 32-bit values shifted left by 8
+static inline __m256i __attribute__ ((target ("avx2")))
+pcm_load_24_avx2 (const char *input) {
+    // the second lane is loaded from offset 8, so its samples start at byte 4
+    const __m256i shuffle = _mm256_setr_epi8 (
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+        -1, 4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15);
+    __m256i v = _mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *)input));
+    v = _mm256_inserti128_si256 (v, _mm_loadu_si128 ((const __m128i *)(input + 8)), 1);
+    return _mm256_shuffle_epi8 (v, shuffle);
+}
+
+// stores the low 3 bytes of 8 32-bit values
+static inline void __attribute__ ((target ("avx2")))
+pcm_store_24_avx2 (char *output, __m256i v) {
+    const __m256i shuffle = _mm256_setr_epi8 (
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    v = _mm256_shuffle_epi8 (v, shuffle);
+    v = _mm256_permutevar8x32_epi32 (v, _mm256_setr_epi32 (0, 1, 2, 4, 5, 6, 3, 7));
+    _mm_storeu_si128 ((__m128i *)output, _mm256_castsi256_si128 (v));
+    _mm_storel_epi64 ((__m128i *)(output + 16), _mm256_extracti128_si256 (v, 1));
+}
+
+static void __attribute__ ((target ("avx2")))
+pcm_convert_16_to_float_avx2 (const char * restrict input, char * restrict output, int n) {
+    const __m256 scale = _mm256_set1_ps (1.f / 0x8000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *)(input + i * 2)));
+        _mm256_storeu_ps ((float *)(output + i * 4), _mm256_mul_ps (_mm256_cvtepi32_ps (s), scale));
+    }
+    pcm_convert_16_to_float_c (input + i * 2, output + i * 4, n - i);
+}
+
+static void __attribute__ ((target ("avx2")))
+pcm_convert_24_to_32_avx2 (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_si256 ((__m256i *)(output + i * 4), pcm_load_24_avx2 (input + i * 3));
+    }
+    pcm_convert_24_to_32_c (input + i * 3, output + i * 4, n - i);
+}
+
+static void __attribute__ ((target ("avx2")))
+pcm_convert_24_to_float_avx2 (const char * restrict input, char * restrict output, int n) {
+    const __m256 scale = _mm256_set1_ps (1.f / 0x800000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_srai_epi32 (pcm_load_24_avx2 (input + i * 3), 8);
+        _mm256_storeu_ps ((float *)(output + i * 4), _mm256_mul_ps (_mm256_cvtepi32_ps (s), scale));
+    }
+    pcm_convert_24_to_float_c (input + i * 3, output + i * 4, n - i);
+}
+
+static void __attribute__ ((target ("avx2")))
+pcm_convert_32_to_24_avx2 (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_loadu_si256 ((const __m256i *)(input + i * 4));
+        pcm_store_24_avx2 (output + i * 3, _mm256_srli_epi32 (s, 8));
+    }
+    pcm_convert_32_to_24_c (input + i * 4, output + i * 3, n - i);
+}
+
+static void __attribute__ ((target ("avx2")))
+pcm_convert_32_to_float_avx2 (const char * restrict input, char * restrict output, int n) {
+    const __m256 scale = _mm256_set1_ps (1.f / 0x80000000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_loadu_si256 ((const __m256i *)(input + i * 4));
+        _mm256_storeu_ps ((float *)(output + i * 4), _mm256_mul_ps (_mm256_cvtepi32_ps (s), scale));
+    }
+    pcm_convert_32_to_float_c (input + i * 4, output + i * 4, n - i);
+}
+
+static void __attribute__ ((target ("avx2")))
+pcm_convert_float_to_16_avx2 (const char * restrict input, char * restrict output, int n) {
+    const __m256 scale = _mm256_set1_ps (0x8000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_loadu_ps ((const float *)(input + i * 4)), scale));
+        __m128i packed = _mm_packs_epi32 (_mm256_castsi256_si128 (s), _mm256_extracti128_si256 (s, 1));
+        _mm_storeu_si128 ((__m128i *)(output + i * 2), packed);
+    }
+    pcm_convert_float_to_16_c (input + i * 4, output + i * 2, n - i);
+}
+
+static void __attribute__ ((target ("avx2")))
+pcm_convert_float_to_24_avx2 (const char * restrict input, char * restrict output, int n) {
+    const __m256 scale = _mm256_set1_ps (0x800000);
+    const __m256i max = _mm256_set1_epi32 (0x7fffff);
+    const __m256i min = _mm256_set1_epi32 (-0x800000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_loadu_ps ((const float *)(input + i * 4)), scale));
+        s = _mm256_max_epi32 (_mm256_min_epi32 (s, max), min);
+        pcm_store_24_avx2 (output + i * 3, s);
+    }
+    pcm_convert_float_to_24_c (input + i * 4, output + i * 3, n - i);
+}
+
+static void __attribute__ ((target ("avx2")))
+pcm_convert_float_to_32_avx2 (const char * restrict input, char * restrict output, int n) {
+    const __m256 scale = _mm256_set1_ps ((float)0x80000000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 f = _mm256_mul_ps (_mm256_loadu_ps ((const float *)(input + i * 4)), scale);
+        __m256i s = _mm256_cvttps_epi32 (f);
+        s = _mm256_xor_si256 (s, _mm256_castps_si256 (_mm256_cmp_ps (f, scale, _CMP_GE_OQ)));
+        _mm256_storeu_si256 ((__m256i *)(output + i * 4), s);
+    }
+    pcm_convert_float_to_32_c (input + i * 4, output + i * 4, n - i);
+}
+
+#endif // PREMIX_AVX2
+
+#elif PREMIX_NEON
+
+// ftoi is floor (f + 0.5) on arm, round the same way here
+static inline int32x4_t
+pcm_ftoi_neon (float32x4_t f) {
+    float32x4_t t = vaddq_f32 (f, vdupq_n_f32 (0.5f));
+    int32x4_t i = vcvtq_s32_f32 (t);
+    // the conversion truncates, which goes up for negative values; the mask is -1 there
+    uint32x4_t up = vcgtq_f32 (vcvtq_f32_s32 (i), t);
+    i = vaddq_s32 (i, vreinterpretq_s32_u32 (up));
+    // from 2^23 up the values are whole already, and adding 0.5 could round them up
+    uint32x4_t whole = vcageq_f32 (f, vdupq_n_f32 (0x800000));
+    return vbslq_s32 (whole, vcvtq_s32_f32 (f), i);
+}
+
+// loads 16 packed 24-bit samples as sign extended 32-bit values
+static inline void
+pcm_load_24_neon (const char *input, int32x4_t out[4]) {
+    uint8x16x3_t b = vld3q_u8 ((const uint8_t *)input);
+    uint8x16x2_t lo = vzipq_u8 (b.val[0], b.val[1]);
+    int8x16_t top = vreinterpretq_s8_u8 (b.val[2]);
+    uint16x8x2_t w0 = vzipq_u16 (vreinterpretq_u16_u8 (lo.val[0]), vreinterpretq_u16_s16 (vmovl_s8 (vget_low_s8 (top))));
+    uint16x8x2_t w1 = vzipq_u16 (vreinterpretq_u16_u8 (lo.val[1]), vreinterpretq_u16_s16 (vmovl_s8 (vget_high_s8 (top))));
+    out[0] = vreinterpretq_s32_u16 (w0.val[0]);
+    out[1] = vreinterpretq_s32_u16 (w0.val[1]);
+    out[2] = vreinterpretq_s32_u16 (w1.val[0]);
+    out[3] = vreinterpretq_s32_u16 (w1.val[1]);
+}
+
+// stores the low 3 bytes of 16 32-bit values
+static inline void
+pcm_store_24_neon (char *output, const int32x4_t v[4]) {
+    uint16x8_t lo0 = vcombine_u16 (vmovn_u32 (vreinterpretq_u32_s32 (v[0])), vmovn_u32 (vreinterpretq_u32_s32 (v[1])));
+    uint16x8_t lo1 = vcombine_u16 (vmovn_u32 (vreinterpretq_u32_s32 (v[2])), vmovn_u32 (vreinterpretq_u32_s32 (v[3])));
+    uint16x8_t hi0 = vcombine_u16 (vshrn_n_u32 (vreinterpretq_u32_s32 (v[0]), 16), vshrn_n_u32 (vreinterpretq_u32_s32 (v[1]), 16));
+    uint16x8_t hi1 = vcombine_u16 (vshrn_n_u32 (vreinterpretq_u32_s32 (v[2]), 16), vshrn_n_u32 (vreinterpretq_u32_s32 (v[3]), 16));
+    uint8x16x3_t b;
+    b.val[0] = vcombine_u8 (vmovn_u16 (lo0), vmovn_u16 (lo1));
+    b.val[1] = vcombine_u8 (vshrn_n_u16 (lo0, 8), vshrn_n_u16 (lo1, 8));
+    b.val[2] = vcombine_u8 (vmovn_u16 (hi0), vmovn_u16 (hi1));
+    vst3q_u8 ((uint8_t *)output, b);
+}
+
+static void
+pcm_convert_16_to_32_neon (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t s = vld1q_s16 ((const int16_t *)(input + i * 2));
+        vst1q_s32 ((int32_t *)(output + i * 4), vshll_n_s16 (vget_low_s16 (s), 16));
+        vst1q_s32 ((int32_t *)(output + i * 4 + 16), vshll_n_s16 (vget_high_s16 (s), 16));
+    }
+    pcm_convert_16_to_32_c (input + i * 2, output + i * 4, n - i);
+}
+
+static void
+pcm_convert_16_to_float_neon (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t s = vld1q_s16 ((const int16_t *)(input + i * 2));
+        vst1q_f32 ((float *)(output + i * 4), vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (s))), 1.f / 0x8000));
+        vst1q_f32 ((float *)(output + i * 4 + 16), vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (s))), 1.f / 0x8000));
+    }
+    pcm_convert_16_to_float_c (input + i * 2, output + i * 4, n - i);
+}
+
+static void
+pcm_convert_24_to_32_neon (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        int32x4_t s[4];
+        pcm_load_24_neon (input + i * 3, s);
+        for (int k = 0; k < 4; k++) {
+            vst1q_s32 ((int32_t *)(output + i * 4 + k * 16), vshlq_n_s32 (s[k], 8));
+        }
+    }
+    pcm_convert_24_to_32_c (input + i * 3, output + i * 4, n - i);
+}
+
+static void
+pcm_convert_24_to_float_neon (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        int32x4_t s[4];
+        pcm_load_24_neon (input + i * 3, s);
+        for (int k = 0; k < 4; k++) {
+            vst1q_f32 ((float *)(output + i * 4 + k * 16), vmulq_n_f32 (vcvtq_f32_s32 (s[k]), 1.f / 0x800000));
+        }
+    }
+    pcm_convert_24_to_float_c (input + i * 3, output + i * 4, n - i);
+}
+
+static void
+pcm_convert_32_to_16_neon (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x4_t lo = vshrn_n_s32 (vld1q_s32 ((const int32_t *)(input + i * 4)), 16);
+        int16x4_t hi = vshrn_n_s32 (vld1q_s32 ((const int32_t *)(input + i * 4 + 16)), 16);
+        vst1q_s16 ((int16_t *)(output + i * 2), vcombine_s16 (lo, hi));
+    }
+    pcm_convert_32_to_16_c (input + i * 4, output + i * 2, n - i);
+}
+
+static void
+pcm_convert_32_to_24_neon (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        int32x4_t s[4];
+        for (int k = 0; k < 4; k++) {
+            s[k] = vshrq_n_s32 (vld1q_s32 ((const int32_t *)(input + i * 4 + k * 16)), 8);
+        }
+        pcm_store_24_neon (output + i * 3, s);
+    }
+    pcm_convert_32_to_24_c (input + i * 4, output + i * 3, n - i);
+}
+
+static void
+pcm_convert_32_to_float_neon (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int32x4_t s = vld1q_s32 ((const int32_t *)(input + i * 4));
+        vst1q_f32 ((float *)(output + i * 4), vmulq_n_f32 (vcvtq_f32_s32 (s), 1.f / 0x80000000));
+    }
+    pcm_convert_32_to_float_c (input + i * 4, output + i * 4, n - i);
+}
+
+static void
+pcm_convert_float_to_16_neon (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int32x4_t lo = pcm_ftoi_neon (vmulq_n_f32 (vld1q_f32 ((const float *)(input + i * 4)), 0x8000));
+        int32x4_t hi = pcm_ftoi_neon (vmulq_n_f32 (vld1q_f32 ((const float *)(input + i * 4 + 16)), 0x8000));
+        vst1q_s16 ((int16_t *)(output + i * 2), vcombine_s16 (vqmovn_s32 (lo), vqmovn_s32 (hi)));
+    }
+    pcm_convert_float_to_16_c (input + i * 4, output + i * 2, n - i);
+}
+
+static void
+pcm_convert_float_to_24_neon (const char * restrict input, char * restrict output, int n) {
+    const int32x4_t max = vdupq_n_s32 (0x7fffff);
+    const int32x4_t min = vdupq_n_s32 (-0x800000);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        int32x4_t s[4];
+        for (int k = 0; k < 4; k++) {
+            s[k] = pcm_ftoi_neon (vmulq_n_f32 (vld1q_f32 ((const float *)(input + i * 4 + k * 16)), 0x800000));
+            s[k] = vmaxq_s32 (vminq_s32 (s[k], max), min);
+        }
+        pcm_store_24_neon (output + i * 3, s);
+    }
+    pcm_convert_float_to_24_c (input + i * 4, output + i * 3, n - i);
+}
+
+static void
+pcm_convert_float_to_32_neon (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    // the conversion saturates, so 1.0 comes out as 0x7fffffff like in the C version
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t f = vld1q_f32 ((const float *)(input + i * 4));
+        vst1q_s32 ((int32_t *)(output + i * 4), vcvtq_s32_f32 (vmulq_n_f32 (f, (float)0x80000000)));
+    }
+    pcm_convert_float_to_32_c (input + i * 4, output + i * 4, n - i);
+}
+
+#endif
+
+// Gain routines multiply interleaved samples in place by a constant gain.
+// Integer samples are rounded and saturated, float samples are left unclamped
+// to keep the headroom of the dsp chain.
+typedef void (*gain_fn_t) (char *bytes, int n, float gain);
+
+static void
+pcm_gain_8_c (char *bytes, int n, float gain) {
+    int8_t *s = (int8_t *)bytes;
+    fpu_control ctl;
+    fpu_setround (&ctl);
+    for (int i = 0; i < n; i++) {
+        int sample = ftoi (s[i] * gain);
+        if (sample > 0x7f) {
+            sample = 0x7f;
+        }
+        else if (sample < -0x80) {
+            sample = -0x80;
+        }
+        s[i] = (int8_t)sample;
+    }
+    fpu_restore (ctl);
+}
+
+static void
+pcm_gain_16_c (char *bytes, int n, float gain) {
+    int16_t *s = (int16_t *)bytes;
+    fpu_control ctl;
+    fpu_setround (&ctl);
+    for (int i = 0; i < n; i++) {
+        int sample = ftoi (s[i] * gain);
+        if (sample > 0x7fff) {
+            sample = 0x7fff;
+        }
+        else if (sample < -0x8000) {
+            sample = -0x8000;
+        }
+        s[i] = (int16_t)sample;
+    }
+    fpu_restore (ctl);
+}
+
+static void
+pcm_gain_24_c (char *bytes, int n, float gain) {
+    fpu_control ctl;
+    fpu_setround (&ctl);
+    for (int i = 0; i < n; i++) {
+        int32_t sample = ((unsigned char)bytes[0]) | ((unsigned char)bytes[1]<<8) | ((int8_t)bytes[2]<<16);
+        sample = ftoi (sample * gain);
+        if (sample > 0x7fffff) {
+            sample = 0x7fffff;
+        }
+        else if (sample < -0x800000) {
+            sample = -0x800000;
+        }
+        bytes[0] = (sample&0x0000ff);
+        bytes[1] = (sample&0x00ff00)>>8;
+        bytes[2] = (sample&0xff0000)>>16;
+        bytes += 3;
+    }
+    fpu_restore (ctl);
+}
+
+static void
+pcm_gain_32_c (char *bytes, int n, float gain) {
+    int32_t *s = (int32_t *)bytes;
+    fpu_control ctl;
+    fpu_setround (&ctl);
+    for (int i = 0; i < n; i++) {
+        float sample = s[i] * gain;
+        if (sample >= (float)0x80000000) {
+            s[i] = 0x7fffffff;
+        }
+        else if (sample < -(float)0x80000000) {
+            s[i] = -0x7fffffff - 1;
+        }
+        else {
+            s[i] = ftoi (sample);
+        }
+    }
+    fpu_restore (ctl);
+}
+
+static void
+pcm_gain_float_c (char *bytes, int n, float gain) {
+    float *s = (float *)bytes;
+    for (int i = 0; i < n; i++) {
+        s[i] *= gain;
+    }
+}
+
+static const gain_fn_t gainers_c[8] = {
+    [0] = pcm_gain_8_c,
+    [1] = pcm_gain_16_c,
+    [2] = pcm_gain_24_c,
+    [3] = pcm_gain_32_c,
+    [7] = pcm_gain_float_c,
+};
+
+static gain_fn_t gainers[8];
+
+#if PREMIX_X86
+
+static void __attribute__ ((target ("sse2")))
+pcm_gain_16_sse2 (char *bytes, int n, float gain) {
+    const __m128 g = _mm_set1_ps (gain);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *)(bytes + i * 2));
+        __m128 lo = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (s, s), 16));
+        __m128 hi = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (s, s), 16));
+        s = _mm_packs_epi32 (_mm_cvtps_epi32 (_mm_mul_ps (lo, g)), _mm_cvtps_epi32 (_mm_mul_ps (hi, g)));
+        _mm_storeu_si128 ((__m128i *)(bytes + i * 2), s);
+    }
+    pcm_gain_16_c (bytes + i * 2, n - i, gain);
+}
+
+static void __attribute__ ((target ("sse2")))
+pcm_gain_32_sse2 (char *bytes, int n, float gain) {
+    const __m128 g = _mm_set1_ps (gain);
+    const __m128 limit = _mm_set1_ps ((float)0x80000000);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 f = _mm_mul_ps (_mm_cvtepi32_ps (_mm_loadu_si128 ((const __m128i *)(bytes + i * 4))), g);
+        __m128i s = _mm_cvtps_epi32 (f);
+        // positive overflow comes out as 0x80000000, flip it to 0x7fffffff
+        s = _mm_xor_si128 (s, _mm_castps_si128 (_mm_cmpge_ps (f, limit)));
+        _mm_storeu_si128 ((__m128i *)(bytes + i * 4), s);
+    }
+    pcm_gain_32_c (bytes + i * 4, n - i, gain);
+}
+
+static void __attribute__ ((target ("sse2")))
+pcm_gain_float_sse2 (char *bytes, int n, float gain) {
+    const __m128 g = _mm_set1_ps (gain);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        float *s = (float *)(bytes + i * 4);
+        _mm_storeu_ps (s, _mm_mul_ps (_mm_loadu_ps (s), g));
+        _mm_storeu_ps (s + 4, _mm_mul_ps (_mm_loadu_ps (s + 4), g));
+    }
+    pcm_gain_float_c (bytes + i * 4, n - i, gain);
+}
+
+#if PREMIX_AVX2
+
+static void __attribute__ ((target ("avx2")))
+pcm_gain_16_avx2 (char *bytes, int n, float gain) {
+    const __m256 g = _mm256_set1_ps (gain);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i s = _mm256_loadu_si256 ((const __m256i *)(bytes + i * 2));
+        __m256 lo = _mm256_cvtepi32_ps (_mm256_cvtepi16_epi32 (_mm256_castsi256_si128 (s)));
+        __m256 hi = _mm256_cvtepi32_ps (_mm256_cvtepi16_epi32 (_mm256_extracti128_si256 (s, 1)));
+        // packs works within 128-bit lanes, which puts the halves back in order
+        s = _mm256_packs_epi32 (_mm256_cvtps_epi32 (_mm256_mul_ps (lo, g)), _mm256_cvtps_epi32 (_mm256_mul_ps (hi, g)));
+        s = _mm256_permute4x64_epi64 (s, 0xd8);
+        _mm256_storeu_si256 ((__m256i *)(bytes + i * 2), s);
+    }
+    pcm_gain_16_c (bytes + i * 2, n - i, gain);
+}
+
+static void __attribute__ ((target ("avx2")))
+pcm_gain_24_avx2 (char *bytes, int n, float gain) {
+    const __m256 g = _mm256_set1_ps (gain);
+    const __m256i max = _mm256_set1_epi32 (0x7fffff);
+    const __m256i min = _mm256_set1_epi32 (-0x800000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 f = _mm256_cvtepi32_ps (_mm256_srai_epi32 (pcm_load_24_avx2 (bytes + i * 3), 8));
+        __m256i s = _mm256_cvtps_epi32 (_mm256_mul_ps (f, g));
+        pcm_store_24_avx2 (bytes + i * 3, _mm256_max_epi32 (_mm256_min_epi32 (s, max), min));
+    }
+    pcm_gain_24_c (bytes + i * 3, n - i, gain);
+}
+
+static void __attribute__ ((target ("avx2")))
+pcm_gain_32_avx2 (char *bytes, int n, float gain) {
+    const __m256 g = _mm256_set1_ps (gain);
+    const __m256 limit = _mm256_set1_ps ((float)0x80000000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 f = _mm256_mul_ps (_mm256_cvtepi32_ps (_mm256_loadu_si256 ((const __m256i *)(bytes + i * 4))), g);
+        __m256i s = _mm256_cvtps_epi32 (f);
+        s = _mm256_xor_si256 (s, _mm256_castps_si256 (_mm256_cmp_ps (f, limit, _CMP_GE_OQ)));
+        _mm256_storeu_si256 ((__m256i *)(bytes + i * 4), s);
+    }
+    pcm_gain_32_c (bytes + i * 4, n - i, gain);
+}
+
+static void __attribute__ ((target ("avx2")))
+pcm_gain_float_avx2 (char *bytes, int n, float gain) {
+    const __m256 g = _mm256_set1_ps (gain);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        float *s = (float *)(bytes + i * 4);
+        _mm256_storeu_ps (s, _mm256_mul_ps (_mm256_loadu_ps (s), g));
+    }
+    pcm_gain_float_c (bytes + i * 4, n - i, gain);
+}
+
+#endif // PREMIX_AVX2
+
+#elif PREMIX_NEON
+
+static void
+pcm_gain_16_neon (char *bytes, int n, float gain) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t s = vld1q_s16 ((const int16_t *)(bytes + i * 2));
+        int32x4_t lo = pcm_ftoi_neon (vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (s))), gain));
+        int32x4_t hi = pcm_ftoi_neon (vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (s))), gain));
+        vst1q_s16 ((int16_t *)(bytes + i * 2), vcombine_s16 (vqmovn_s32 (lo), vqmovn_s32 (hi)));
+    }
+    pcm_gain_16_c (bytes + i * 2, n - i, gain);
+}
+
+static void
+pcm_gain_24_neon (char *bytes, int n, float gain) {
+    const int32x4_t max = vdupq_n_s32 (0x7fffff);
+    const int32x4_t min = vdupq_n_s32 (-0x800000);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        int32x4_t s[4];
+        pcm_load_24_neon (bytes + i * 3, s);
+        for (int k = 0; k < 4; k++) {
+            s[k] = pcm_ftoi_neon (vmulq_n_f32 (vcvtq_f32_s32 (s[k]), gain));
+            s[k] = vmaxq_s32 (vminq_s32 (s[k], max), min);
+        }
+        pcm_store_24_neon (bytes + i * 3, s);
+    }
+    pcm_gain_24_c (bytes + i * 3, n - i, gain);
+}
+
+static void
+pcm_gain_32_neon (char *bytes, int n, float gain) {
+    int i = 0;
+    // the conversion saturates, like the C version
+    for (; i + 4 <= n; i += 4) {
+        int32x4_t s = vld1q_s32 ((const int32_t *)(bytes + i * 4));
+        vst1q_s32 ((int32_t *)(bytes + i * 4), pcm_ftoi_neon (vmulq_n_f32 (vcvtq_f32_s32 (s), gain)));
+    }
+    pcm_gain_32_c (bytes + i * 4, n - i, gain);
+}
+
+static void
+pcm_gain_float_neon (char *bytes, int n, float gain) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float *s = (float *)(bytes + i * 4);
+        vst1q_f32 (s, vmulq_n_f32 (vld1q_f32 (s), gain));
+    }
+    pcm_gain_float_c (bytes + i * 4, n - i, gain);
+}
+
+#endif
+
+void
+pcm_apply_gain (const ddb_waveformat_t *fmt, char *bytes, int size, float *gain, float target, int ramp) {
+    int idx = ((fmt->bps >> 3) - 1) | (fmt->is_float << 2);
+    gain_fn_t fn = gainers[idx] ? gainers[idx] : gainers_c[idx];
+    int samplesize = fmt->bps >> 3;
+    int framesize = samplesize * fmt->channels;
+    if (!fn || framesize <= 0) {
+        return;
+    }
+    int nframes = size / framesize;
+
+    // move towards the target a frame at a time, the rest of the buffer gets the target gain
+    int f = 0;
+    if (*gain != target) {
+        float from = *gain;
+        int n = ramp < nframes ? ramp : nframes;
+        for (f = 0; f < n; f++) {
+            *gain = from + (target - from) * (f + 1) / ramp;
+            gainers_c[idx] (bytes + f * framesize, fmt->channels, *gain);
+        }
+        if (n == ramp) {
+            *gain = target;
+        }
+    }
+    if (f < nframes && *gain != 1.f) {
+        fn (bytes + f * framesize, (nframes - f) * fmt->channels, *gain);
+    }
+}
+
+void
+pcm_convert_init (int simd) {
+    memcpy (converters, converters_c, sizeof (converters));
+    memcpy (gainers, gainers_c, sizeof (gainers));
+    if (!simd) {
+        return;
+    }
+#if PREMIX_X86
+    int flags = pcm_cpu_features ();
+    if (flags & PCM_CPU_SSE2) {
+        converters[1][3] = pcm_convert_16_to_32_sse2;
+        converters[1][7] = pcm_convert_16_to_float_sse2;
+        converters[3][1] = pcm_convert_32_to_16_sse2;
+        converters[3][7] = pcm_convert_32_to_float_sse2;
+        converters[7][1] = pcm_convert_float_to_16_sse2;
+        converters[7][3] = pcm_convert_float_to_32_sse2;
+        gainers[1] = pcm_gain_16_sse2;
+        gainers[3] = pcm_gain_32_sse2;
+        gainers[7] = pcm_gain_float_sse2;
+    }
+#if PREMIX_AVX2
+    if (flags & PCM_CPU_AVX2) {
+        converters[1][7] = pcm_convert_16_to_float_avx2;
+        converters[2][3] = pcm_convert_24_to_32_avx2;
+        converters[2][7] = pcm_convert_24_to_float_avx2;
+        converters[3][2] = pcm_convert_32_to_24_avx2;
+        converters[3][7] = pcm_convert_32_to_float_avx2;
+        converters[7][1] = pcm_convert_float_to_16_avx2;
+        converters[7][2] = pcm_convert_float_to_24_avx2;
+        converters[7][3] = pcm_convert_float_to_32_avx2;
+        gainers[1] = pcm_gain_16_avx2;
+        gainers[2] = pcm_gain_24_avx2;
+        gainers[3] = pcm_gain_32_avx2;
+        gainers[7] = pcm_gain_float_avx2;
+    }
+#endif
+#elif PREMIX_NEON
+    converters[1][3] = pcm_convert_16_to_32_neon;
+    converters[1][7] = pcm_convert_16_to_float_neon;
+    converters[2][3] = pcm_convert_24_to_32_neon;
+    converters[2][7] = pcm_convert_24_to_float_neon;
+    converters[3][1] = pcm_convert_32_to_16_neon;
+    converters[3][2] = pcm_convert_32_to_24_neon;
+    converters[3][7] = pcm_convert_32_to_float_neon;
+    converters[7][1] = pcm_convert_float_to_16_neon;
+    converters[7][2] = pcm_convert_float_to_24_neon;
+    converters[7][3] = pcm_convert_float_to_32_neon;
+    gainers[1] = pcm_gain_16_neon;
+    gainers[2] = pcm_gain_24_neon;
+    gainers[3] = pcm_gain_32_neon;
+    gainers[7] = pcm_gain_float_neon;
+#endif
+}
+
 int
 pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int inputsize) {
     // calculate output size
@@ -500,7 +1457,18 @@ pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict i
 
         int outidx = ((outputfmt->bps >> 3) - 1) | (outputfmt->is_float << 2);
         int inidx = ((inputfmt->bps >> 3) - 1) | (inputfmt->is_float << 2);
-        if (remappers[inidx][outidx]) {
+
+        int identity = inputfmt->channels == outputfmt->channels && outchannels == outputfmt->channelmask;
+        for (int c = 0; identity && c < outputfmt->channels; c++) {
+            if (channelmap[c] != c) {
+                identity = 0;
+            }
+        }
+
+        if (identity && converters[inidx][outidx]) {
+            converters[inidx][outidx] (input, output, nsamples * outputfmt->channels);
+        }
+        else if (remappers[inidx][outidx]) {
             remappers[inidx][outidx] (inputfmt, input, outputfmt, output, nsamples, channelmap, outputsamplesize);
         }
         else {
@@ -28,6 +28,15 @@
 #ifndef __PREMIX_H
 #define __PREMIX_H
 
+// picks the conversion routines for the running CPU; simd=0 uses only the C versions
+void
+pcm_convert_init (int simd);
+
+// multiplies samples by a gain in place; the gain moves linearly from *gain to
+// target over ramp frames, and *gain is updated to the gain of the last frame
+void
+pcm_apply_gain (const ddb_waveformat_t *fmt, char *bytes, int size, float *gain, float target, int ramp);
+
 // @returns number of output bytes
 int
 pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int inputsize);
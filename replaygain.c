@@ -26,6 +26,7 @@
 */
 #include "playlist.h"
 #include "volume.h"
+#include "premix.h"
 #include "replaygain.h"
 
 static int conf_replaygain_mode = 0;
@@ -42,24 +43,52 @@ static float rg_trackgain_full_preamp = 1;
 static float rg_albumgain_global_preamp = 1;
 static float rg_trackgain_global_preamp = 1;
 
-void
-replaygain_apply (ddb_waveformat_t *fmt, playItem_t *it, char *bytes, int bytesread) {
-    // FIXME: separate replaygain DSP plugin?
-    if (fmt->bps == 16) {
-        apply_replay_gain_int16 (it, bytes, bytesread);
-    }
-    else if (fmt->bps == 24) {
-        apply_replay_gain_int24 (it, bytes, bytesread);
-    }
-    else if (fmt->bps == 8) {
-        apply_replay_gain_int16 (it, bytes, bytesread);
-    }
-    else if (fmt->bps == 32 && !fmt->is_float) {
-        apply_replay_gain_int32 (it, bytes, bytesread);
+// gain of the last streamed frame, and whether the next track should start at its own gain
+static float rg_gain = 1;
+static int rg_reset = 1;
+
+static float
+replaygain_get_gain (void) {
+    float vol = 1.f;
+    if (conf_replaygain_mode == 1) {
+        if (rg_trackgain == 1) {
+            vol = rg_trackgain_global_preamp;
+        } else {
+            vol = rg_trackgain_full_preamp;
+        }
+        if (conf_replaygain_scale) {
+            if (vol * rg_trackpeak > 1.f) {
+                vol = 1.f / rg_trackpeak;
+            }
+        }
     }
-    else if (fmt->bps == 32 && fmt->is_float) {
-        apply_replay_gain_float32 (it, bytes, bytesread);
+    else if (conf_replaygain_mode == 2) {
+        if (rg_albumgain == 1) {
+            vol = rg_albumgain_global_preamp;
+        } else {
+            vol = rg_albumgain_full_preamp;
+        }
+        if (conf_replaygain_scale) {
+            if (vol * rg_albumpeak > 1.f) {
+                vol = 1.f / rg_albumpeak;
+            }
+        }
     }
+    return vol;
+}
+
+// applies the gain of the current track in place; the streamer calls this on
+// the decoded data before the dsp chain, so the dsp plugins get the
+// normalized signal
+void
+replaygain_apply (ddb_waveformat_t *fmt, char *bytes, int bytesread) {
+    float target = replaygain_get_gain ();
+    if (rg_reset) {
+        rg_gain = target;
+        rg_reset = 0;
+    }
+    // settings changed in the middle of a track are faded in over 10ms to avoid clicks
+    pcm_apply_gain (fmt, bytes, bytesread, &rg_gain, target, fmt->samplerate / 100);
 }
 
 void
@@ -95,167 +124,5 @@ replaygain_set_values (float albumgain, float albumpeak, float trackgain, float
     rg_trackgain_global_preamp = rg_trackgain * conf_global_preamp;
     rg_albumpeak = albumpeak;
     rg_trackpeak = trackpeak;
-}
-
-static inline int
-get_int_volume (void) {
-    int vol = 1000;
-    if (conf_replaygain_mode == 1) {
-        if (rg_trackgain == 1) {
-            vol = rg_trackgain_global_preamp * 1000;
-        } else {
-            vol = rg_trackgain_full_preamp * 1000;
-        }
-        if (conf_replaygain_scale) {
-            if (vol * rg_trackpeak > 1000) {
-                vol = 1000 / rg_trackpeak;
-            }
-        }
-    }
-    else if (conf_replaygain_mode == 2) {
-        if (rg_albumgain == 1) {
-            vol = rg_albumgain_global_preamp * 1000;
-        } else {
-            vol = rg_albumgain_full_preamp * 1000;
-        }
-        if (conf_replaygain_scale) {
-            if (vol * rg_albumpeak > 1000) {
-                vol = 1000 / rg_albumpeak;
-            }
-        }
-    }
-    return vol;
-}
-
-void
-apply_replay_gain_int8 (playItem_t *it, char *bytes, int size) {
-    if (!conf_replaygain_mode) {
-        return;
-    }
-    int vol = get_int_volume ();
-    if (vol < 0) {
-        return;
-    }
-    int8_t *s = (int8_t*)bytes;
-    for (int j = 0; j < size; j++) {
-        int32_t sample = ((int8_t)(*s)) * vol / 1000;
-        if (sample > 0x7f) {
-            sample = 0x7f;
-        }
-        else if (sample < -0x80) {
-            sample = -0x80;
-        }
-        *s = (int8_t)sample;
-        s++;
-    }
-}
-
-void
-apply_replay_gain_int16 (playItem_t *it, char *bytes, int size) {
-    if (!conf_replaygain_mode) {
-        return;
-    }
-    int vol = get_int_volume ();
-    if (vol < 0) {
-        return;
-    }
-    int16_t *s = (int16_t*)bytes;
-    for (int j = 0; j < size/2; j++) {
-        int32_t sample = ((int32_t)(*s)) * vol / 1000;
-        if (sample > 0x7fff) {
-            sample = 0x7fff;
-        }
-        else if (sample < -0x8000) {
-            sample = -0x8000;
-        }
-        *s = (int16_t)sample;
-        s++;
-    }
-}
-
-void
-apply_replay_gain_int24 (playItem_t *it, char *bytes, int size) {
-    if (!conf_replaygain_mode) {
-        return;
-    }
-    int64_t vol = get_int_volume ();
-    if (vol < 0) {
-        return;
-    }
-    char *s = (char*)bytes;
-    for (int j = 0; j < size/3; j++) {
-        int32_t sample = ((unsigned char)s[0]) | ((unsigned char)s[1]<<8) | (s[2]<<16);
-        sample = sample * vol / 1000;
-        if (sample > 0x7fffff) {
-            sample = 0x7fffff;
-        }
-        else if (sample < -0x800000) {
-            sample = -0x800000;
-        }
-        s[0] = (sample&0x0000ff);
-        s[1] = (sample&0x00ff00)>>8;
-        s[2] = (sample&0xff0000)>>16;
-        s += 3;
-    }
-}
-
-void
-apply_replay_gain_int32 (playItem_t *it, char *bytes, int size) {
-    if (!conf_replaygain_mode) {
-        return;
-    }
-    int64_t vol = get_int_volume ();
-    if (vol < 0) {
-        return;
-    }
-    int32_t *s = (int32_t*)bytes;
-    for (int j = 0; j < size/4; j++) {
-        int64_t sample = ((int32_t)(*s)) * vol / 1000;
-        *s = (int32_t)sample;
-        s++;
-    }
-}
-
-void
-apply_replay_gain_float32 (playItem_t *it, char *bytes, int size) {
-    if (!conf_replaygain_mode) {
-        return;
-    }
-    float vol = 1.f;
-    if (conf_replaygain_mode == 1) {
-        if (rg_trackgain == 1) {
-            vol = rg_trackgain_global_preamp;
-        } else {
-            vol = rg_trackgain_full_preamp;
-        }
-        if (conf_replaygain_scale) {
-            if (vol * rg_trackpeak > 1.f) {
-                vol = 1.f / rg_trackpeak;
-            }
-        }
-    }
-    else if (conf_replaygain_mode == 2) {
-        if (rg_albumgain == 1) {
-            vol = rg_albumgain_global_preamp;
-        } else {
-            vol = rg_albumgain_full_preamp;
-        }
-        if (conf_replaygain_scale) {
-            if (vol * rg_albumpeak > 1.f) {
-                vol = 1.f / rg_albumpeak;
-            }
-        }
-    }
-    float *s = (float*)bytes;
-    for (int j = 0; j < size/4; j++) {
-        float sample = ((float)*s) * vol;
-        if (sample > 1.f) {
-            sample = 1.f;
-        }
-        else if (sample < -1.f) {
-            sample = -1.f;
-        }
-        *s = sample;
-        s++;
-    }
+    rg_reset = 1;
 }
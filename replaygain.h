@@ -30,7 +30,7 @@
 #include "deadbeef.h"
 
 void
-replaygain_apply (ddb_waveformat_t *fmt, playItem_t *it, char *bytes, int bytesread);
+replaygain_apply (ddb_waveformat_t *fmt, char *bytes, int bytesread);
 
 void
 replaygain_set (int mode, int scale, float preamp, float global_preamp);
@@ -38,19 +38,4 @@ replaygain_set (int mode, int scale, float preamp, float global_preamp);
 void
 replaygain_set_values (float albumgain, float albumpeak, float trackgain, float trackpeak);
 
-void
-apply_replay_gain_int8 (playItem_t *it, char *bytes, int size);
-
-void
-apply_replay_gain_int16 (playItem_t *it, char *bytes, int size);
-
-void
-apply_replay_gain_int24 (playItem_t *it, char *bytes, int size);
-
-void
-apply_replay_gain_int32 (playItem_t *it, char *bytes, int size);
-
-void
-apply_replay_gain_float32 (playItem_t *it, char *bytes, int size);
-
 #endif
@@ -2,7 +2,7 @@
   This file is part of Deadbeef Player source code
   http://deadbeef.sourceforge.net
 
-  basic ring buffer implementation
+  single-producer/single-consumer lock-free ring buffer
 
   Copyright (C) 2009-2013 Alexey Yakovenko
 
@@ -26,68 +26,127 @@
 */
 
 #include <string.h>
+#include <assert.h>
 #include "ringbuf.h"
 
+// read position as seen after applying a pending flush
+static inline size_t
+effective_rd (ringbuf_t *p) {
+    size_t rd = p->rd;
+    size_t fl = p->flush;
+    if (fl && fl - 1 - rd < p->size) {
+        rd = fl - 1;
+    }
+    return rd;
+}
+
 void
 ringbuf_init (ringbuf_t *p, char *buffer, size_t size) {
+    assert (size && !(size & (size-1)));
     memset (p, 0, sizeof (ringbuf_t));
     p->bytes = buffer;
-    p->cursor = 0;
     p->size = size;
-    p->remaining = 0;
+}
+
+size_t
+ringbuf_get_remaining (ringbuf_t *p) {
+    __sync_synchronize ();
+    return p->wr - effective_rd (p);
+}
+
+size_t
+ringbuf_get_free (ringbuf_t *p) {
+    return p->size - ringbuf_get_remaining (p);
+}
+
+size_t
+ringbuf_write_span (ringbuf_t *p, char **ptr) {
+    __sync_synchronize ();
+    size_t wr = p->wr;
+    size_t avail = p->size - (wr - effective_rd (p));
+    size_t pos = wr & (p->size-1);
+    if (avail > p->size - pos) {
+        avail = p->size - pos;
+    }
+    *ptr = p->bytes + pos;
+    return avail;
+}
+
+void
+ringbuf_write_commit (ringbuf_t *p, size_t size) {
+    // make the data visible before the index
+    __sync_synchronize ();
+    p->wr += size;
+}
+
+void
+ringbuf_flush (ringbuf_t *p) {
+    __sync_synchronize ();
+    p->flush = p->wr + 1;
+    __sync_synchronize ();
 }
 
 int
 ringbuf_write (ringbuf_t *p, char *bytes, size_t size) {
-    if (p->size - p->remaining < size) {
+    if (ringbuf_get_free (p) < size) {
         return -1;
     }
 
-    size_t cursor = p->cursor + p->remaining;
-    cursor %= p->size;
-
-    if (p->size - cursor >= size) { // split
-        memcpy (p->bytes + cursor, bytes, size);
-        p->remaining += size;
-    }
-    else {
-        size_t n = p->size - cursor;
-        if (n > 0) {
-            memcpy (p->bytes + cursor, bytes, n);
-            p->remaining += n;
-            size -= n;
-            bytes += n;
+    while (size > 0) {
+        char *ptr;
+        size_t n = ringbuf_write_span (p, &ptr);
+        if (n > size) {
+            n = size;
         }
-        memcpy (p->bytes, bytes, size);
-        p->remaining += size;
+        memcpy (ptr, bytes, n);
+        ringbuf_write_commit (p, n);
+        bytes += n;
+        size -= n;
     }
     return 0;
 }
 
-int
-ringbuf_read (ringbuf_t *p, char *bytes, size_t size) {
-    if (p->remaining < size) {
-        size = p->remaining;
+size_t
+ringbuf_read_span (ringbuf_t *p, char **ptr) {
+    size_t fl = __sync_lock_test_and_set (&p->flush, 0);
+    if (fl && fl - 1 - p->rd < p->size) {
+        p->rd = fl - 1;
     }
-    int rb = size;
-
-    if (p->size - p->cursor >= size) {
-        memcpy (bytes, p->bytes + p->cursor, size);
-        p->cursor += size;
-        p->remaining -= size;
+    __sync_synchronize ();
+    size_t rd = p->rd;
+    size_t avail = p->wr - rd;
+    size_t pos = rd & (p->size-1);
+    if (avail > p->size - pos) {
+        avail = p->size - pos;
     }
-    else {
-        size_t n = p->size - p->cursor;
-        if (n > 0) {
-            memcpy (bytes, p->bytes + p->cursor, n);
-            p->cursor += n;
-            p->remaining -= n;
-            bytes += n;
-            size -= n;
+    *ptr = p->bytes + pos;
+    return avail;
+}
+
+void
+ringbuf_read_commit (ringbuf_t *p, size_t size) {
+    // finish reading the data before releasing the space to producer
+    __sync_synchronize ();
+    p->rd += size;
+}
+
+int
+ringbuf_read (ringbuf_t *p, char *bytes, size_t size) {
+    int rb = 0;
+    while (size > 0) {
+        char *ptr;
+        size_t n = ringbuf_read_span (p, &ptr);
+        if (!n) {
+            break;
+        }
+        if (n > size) {
+            n = size;
         }
-        memcpy (bytes, p->bytes, size);
-        p->cursor = size;
-        p->remaining -= size;
+        memcpy (bytes, ptr, n);
+        ringbuf_read_commit (p, n);
+        bytes += n;
+        size -= n;
+        rb += n;
     }
     return rb;
 }
@@ -2,7 +2,7 @@
   This file is part of Deadbeef Player source code
   http://deadbeef.sourceforge.net
 
-  basic ring buffer implementation
+  single-producer/single-consumer lock-free ring buffer
 
   Copyright (C) 2009-2013 Alexey Yakovenko
 
@@ -29,20 +29,58 @@
 
 #include <sys/types.h>
 
+// one thread may write (producer), one thread may read (consumer),
+// concurrently and without locking.
+// size must be a power of 2.
+// wr/rd are free running counters, wrapping is handled by masking with size-1.
 typedef struct {
     char *bytes;
     size_t size;
-    size_t cursor;
-    size_t remaining;
+    volatile size_t wr; // advanced by producer only
+    volatile size_t rd; // advanced by consumer only
+    volatile size_t flush; // pending flush position + 1, or 0
 } ringbuf_t;
 
 void
 ringbuf_init (ringbuf_t *p, char *buffer, size_t size);
 
+// producer side
+
+// writes all of the data, or nothing (returns -1)
 int
 ringbuf_write (ringbuf_t *p, char *bytes, size_t size);
 
+// returns size of contiguous writable region, and pointer to it in *ptr
+size_t
+ringbuf_write_span (ringbuf_t *p, char **ptr);
+
+void
+ringbuf_write_commit (ringbuf_t *p, size_t size);
+
+// discard everything written so far;
+// must not be called concurrently with the producer
+void
+ringbuf_flush (ringbuf_t *p);
+
+// consumer side
+
+// returns number of bytes read
 int
 ringbuf_read (ringbuf_t *p, char *bytes, size_t size);
 
+// returns size of contiguous readable region, and pointer to it in *ptr
+size_t
+ringbuf_read_span (ringbuf_t *p, char **ptr);
+
+void
+ringbuf_read_commit (ringbuf_t *p, size_t size);
+
+// can be called from any thread
+
+size_t
+ringbuf_get_remaining (ringbuf_t *p);
+
+size_t
+ringbuf_get_free (ringbuf_t *p);
+
 #endif
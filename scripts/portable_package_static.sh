@@ -75,6 +75,7 @@ tar jcvf ../../portable_out/build/$OUTNAME\
     $PLUGDIR/pulse.so\
     $PLUGDIR/dsp_libsrc.so\
     $PLUGDIR/ddb_mono2stereo.so\
+    $PLUGDIR/ddb_dsp_resampler.so\
     $PLUGDIR/alac.so\
     $PLUGDIR/wma.so\
     $PLUGDIR/pltbrowser_gtk2.so\
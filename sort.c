@@ -25,9 +25,11 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "utf8.h"
 #include "sort.h"
 #include "tf.h"
+#include "threading.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
 #define trace(fmt,...)
@@ -45,94 +47,325 @@ plt_sort (playlist_t *playlist, int iter, int id, const char *format, int order)
     plt_sort_internal (playlist, iter, id, format, order, 0);
 }
 
-static int pl_sort_is_duration;
-static int pl_sort_is_track;
-static int pl_sort_ascending;
-static int pl_sort_id;
-static int pl_sort_version; // 0: use pl_sort_format, 1: use pl_sort_tf_bytecode
-static const char *pl_sort_format;
-static char *pl_sort_tf_bytecode;
-static ddb_tf_context_t pl_sort_tf_ctx;
-
+// parameters of one sort, shared by all its threads
+typedef struct {
+    int is_duration;
+    int is_track;
+    int ascending;
+    int id;
+    int version; // 0: use format, 1: use tf_bytecode
+    const char *format;
+    char *tf_bytecode;
+    ddb_tf_context_t tf_ctx; // copied by each thread
+} sort_params_t;
+
+// the sort which the current thread works on, for qsort_cmp_func
+static __thread const sort_params_t *pl_sort_params;
+
+// don't start a thread for less items than that
+#define SORT_MIN_ITEMS_PER_THREAD 4096
+#define SORT_MAX_THREADS 16
+
+// decorated playlist item: the sort key is computed once per item
+typedef struct {
+    playItem_t *it;
+    int idx; // position before sorting, used to keep the sort stable
+    const char *key; // collation key
+    size_t key_offs; // offset of the collation key in the job arena
+    double num; // key for duration and track number sorting
+} sort_item_t;
+
+// arena holding the collation keys of all items
+typedef struct {
+    char *keys;
+    size_t keys_size;
+    size_t keys_alloc;
+} sort_keys_t;
+
+// a range of items decorated and sorted by one thread
+typedef struct {
+    const sort_params_t *params;
+    sort_item_t *items;
+    int count;
+    ddb_tf_context_t tf_ctx;
+    sort_keys_t keys;
+} sort_job_t;
+
+// merge of two adjacent sorted ranges
+typedef struct {
+    const sort_params_t *params;
+    const sort_item_t *src;
+    sort_item_t *dst;
+    int mid;
+    int count;
+} sort_merge_t;
+
+// Build a collation key for str, which can be compared using strcmp, and
+// gives the same order as comparing the original strings with
+// u8_strcasecmp, except that if both strings start with a number, the
+// numbers are compared first, and the rest of the strings after that.
+//
+// Each character is stored as its lowercase length followed by the
+// lowercase bytes, which is what u8_strcasecmp compares.
+// A leading number is stored as if it was a single digit character, and
+// that "digit" is the count of significant digits, followed by the digits.
+// This keeps numbers in the same range as digit characters relative to
+// the other strings, and makes longer numbers sort after shorter ones.
 static int
-strcasecmp_numeric (const char *a, const char *b) {
-    if (isdigit (*a) && isdigit (*b)) {
-        int anum = *a-'0';
-        const char *ae = a+1;
-        while (*ae && isdigit (*ae)) {
-            anum *= 10;
-            anum += *ae-'0';
-            ae++;
+pl_sort_make_key (const char *str, char *out, int size) {
+    char *p = out;
+    char *end = out + size - 1;
+    if (isdigit (*str)) {
+        while (*str == '0') {
+            str++;
+        }
+        const char *digits = str;
+        int n = 0;
+        while (isdigit (*str)) {
+            str++;
+            n++;
         }
-        int bnum = *b-'0';
-        const char *be = b+1;
-        while (*be && isdigit (*be)) {
-            bnum *= 10;
-            bnum += *be-'0';
-            be++;
+        if (end - p < n + 3) {
+            *p = 0;
+            return 0;
         }
-        if (anum == bnum) {
-            return u8_strcasecmp (ae, be);
+        *p++ = 1;
+        if (n < 9) {
+            *p++ = '0' + n;
+        }
+        else {
+            *p++ = '9';
+            *p++ = n < 255 ? n : 255;
         }
-        return anum - bnum;
+        memcpy (p, digits, n);
+        p += n;
     }
-    return u8_strcasecmp (a,b);
+    while (*str) {
+        int32_t i = 0;
+        char lc[10];
+        u8_nextchar (str, &i);
+        int l = u8_tolower ((const signed char *)str, i, lc);
+        if (l <= 0 || end - p < l + 1) {
+            break;
+        }
+        *p++ = l;
+        memcpy (p, lc, l);
+        p += l;
+        str += i;
+    }
+    *p = 0;
+    return (int)(p - out);
 }
 
-static int
-pl_sort_compare_str (playItem_t *a, playItem_t *b) {
-    if (pl_sort_is_duration) {
-        float dur_a = a->_duration * 100000;
-        float dur_b = b->_duration * 100000;
-        return !pl_sort_ascending ? dur_b - dur_a : dur_a - dur_b;
-    }
-    else if (pl_sort_is_track) {
-        int t1;
-        int t2;
-        const char *t;
-        t = pl_find_meta_raw (a, "track");
+static void
+pl_sort_add_key (sort_keys_t *job, sort_item_t *item, const char *str) {
+    int len = strlen (str);
+    int size = len * 3 + 16;
+    if (job->keys_size + size > job->keys_alloc) {
+        size_t alloc = job->keys_alloc ? job->keys_alloc : 0x10000;
+        while (job->keys_size + size > alloc) {
+            alloc *= 2;
+        }
+        job->keys = realloc (job->keys, alloc);
+        job->keys_alloc = alloc;
+    }
+    item->key_offs = job->keys_size;
+    job->keys_size += pl_sort_make_key (str, job->keys + job->keys_size, size) + 1;
+}
+
+// The formatting functions take the playlist lock for each item, the
+// collation key is built without it.
+static void
+pl_sort_decorate (sort_job_t *job, sort_item_t *item) {
+    const sort_params_t *params = job->params;
+    playItem_t *it = item->it;
+    if (params->is_duration) {
+        pl_lock ();
+        item->num = it->_duration;
+        pl_unlock ();
+    }
+    else if (params->is_track) {
+        pl_lock ();
+        const char *t = pl_find_meta_raw (it, "track");
         if (t && !isdigit (*t)) {
-            t1 = 999999;
+            item->num = 999999;
         }
         else {
-            t1 = t ? atoi (t) : -1;
+            item->num = t ? atoi (t) : -1;
         }
-        t = pl_find_meta_raw (b, "track");
-        if (t && !isdigit (*t)) {
-            t2 = 999999;
+        pl_unlock ();
+    }
+    else {
+        char tmp[1024];
+        if (params->version == 0) {
+            pl_format_title (it, -1, tmp, sizeof (tmp), params->id, params->format);
         }
         else {
-            t2 = t ? atoi (t) : -1;
+            job->tf_ctx.it = (ddb_playItem_t *)it;
+            tf_eval (&job->tf_ctx, params->tf_bytecode, tmp, sizeof (tmp));
         }
-        return !pl_sort_ascending ? t2 - t1 : t1 - t2;
+        pl_sort_add_key (&job->keys, item, tmp);
+    }
+}
+
+static int
+qsort_cmp_func (const void *a, const void *b) {
+    const sort_item_t *aa = a;
+    const sort_item_t *bb = b;
+    int res;
+    if (pl_sort_params->is_duration || pl_sort_params->is_track) {
+        res = (aa->num > bb->num) - (aa->num < bb->num);
     }
     else {
-        char tmp1[1024];
-        char tmp2[1024];
-        if (pl_sort_version == 0) {
-            pl_format_title (a, -1, tmp1, sizeof (tmp1), pl_sort_id, pl_sort_format);
-            pl_format_title (b, -1, tmp2, sizeof (tmp2), pl_sort_id, pl_sort_format);
+        res = strcmp (aa->key, bb->key);
+    }
+    if (!pl_sort_params->ascending) {
+        res = -res;
+    }
+    if (!res) {
+        res = aa->idx - bb->idx;
+    }
+    return res;
+}
+
+static void
+pl_sort_job_thread (void *ctx) {
+    sort_job_t *job = ctx;
+    job->tf_ctx = job->params->tf_ctx;
+    for (int i = 0; i < job->count; i++) {
+        pl_sort_decorate (job, &job->items[i]);
+    }
+    // the arena may have moved while growing
+    if (!job->params->is_duration && !job->params->is_track) {
+        for (int i = 0; i < job->count; i++) {
+            job->items[i].key = job->keys.keys + job->items[i].key_offs;
         }
-        else {
-            pl_sort_tf_ctx.id = pl_sort_id;
-            pl_sort_tf_ctx.it = (ddb_playItem_t *)a;
-            tf_eval(&pl_sort_tf_ctx, pl_sort_tf_bytecode, tmp1, sizeof(tmp1));
-            pl_sort_tf_ctx.it = (ddb_playItem_t *)b;
-            tf_eval(&pl_sort_tf_ctx, pl_sort_tf_bytecode, tmp2, sizeof(tmp2));
+    }
+    pl_sort_params = job->params;
+    qsort (job->items, job->count, sizeof (sort_item_t), qsort_cmp_func);
+}
+
+static void
+pl_sort_merge (sort_merge_t *m) {
+    const sort_item_t *a = m->src;
+    const sort_item_t *a_end = m->src + m->mid;
+    const sort_item_t *b = a_end;
+    const sort_item_t *b_end = m->src + m->count;
+    sort_item_t *out = m->dst;
+    while (a < a_end && b < b_end) {
+        // take from the left range on ties, to keep the merge stable
+        if (qsort_cmp_func (b, a) < 0) {
+            *out++ = *b++;
         }
-        int res = strcasecmp_numeric (tmp1, tmp2);
-        if (!pl_sort_ascending) {
-            res = -res;
+        else {
+            *out++ = *a++;
         }
-        return res;
     }
+    memcpy (out, a, (a_end - a) * sizeof (sort_item_t));
+    out += a_end - a;
+    memcpy (out, b, (b_end - b) * sizeof (sort_item_t));
+}
+
+static void
+pl_sort_merge_thread (void *ctx) {
+    sort_merge_t *m = ctx;
+    pl_sort_params = m->params;
+    pl_sort_merge (m);
 }
 
 static int
-qsort_cmp_func (const void *a, const void *b) {
-    playItem_t *aa = *((playItem_t **)a);
-    playItem_t *bb = *((playItem_t **)b);
-    return pl_sort_compare_str (aa, bb);
+pl_sort_get_num_threads (int count) {
+    long ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+    int nthreads = count / SORT_MIN_ITEMS_PER_THREAD;
+    if (nthreads > ncpu) {
+        nthreads = (int)ncpu;
+    }
+    if (nthreads > SORT_MAX_THREADS) {
+        nthreads = SORT_MAX_THREADS;
+    }
+    return nthreads > 1 ? nthreads : 1;
+}
+
+// Decorate items, and sort them splitting the work between threads.
+// Each thread computes the keys of a contiguous range and sorts it, and then
+// the ranges are merged pairwise in parallel. Since the comparison is a total
+// order, the result is the same as with a single thread.
+// The items must be referenced. The keys are formatted taking the playlist
+// lock per item, so it must not be held by the caller, unless nthreads is 1.
+static void
+pl_sort_items (const sort_params_t *params, sort_item_t *items, int count, int nthreads) {
+    sort_job_t jobs[SORT_MAX_THREADS];
+    int starts[SORT_MAX_THREADS+1];
+    intptr_t tids[SORT_MAX_THREADS];
+
+    for (int i = 0; i <= nthreads; i++) {
+        starts[i] = (int)((int64_t)count * i / nthreads);
+    }
+    memset (jobs, 0, sizeof (jobs));
+    for (int i = 0; i < nthreads; i++) {
+        jobs[i].params = params;
+        jobs[i].items = items + starts[i];
+        jobs[i].count = starts[i+1] - starts[i];
+    }
+
+    if (nthreads == 1) {
+        pl_sort_job_thread (&jobs[0]);
+        free (jobs[0].keys.keys);
+        return;
+    }
+
+    for (int i = 1; i < nthreads; i++) {
+        tids[i] = thread_start (pl_sort_job_thread, &jobs[i]);
+    }
+    pl_sort_job_thread (&jobs[0]);
+    for (int i = 1; i < nthreads; i++) {
+        thread_join (tids[i]);
+    }
+
+    // merge adjacent ranges until one is left
+    sort_item_t *tmp = malloc (count * sizeof (sort_item_t));
+    sort_item_t *src = items;
+    sort_item_t *dst = tmp;
+    int nranges = nthreads;
+    while (nranges > 1) {
+        sort_merge_t merges[SORT_MAX_THREADS];
+        int nmerges = 0;
+        int n = 0;
+        for (int i = 0; i < nranges; i += 2) {
+            int first = starts[i];
+            if (i + 1 < nranges) {
+                merges[nmerges].params = params;
+                merges[nmerges].src = src + first;
+                merges[nmerges].dst = dst + first;
+                merges[nmerges].mid = starts[i+1] - first;
+                merges[nmerges].count = starts[i+2] - first;
+                nmerges++;
+            }
+            else {
+                memcpy (dst + first, src + first, (starts[i+1] - first) * sizeof (sort_item_t));
+            }
+            starts[n++] = first;
+        }
+        starts[n] = count;
+        for (int i = 1; i < nmerges; i++) {
+            tids[i] = thread_start (pl_sort_merge_thread, &merges[i]);
+        }
+        pl_sort_merge_thread (&merges[0]);
+        for (int i = 1; i < nmerges; i++) {
+            thread_join (tids[i]);
+        }
+        nranges = n;
+        sort_item_t *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != items) {
+        memcpy (items, src, count * sizeof (sort_item_t));
+    }
+    free (tmp);
+    for (int i = 0; i < nthreads; i++) {
+        free (jobs[i].keys.keys);
+    }
 }
 
 void
@@ -177,6 +410,7 @@ plt_sort_random (playlist_t *playlist, int iter) {
         prev = it;
     }
     playlist->tail[iter] = array[playlist->count[iter]-1];
+    plt_index_invalidate (playlist, iter, 0);
 
     free (array);
 
@@ -185,6 +419,49 @@ plt_sort_random (playlist_t *playlist, int iter) {
     pl_unlock ();
 }
 
+// Snapshot the items of the list, and reference them.
+static sort_item_t *
+pl_sort_snapshot (playlist_t *playlist, int iter, int *pcount) {
+    int count = playlist->count[iter];
+    sort_item_t *items = malloc (count * sizeof (sort_item_t));
+    int idx = 0;
+    for (playItem_t *it = playlist->head[iter]; it; it = it->next[iter], idx++) {
+        pl_item_ref (it);
+        items[idx].it = it;
+        items[idx].idx = idx;
+    }
+    *pcount = count;
+    return items;
+}
+
+static void
+pl_sort_snapshot_free (sort_item_t *items, int count) {
+    for (int i = 0; i < count; i++) {
+        pl_item_unref (items[i].it);
+    }
+    free (items);
+}
+
+// Check that the list still has the snapshot items in their original order,
+// that is, nothing was added, removed or moved while it was unlocked.
+// Fills array with the items in the original order.
+static int
+pl_sort_snapshot_valid (playlist_t *playlist, int iter, const sort_item_t *items, int count, playItem_t **array) {
+    if (playlist->count[iter] != count) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        array[items[i].idx] = items[i].it;
+    }
+    int idx = 0;
+    for (playItem_t *it = playlist->head[iter]; it; it = it->next[iter], idx++) {
+        if (idx >= count || array[idx] != it) {
+            return 0;
+        }
+    }
+    return idx == count;
+}
+
 // version 0: title formatting v1
 // version 1: title formatting v2
 void
@@ -198,45 +475,70 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
     if (format == NULL || id == DB_COLUMN_FILENUMBER || !playlist->head[iter] || !playlist->head[iter]->next[iter]) {
         return;
     }
-    pl_lock ();
     struct timeval tm1;
     gettimeofday (&tm1, NULL);
-    pl_sort_ascending = ascending;
+
+    sort_params_t params;
+    memset (&params, 0, sizeof (params));
+    params.ascending = ascending;
     trace ("ascending: %d\n", ascending);
-    pl_sort_id = id;
+    params.id = id;
 
-    pl_sort_version = version;
+    params.version = version;
     if (version == 0) {
-        pl_sort_format = format;
-        pl_sort_tf_bytecode = NULL;
+        params.format = format;
     }
     else {
-        pl_sort_format = NULL;
-        pl_sort_tf_bytecode = tf_compile (format);
-        pl_sort_tf_ctx._size = sizeof (pl_sort_tf_ctx);
-        pl_sort_tf_ctx.it = NULL;
-        pl_sort_tf_ctx.plt = (ddb_playlist_t *)playlist;
-        pl_sort_tf_ctx.idx = -1;
-        pl_sort_tf_ctx.id = id;
+        params.tf_bytecode = tf_compile (format);
+        params.tf_ctx._size = sizeof (params.tf_ctx);
+        // every track is formatted once
+        params.tf_ctx.flags = DDB_TF_CONTEXT_NO_CACHE;
+        params.tf_ctx.it = NULL;
+        params.tf_ctx.plt = (ddb_playlist_t *)playlist;
+        params.tf_ctx.idx = -1;
+        params.tf_ctx.id = id;
     }
 
     if (format && id == -1
         && ((version == 0 && !strcmp (format, "%l"))
             || (version == 1 && !strcmp (format, "%length%")))
         ) {
-        pl_sort_is_duration = 1;
-    }
-    else {
-        pl_sort_is_duration = 0;
+        params.is_duration = 1;
     }
     if (format && id == -1
         && ((version == 0 && !strcmp (format, "%n"))
             || (version == 1 && (!strcmp (format, "%track number%") || !strcmp (format, "%tracknumber%"))))
         ) {
-        pl_sort_is_track = 1;
+        params.is_track = 1;
     }
-    else {
-        pl_sort_is_track = 0;
+
+    // The keys are evaluated without the playlist lock, on the helper
+    // threads, which lock it for each item. If the list changes meanwhile,
+    // the keys are evaluated again; the last attempt, or a caller which holds
+    // the lock already, keeps it locked and uses a single thread.
+    int held = pl_lock_held ();
+    pl_lock ();
+    sort_item_t *items = NULL;
+    playItem_t **array = NULL;
+    int count = 0;
+    for (int attempt = 0; ; attempt++) {
+        items = pl_sort_snapshot (playlist, iter, &count);
+        int locked = held || attempt >= 2;
+        int nthreads = locked ? 1 : pl_sort_get_num_threads (count);
+        if (!locked) {
+            pl_unlock ();
+        }
+        pl_sort_items (&params, items, count, nthreads);
+        if (!locked) {
+            pl_lock ();
+        }
+        array = malloc (count * sizeof (playItem_t *));
+        if (locked || pl_sort_snapshot_valid (playlist, iter, items, count, array)) {
+            break;
+        }
+        trace ("playlist changed while sorting, retrying\n");
+        free (array);
+        pl_sort_snapshot_free (items, count);
     }
 
     int cursor = plt_get_cursor (playlist, PL_MAIN);
@@ -244,35 +546,33 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
     if (cursor != -1) {
         track_under_cursor = plt_get_item_for_idx (playlist, cursor, PL_MAIN);
     }
-    playItem_t **array = malloc (playlist->count[iter] * sizeof (playItem_t *));
-    int idx = 0;
-    for (playItem_t *it = playlist->head[iter]; it; it = it->next[iter], idx++) {
-        array[idx] = it;
+
+    for (int idx = 0; idx < count; idx++) {
+        array[idx] = items[idx].it;
     }
 
-#if HAVE_MERGESORT
-    mergesort (array, playlist->count[iter], sizeof (playItem_t *), qsort_cmp_func);
-#else
-    qsort (array, playlist->count[iter], sizeof (playItem_t *), qsort_cmp_func);
-#endif
-    playItem_t *prev = NULL;
-    playlist->head[iter] = 0;
-    for (idx = 0; idx < playlist->count[iter]; idx++) {
-        playItem_t *it = array[idx];
-        it->prev[iter] = prev;
-        it->next[iter] = NULL;
-        if (!prev) {
-            playlist->head[iter] = it;
+    if (count > 0) {
+        playItem_t *prev = NULL;
+        playlist->head[iter] = 0;
+        for (int idx = 0; idx < count; idx++) {
+            playItem_t *it = array[idx];
+            it->prev[iter] = prev;
+            it->next[iter] = NULL;
+            if (!prev) {
+                playlist->head[iter] = it;
+            }
+            else {
+                prev->next[iter] = it;
+            }
+            prev = it;
         }
-        else {
-            prev->next[iter] = it;
-        }
-        prev = it;
-    }
 
-    playlist->tail[iter] = array[playlist->count[iter]-1];
+        playlist->tail[iter] = array[count-1];
+        plt_index_invalidate (playlist, iter, 0);
+    }
 
     free (array);
+    pl_sort_snapshot_free (items, count);
 
     if (track_under_cursor) {
         cursor = plt_get_item_idx (playlist, track_under_cursor, PL_MAIN);
@@ -287,15 +587,9 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
 
     plt_modified (playlist);
 
-    if (version == 0) {
-        pl_sort_format = NULL;
-    }
+    pl_unlock ();
 
     if (version == 1) {
-        tf_free (pl_sort_tf_bytecode);
-        pl_sort_tf_bytecode = NULL;
-        memset (&pl_sort_tf_ctx, 0, sizeof (pl_sort_tf_ctx));
+        tf_free (params.tf_bytecode);
     }
-
-    pl_unlock ();
 }
@@ -0,0 +1,136 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2015 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include <stdlib.h>
+#include "streambuffer.h"
+
+static ringbuf_t *
+streambuffer_alloc (size_t size) {
+    ringbuf_t *rb = malloc (sizeof (ringbuf_t) + size);
+    if (!rb) {
+        return NULL;
+    }
+    ringbuf_init (rb, (char *)(rb + 1), size);
+    return rb;
+}
+
+int
+streambuffer_init (streambuffer_t *sb, size_t size) {
+    sb->next = NULL;
+    sb->retired = NULL;
+    sb->readers = 0;
+    sb->cur = streambuffer_alloc (size);
+    return sb->cur ? 0 : -1;
+}
+
+void
+streambuffer_free (streambuffer_t *sb) {
+    if (sb->next != sb->cur) {
+        free (sb->next);
+    }
+    free (sb->cur);
+    free (sb->retired);
+    sb->cur = sb->next = sb->retired = NULL;
+}
+
+ringbuf_t *
+streambuffer_get_target (streambuffer_t *sb) {
+    ringbuf_t *next = sb->next;
+    __sync_synchronize ();
+    return next ? next : sb->cur;
+}
+
+int
+streambuffer_resize (streambuffer_t *sb, size_t size) {
+    // the reader publishes the retired buffer after it switched over, so a
+    // thread which enters get_fill or flush later can't see it anymore
+    ringbuf_t *retired = sb->retired;
+    if (retired && !__sync_fetch_and_add (&sb->readers, 0)) {
+        sb->retired = NULL;
+        free (retired);
+    }
+    if (sb->next || sb->retired) {
+        return 0; // previous resize is still in progress
+    }
+    if (sb->cur->size == size) {
+        return 0;
+    }
+
+    ringbuf_t *rb = streambuffer_alloc (size);
+    if (!rb) {
+        return -1;
+    }
+    __sync_synchronize ();
+    sb->next = rb;
+    return 0;
+}
+
+int
+streambuffer_read (streambuffer_t *sb, char *bytes, int size) {
+    ringbuf_t *cur = sb->cur;
+    int rb = ringbuf_read (cur, bytes, size);
+    if (rb < size) {
+        ringbuf_t *next = sb->next;
+        // once next buffer is set, the writer doesn't write to current one
+        if (next && !sb->retired && !ringbuf_get_remaining (cur)) {
+            sb->cur = next;
+            __sync_synchronize ();
+            sb->next = NULL;
+            __sync_synchronize ();
+            sb->retired = cur;
+            rb += ringbuf_read (next, bytes + rb, size - rb);
+        }
+    }
+    return rb;
+}
+
+size_t
+streambuffer_get_fill (streambuffer_t *sb) {
+    __sync_fetch_and_add (&sb->readers, 1);
+    ringbuf_t *next = sb->next;
+    __sync_synchronize ();
+    ringbuf_t *cur = sb->cur;
+    size_t fill = ringbuf_get_remaining (cur);
+    if (next && next != cur) {
+        fill += ringbuf_get_remaining (next);
+    }
+    __sync_fetch_and_sub (&sb->readers, 1);
+    return fill;
+}
+
+void
+streambuffer_flush (streambuffer_t *sb) {
+    __sync_fetch_and_add (&sb->readers, 1);
+    // read next first, in case the output switches buffers meanwhile
+    ringbuf_t *next = sb->next;
+    __sync_synchronize ();
+    ringbuf_t *cur = sb->cur;
+    if (next) {
+        ringbuf_flush (next);
+    }
+    if (cur != next) {
+        ringbuf_flush (cur);
+    }
+    __sync_fetch_and_sub (&sb->readers, 1);
+}
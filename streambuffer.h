@@ -0,0 +1,76 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2015 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#ifndef __deadbeef__streambuffer__
+#define __deadbeef__streambuffer__
+
+#include "ringbuf.h"
+
+// Output buffer between the streamer and the output plugin, which can be
+// resized while the output is reading from it.
+// To change the size, a new buffer is allocated and becomes the write target,
+// while the output keeps reading the old one until it's drained, and then
+// switches over, so no audio is dropped. The old buffer is freed by the
+// writer, once no other thread can be looking at it.
+typedef struct {
+    ringbuf_t * volatile cur; // read by the output
+    ringbuf_t * volatile next; // pending resize
+    ringbuf_t * volatile retired; // drained, to be freed by the writer
+    volatile int readers; // threads in streambuffer_get_fill or _flush
+} streambuffer_t;
+
+int
+streambuffer_init (streambuffer_t *sb, size_t size);
+
+// must not be called while any other thread can access the buffer
+void
+streambuffer_free (streambuffer_t *sb);
+
+// writer side
+
+// the buffer to write to
+ringbuf_t *
+streambuffer_get_target (streambuffer_t *sb);
+
+// starts switching to a buffer of the new size, which must be a power of 2.
+// does nothing while a previous resize is in progress.
+// returns -1 if the new buffer can't be allocated.
+int
+streambuffer_resize (streambuffer_t *sb, size_t size);
+
+// reader side, there can be only one reader thread
+
+int
+streambuffer_read (streambuffer_t *sb, char *bytes, int size);
+
+// can be called from any thread
+
+size_t
+streambuffer_get_fill (streambuffer_t *sb);
+
+// must not be called concurrently with the writer
+void
+streambuffer_flush (streambuffer_t *sb);
+
+#endif
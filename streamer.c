@@ -47,6 +47,8 @@
 #include "premix.h"
 #include "ringbuf.h"
 #include "replaygain.h"
+#include "dsppipeline.h"
+#include "streambuffer.h"
 #include "fft.h"
 #include "handler.h"
 #include "plugins/libparser/parser.h"
@@ -81,12 +83,37 @@ static ddb_dsp_context_t *eq;
 
 static int dsp_on = 0;
 
+// decoding and dsp buffers are sized once per chain and input format
+// by streamer_dsp_negotiate, and the chain is run in blocks of at most
+// DSP_BLOCK_FRAMES input frames, so nothing is allocated while playing
+#define DSP_BLOCK_FRAMES 2048
+
 static char *dsp_input_buffer;
 static int dsp_input_buffer_size;
 
 static char *dsp_temp_buffer;
 static int dsp_temp_buffer_size;
 
+static int dsp_negotiated;
+static ddb_waveformat_t dsp_negotiated_fmt;
+static int dsp_negotiated_samplerate;
+static float dsp_chain_ratio = 1; // max output frames per input frame
+
+// processed frames which didn't fit into the output yet
+static ddb_waveformat_t dsp_pending_fmt;
+static int dsp_pending_pos;
+static int dsp_pending;
+static int dsp_pending_eof;
+static dsp_block_t *dsp_pending_block; // when the pipeline is used
+
+// run each dsp plugin on its own thread
+static int conf_dsp_pipeline;
+static int dsp_pipeline_eof; // last block of the track is in the pipeline
+static int dsp_pipeline_gen;
+
+// cpu time of the plugins, when they run on the streamer thread
+static dsp_stats_t dsp_stats[DSP_PIPELINE_MAX_STAGES];
+
 static int autoconv_8_to_16 = 1;
 
 static int autoconv_16_to_24 = 0;
@@ -98,10 +125,29 @@ static int stop_after_album = 0;
 
 static int conf_streamer_nosleep = 0;
 
+// size of the output buffer, in milliseconds of output audio
+#define DEFAULT_BUFFER_MS 3000
+static int conf_buffer_ms = DEFAULT_BUFFER_MS;
+
+// extra buffer space to fill when the streaming track is close to its end,
+// so that opening the next track can't cause an underrun
+static int conf_readahead_ms = 0;
+
+// the streamer decodes until buffer fill reaches the high watermark,
+// and then sleeps until the output drains it below the low watermark
+#define DEFAULT_LOW_WATERMARK_MS 1000
+static int conf_low_watermark_ms = DEFAULT_LOW_WATERMARK_MS;
+static int conf_high_watermark_ms = DEFAULT_BUFFER_MS;
+static volatile int low_watermark; // in bytes, for the current output format
+static int streamer_draining;
+
+// when idle, there's nothing to wait for except handler messages
+#define STREAMER_IDLE_WAIT_MS 1000
+
 static int streaming_terminate;
 
-// buffer up to 3 seconds at 44100Hz stereo
-#define STREAM_BUFFER_SIZE 0x80000 // slightly more than 3 seconds of 44100 stereo
+// minimal output buffer size, slightly more than 3 seconds of 44100 stereo
+#define MIN_STREAM_BUFFER_SIZE 0x80000
 
 // how much bigger should read-buffer be to allow upsampling.
 // e.g. 8000Hz -> 192000Hz upsampling requires 24x buffer size,
@@ -114,10 +160,12 @@ static int streaming_terminate;
 #define READBUFFER_SIZE (MAX_BLOCK_SIZE * MAX_DSP_RATIO)
 static char readbuffer[READBUFFER_SIZE];
 
-static ringbuf_t streamer_ringbuf;
-static char streambuffer[STREAM_BUFFER_SIZE];
+// output buffer between the streamer and the output plugin
+static streambuffer_t streamer_buffer;
 
-static int bytes_until_next_song = 0;
+// bytes_until_next_song, playpos and playtime are updated by the output
+// thread without taking the streamer lock, see streamer_read
+static volatile int bytes_until_next_song = 0;
 static uintptr_t mutex;
 static uintptr_t currtrack_mutex;
 static uintptr_t wdl_mutex; // wavedata listener
@@ -128,13 +176,13 @@ static int badsong = -1;
 
 static float last_seekpos = -1;
 
-static float playpos = 0; // play position of current song
+static volatile float playpos = 0; // play position of current song
 static int avg_bitrate = -1; // avg bitrate of current song
 static int last_bitrate = -1; // last bitrate of current song
 
 static playlist_t *streamer_playlist;
 static playItem_t *playing_track;
-static float playtime; // total playtime of playing track
+static volatile float playtime; // total playtime of playing track
 static time_t started_timestamp; // result of calling time(NULL)
 static playItem_t *streaming_track;
 static playItem_t *playlist_track;
@@ -150,6 +198,49 @@ static DB_FILE *new_fileinfo_file;
 
 static int streamer_buffering;
 
+// decoded data which should be returned before reading from fileinfo,
+// e.g. when the track was prepared by the next track preparer
+typedef struct {
+    char *buffer;
+    int size;
+    int pos;
+} predecoded_t;
+
+static predecoded_t predecoded;
+static predecoded_t new_predecoded;
+
+// next track preparer:
+// opens the track which is expected to play next, and decodes the beginning
+// of it on a separate thread, while the current track is still streaming
+#define PREPARE_NEXT_SECONDS 10
+#define DEFAULT_PREPARE_NEXT_MS 2000
+
+enum {
+    PREPARE_IDLE,
+    PREPARE_REQUESTED,
+    PREPARE_WORKING,
+    PREPARE_READY,
+    PREPARE_FAILED, // don't retry for the same streaming track
+};
+
+typedef struct {
+    int state;
+    int cancel;
+    playItem_t *track; // the track which is being prepared
+    playItem_t *after; // the track which was streaming at the time of request
+    DB_fileinfo_t *fileinfo;
+    DB_fileinfo_t *opening; // owned by the worker, published so that its file can be aborted
+    predecoded_t data;
+} prepared_track_t;
+
+static prepared_track_t prepared;
+static uintptr_t prepare_mutex;
+static uintptr_t prepare_cond;
+static intptr_t prepare_tid;
+static int prepare_terminate;
+static int conf_prepare_next = 1;
+static int conf_prepare_next_ms = DEFAULT_PREPARE_NEXT_MS;
+
 // to allow interruption of stall file requests
 static DB_FILE *streamer_file;
 
@@ -159,6 +250,9 @@ static float audio_data[DDB_FREQ_BANDS * 2 * DDB_FREQ_MAX_CHANNELS];
 static int audio_data_fill = 0;
 static int audio_data_channels = 0;
 
+// software volume applied to the last frame given to the output plugin
+static float volume_gain = 1;
+
 // message queue
 static struct handler_s *handler;
 
@@ -172,6 +266,76 @@ typedef struct wavedata_listener_s {
 static wavedata_listener_t *waveform_listeners;
 static wavedata_listener_t *spectrum_listeners;
 
+// lock-free helpers for the state shared with the output thread
+static inline void
+atomic_float_add (volatile float *val, float add) {
+    union { float f; uint32_t i; } o, n;
+    do {
+        o.f = *val;
+        n.f = o.f + add;
+    } while (!__sync_bool_compare_and_swap ((volatile uint32_t *)val, o.i, n.i));
+}
+
+// decrement by `sub`, if positive, clamping at 0
+// returns 1 if the value reached 0
+static inline int
+atomic_int_countdown (volatile int *val, int sub) {
+    int o, n;
+    do {
+        o = *val;
+        if (o <= 0) {
+            return 0;
+        }
+        n = o - sub;
+        if (n < 0) {
+            n = 0;
+        }
+    } while (!__sync_bool_compare_and_swap (val, o, n));
+    return n == 0;
+}
+
+// sleep until a message arrives, the output thread requests more data,
+// or timeout expires
+static void
+streamer_wait (int timeout_ms) {
+    if (timeout_ms <= 0) {
+        return;
+    }
+    handler_wait_timeout (handler, timeout_ms);
+}
+
+// must be called from the streamer thread, with streamer_lock held
+static void
+streamer_buffer_resize (int bytes_in_one_second, int headroom) {
+    size_t need = (int64_t)(conf_buffer_ms + conf_readahead_ms) * bytes_in_one_second / 1000 + headroom;
+    size_t size = MIN_STREAM_BUFFER_SIZE;
+    while (size < need) {
+        size <<= 1;
+    }
+    if (streambuffer_resize (&streamer_buffer, size) < 0) {
+        fprintf (stderr, "streamer: failed to allocate %d bytes buffer\n", (int)size);
+    }
+}
+
+static void
+streamer_load_buffer_conf (void) {
+    conf_buffer_ms = conf_get_int ("streamer.buffer_ms", DEFAULT_BUFFER_MS);
+    if (conf_buffer_ms < 100) {
+        conf_buffer_ms = 100;
+    }
+    conf_readahead_ms = conf_get_int ("streamer.readahead_ms", 0);
+    if (conf_readahead_ms < 0) {
+        conf_readahead_ms = 0;
+    }
+    conf_low_watermark_ms = conf_get_int ("streamer.low_watermark_ms", DEFAULT_LOW_WATERMARK_MS);
+    conf_high_watermark_ms = conf_get_int ("streamer.high_watermark_ms", conf_buffer_ms);
+    if (conf_high_watermark_ms > conf_buffer_ms) {
+        conf_high_watermark_ms = conf_buffer_ms;
+    }
+    conf_prepare_next = conf_get_int ("streamer.prepare_next", 1);
+    conf_prepare_next_ms = conf_get_int ("streamer.prepare_next_ms", DEFAULT_PREPARE_NEXT_MS);
+}
+
 #if DETECT_PL_LOCK_RC
 volatile pthread_t streamer_lock_tid = 0;
 #endif
@@ -232,6 +396,14 @@ streamer_abort_files (void) {
         deadbeef->fabort (strfile);
     }
 
+    // the streamer may be waiting for the next track preparer
+    if (prepare_mutex) {
+        mutex_lock (prepare_mutex);
+        if (prepared.opening && prepared.opening->file) {
+            deadbeef->fabort (prepared.opening->file);
+        }
+        mutex_unlock (prepare_mutex);
+    }
 }
 
 static void
@@ -344,16 +516,7 @@ str_get_idx_of (playItem_t *it) {
     if (!streamer_playlist) {
         streamer_playlist = plt_get_curr ();
     }
-    playItem_t *c = streamer_playlist->head[PL_MAIN];
-    int idx = 0;
-    while (c && c != it) {
-        c = c->next[PL_MAIN];
-        idx++;
-    }
-    if (!c) {
-        pl_unlock ();
-        return -1;
-    }
+    int idx = plt_get_item_idx (streamer_playlist, it, PL_MAIN);
     pl_unlock ();
     return idx;
 }
@@ -364,17 +527,7 @@ str_get_for_idx (int idx) {
     if (!streamer_playlist) {
         streamer_playlist = plt_get_curr ();
     }
-    playItem_t *it = streamer_playlist->head[PL_MAIN];
-    while (idx--) {
-        if (!it) {
-            pl_unlock ();
-            return NULL;
-        }
-        it = it->next[PL_MAIN];
-    }
-    if (it) {
-        pl_item_ref (it);
-    }
+    playItem_t *it = plt_get_item_for_idx (streamer_playlist, idx, PL_MAIN);
     pl_unlock ();
     return it;
 }
@@ -440,6 +593,39 @@ stop_after_album_check (playItem_t *cur, playItem_t *next) {
     return 1;
 }
 
+// returns the track after curr in plt, in the given playback order, or NULL
+// if there's none left, or the next track depends on a reshuffle or a random
+// pick. in linear order, wraps around to the first track with loop all, and
+// sets *wrapped.
+// shared by streamer_move_to_nextsong_real and streamer_peek_nextsong, so
+// that the track which is prepared in advance is the one which gets played.
+// must be called with pl_lock held
+static playItem_t *
+streamer_find_next_in_order (playlist_t *plt, playItem_t *curr, int pl_order, int pl_loop_mode, int *wrapped) {
+    *wrapped = 0;
+    playItem_t *it = NULL;
+    if (pl_order == PLAYBACK_ORDER_SHUFFLE_TRACKS || pl_order == PLAYBACK_ORDER_SHUFFLE_ALBUMS) {
+        // find minimal notplayed, above current when shuffling albums
+        int above = curr && pl_order == PLAYBACK_ORDER_SHUFFLE_ALBUMS;
+        for (playItem_t *i = plt->head[PL_MAIN]; i; i = i->next[PL_MAIN]) {
+            if (i->played || (above && i->shufflerating < curr->shufflerating)) {
+                continue;
+            }
+            if (!it || i->shufflerating < it->shufflerating) {
+                it = i;
+            }
+        }
+    }
+    else if (pl_order == PLAYBACK_ORDER_LINEAR) {
+        it = curr ? curr->next[PL_MAIN] : plt->head[PL_MAIN];
+        if (!it && pl_loop_mode == PLAYBACK_MODE_LOOP_ALL) {
+            it = plt->head[PL_MAIN];
+            *wrapped = 1;
+        }
+    }
+    return it;
+}
+
 static int
 streamer_move_to_nextsong_real (int reason) {
     if (reason) {
@@ -527,88 +713,40 @@ streamer_move_to_nextsong_real (int reason) {
     }
 
     if (pl_order == PLAYBACK_ORDER_SHUFFLE_TRACKS || pl_order == PLAYBACK_ORDER_SHUFFLE_ALBUMS) { // shuffle
-        if (!curr || pl_order == PLAYBACK_ORDER_SHUFFLE_TRACKS) {
-            // find minimal notplayed
-            playItem_t *pmin = NULL; // notplayed minimum
-            for (playItem_t *i = plt->head[PL_MAIN]; i; i = i->next[PL_MAIN]) {
-                if (i->played) {
-                    continue;
-                }
-                if (!pmin || i->shufflerating < pmin->shufflerating) {
-                    pmin = i;
-                }
-            }
-            playItem_t *it = pmin;
-            // although it is possible that, although it == NULL, reshuffling the playlist
-            // will result in the next track belonging to the same album as this one, this
-            // is most likely not what the user wants.
-            if (stop_after_album_check(curr, it)) {
-                pl_unlock ();
-                return -1;
-            }
-            if (!it) {
-                // all songs played, reshuffle and try again
-                if (pl_loop_mode == PLAYBACK_MODE_LOOP_ALL) { // loop
-                    plt_reshuffle (streamer_playlist, &it, NULL);
-                }
-            }
-            if (!it) {
-                streamer_buffering = 0;
-                send_trackinfochanged (streaming_track);
-                playItem_t *temp;
-                plt_reshuffle (streamer_playlist, &temp, NULL);
-                pl_unlock ();
-                streamer_set_nextsong_real (-2, -2);
-                return -1;
-            }
-            int r = str_get_idx_of (it);
+        trace ("pl_next_song: reason=%d, loop=%d\n", reason, pl_loop_mode);
+        int wrapped;
+        playItem_t *it = streamer_find_next_in_order (plt, curr, pl_order, pl_loop_mode, &wrapped);
+        // although it is possible that, although it == NULL, reshuffling the playlist
+        // will result in the next track belonging to the same album as this one, this
+        // is most likely not what the user wants.
+        if (stop_after_album_check(curr, it)) {
             pl_unlock ();
-            streamer_set_nextsong_real (r, 1);
-            return 0;
+            return -1;
         }
-        else {
-            trace ("pl_next_song: reason=%d, loop=%d\n", reason, pl_loop_mode);
-            // find minimal notplayed above current
-            int rating = curr->shufflerating;
-            playItem_t *pmin = NULL; // notplayed minimum
-            for (playItem_t *i = plt->head[PL_MAIN]; i; i = i->next[PL_MAIN]) {
-                if (i->played || i->shufflerating < rating) {
-                    continue;
-                }
-                if (!pmin || i->shufflerating < pmin->shufflerating) {
-                    pmin = i;
-                }
-            }
-            playItem_t *it = pmin;
-            if (stop_after_album_check(curr, it)) {
-                pl_unlock ();
-                return -1;
-            }
-            if (!it) {
-                // all songs played, reshuffle and try again
-                if (pl_loop_mode == PLAYBACK_MODE_LOOP_ALL || reason == 1) { // loop
-                    trace ("all songs played! reshuffle\n");
-                    plt_reshuffle (streamer_playlist, &it, NULL);
-                }
-            }
-            if (!it) {
-                streamer_buffering = 0;
-                send_trackinfochanged (streaming_track);
-                playItem_t *temp;
-                plt_reshuffle (streamer_playlist, &temp, NULL);
-                pl_unlock ();
-                streamer_set_nextsong_real (-2, -2);
-                return -1;
+        if (!it) {
+            // all songs played, reshuffle and try again; skipping to the next
+            // album reshuffles too
+            if (pl_loop_mode == PLAYBACK_MODE_LOOP_ALL || (curr && pl_order == PLAYBACK_ORDER_SHUFFLE_ALBUMS && reason == 1)) { // loop
+                trace ("all songs played! reshuffle\n");
+                plt_reshuffle (streamer_playlist, &it, NULL);
             }
-            int r = str_get_idx_of (it);
+        }
+        if (!it) {
+            streamer_buffering = 0;
+            send_trackinfochanged (streaming_track);
+            playItem_t *temp;
+            plt_reshuffle (streamer_playlist, &temp, NULL);
             pl_unlock ();
-            streamer_set_nextsong_real (r, 1);
-            return 0;
+            streamer_set_nextsong_real (-2, -2);
+            return -1;
         }
+        int r = str_get_idx_of (it);
+        pl_unlock ();
+        streamer_set_nextsong_real (r, 1);
+        return 0;
     }
     else if (pl_order == PLAYBACK_ORDER_LINEAR) { // linear
         DB_output_t *output = plug_get_output ();
-        playItem_t *it = NULL;
         if (!curr && output->state () == OUTPUT_STATE_STOPPED) {
             int cur = plt_get_cursor (streamer_playlist, PL_MAIN);
             if (cur != -1) {
@@ -616,33 +754,21 @@ streamer_move_to_nextsong_real (int reason) {
                 pl_item_unref (curr);
             }
         }
-        if (curr) {
-            it = curr->next[PL_MAIN];
-        }
-        else {
-            it = streamer_playlist->head[PL_MAIN];
-        }
-        if (stop_after_album_check(curr, it)) {
+        int wrapped;
+        playItem_t *it = streamer_find_next_in_order (plt, curr, pl_order, pl_loop_mode, &wrapped);
+        // stop after the album at the end of the playlist, even with loop all
+        if (stop_after_album_check(curr, wrapped ? NULL : it)) {
             pl_unlock ();
             return -1;
         }
         if (!it) {
             trace ("streamer_move_nextsong: was last track\n");
-            if (pl_loop_mode == PLAYBACK_MODE_LOOP_ALL) {
-                it = plt->head[PL_MAIN];
-            }
-            else {
-                streamer_buffering = 0;
-                send_trackinfochanged (streaming_track);
-                badsong = -1;
-                pl_unlock ();
-                streamer_set_nextsong_real (-2, -2);
-                return 0;
-            }
-        }
-        if (!it) {
+            streamer_buffering = 0;
+            send_trackinfochanged (streaming_track);
+            badsong = -1;
             pl_unlock ();
-            return -1;
+            streamer_set_nextsong_real (-2, -2);
+            return 0;
         }
         int r = str_get_idx_of (it);
         pl_unlock ();
@@ -965,6 +1091,278 @@ static DB_fileinfo_t *dec_open (DB_decoder_t *dec, uint32_t hints, playItem_t *i
     return dec->open (hints);
 }
 
+static void
+predecoded_free (predecoded_t *pd) {
+    if (pd->buffer) {
+        free (pd->buffer);
+    }
+    memset (pd, 0, sizeof (predecoded_t));
+}
+
+// reads from current fileinfo, after returning predecoded data
+static int
+streamer_decoder_read (char *bytes, int size) {
+    int n = 0;
+    if (predecoded.buffer) {
+        n = min (size, predecoded.size - predecoded.pos);
+        memcpy (bytes, predecoded.buffer + predecoded.pos, n);
+        predecoded.pos += n;
+        if (predecoded.pos >= predecoded.size) {
+            predecoded_free (&predecoded);
+        }
+        if (n == size) {
+            return n;
+        }
+    }
+    int rb = fileinfo->plugin->read (fileinfo, bytes + n, size - n);
+    if (rb < 0) {
+        return n ? n : rb;
+    }
+    return n + rb;
+}
+
+// must be called with prepare_mutex locked
+static void
+prepared_reset (void) {
+    if (prepared.fileinfo) {
+        prepared.fileinfo->plugin->free (prepared.fileinfo);
+        prepared.fileinfo = NULL;
+    }
+    if (prepared.track) {
+        pl_item_unref (prepared.track);
+        prepared.track = NULL;
+    }
+    if (prepared.after) {
+        pl_item_unref (prepared.after);
+        prepared.after = NULL;
+    }
+    predecoded_free (&prepared.data);
+    prepared.state = PREPARE_IDLE;
+}
+
+static void
+streamer_prepare_thread (void *ctx) {
+#ifdef __linux__
+    prctl (PR_SET_NAME, "deadbeef-prepare", 0, 0, 0, 0);
+#endif
+    mutex_lock (prepare_mutex);
+    for (;;) {
+        while (!prepare_terminate && prepared.state != PREPARE_REQUESTED) {
+            cond_wait_timeout (prepare_cond, prepare_mutex, 1000);
+        }
+        if (prepare_terminate) {
+            break;
+        }
+        playItem_t *it = prepared.track;
+        pl_item_ref (it);
+        prepared.state = PREPARE_WORKING;
+        prepared.cancel = 0;
+        mutex_unlock (prepare_mutex);
+
+        DB_decoder_t *dec = NULL;
+        pl_lock ();
+        const char *decoder_id = pl_find_meta (it, ":DECODER");
+        if (decoder_id) {
+            dec = plug_get_decoder_for_id (decoder_id);
+        }
+        pl_unlock ();
+
+        DB_fileinfo_t *fi = NULL;
+        predecoded_t data = {0};
+        if (dec) {
+            trace ("prepare: opening %s\n", pl_find_meta (it, ":URI"));
+            fi = dec_open (dec, STREAMER_HINTS, it);
+            if (fi) {
+                // the decoder opens the file in init, which is where a slow
+                // open can hang, so publish the fileinfo before that
+                mutex_lock (prepare_mutex);
+                prepared.opening = fi;
+                int cancel = prepared.cancel;
+                mutex_unlock (prepare_mutex);
+                if (cancel || dec->init (fi, DB_PLAYITEM (it)) != 0) {
+                    mutex_lock (prepare_mutex);
+                    prepared.opening = NULL;
+                    mutex_unlock (prepare_mutex);
+                    dec->free (fi);
+                    fi = NULL;
+                }
+            }
+        }
+        if (fi) {
+            int samplesize = fi->fmt.channels * fi->fmt.bps / 8;
+            int64_t size = (int64_t)conf_prepare_next_ms * fi->fmt.samplerate / 1000 * samplesize;
+            if (size > 0 && fi->fmt.samplerate > 0 && (data.buffer = malloc (size))) {
+                int nb = fi->plugin->read (fi, data.buffer, (int)size);
+                if (nb <= 0) {
+                    predecoded_free (&data);
+                }
+                else {
+                    data.size = nb;
+                }
+            }
+        }
+
+        mutex_lock (prepare_mutex);
+        prepared.opening = NULL;
+        if (prepared.cancel || !fi) {
+            // failed or not needed anymore, streamer will open the track normally
+            if (fi) {
+                fi->plugin->free (fi);
+            }
+            predecoded_free (&data);
+            if (prepared.cancel) {
+                prepared_reset ();
+            }
+            else {
+                prepared.state = PREPARE_FAILED;
+            }
+        }
+        else {
+            prepared.fileinfo = fi;
+            prepared.data = data;
+            prepared.state = PREPARE_READY;
+        }
+        pl_item_unref (it);
+        cond_broadcast (prepare_cond);
+    }
+    prepared_reset ();
+    mutex_unlock (prepare_mutex);
+}
+
+// returns the track which is expected to play after streaming_track,
+// without changing any playback state; only the deterministic cases are handled.
+static playItem_t *
+streamer_peek_nextsong (void) {
+    if (stop_after_current || stop_after_album || !streaming_track) {
+        return NULL;
+    }
+    playItem_t *it = NULL;
+    pl_lock ();
+    if (playqueue_getcount ()) {
+        it = playqueue_getnext ();
+        pl_unlock ();
+        return it;
+    }
+
+    playItem_t *curr = playlist_track;
+    playlist_t *plt = streamer_playlist;
+    int pl_order = pl_get_order ();
+    int pl_loop_mode = conf_get_int ("playback.loop", 0);
+    if (!plt || !curr || curr != streaming_track) {
+        // don't guess after the user has changed something
+    }
+    else if (pl_loop_mode == PLAYBACK_MODE_LOOP_SINGLE) {
+        it = curr;
+    }
+    else {
+        int wrapped;
+        it = streamer_find_next_in_order (plt, curr, pl_order, pl_loop_mode, &wrapped);
+    }
+    if (it) {
+        pl_item_ref (it);
+    }
+    pl_unlock ();
+    return it;
+}
+
+// starts preparing the next track, if streaming track is close to its end
+static void
+streamer_prepare_next_check (void) {
+    if (!conf_prepare_next || !fileinfo || !streaming_track || bytes_until_next_song >= 0) {
+        return;
+    }
+    float dur = pl_get_item_duration (streaming_track);
+    if (dur <= 0 || fileinfo->readpos < dur - PREPARE_NEXT_SECONDS) {
+        return;
+    }
+
+    mutex_lock (prepare_mutex);
+    int done = prepared.state != PREPARE_IDLE && prepared.after == streaming_track;
+    mutex_unlock (prepare_mutex);
+    if (done) {
+        return;
+    }
+
+    playItem_t *next = streamer_peek_nextsong ();
+    if (!next) {
+        return;
+    }
+    // streams can't be opened twice, and content type detection must run on
+    // the streamer thread
+    pl_lock ();
+    int can_prepare = pl_find_meta (next, ":DECODER") != NULL;
+    pl_unlock ();
+    if (!can_prepare || is_remote_stream (next)) {
+        pl_item_unref (next);
+        return;
+    }
+
+    mutex_lock (prepare_mutex);
+    if (prepared.state == PREPARE_WORKING) {
+        prepared.cancel = 1;
+        mutex_unlock (prepare_mutex);
+        pl_item_unref (next);
+        return; // try again when the worker is done
+    }
+    prepared_reset ();
+    prepared.track = next;
+    prepared.after = streaming_track;
+    pl_item_ref (prepared.after);
+    prepared.state = PREPARE_REQUESTED;
+    cond_broadcast (prepare_cond);
+    mutex_unlock (prepare_mutex);
+}
+
+// returns prepared fileinfo if it was opened for `it`, and discards it otherwise
+static DB_fileinfo_t *
+streamer_take_prepared (playItem_t *it, predecoded_t *data) {
+    DB_fileinfo_t *fi = NULL;
+    mutex_lock (prepare_mutex);
+    // a track which is still being prepared is opened again by the caller,
+    // instead of waiting for a slow open on the streamer thread
+    if (prepared.state == PREPARE_READY && prepared.track == it) {
+        fi = prepared.fileinfo;
+        prepared.fileinfo = NULL;
+        *data = prepared.data;
+        memset (&prepared.data, 0, sizeof (predecoded_t));
+        prepared_reset ();
+    }
+    else if (prepared.state == PREPARE_WORKING) {
+        prepared.cancel = 1;
+    }
+    else {
+        prepared_reset ();
+    }
+    mutex_unlock (prepare_mutex);
+    return fi;
+}
+
+static void
+streamer_prepare_init (void) {
+    prepare_mutex = mutex_create_nonrecursive ();
+    prepare_cond = cond_create ();
+    prepare_terminate = 0;
+    prepare_tid = thread_start (streamer_prepare_thread, NULL);
+}
+
+static void
+streamer_prepare_free (void) {
+    mutex_lock (prepare_mutex);
+    prepare_terminate = 1;
+    prepared.cancel = 1;
+    if (prepared.opening && prepared.opening->file) {
+        deadbeef->fabort (prepared.opening->file);
+    }
+    cond_broadcast (prepare_cond);
+    mutex_unlock (prepare_mutex);
+    thread_join (prepare_tid);
+    prepare_tid = 0;
+    cond_free (prepare_cond);
+    prepare_cond = 0;
+    mutex_free (prepare_mutex);
+    prepare_mutex = 0;
+}
+
 // that must be called after last sample from str_playing_song was done reading
 static int
 streamer_set_current (playItem_t *it) {
@@ -1007,6 +1405,7 @@ streamer_set_current (playItem_t *it) {
     }
 
     if (!it || paused_stream) {
+        streamer_take_prepared (NULL, NULL);
         goto success;
     }
     if (to) {
@@ -1016,6 +1415,20 @@ streamer_set_current (playItem_t *it) {
     if (from) {
         send_trackinfochanged (from);
     }
+
+    new_fileinfo = streamer_take_prepared (it, &new_predecoded);
+    if (new_fileinfo) {
+        trace ("using prepared decoder for %s\n", pl_find_meta (it, ":URI"));
+        new_fileinfo_file = new_fileinfo->file;
+        playlist_track = it;
+        if (streaming_track) {
+            pl_item_unref (streaming_track);
+        }
+        streaming_track = it;
+        pl_item_ref (streaming_track);
+        streamer_set_replaygain (streaming_track);
+        goto success;
+    }
     char decoder_id[100] = "";
     char filetype[100] = "";
     pl_lock ();
@@ -1315,10 +1728,13 @@ success:
         fileinfo = NULL;
         fileinfo_file = NULL;
     }
+    predecoded_free (&predecoded);
     if (new_fileinfo) {
         fileinfo = new_fileinfo;
         new_fileinfo = NULL;
         new_fileinfo_file = NULL;
+        predecoded = new_predecoded;
+        memset (&new_predecoded, 0, sizeof (predecoded_t));
     }
     if (do_songstarted && playing_track) {
         trace ("songstarted %s\n", playing_track ? pl_find_meta (playing_track, ":URI") : "null");
@@ -1473,7 +1889,7 @@ streamer_start_new_song (void) {
         if (nextsong == -1) {
             trace ("streamer_move_to_nextsong after skip\n");
             streamer_move_to_nextsong_real (1);
-            usleep (50000);
+            streamer_wait (50);
         }
         else {
             trace ("nextsong changed from %d to %d by another thread, reinit\n", initsng, nextsong);
@@ -1536,7 +1952,7 @@ streamer_start_new_song (void) {
 static void
 streamer_next (int bytesread) {
     streamer_lock ();
-    bytes_until_next_song = streamer_ringbuf.remaining + bytesread;
+    bytes_until_next_song = streambuffer_get_fill (&streamer_buffer) + bytesread;
     streamer_unlock ();
     if (stop_after_current) {
         streamer_buffering = 0;
@@ -1565,6 +1981,9 @@ streamer_notify_order_changed_real (int prev_order, int new_order);
 static void
 free_dsp_buffers (void);
 
+static void
+streamer_dsp_negotiate (const ddb_waveformat_t *infmt);
+
 void
 streamer_thread (void *ctx) {
 #ifdef __linux__
@@ -1654,7 +2073,7 @@ streamer_thread (void *ctx) {
             continue;
         }
         else if (output->state () == OUTPUT_STATE_STOPPED) {
-            usleep (50000);
+            streamer_wait (STREAMER_IDLE_WAIT_MS);
             continue;
         }
 
@@ -1726,6 +2145,7 @@ streamer_thread (void *ctx) {
                     pl_item_unref (streaming_track);
                     streaming_track = NULL;
                 }
+                predecoded_free (&predecoded);
                 streaming_track = playing_track;
                 if (streaming_track) {
                     pl_item_ref (streaming_track);
@@ -1767,7 +2187,7 @@ streamer_thread (void *ctx) {
                     trace ("failed to restart prev track on seek, trying to jump to next track\n");
                     trace ("streamer_move_to_nextsong from seek\n");
                     streamer_move_to_nextsong (0);
-                    usleep (50000);
+                    streamer_wait (50);
                     continue;
                 }
             }
@@ -1786,6 +2206,7 @@ streamer_thread (void *ctx) {
                 }
                 streamer_lock ();
                 streamer_reset (1);
+                predecoded_free (&predecoded);
                 if (fileinfo->plugin->seek (fileinfo, pos) >= 0) {
                     playpos = fileinfo->readpos;
                 }
@@ -1803,11 +2224,11 @@ streamer_thread (void *ctx) {
         }
         last_seekpos = -1;
 
-        // read ahead at 2x speed of output samplerate, in 4k blocks
+        // read ahead in 4k..16k blocks, between low and high watermarks
         int rate = output->fmt.samplerate;
         if (!rate) {
             trace ("str: got 0 output samplerate\n");
-            usleep(20000);
+            streamer_wait (20);
             continue;
         }
         int channels = output->fmt.channels;
@@ -1827,8 +2248,33 @@ streamer_thread (void *ctx) {
             bytes_in_one_second = blocksize;
         }
 
+        // max time to spend decoding before checking messages again
         int alloc_time = 1000 / (bytes_in_one_second / blocksize);
 
+        // reallocate the buffer if needed for the current output format
+        int headroom = blocksize * MAX_DSP_RATIO;
+        streamer_lock ();
+        streamer_buffer_resize (bytes_in_one_second, headroom);
+        ringbuf_t *target = streambuffer_get_target (&streamer_buffer);
+        streamer_unlock ();
+
+        int high_ms = conf_high_watermark_ms;
+        if (conf_readahead_ms > 0 && fileinfo && streaming_track) {
+            // read-ahead tier: when the decoder is close to the end of the
+            // streaming track, keep going to get the next track opened early
+            float dur = pl_get_item_duration (streaming_track);
+            if (bytes_until_next_song > 0 || (dur > 0 && fileinfo->readpos >= dur - conf_readahead_ms / 1000.f)) {
+                high_ms = conf_buffer_ms + conf_readahead_ms;
+            }
+        }
+
+        int high = (int64_t)high_ms * bytes_in_one_second / 1000;
+        int low = (int64_t)conf_low_watermark_ms * bytes_in_one_second / 1000;
+        if (low > high / 2) {
+            low = high / 2;
+        }
+        low_watermark = low;
+
         int skip = 0;
         if (bytes_until_next_song >= 0) {
             // check if streaming format differs from output
@@ -1839,19 +2285,29 @@ streamer_thread (void *ctx) {
         }
         streamer_lock ();
 
-        if (!formatchanged && !skip && streamer_ringbuf.remaining < (STREAM_BUFFER_SIZE-blocksize * MAX_DSP_RATIO)) {
-            int sz = STREAM_BUFFER_SIZE - streamer_ringbuf.remaining;
+        int fill = streambuffer_get_fill (&streamer_buffer);
+        if (fill >= high) {
+            streamer_draining = 1;
+        }
+        else if (fill <= low || streamer_buffering) {
+            streamer_draining = 0;
+        }
+
+        int got = 0;
+        int maxwrite = (int)ringbuf_get_free (target) - headroom;
+        if (!formatchanged && !skip && !streamer_draining && maxwrite > 0) {
+            int sz = maxwrite;
             int minsize = blocksize;
 
             // speed up buffering when empty
-            if (streamer_ringbuf.remaining < MAX_BLOCK_SIZE) {
+            if (fill < MAX_BLOCK_SIZE) {
                 minsize *= 4;
                 alloc_time *= 4;
             }
             sz = min (minsize, sz);
-            assert ((sz&3) == 0);
-            // buffer must be larger enough to accomodate resamplers/pitchers/...
-            // FIXME: bounds checking
+            sz &= ~3;
+            // the dsp chain output is held back when it doesn't fit into sz,
+            // so resamplers/pitchers can't overflow the readbuffer
             streamer_unlock ();
 
             // ensure that size is possible with current format
@@ -1880,46 +2336,55 @@ streamer_thread (void *ctx) {
             streamer_lock ();
 
             if (bytesread > 0) {
-                ringbuf_write (&streamer_ringbuf, readbuffer, bytesread);
+                ringbuf_write (target, readbuffer, bytesread);
+                got = bytesread;
             }
 
             if (trace_bufferfill >= 1) {
-                fprintf (stderr, "fill: %d, read: %d, size=%d, blocksize=%d\n", (int)streamer_ringbuf.remaining, (int)bytesread, (int)STREAM_BUFFER_SIZE, (int)blocksize);
+                fprintf (stderr, "fill: %d, read: %d, size=%d, blocksize=%d\n", (int)streambuffer_get_fill (&streamer_buffer), (int)bytesread, (int)target->size, (int)blocksize);
             }
         }
         streamer_unlock ();
-        if ((streamer_ringbuf.remaining > 128000 && streamer_buffering) || !streaming_track) {
+        fill = streambuffer_get_fill (&streamer_buffer);
+        if ((fill > 128000 && streamer_buffering) || !streaming_track) {
             streamer_buffering = 0;
             if (streaming_track) {
                 send_trackinfochanged (streaming_track);
             }
         }
-        struct timeval tm2;
-        gettimeofday (&tm2, NULL);
+        streamer_prepare_next_check ();
 
-        int ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
-        if (trace_bufferfill >= 2) {
-            fprintf (stderr, "slept %dms (alloc=%dms, bytespersec=%d, chan=%d, blocksize=%d), fill: %d/%d (cursor=%d)\n", (int)(alloc_time-ms), (int)alloc_time, (int)bytes_in_one_second, output->fmt.channels, blocksize, (int)streamer_ringbuf.remaining, STREAM_BUFFER_SIZE, (int)streamer_ringbuf.cursor);
+        if ((streamer_buffering && got) || conf_streamer_nosleep) {
+            continue;
         }
 
-        // add 1ms here to compensate the rounding error
-        // and another 1ms to buffer slightly faster then playing
-        alloc_time -= ms+2;
-        if (streamer_buffering) {
-            alloc_time = 0;
+        // nothing to decode right now: sleep until the output drains the
+        // buffer to the low watermark, or reaches the end of current track;
+        // streamer_read will wake us up earlier
+        int wait_ms = 0;
+        int buns = bytes_until_next_song;
+        if (skip || formatchanged) {
+            // next track can't be decoded until current one finishes playing
+            wait_ms = (int64_t)buns * 1000 / bytes_in_one_second;
         }
-        else if (streamer_ringbuf.remaining < STREAM_BUFFER_SIZE / 2) {
-            alloc_time >>= 2; // speed-up loading a little
+        else if (streamer_draining) {
+            wait_ms = (int64_t)(fill - low) * 1000 / bytes_in_one_second;
         }
-
-        //printf ("sleep: %d, buffering: %d, buffer_starving: %d (%d/%d)\n", alloc_time, streamer_buffering, streamer_ringbuf.remaining < STREAM_BUFFER_SIZE / 2, streamer_ringbuf.remaining, STREAM_BUFFER_SIZE / 2);
-
-        if (alloc_time > 0 && !conf_streamer_nosleep) {
-            usleep (alloc_time * 1000);
+        else if (!got) {
+            // decoder has nothing to give right now
+            wait_ms = alloc_time;
         }
-        else if (bytes_until_next_song > 0) {
-            usleep (20000);
+        if (wait_ms < 0 || (wait_ms == 0 && (skip || formatchanged))) {
+            wait_ms = 1;
         }
+        else if (wait_ms > STREAMER_IDLE_WAIT_MS) {
+            wait_ms = STREAMER_IDLE_WAIT_MS;
+        }
+
+        if (trace_bufferfill >= 2) {
+            fprintf (stderr, "wait %dms (bytespersec=%d, chan=%d, blocksize=%d), fill: %d/%d, low: %d, high: %d\n", wait_ms, (int)bytes_in_one_second, output->fmt.channels, blocksize, fill, (int)target->size, low, high);
+        }
+        streamer_wait (wait_ms);
     }
 
     // stop streaming song
@@ -1928,6 +2393,7 @@ streamer_thread (void *ctx) {
         fileinfo = NULL;
         fileinfo_file = NULL;
     }
+    predecoded_free (&predecoded);
     mutex_lock (currtrack_mutex);
     if (streaming_track) {
         pl_item_unref (streaming_track);
@@ -2130,6 +2596,18 @@ streamer_dsp_postinit (void) {
     else if (!ctx) {
         dsp_on = 0;
     }
+
+    // the chain has changed, so the buffers need to be sized again,
+    // and the pipeline restarted
+    dsp_pipeline_stop ();
+    dsp_negotiated = 0;
+    if (!dsp_on) {
+        dsp_pending = 0;
+        dsp_pending_eof = 0;
+    }
+    if (fileinfo) {
+        streamer_dsp_negotiate (&fileinfo->fmt);
+    }
 }
 
 void
@@ -2192,10 +2670,14 @@ streamer_init (void) {
     currtrack_mutex = mutex_create ();
     wdl_mutex = mutex_create ();
 
-    ringbuf_init (&streamer_ringbuf, streambuffer, STREAM_BUFFER_SIZE);
+    streamer_load_buffer_conf ();
+    streambuffer_init (&streamer_buffer, MIN_STREAM_BUFFER_SIZE);
 
     pl_set_order (conf_get_int ("playback.order", 0));
 
+    dsp_pipeline_init ();
+    conf_dsp_pipeline = conf_get_int ("streamer.dsp_pipeline", 0);
+    dsp_pipeline_set_profiling (conf_get_int ("streamer.dsp_profile", 0));
     streamer_dsp_init ();
 
     replaygain_set (conf_get_int ("replaygain_mode", 0), conf_get_int ("replaygain_scale", 1), conf_get_float ("replaygain_preamp", 0), conf_get_float ("global_preamp", 0));
@@ -2204,6 +2686,7 @@ streamer_init (void) {
     deadbeef->conf_get_str ("network.ctmapping", DDB_DEFAULT_CTMAPPING, conf_network_ctmapping, sizeof (conf_network_ctmapping));
     ctmap_init ();
 
+    streamer_prepare_init ();
     streamer_tid = thread_start (streamer_thread, NULL);
     return 0;
 }
@@ -2219,7 +2702,9 @@ streamer_free (void) {
     }
     streamer_abort_files ();
     streaming_terminate = 1;
+    handler_wakeup (handler);
     thread_join (streamer_tid);
+    streamer_prepare_free ();
 
     if (streaming_track) {
         pl_item_unref (streaming_track);
@@ -2249,10 +2734,14 @@ streamer_free (void) {
 
     streamer_dsp_chain_save();
 
+    dsp_pipeline_free ();
     streamer_dsp_chain_free (dsp_chain);
     dsp_chain = NULL;
 
     free_dsp_buffers ();
+    // the output is stopped before streamer_free, and streamer_read returns
+    // early without playing_track, so nothing reads from the buffer anymore
+    streambuffer_free (&streamer_buffer);
 
     eqplug = NULL;
     eq = NULL;
@@ -2271,18 +2760,25 @@ streamer_reset (int full) { // must be called when current song changes by exter
     }
     if (full) {
         streamer_lock ();
-        streamer_ringbuf.remaining = 0;
+        streambuffer_flush (&streamer_buffer);
+        streamer_draining = 0;
         streamer_unlock ();
+        handler_wakeup (handler);
     }
 
-    // reset dsp
-    ddb_dsp_context_t *dsp = dsp_chain;
-    while (dsp) {
-        if (dsp->plugin->reset) {
-            dsp->plugin->reset (dsp);
+    // reset dsp; the pipeline threads reset their own plugins
+    dsp_pipeline_reset ();
+    if (!dsp_pipeline_is_running ()) {
+        ddb_dsp_context_t *dsp = dsp_chain;
+        while (dsp) {
+            if (dsp->plugin->reset) {
+                dsp->plugin->reset (dsp);
+            }
+            dsp = dsp->next;
         }
-        dsp = dsp->next;
     }
+    dsp_pending = 0;
+    dsp_pending_eof = 0;
 }
 
 static int
@@ -2290,7 +2786,7 @@ streamer_set_output_format (void) {
     DB_output_t *output = plug_get_output ();
     int playing = (output->state () == OUTPUT_STATE_PLAYING);
 
-    trace ("streamer_set_output_format %dbit %s %dch %dHz channelmask=%X, bufferfill: %d\n", output_format.bps, output_format.is_float ? "float" : "int", output_format.channels, output_format.samplerate, output_format.channelmask, streamer_ringbuf.remaining);
+    trace ("streamer_set_output_format %dbit %s %dch %dHz channelmask=%X, bufferfill: %d\n", output_format.bps, output_format.is_float ? "float" : "int", output_format.channels, output_format.samplerate, output_format.channelmask, (int)streambuffer_get_fill (&streamer_buffer));
     ddb_waveformat_t fmt;
     memcpy (&fmt, &output_format, sizeof (ddb_waveformat_t));
     if (autoconv_8_to_16) {
@@ -2316,43 +2812,147 @@ streamer_set_output_format (void) {
     return 0;
 }
 
+// grows an aligned buffer, keeping its contents
 static char *
-ensure_dsp_input_buffer (int size) {
-    if (!size) {
-        if (dsp_input_buffer) {
-            free (dsp_input_buffer);
-            dsp_input_buffer = NULL;
-        }
-        return 0;
+dsp_buffer_realloc (char *buffer, int *buffer_size, int size) {
+    if (buffer && *buffer_size >= size) {
+        return buffer;
+    }
+    char *newbuffer;
+    if (posix_memalign ((void **)&newbuffer, 32, size)) {
+        fprintf (stderr, "streamer: failed to allocate %d bytes dsp buffer\n", size);
+        free (buffer);
+        *buffer_size = 0;
+        return NULL;
     }
-    if (size != dsp_input_buffer_size) {
-        dsp_input_buffer = realloc (dsp_input_buffer, size);
-        dsp_input_buffer_size = size;
+    if (buffer) {
+        memcpy (newbuffer, buffer, *buffer_size);
+        free (buffer);
     }
-    return dsp_input_buffer;
+    *buffer_size = size;
+    return newbuffer;
 }
 
+static void
+free_dsp_buffers (void) {
+    free (dsp_input_buffer);
+    dsp_input_buffer = NULL;
+    dsp_input_buffer_size = 0;
+    free (dsp_temp_buffer);
+    dsp_temp_buffer = NULL;
+    dsp_temp_buffer_size = 0;
+    dsp_negotiated = 0;
+    dsp_pending = 0;
+    dsp_pending_eof = 0;
+}
+
+// walks the enabled dsp plugins, to find out the largest buffer the chain
+// may need for one block of input in the given format, and allocates
+// the buffers; buffers only grow, so renegotiating with a smaller chain
+// or format doesn't reallocate, and pending output is never lost
+static void
+streamer_dsp_negotiate (const ddb_waveformat_t *infmt) {
+    DB_output_t *output = plug_get_output ();
+    memcpy (&dsp_negotiated_fmt, infmt, sizeof (ddb_waveformat_t));
+    dsp_negotiated_samplerate = output->fmt.samplerate;
+    dsp_negotiated = 1;
+
+    ddb_waveformat_t fmt;
+    memcpy (&fmt, infmt, sizeof (ddb_waveformat_t));
+    fmt.bps = 32;
+    fmt.is_float = 1;
 
-static char *
-ensure_dsp_temp_buffer (int size) {
-    if (!size) {
-        if (dsp_temp_buffer) {
-            free (dsp_temp_buffer);
-            dsp_temp_buffer = NULL;
-        }
-        return NULL;
+    float ratio = 1;
+    int tempsize = DSP_BLOCK_FRAMES * fmt.channels * sizeof (float);
+    if (dsp_on) {
+        tempsize = dsp_chain_negotiate (dsp_chain, &fmt, DSP_BLOCK_FRAMES, MAX_DSP_RATIO, &ratio);
     }
-    if (size != dsp_temp_buffer_size) {
-        dsp_temp_buffer = realloc (dsp_temp_buffer, size);
-        dsp_temp_buffer_size = size;
+    dsp_chain_ratio = ratio;
+
+    int inputsize = DSP_BLOCK_FRAMES * infmt->channels * infmt->bps / 8;
+    dsp_input_buffer = dsp_buffer_realloc (dsp_input_buffer, &dsp_input_buffer_size, inputsize);
+    if (dsp_on) {
+        dsp_temp_buffer = dsp_buffer_realloc (dsp_temp_buffer, &dsp_temp_buffer_size, tempsize);
+    }
+    trace ("streamer: dsp negotiated for %dch %dHz: ratio %f, input %d bytes, dsp %d bytes\n", infmt->channels, infmt->samplerate, ratio, dsp_input_buffer_size, dsp_temp_buffer_size);
+    if (!dsp_input_buffer || (dsp_on && !dsp_temp_buffer)) {
+        free_dsp_buffers ();
+        return;
+    }
+
+    // falls back to running the chain on the streamer thread, when there's
+    // less than 2 plugins
+    if (!dsp_on || !conf_dsp_pipeline || dsp_pipeline_start (dsp_chain, tempsize) < 0) {
+        dsp_pipeline_stop ();
     }
-    return dsp_temp_buffer;
 }
 
+// makes the output of the dsp chain pending, and switches the output
+// to its format
 static void
-free_dsp_buffers (void) {
-    ensure_dsp_input_buffer (0);
-    ensure_dsp_temp_buffer (0);
+streamer_dsp_set_pending (const ddb_waveformat_t *dspfmt, int nframes, float ratio) {
+    dsp_ratio = ratio;
+
+    ddb_waveformat_t outfmt;
+    // preserve sampleformat, but take channels, samplerate
+    outfmt.bps = fileinfo->fmt.bps;
+    outfmt.is_float = fileinfo->fmt.is_float;
+    // channelmask from dsp chain
+    outfmt.channels = dspfmt->channels;
+    outfmt.samplerate = dspfmt->samplerate;
+    outfmt.channelmask = dspfmt->channelmask;
+    outfmt.is_bigendian = fileinfo->fmt.is_bigendian;
+    // an empty block at the end of a track may be in the input format, when
+    // no plugin had anything to process
+    if (nframes > 0 && bytes_until_next_song <= 0 && memcmp (&output_format, &outfmt, sizeof (ddb_waveformat_t))) {
+        memcpy (&output_format, &outfmt, sizeof (ddb_waveformat_t));
+        streamer_set_output_format ();
+    }
+
+    memcpy (&dsp_pending_fmt, dspfmt, sizeof (ddb_waveformat_t));
+    dsp_pending_pos = 0;
+    dsp_pending = nframes > 0 ? nframes : 0;
+}
+
+// submits decoded blocks to the pipeline until all blocks are in use,
+// and makes the next processed block pending.
+// after the pipeline was stopped, only returns the blocks left in it.
+// returns 1 if there's a new pending block
+static int
+streamer_dsp_pipeline_read (int inputsamplesize, ddb_waveformat_t *dspfmt) {
+    int running = dsp_pipeline_is_running ();
+    int gen = dsp_pipeline_get_gen ();
+    if (gen != dsp_pipeline_gen) {
+        // streamer_reset was called, the blocks in flight are dropped
+        dsp_pipeline_gen = gen;
+        dsp_pipeline_eof = 0;
+    }
+
+    dsp_block_t *block;
+    while (running && !dsp_pipeline_eof && (block = dsp_pipeline_get_free ())) {
+        int inputsize = DSP_BLOCK_FRAMES * inputsamplesize;
+        int nb = streamer_decoder_read (dsp_input_buffer, inputsize);
+        int size = pcm_convert (&fileinfo->fmt, dsp_input_buffer, dspfmt, block->samples, nb);
+        replaygain_apply (dspfmt, block->samples, size);
+        memcpy (&block->fmt, dspfmt, sizeof (ddb_waveformat_t));
+        block->nframes = nb / inputsamplesize;
+        block->eof = nb != inputsize;
+        dsp_pipeline_eof = block->eof;
+        dsp_pipeline_submit (block);
+    }
+
+    // wait for the output only if there's anything in the pipeline
+    while ((block = dsp_pipeline_get_output (running ? 100 : 0))) {
+        if (block->gen != dsp_pipeline_gen) {
+            dsp_pipeline_release (block);
+            continue;
+        }
+        dsp_pending_block = block;
+        dsp_pending_eof = block->eof;
+        streamer_dsp_set_pending (&block->fmt, block->nframes, block->ratio);
+        return 1;
+    }
+    return 0;
 }
 
 // decodes data and converts to current output format
@@ -2376,91 +2976,107 @@ streamer_read_async (char *bytes, int size) {
         memcpy (&dspfmt, &fileinfo->fmt, sizeof (ddb_waveformat_t));
         dspfmt.bps = 32;
         dspfmt.is_float = 1;
-        int can_bypass = 0;
-        if (dsp_on) {
-            // check if DSP can be passed through
-            ddb_dsp_context_t *dsp = dsp_chain;
-            while (dsp) {
-                if (dsp->enabled) {
-                    if (dsp->plugin->plugin.api_vminor >= 1) {
-                        if (dsp->plugin->can_bypass && !dsp->plugin->can_bypass (dsp, &dspfmt)) {
-                            break;
-                        }
-                    }
-                    else {
-                        break;
-                    }
-                }
-                dsp = dsp->next;
-            }
-            if (!dsp) {
-                can_bypass = 1;
-            }
-        }
+        // check if DSP can be passed through
+        int can_bypass = dsp_on && dsp_chain_can_bypass (dsp_chain, &dspfmt);
 
         if (!memcmp (&fileinfo->fmt, &output->fmt, sizeof (ddb_waveformat_t)) && (!dsp_on || can_bypass)) {
             // pass through from input to output
-            bytesread = fileinfo->plugin->read (fileinfo, bytes, size);
+            bytesread = streamer_decoder_read (bytes, size);
 
             if (bytesread != size) {
                 is_eof = 1;
             }
+
+            replaygain_apply (&output->fmt, bytes, bytesread);
         }
         else if (dsp_on) {
             // convert to float, pass through streamer DSP chain
-            int dspsamplesize = fileinfo->fmt.channels * sizeof (float);
-            int dsp_num_frames = size / (output->fmt.channels * output->fmt.bps / 8);
-
-            int inputsize = dsp_num_frames * inputsamplesize;
-            char *input = ensure_dsp_input_buffer (inputsize);
+            if (!dsp_negotiated || memcmp (&dsp_negotiated_fmt, &fileinfo->fmt, sizeof (ddb_waveformat_t)) || dsp_negotiated_samplerate != output->fmt.samplerate) {
+                streamer_dsp_negotiate (&fileinfo->fmt);
+                if (!dsp_negotiated) {
+                    return -1;
+                }
+            }
 
-            // decode pcm
-            int nb = fileinfo->plugin->read (fileinfo, input, inputsize);
-            if (nb != inputsize) {
-                is_eof = 1;
+            if (dsp_pending_block && !dsp_pending) {
+                dsp_pipeline_release (dsp_pending_block);
+                dsp_pending_block = NULL;
             }
-            inputsize = nb;
 
-            if (inputsize > 0) {
-                // make *MAX_DSP_RATIO sized buffer for float data
-                int tempbuf_size = inputsize/inputsamplesize * dspsamplesize * MAX_DSP_RATIO;
-                char *tempbuf = ensure_dsp_temp_buffer (tempbuf_size);
-
-                // convert to float
-                int tempsize = pcm_convert (&fileinfo->fmt, input, &dspfmt, tempbuf, inputsize);
-                int nframes = inputsize / inputsamplesize;
-                ddb_dsp_context_t *dsp = dsp_chain;
-                float ratio = 1.f;
-                int maxframes = tempbuf_size / dspsamplesize;
-                while (dsp) {
-                    if (dsp->enabled) {
-                        float r = 1;
-                        nframes = dsp->plugin->process (dsp, (float *)tempbuf, nframes, maxframes, &dspfmt, &r);
-                        ratio *= r;
-                    }
-                    dsp = dsp->next;
+            if (!dsp_pending && !streamer_dsp_pipeline_read (inputsamplesize, &dspfmt) && !dsp_pipeline_is_running ()) {
+                // decode just enough for the output to take all of it, but
+                // no more than one block
+                int dsp_num_frames = size / outputsamplesize / dsp_chain_ratio + 1;
+                if (dsp_num_frames > DSP_BLOCK_FRAMES) {
+                    dsp_num_frames = DSP_BLOCK_FRAMES;
                 }
-                dsp_ratio = ratio;
-
-                ddb_waveformat_t outfmt;
-                // preserve sampleformat, but take channels, samplerate
-                outfmt.bps = fileinfo->fmt.bps;
-                outfmt.is_float = fileinfo->fmt.is_float;
-                // channelmask from dsp chain
-                outfmt.channels = dspfmt.channels;
-                outfmt.samplerate = dspfmt.samplerate;
-                outfmt.channelmask = dspfmt.channelmask;
-                outfmt.is_bigendian = fileinfo->fmt.is_bigendian;
-                if (bytes_until_next_song <= 0 && memcmp (&output_format, &outfmt, sizeof (ddb_waveformat_t))) {
-                    memcpy (&output_format, &outfmt, sizeof (ddb_waveformat_t));
-                    streamer_set_output_format ();
+                if (dsp_num_frames < 1) {
+                    dsp_num_frames = 1;
                 }
 
-                //printf ("convert from %dbit %s %dch %dHz channelmask=%X to %dbit %s %dch %dHz channelmask=%X\n", dspfmt.bps, dspfmt.is_float ? "float" : "int", dspfmt.channels, dspfmt.samplerate, dspfmt.channelmask, output->fmt.bps, output->fmt.is_float ? "float" : "int", output->fmt.channels, output->fmt.samplerate, output->fmt.channelmask);
+                int inputsize = dsp_num_frames * inputsamplesize;
+                char *input = dsp_input_buffer;
+
+                // decode pcm
+                int nb = streamer_decoder_read (input, inputsize);
+                if (nb != inputsize) {
+                    dsp_pending_eof = 1;
+                }
+                inputsize = nb;
+
+                // at the end of the track, the chain runs even without input,
+                // for the plugins to flush what they hold back
+                if (inputsize > 0 || dsp_pending_eof) {
+                    char *tempbuf = dsp_temp_buffer;
+
+                    // convert to float
+                    int tempsize = pcm_convert (&fileinfo->fmt, input, &dspfmt, tempbuf, inputsize);
+                    int nframes = inputsize / inputsamplesize;
+
+                    // replaygain goes first, so that the dsp chain gets the normalized signal
+                    replaygain_apply (&dspfmt, tempbuf, tempsize);
+
+                    ddb_dsp_context_t *dsp = dsp_chain;
+                    float ratio = 1.f;
+                    int profiling = dsp_pipeline_get_profiling ();
+                    for (int i = 0; dsp; dsp = dsp->next) {
+                        if (dsp->enabled) {
+                            float r = 1;
+                            int64_t cpu = profiling ? dsp_thread_cpu_ns () : 0;
+                            int frames = nframes;
+                            int samplerate = dspfmt.samplerate;
+                            nframes = dsp_plugin_process (dsp, tempbuf, dsp_temp_buffer_size, nframes, &dspfmt, &r, dsp_pending_eof);
+                            ratio *= r;
+                            // plugins after the first few aren't profiled
+                            if (profiling && i < DSP_PIPELINE_MAX_STAGES) {
+                                dsp_stats_add (&dsp_stats[i], dsp->plugin->plugin.name, dsp_thread_cpu_ns () - cpu, frames, samplerate);
+                            }
+                            i++;
+                        }
+                    }
+
+                    streamer_dsp_set_pending (&dspfmt, nframes, ratio);
+                }
+            }
 
-                int n = pcm_convert (&dspfmt, tempbuf, &output->fmt, bytes, nframes * dspfmt.channels * sizeof (float));
+            //printf ("convert from %dbit %s %dch %dHz channelmask=%X to %dbit %s %dch %dHz channelmask=%X\n", dsp_pending_fmt.bps, dsp_pending_fmt.is_float ? "float" : "int", dsp_pending_fmt.channels, dsp_pending_fmt.samplerate, dsp_pending_fmt.channelmask, output->fmt.bps, output->fmt.is_float ? "float" : "int", output->fmt.channels, output->fmt.samplerate, output->fmt.channelmask);
 
-                bytesread = n;
+            // whatever doesn't fit is left for the next call
+            int n = size / outputsamplesize;
+            if (n > dsp_pending) {
+                n = dsp_pending;
+            }
+            if (n > 0) {
+                int framesize = dsp_pending_fmt.channels * sizeof (float);
+                char *pending = dsp_pending_block ? dsp_pending_block->samples : dsp_temp_buffer;
+                bytesread = pcm_convert (&dsp_pending_fmt, pending + dsp_pending_pos * framesize, &output->fmt, bytes, n * framesize);
+                dsp_pending_pos += n;
+                dsp_pending -= n;
+            }
+            if (dsp_pending_eof && !dsp_pending) {
+                dsp_pending_eof = 0;
+                dsp_pipeline_eof = 0;
+                is_eof = 1;
             }
         }
         else {
@@ -2475,10 +3091,19 @@ streamer_read_async (char *bytes, int size) {
                 }
             }
 #endif
-            // convert from input fmt to output fmt
+            // convert from input fmt to output fmt, one block at a time
+            if (!dsp_negotiated || memcmp (&dsp_negotiated_fmt, &fileinfo->fmt, sizeof (ddb_waveformat_t))) {
+                streamer_dsp_negotiate (&fileinfo->fmt);
+                if (!dsp_negotiated) {
+                    return -1;
+                }
+            }
             int inputsize = size/outputsamplesize*inputsamplesize;
-            char input[inputsize];
-            int nb = fileinfo->plugin->read (fileinfo, input, inputsize);
+            if (inputsize > DSP_BLOCK_FRAMES * inputsamplesize) {
+                inputsize = DSP_BLOCK_FRAMES * inputsamplesize;
+            }
+            char *input = dsp_input_buffer;
+            int nb = streamer_decoder_read (input, inputsize);
             if (nb != inputsize) {
                 bytesread = nb;
                 is_eof = 1;
@@ -2536,21 +3161,19 @@ streamer_read_async (char *bytes, int size) {
             assert ((bytesread%2) == 0);
 #endif
 
+            replaygain_apply (&output->fmt, bytes, bytesread);
         }
 #if WRITE_DUMP
         if (bytesread) {
             fwrite (bytes, 1, bytesread, out);
         }
 #endif
-
-        replaygain_apply (&output->fmt, streaming_track, bytes, bytesread);
     }
     if (!is_eof) {
         return bytesread;
     }
     else  {
         // that means EOF
-        // trace ("streamer: EOF! buns: %d, bytesread: %d, buffering: %d, bufferfill: %d\n", bytes_until_next_song, bytesread, streamer_buffering, streamer_ringbuf.remaining);
 
         // EOF or error while buffering -- stop buffering
         if (bytesread <= 0 && bytes_until_next_song >= 0 && streamer_buffering) {
@@ -2576,20 +3199,23 @@ streamer_read (char *bytes, int size) {
         return -1;
     }
     DB_output_t *output = plug_get_output ();
-    streamer_lock ();
-    int sz = min (size, streamer_ringbuf.remaining);
+
+    // this is the only consumer of streamer_buffer, so no locking is needed
+    int sz = streambuffer_read (&streamer_buffer, bytes, size);
     if (sz) {
-        ringbuf_read (&streamer_ringbuf, bytes, sz);
-        playpos += (float)sz/output->fmt.samplerate/((output->fmt.bps>>3)*output->fmt.channels) * dsp_ratio;
-        playtime += (float)sz/output->fmt.samplerate/((output->fmt.bps>>3)*output->fmt.channels);
-        if (bytes_until_next_song > 0) {
-            bytes_until_next_song -= sz;
-            if (bytes_until_next_song < 0) {
-                bytes_until_next_song = 0;
-            }
+        float t = (float)sz/output->fmt.samplerate/((output->fmt.bps>>3)*output->fmt.channels);
+        atomic_float_add (&playpos, t * dsp_ratio);
+        atomic_float_add (&playtime, t);
+        int track_end = atomic_int_countdown (&bytes_until_next_song, sz);
+
+        // wake up the streamer when the buffer crosses the low watermark,
+        // or when it has to switch to the next track
+        int fill = streambuffer_get_fill (&streamer_buffer);
+        int low = low_watermark;
+        if (track_end || (fill <= low && fill + sz > low)) {
+            handler_wakeup (handler);
         }
     }
-    streamer_unlock ();
 
     // approximate bitrate
     if (last_bitrate != -1) {
@@ -2686,67 +3312,9 @@ streamer_read (char *bytes, int size) {
     }
 
     if (!output->has_volume) {
-        int mult = 1-audio_is_mute ();
-        char *stream = bytes;
-        int bytesread = sz;
-        if (output->fmt.bps == 16) {
-            mult *= 1000;
-            int16_t ivolume = volume_get_amp () * mult;
-            if (ivolume != 1000) {
-                int half = bytesread/2;
-                for (int i = 0; i < half; i++) {
-                    int16_t sample = *((int16_t*)stream);
-                    *((int16_t*)stream) = (int16_t)(((int32_t)sample) * ivolume / 1000);
-                    stream += 2;
-                }
-            }
-        }
-        else if (output->fmt.bps == 8) {
-            mult *= 255;
-            int16_t ivolume = volume_get_amp () * mult;
-            if (ivolume != 255) {
-                for (int i = 0; i < bytesread; i++) {
-                    *stream = (int8_t)(((int32_t)(*stream)) * ivolume / 1000);
-                    stream++;
-                }
-            }
-        }
-        else if (output->fmt.bps == 24) {
-            mult *= 1000;
-            int16_t ivolume = volume_get_amp () * mult;
-            if (ivolume != 1000) {
-                int third = bytesread/3;
-                for (int i = 0; i < third; i++) {
-                    int32_t sample = ((unsigned char)stream[0]) | ((unsigned char)stream[1]<<8) | (stream[2]<<16);
-                    int32_t newsample = (int64_t)sample * ivolume / 1000;
-                    stream[0] = (newsample&0x0000ff);
-                    stream[1] = (newsample&0x00ff00)>>8;
-                    stream[2] = (newsample&0xff0000)>>16;
-                    stream += 3;
-                }
-            }
-        }
-        else if (output->fmt.bps == 32 && !output->fmt.is_float) {
-            mult *= 1000;
-            int16_t ivolume = volume_get_amp () * mult;
-            if (ivolume != 1000) {
-                for (int i = 0; i < bytesread/4; i++) {
-                    int32_t sample = *((int32_t*)stream);
-                    int32_t newsample = (int64_t)sample * ivolume / 1000;
-                    *((int32_t*)stream) = newsample;
-                    stream += 4;
-                }
-            }
-        }
-        else if (output->fmt.bps == 32 && output->fmt.is_float) {
-            float fvolume = volume_get_amp () * (1-audio_is_mute ());
-            if (fvolume != 1.f) {
-                for (int i = 0; i < bytesread/4; i++) {
-                    *((float*)stream) = (*((float*)stream)) * fvolume;
-                    stream += 4;
-                }
-            }
-        }
+        // volume changes are faded in over 10ms to avoid zipper noise
+        float target = volume_get_amp () * (1-audio_is_mute ());
+        pcm_apply_gain (&output->fmt, bytes, sz, &volume_gain, target, output->fmt.samplerate / 100);
     }
 
     return sz;
@@ -2754,7 +3322,7 @@ streamer_read (char *bytes, int size) {
 
 static int
 streamer_get_fill (void) {
-    return streamer_ringbuf.remaining;
+    return streambuffer_get_fill (&streamer_buffer);
 }
 
 int
@@ -2764,7 +3332,7 @@ streamer_ok_to_read (int len) {
         streamer_set_output_format ();
         formatchanged = 0;
     }
-    if (len >= 0 && (bytes_until_next_song > 0 || streamer_ringbuf.remaining >= (len*2))) {
+    if (len >= 0 && (bytes_until_next_song > 0 || streambuffer_get_fill (&streamer_buffer) >= (len*2))) {
         return 1;
     }
     else {
@@ -2805,6 +3373,14 @@ streamer_configchanged (void) {
     }
 
     conf_streamer_nosleep = conf_get_int ("streamer.nosleep", 0);
+    streamer_load_buffer_conf ();
+
+    int pipeline = conf_get_int ("streamer.dsp_pipeline", 0);
+    if (pipeline != conf_dsp_pipeline) {
+        conf_dsp_pipeline = pipeline;
+        streamer_dsp_refresh ();
+    }
+    dsp_pipeline_set_profiling (conf_get_int ("streamer.dsp_profile", 0));
 }
 
 static void
@@ -2926,6 +3502,7 @@ dsp_clone (ddb_dsp_context_t *from) {
 
 static void
 streamer_set_dsp_chain_real (ddb_dsp_context_t *chain) {
+    dsp_pipeline_stop ();
     streamer_dsp_chain_free (dsp_chain);
     dsp_chain = chain;
     eq = NULL;
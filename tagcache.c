@@ -0,0 +1,805 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2015 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+// Persistent cache of the tracks the decoders create for local files.
+//
+// Re-adding a folder or loading a playlist file otherwise reopens every file
+// and parses its tags again. The cache is keyed by the path, size, mtime and
+// inode of the file, and stores the tracks which the decoder inserted for it: the
+// sample ranges, duration, flags and metadata. A hit builds the tracks
+// directly, without calling the decoder.
+//
+// The cache file is an append-only log of records. The newest record for a
+// path wins, older ones are garbage, and are dropped when the file is
+// compacted. Compaction also evicts the least recently used entries when the
+// file grows over tagcache.max_size_mb. An in-memory index of the records is
+// built on first use from the record headers, the rest of the record is read
+// only on a hit.
+//
+// Record layout, all numbers are in native byte order:
+//   tagcache_record_t
+//   path (path_size bytes), decoder id (decoder_size bytes)
+//   count x {
+//     tagcache_item_t
+//     meta_count x { uint32 keysize, uint32 valuesize, key, value }
+//   }
+// Keys and values include the terminating zero, multi-values are separated
+// by zeros as in DB_metaInfo_t.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "tagcache.h"
+#include "plugins.h"
+#include "conf.h"
+#include "common.h"
+#include "threading.h"
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(fmt,...)
+
+#define TAGCACHE_VERSION 2
+#define TAGCACHE_FILENAME "tagcache.dbtc"
+#define TAGCACHE_DEFAULT_MAX_SIZE_MB 64
+
+// don't bother compacting files smaller than that because of the garbage
+#define TAGCACHE_MIN_COMPACT_SIZE (1024*1024)
+
+#define TAGCACHE_HASH_SIZE 4096
+
+#define TAGCACHE_MAX_DECODER_ID 100
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+} tagcache_header_t;
+
+typedef struct {
+    uint32_t size; // size of the whole record, including this header
+    uint32_t checksum; // of everything after this field
+    int64_t file_size;
+    int64_t mtime; // in nanoseconds
+    uint64_t inode;
+    uint32_t path_size;
+    uint32_t decoder_size;
+    uint32_t count;
+    uint32_t reserved;
+} tagcache_record_t;
+
+typedef struct {
+    int32_t startsample;
+    int32_t endsample;
+    float duration;
+    uint32_t flags;
+    uint32_t meta_count;
+} tagcache_item_t;
+
+typedef struct tagcache_entry_s {
+    char *path;
+    uint32_t hash;
+    int64_t file_size;
+    int64_t mtime;
+    uint64_t inode;
+    uint64_t offset;
+    uint32_t size;
+    uint64_t last_used;
+    struct tagcache_entry_s *next;
+} tagcache_entry_t;
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t alloc;
+} tagcache_buffer_t;
+
+static uintptr_t tagcache_mutex;
+static int tagcache_fd = -1;
+static int tagcache_opened;
+static uint64_t tagcache_end; // where the next record goes
+static uint64_t tagcache_garbage; // bytes taken by superseded records
+static uint64_t tagcache_clock;
+static tagcache_entry_t *tagcache_hash[TAGCACHE_HASH_SIZE];
+static int tagcache_count;
+
+static uint32_t
+tagcache_checksum (const char *data, size_t size) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ (uint8_t)data[i]) * 16777619u;
+    }
+    return h;
+}
+
+static uint32_t
+tagcache_path_hash (const char *path, size_t len) {
+    return tagcache_checksum (path, len);
+}
+
+static void
+tagcache_get_filename (char *out, size_t size, const char *suffix) {
+    snprintf (out, size, "%s/%s%s", dbconfdir, TAGCACHE_FILENAME, suffix);
+}
+
+static int64_t
+tagcache_get_mtime (const struct stat *st) {
+#if defined(__APPLE__)
+    return (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#else
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#endif
+}
+
+// the inode catches files replaced by a rename, which can have the same size
+// and mtime as the old file
+static int
+tagcache_entry_matches (const tagcache_entry_t *e, const struct stat *st) {
+    return e->file_size == (int64_t)st->st_size
+        && e->mtime == tagcache_get_mtime (st)
+        && e->inode == (uint64_t)st->st_ino;
+}
+
+static tagcache_entry_t *
+tagcache_find (const char *path, uint32_t hash) {
+    for (tagcache_entry_t *e = tagcache_hash[hash & (TAGCACHE_HASH_SIZE-1)]; e; e = e->next) {
+        if (e->hash == hash && !strcmp (e->path, path)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void
+tagcache_remove (tagcache_entry_t *entry) {
+    tagcache_entry_t **pe = &tagcache_hash[entry->hash & (TAGCACHE_HASH_SIZE-1)];
+    while (*pe != entry) {
+        pe = &(*pe)->next;
+    }
+    *pe = entry->next;
+    tagcache_garbage += entry->size;
+    tagcache_count--;
+    free (entry->path);
+    free (entry);
+}
+
+// adds the index entry for a record, superseding the previous one for the
+// same path
+static void
+tagcache_index (const char *path, uint32_t hash, const tagcache_record_t *rec, uint64_t offset) {
+    tagcache_entry_t *e = tagcache_find (path, hash);
+    if (e) {
+        tagcache_garbage += e->size;
+    }
+    else {
+        e = calloc (1, sizeof (tagcache_entry_t));
+        if (!e) {
+            tagcache_garbage += rec->size;
+            return;
+        }
+        e->path = strdup (path);
+        e->hash = hash;
+        e->next = tagcache_hash[hash & (TAGCACHE_HASH_SIZE-1)];
+        tagcache_hash[hash & (TAGCACHE_HASH_SIZE-1)] = e;
+        tagcache_count++;
+    }
+    e->file_size = rec->file_size;
+    e->mtime = rec->mtime;
+    e->inode = rec->inode;
+    e->offset = offset;
+    e->size = rec->size;
+    e->last_used = ++tagcache_clock;
+}
+
+static void
+tagcache_clear_index (void) {
+    for (int i = 0; i < TAGCACHE_HASH_SIZE; i++) {
+        while (tagcache_hash[i]) {
+            tagcache_entry_t *next = tagcache_hash[i]->next;
+            free (tagcache_hash[i]->path);
+            free (tagcache_hash[i]);
+            tagcache_hash[i] = next;
+        }
+    }
+    tagcache_count = 0;
+    tagcache_garbage = 0;
+}
+
+static int
+tagcache_write_header (int fd) {
+    tagcache_header_t hdr;
+    memcpy (hdr.magic, "DBTC", 4);
+    hdr.version = TAGCACHE_VERSION;
+    if (ftruncate (fd, 0) < 0 || pwrite (fd, &hdr, sizeof (hdr), 0) != sizeof (hdr)) {
+        return -1;
+    }
+    return 0;
+}
+
+// opens the cache file and builds the index, must be called with the mutex
+// locked
+static int
+tagcache_open (void) {
+    if (tagcache_opened) {
+        return tagcache_fd >= 0 ? 0 : -1;
+    }
+    tagcache_opened = 1;
+    if (!dbconfdir[0]) {
+        return -1;
+    }
+
+    char fname[PATH_MAX];
+    tagcache_get_filename (fname, sizeof (fname), "");
+    int fd = open (fname, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        trace ("tagcache: failed to open %s\n", fname);
+        return -1;
+    }
+
+    struct stat st;
+    tagcache_header_t hdr;
+    if (fstat (fd, &st) < 0
+            || pread (fd, &hdr, sizeof (hdr), 0) != sizeof (hdr)
+            || memcmp (hdr.magic, "DBTC", 4)
+            || hdr.version != TAGCACHE_VERSION) {
+        if (tagcache_write_header (fd) < 0) {
+            close (fd);
+            return -1;
+        }
+        st.st_size = sizeof (hdr);
+    }
+
+    uint64_t offset = sizeof (hdr);
+    char path[PATH_MAX];
+    while (offset + sizeof (tagcache_record_t) <= (uint64_t)st.st_size) {
+        tagcache_record_t rec;
+        if (pread (fd, &rec, sizeof (rec), offset) != sizeof (rec)
+                || rec.path_size == 0
+                || rec.path_size >= sizeof (path)
+                || rec.size < sizeof (rec) + (uint64_t)rec.path_size + rec.decoder_size
+                || offset + rec.size > (uint64_t)st.st_size
+                || pread (fd, path, rec.path_size, offset + sizeof (rec)) != rec.path_size) {
+            break;
+        }
+        path[rec.path_size] = 0;
+        tagcache_index (path, tagcache_path_hash (path, rec.path_size), &rec, offset);
+        offset += rec.size;
+    }
+    if (offset < (uint64_t)st.st_size) {
+        // drop the partially written record at the end
+        trace ("tagcache: truncating %s at %lld\n", fname, (long long)offset);
+        if (ftruncate (fd, offset) < 0) {
+            tagcache_clear_index ();
+            close (fd);
+            return -1;
+        }
+    }
+    tagcache_end = offset;
+    tagcache_fd = fd;
+    trace ("tagcache: %d entries, %lld bytes of garbage\n", tagcache_count, (long long)tagcache_garbage);
+    return 0;
+}
+
+static int
+tagcache_entry_cmp_last_used (const void *a, const void *b) {
+    const tagcache_entry_t *ea = *(const tagcache_entry_t **)a;
+    const tagcache_entry_t *eb = *(const tagcache_entry_t **)b;
+    return ea->last_used < eb->last_used ? -1 : ea->last_used > eb->last_used;
+}
+
+// rewrites the cache file without the garbage, evicting the least recently
+// used entries until the file fits max_size, must be called with the mutex
+// locked
+static void
+tagcache_compact (uint64_t max_size) {
+    tagcache_entry_t **entries = malloc (sizeof (tagcache_entry_t *) * (tagcache_count + 1));
+    if (!entries) {
+        return;
+    }
+    int n = 0;
+    uint64_t total = sizeof (tagcache_header_t);
+    for (int i = 0; i < TAGCACHE_HASH_SIZE; i++) {
+        for (tagcache_entry_t *e = tagcache_hash[i]; e; e = e->next) {
+            entries[n++] = e;
+            total += e->size;
+        }
+    }
+    qsort (entries, n, sizeof (tagcache_entry_t *), tagcache_entry_cmp_last_used);
+
+    int first = 0;
+    while (first < n && total > max_size) {
+        total -= entries[first]->size;
+        first++;
+    }
+
+    char fname[PATH_MAX];
+    char tempname[PATH_MAX];
+    tagcache_get_filename (fname, sizeof (fname), "");
+    tagcache_get_filename (tempname, sizeof (tempname), ".tmp");
+
+    uint64_t *offsets = malloc (sizeof (uint64_t) * (n + 1));
+    char *buf = NULL;
+    size_t bufsize = 0;
+    int fd = open (tempname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || !offsets || tagcache_write_header (fd) < 0) {
+        goto fail;
+    }
+
+    // the records are written from the least to the most recently used, so
+    // that the order is restored on the next start
+    uint64_t offset = sizeof (tagcache_header_t);
+    for (int i = first; i < n; i++) {
+        tagcache_entry_t *e = entries[i];
+        if (e->size > bufsize) {
+            char *newbuf = realloc (buf, e->size);
+            if (!newbuf) {
+                goto fail;
+            }
+            buf = newbuf;
+            bufsize = e->size;
+        }
+        if (pread (tagcache_fd, buf, e->size, e->offset) != e->size
+                || pwrite (fd, buf, e->size, offset) != e->size) {
+            goto fail;
+        }
+        offsets[i] = offset;
+        offset += e->size;
+    }
+    if (rename (tempname, fname) < 0) {
+        goto fail;
+    }
+
+    close (tagcache_fd);
+    tagcache_fd = fd;
+    tagcache_end = offset;
+    for (int i = first; i < n; i++) {
+        entries[i]->offset = offsets[i];
+    }
+    for (int i = 0; i < first; i++) {
+        tagcache_remove (entries[i]);
+    }
+    tagcache_garbage = 0;
+    trace ("tagcache: compacted to %lld bytes, evicted %d entries\n", (long long)offset, first);
+    free (buf);
+    free (offsets);
+    free (entries);
+    return;
+
+fail:
+    if (fd >= 0) {
+        close (fd);
+        unlink (tempname);
+    }
+    free (buf);
+    free (offsets);
+    free (entries);
+}
+
+static uint64_t
+tagcache_get_max_size (void) {
+    int mb = conf_get_int ("tagcache.max_size_mb", TAGCACHE_DEFAULT_MAX_SIZE_MB);
+    if (mb < 1) {
+        mb = 1;
+    }
+    return (uint64_t)mb * 1024 * 1024;
+}
+
+static int
+tagcache_has_cuesheet (const char *fname) {
+    // same names as plt_insert_cue looks for
+    size_t len = strlen (fname);
+    char cuename[len + 5];
+    memcpy (cuename, fname, len);
+    strcpy (cuename + len, ".cue");
+    if (!access (cuename, F_OK)) {
+        return 1;
+    }
+    strcpy (cuename + len, ".CUE");
+    if (!access (cuename, F_OK)) {
+        return 1;
+    }
+    char *ext = strrchr (cuename, '.');
+    *ext = 0;
+    ext = strrchr (cuename, '.');
+    if (!ext || strchr (ext, '/')) {
+        return 0;
+    }
+    strcpy (ext + 1, "cue");
+    if (!access (cuename, F_OK)) {
+        return 1;
+    }
+    strcpy (ext + 1, "CUE");
+    return !access (cuename, F_OK);
+}
+
+int
+tagcache_can_cache (const char *fname, struct stat *st) {
+    if (fname[0] != '/' || !conf_get_int ("tagcache.enable", 1)) {
+        return 0;
+    }
+    if (stat (fname, st) < 0 || !S_ISREG (st->st_mode)) {
+        return 0;
+    }
+    // the tracks of files with an external cue sheet don't depend only on
+    // the file itself
+    if (tagcache_has_cuesheet (fname)) {
+        return 0;
+    }
+    return 1;
+}
+
+// reads n bytes from the record, returns NULL if the record is too short
+static const char *
+tagcache_read (const char **p, const char *end, size_t n) {
+    if ((size_t)(end - *p) < n) {
+        return NULL;
+    }
+    const char *res = *p;
+    *p += n;
+    return res;
+}
+
+// returns 1 if decoder_id accepts the file's extension or prefix, i.e. it's
+// one of the decoders which plt_insert_file tries, not necessarily the first:
+// a file which the earlier decoders declined is cached with the one that
+// loaded it
+static int
+tagcache_decoder_accepts (const char *decoder_id, const char *fname) {
+    const char *eol = strrchr (fname, '.');
+    if (!eol) {
+        return 0;
+    }
+    eol++;
+    const char *fn = strrchr (fname, '/');
+    fn = fn ? fn + 1 : fname;
+
+    DB_decoder_t **decoders = plug_get_decoder_list ();
+    for (int i = 0; decoders[i]; i++) {
+        if (!decoders[i]->insert || strcmp (decoders[i]->plugin.id, decoder_id)) {
+            continue;
+        }
+        if (decoders[i]->exts) {
+            const char **exts = decoders[i]->exts;
+            for (int e = 0; exts[e]; e++) {
+                if (!strcasecmp (exts[e], eol) || !strcmp (exts[e], "*")) {
+                    return 1;
+                }
+            }
+        }
+        if (decoders[i]->prefixes) {
+            const char **prefixes = decoders[i]->prefixes;
+            for (int e = 0; prefixes[e]; e++) {
+                size_t l = strlen (prefixes[e]);
+                if (!strncasecmp (prefixes[e], fn, l) && fn[l] == '.') {
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+playItem_t *
+tagcache_insert (playlist_t *playlist, playItem_t *after, const char *fname, const struct stat *st) {
+    size_t pathlen = strlen (fname);
+    uint32_t hash = tagcache_path_hash (fname, pathlen);
+
+    mutex_lock (tagcache_mutex);
+    if (tagcache_open () < 0) {
+        mutex_unlock (tagcache_mutex);
+        return NULL;
+    }
+    tagcache_entry_t *e = tagcache_find (fname, hash);
+    if (!e || !tagcache_entry_matches (e, st)) {
+        mutex_unlock (tagcache_mutex);
+        return NULL;
+    }
+    uint32_t size = e->size;
+    uint64_t offset = e->offset;
+    char *buf = malloc (size);
+    if (!buf || pread (tagcache_fd, buf, size, offset) != size) {
+        mutex_unlock (tagcache_mutex);
+        free (buf);
+        return NULL;
+    }
+    e->last_used = ++tagcache_clock;
+    mutex_unlock (tagcache_mutex);
+
+    playItem_t **items = NULL;
+    uint32_t nitems = 0;
+    char decoder_id[TAGCACHE_MAX_DECODER_ID + 1];
+
+    tagcache_record_t rec;
+    memcpy (&rec, buf, sizeof (rec));
+    if (rec.size != size
+            || rec.checksum != tagcache_checksum (buf + 8, size - 8)
+            || rec.path_size != pathlen
+            || memcmp (buf + sizeof (rec), fname, pathlen)
+            || rec.decoder_size == 0
+            || rec.decoder_size > TAGCACHE_MAX_DECODER_ID
+            || rec.count == 0
+            || rec.count > size / sizeof (tagcache_item_t)) {
+        goto corrupt;
+    }
+
+    const char *p = buf + sizeof (rec) + rec.path_size;
+    const char *end = buf + size;
+    memcpy (decoder_id, p, rec.decoder_size);
+    decoder_id[rec.decoder_size] = 0;
+    p += rec.decoder_size;
+    if (!tagcache_decoder_accepts (decoder_id, fname)) {
+        // the decoder which added the file is not loaded anymore, or doesn't
+        // handle its extension anymore
+        trace ("tagcache: decoder changed for %s\n", fname);
+        free (buf);
+        mutex_lock (tagcache_mutex);
+        e = tagcache_find (fname, hash);
+        if (e && e->offset == offset) {
+            tagcache_remove (e);
+        }
+        mutex_unlock (tagcache_mutex);
+        return NULL;
+    }
+
+    items = calloc (rec.count, sizeof (playItem_t *));
+    if (!items) {
+        free (buf);
+        return NULL;
+    }
+    for (nitems = 0; nitems < rec.count; nitems++) {
+        tagcache_item_t item;
+        const char *data = tagcache_read (&p, end, sizeof (item));
+        if (!data) {
+            goto corrupt;
+        }
+        memcpy (&item, data, sizeof (item));
+
+        playItem_t *it = pl_item_alloc ();
+        items[nitems] = it;
+        it->startsample = item.startsample;
+        it->endsample = item.endsample;
+        it->_duration = item.duration;
+        it->_flags = item.flags;
+        for (uint32_t m = 0; m < item.meta_count; m++) {
+            uint32_t sizes[2];
+            const char *key, *value;
+            if (!(data = tagcache_read (&p, end, sizeof (sizes)))) {
+                goto corrupt;
+            }
+            memcpy (sizes, data, sizeof (sizes));
+            if (sizes[0] == 0 || sizes[1] == 0
+                    || !(key = tagcache_read (&p, end, sizes[0]))
+                    || !(value = tagcache_read (&p, end, sizes[1]))
+                    || key[sizes[0]-1] || value[sizes[1]-1]) {
+                goto corrupt;
+            }
+            pl_add_meta_full (it, key, value, sizes[1]);
+        }
+    }
+    if (p != end) {
+        goto corrupt;
+    }
+    free (buf);
+
+    for (uint32_t i = 0; i < nitems; i++) {
+        after = plt_insert_item (playlist, after, items[i]);
+        pl_item_unref (items[i]);
+    }
+    free (items);
+    trace ("tagcache: hit %s\n", fname);
+    return after;
+
+corrupt:
+    trace ("tagcache: corrupt record for %s\n", fname);
+    if (items) {
+        for (uint32_t i = 0; i < rec.count && items[i]; i++) {
+            pl_item_unref (items[i]);
+        }
+        free (items);
+    }
+    free (buf);
+    mutex_lock (tagcache_mutex);
+    e = tagcache_find (fname, hash);
+    if (e && e->offset == offset) {
+        tagcache_remove (e);
+    }
+    mutex_unlock (tagcache_mutex);
+    return NULL;
+}
+
+static int
+tagcache_buffer_append (tagcache_buffer_t *b, const void *data, size_t size) {
+    if (b->size + size > b->alloc) {
+        size_t alloc = b->alloc ? b->alloc : 4096;
+        while (alloc < b->size + size) {
+            alloc *= 2;
+        }
+        char *newdata = realloc (b->data, alloc);
+        if (!newdata) {
+            return -1;
+        }
+        b->data = newdata;
+        b->alloc = alloc;
+    }
+    memcpy (b->data + b->size, data, size);
+    b->size += size;
+    return 0;
+}
+
+static int
+tagcache_write_item (tagcache_buffer_t *b, playItem_t *it) {
+    size_t item_offset = b->size;
+    tagcache_item_t item;
+    item.startsample = it->startsample;
+    item.endsample = it->endsample;
+    item.duration = it->_duration;
+    item.flags = it->_flags;
+    item.meta_count = 0;
+    if (tagcache_buffer_append (b, &item, sizeof (item)) < 0) {
+        return -1;
+    }
+    for (DB_metaInfo_t *m = pl_get_metadata_head (it); m; m = m->next) {
+        if (m->key[0] == '_' || m->key[0] == '!' || !m->value || m->valuesize <= 0) {
+            continue; // reserved names and user overrides
+        }
+        uint32_t sizes[2] = { strlen (m->key) + 1, m->valuesize };
+        if (m->value[m->valuesize-1]) {
+            continue;
+        }
+        if (tagcache_buffer_append (b, sizes, sizeof (sizes)) < 0
+                || tagcache_buffer_append (b, m->key, sizes[0]) < 0
+                || tagcache_buffer_append (b, m->value, sizes[1]) < 0) {
+            return -1;
+        }
+        item.meta_count++;
+    }
+    memcpy (b->data + item_offset, &item, sizeof (item));
+    return 0;
+}
+
+void
+tagcache_add (playlist_t *playlist, playItem_t *after, playItem_t *last, const char *fname, const struct stat *st, const char *decoder_id) {
+    tagcache_buffer_t b;
+    memset (&b, 0, sizeof (b));
+
+    tagcache_record_t rec;
+    memset (&rec, 0, sizeof (rec));
+    rec.file_size = st->st_size;
+    rec.mtime = tagcache_get_mtime (st);
+    rec.inode = st->st_ino;
+    rec.path_size = strlen (fname);
+    rec.decoder_size = strlen (decoder_id);
+    if (rec.path_size >= PATH_MAX || rec.decoder_size == 0 || rec.decoder_size > TAGCACHE_MAX_DECODER_ID) {
+        return;
+    }
+    if (tagcache_buffer_append (&b, &rec, sizeof (rec)) < 0
+            || tagcache_buffer_append (&b, fname, rec.path_size) < 0
+            || tagcache_buffer_append (&b, decoder_id, rec.decoder_size) < 0) {
+        goto out;
+    }
+
+    pl_lock ();
+    playItem_t *it = after ? after->next[PL_MAIN] : playlist->head[PL_MAIN];
+    for (; it; it = it->next[PL_MAIN]) {
+        const char *uri = pl_find_meta_raw (it, ":URI");
+        if (!uri || strcmp (uri, fname) || tagcache_write_item (&b, it) < 0) {
+            break;
+        }
+        rec.count++;
+        if (it == last) {
+            break;
+        }
+    }
+    pl_unlock ();
+    if (it != last || it == NULL) {
+        // the tracks came from somewhere else, or the playlist was changed
+        // meanwhile
+        goto out;
+    }
+    if (b.size > UINT32_MAX) {
+        goto out;
+    }
+
+    rec.size = (uint32_t)b.size;
+    memcpy (b.data, &rec, sizeof (rec));
+    rec.checksum = tagcache_checksum (b.data + 8, b.size - 8);
+    memcpy (b.data, &rec, sizeof (rec));
+
+    mutex_lock (tagcache_mutex);
+    if (tagcache_open () >= 0) {
+        if (pwrite (tagcache_fd, b.data, b.size, tagcache_end) == b.size) {
+            tagcache_index (fname, tagcache_path_hash (fname, rec.path_size), &rec, tagcache_end);
+            tagcache_end += b.size;
+
+            uint64_t max_size = tagcache_get_max_size ();
+            if (tagcache_end > max_size) {
+                tagcache_compact (max_size / 4 * 3);
+            }
+            else if (tagcache_garbage > TAGCACHE_MIN_COMPACT_SIZE && tagcache_garbage > tagcache_end / 2) {
+                tagcache_compact (max_size);
+            }
+        }
+        else if (ftruncate (tagcache_fd, tagcache_end) < 0) {
+            // don't append after a partially written record
+            close (tagcache_fd);
+            tagcache_fd = -1;
+            tagcache_clear_index ();
+        }
+    }
+    mutex_unlock (tagcache_mutex);
+
+out:
+    free (b.data);
+}
+
+void
+tagcache_rebuild (void) {
+    mutex_lock (tagcache_mutex);
+    if (tagcache_open () < 0) {
+        mutex_unlock (tagcache_mutex);
+        return;
+    }
+    int removed = 0;
+    for (int i = 0; i < TAGCACHE_HASH_SIZE; i++) {
+        tagcache_entry_t *e = tagcache_hash[i];
+        while (e) {
+            tagcache_entry_t *next = e->next;
+            struct stat st;
+            if (stat (e->path, &st) < 0
+                    || !S_ISREG (st.st_mode)
+                    || !tagcache_entry_matches (e, &st)) {
+                tagcache_remove (e);
+                removed++;
+            }
+            e = next;
+        }
+    }
+    tagcache_compact (tagcache_get_max_size ());
+    fprintf (stderr, "tagcache: removed %d stale entries, %d entries left\n", removed, tagcache_count);
+    mutex_unlock (tagcache_mutex);
+}
+
+void
+tagcache_init (void) {
+    tagcache_mutex = mutex_create ();
+}
+
+void
+tagcache_free (void) {
+    if (!tagcache_mutex) {
+        return;
+    }
+    mutex_lock (tagcache_mutex);
+    if (tagcache_fd >= 0) {
+        close (tagcache_fd);
+        tagcache_fd = -1;
+    }
+    tagcache_clear_index ();
+    tagcache_opened = 0;
+    mutex_unlock (tagcache_mutex);
+    mutex_free (tagcache_mutex);
+    tagcache_mutex = 0;
+}
@@ -0,0 +1,59 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2015 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef __deadbeef__tagcache__
+#define __deadbeef__tagcache__
+
+#include <sys/stat.h>
+#include "playlist.h"
+
+// Inserts the tracks of fname into the playlist from the cache, if the file
+// has been added before, and it didn't change since.
+// Returns the last inserted track (like the decoder insert functions), or
+// NULL if the file is not in the cache.
+playItem_t *
+tagcache_insert (playlist_t *playlist, playItem_t *after, const char *fname, const struct stat *st);
+
+// Stores the tracks which were inserted by the decoder: everything after
+// `after` up to and including `last`.
+void
+tagcache_add (playlist_t *playlist, playItem_t *after, playItem_t *last, const char *fname, const struct stat *st, const char *decoder_id);
+
+// Returns 1 if the cache should be used for fname: the cache is enabled,
+// fname is a local regular file and there's no cue sheet next to it.
+// Fills st on success.
+int
+tagcache_can_cache (const char *fname, struct stat *st);
+
+// Drops the entries for files which were removed or modified, and compacts
+// the cache file.
+void
+tagcache_rebuild (void);
+
+void
+tagcache_init (void);
+
+void
+tagcache_free (void);
+
+#endif
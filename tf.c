@@ -36,9 +36,22 @@
 //   len:byte, data
 //  3: if_defined block
 //   len:int32, data
-//  4: pre-interpreted text
+//  4: literal text run
 //   len:int32, data
+//  5: meta field resolved at compile time
+//   field:byte (one of TF_FIELD_*), atom:uint16 (little endian, for TF_FIELD_META)
+//  6: constant function result, folded at compile time
+//   bool:byte, len:int32, data, followed by the original function call,
+//   which is evaluated instead when the result doesn't fit the output
 // !0: plain text
+//
+// opcodes 4 and 6 are only produced by tf_optimize, which never touches
+// function arguments, so that the argument lengths stay within a byte
+//
+// the compiled script is stored as
+//  size:int32, code, padding:4 zero bytes, script_id:uint32
+// script_id is unique for each compiled script, or 0 if the results of the
+// script must not be cached (see tf_cache_*)
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -58,6 +71,7 @@
 #include "gettext.h"
 #include "plugins.h"
 #include "junklib.h"
+#include "metacache.h"
 
 #define min(x,y) ((x)<(y)?(x):(y))
 
@@ -74,9 +88,17 @@ typedef int (*tf_func_ptr_t)(ddb_tf_context_t *ctx, int argc, const char *arglen
 
 #define TF_MAX_FUNCS 0xff
 
+enum {
+    // the result depends on more than the arguments, never constant-folded
+    TF_FUNC_IMPURE = 1,
+    // the result may change without changes to the track, never cached
+    TF_FUNC_VOLATILE = 2,
+};
+
 typedef struct {
     const char *name;
     tf_func_ptr_t func;
+    int flags;
 } tf_func_def;
 
 static int
@@ -85,6 +107,128 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
 static const char *
 _tf_get_combined_value (playItem_t *it, const char *key, int *needs_free);
 
+static int
+tf_opt_block_size (const char *code);
+
+// fields with special handling in tf_eval_int, anything else is looked up
+// in the track metadata (TF_FIELD_META)
+enum {
+    TF_FIELD_META = 0,
+    TF_FIELD_ALBUM_ARTIST,
+    TF_FIELD_ARTIST,
+    TF_FIELD_ALBUM,
+    TF_FIELD_TRACK_ARTIST,
+    TF_FIELD_TRACKNUMBER,
+    TF_FIELD_TITLE,
+    TF_FIELD_DISCNUMBER,
+    TF_FIELD_TOTALDISCS,
+    TF_FIELD_TRACK_NUMBER,
+    TF_FIELD_DATE,
+    TF_FIELD_SAMPLERATE,
+    TF_FIELD_BITRATE,
+    TF_FIELD_FILESIZE,
+    TF_FIELD_FILESIZE_NATURAL,
+    TF_FIELD_CHANNELS,
+    TF_FIELD_CODEC,
+    TF_FIELD_REPLAYGAIN_ALBUM_GAIN,
+    TF_FIELD_REPLAYGAIN_ALBUM_PEAK,
+    TF_FIELD_REPLAYGAIN_TRACK_GAIN,
+    TF_FIELD_REPLAYGAIN_TRACK_PEAK,
+    TF_FIELD_PLAYBACK_TIME,
+    TF_FIELD_PLAYBACK_TIME_SECONDS,
+    TF_FIELD_PLAYBACK_TIME_REMAINING,
+    TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS,
+    TF_FIELD_LENGTH,
+    TF_FIELD_LENGTH_EX,
+    TF_FIELD_LENGTH_SECONDS,
+    TF_FIELD_LENGTH_SECONDS_FP,
+    TF_FIELD_LENGTH_SAMPLES,
+    TF_FIELD_ISPLAYING,
+    TF_FIELD_ISPAUSED,
+    TF_FIELD_FILENAME,
+    TF_FIELD_FILENAME_EXT,
+    TF_FIELD_DIRECTORYNAME,
+    TF_FIELD_PATH,
+    TF_FIELD_LIST_INDEX,
+    TF_FIELD_LIST_TOTAL,
+    TF_FIELD_QUEUE_INDEX,
+    TF_FIELD_QUEUE_INDEXES,
+    TF_FIELD_QUEUE_TOTAL,
+    TF_FIELD_DEADBEEF_VERSION,
+    TF_FIELD_COUNT
+};
+
+static const char *tf_field_names[TF_FIELD_COUNT] = {
+    [TF_FIELD_ALBUM_ARTIST] = "album artist",
+    [TF_FIELD_ARTIST] = "artist",
+    [TF_FIELD_ALBUM] = "album",
+    [TF_FIELD_TRACK_ARTIST] = "track artist",
+    [TF_FIELD_TRACKNUMBER] = "tracknumber",
+    [TF_FIELD_TITLE] = "title",
+    [TF_FIELD_DISCNUMBER] = "discnumber",
+    [TF_FIELD_TOTALDISCS] = "totaldiscs",
+    [TF_FIELD_TRACK_NUMBER] = "track number",
+    [TF_FIELD_DATE] = "date",
+    [TF_FIELD_SAMPLERATE] = "samplerate",
+    [TF_FIELD_BITRATE] = "bitrate",
+    [TF_FIELD_FILESIZE] = "filesize",
+    [TF_FIELD_FILESIZE_NATURAL] = "filesize_natural",
+    [TF_FIELD_CHANNELS] = "channels",
+    [TF_FIELD_CODEC] = "codec",
+    [TF_FIELD_REPLAYGAIN_ALBUM_GAIN] = "replaygain_album_gain",
+    [TF_FIELD_REPLAYGAIN_ALBUM_PEAK] = "replaygain_album_peak",
+    [TF_FIELD_REPLAYGAIN_TRACK_GAIN] = "replaygain_track_gain",
+    [TF_FIELD_REPLAYGAIN_TRACK_PEAK] = "replaygain_track_peak",
+    [TF_FIELD_PLAYBACK_TIME] = "playback_time",
+    [TF_FIELD_PLAYBACK_TIME_SECONDS] = "playback_time_seconds",
+    [TF_FIELD_PLAYBACK_TIME_REMAINING] = "playback_time_remaining",
+    [TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS] = "playback_time_remaining_seconds",
+    [TF_FIELD_LENGTH] = "length",
+    [TF_FIELD_LENGTH_EX] = "length_ex",
+    [TF_FIELD_LENGTH_SECONDS] = "length_seconds",
+    [TF_FIELD_LENGTH_SECONDS_FP] = "length_seconds_fp",
+    [TF_FIELD_LENGTH_SAMPLES] = "length_samples",
+    [TF_FIELD_ISPLAYING] = "isplaying",
+    [TF_FIELD_ISPAUSED] = "ispaused",
+    [TF_FIELD_FILENAME] = "filename",
+    [TF_FIELD_FILENAME_EXT] = "filename_ext",
+    [TF_FIELD_DIRECTORYNAME] = "directoryname",
+    [TF_FIELD_PATH] = "path",
+    [TF_FIELD_LIST_INDEX] = "list_index",
+    [TF_FIELD_LIST_TOTAL] = "list_total",
+    [TF_FIELD_QUEUE_INDEX] = "queue_index",
+    [TF_FIELD_QUEUE_INDEXES] = "queue_indexes",
+    [TF_FIELD_QUEUE_TOTAL] = "queue_total",
+    [TF_FIELD_DEADBEEF_VERSION] = "_deadbeef_version",
+};
+
+// fields which depend on the playback state, the playlist or the queue,
+// scripts using them are never cached
+static const char tf_field_volatile[TF_FIELD_COUNT] = {
+    [TF_FIELD_PLAYBACK_TIME] = 1,
+    [TF_FIELD_PLAYBACK_TIME_SECONDS] = 1,
+    [TF_FIELD_PLAYBACK_TIME_REMAINING] = 1,
+    [TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS] = 1,
+    [TF_FIELD_LENGTH_SAMPLES] = 1,
+    [TF_FIELD_ISPLAYING] = 1,
+    [TF_FIELD_ISPAUSED] = 1,
+    [TF_FIELD_LIST_INDEX] = 1,
+    [TF_FIELD_LIST_TOTAL] = 1,
+    [TF_FIELD_QUEUE_INDEX] = 1,
+    [TF_FIELD_QUEUE_INDEXES] = 1,
+    [TF_FIELD_QUEUE_TOTAL] = 1,
+};
+
+static int
+tf_field_for_name (const char *name) {
+    for (int i = 1; i < TF_FIELD_COUNT; i++) {
+        if (!strcmp (name, tf_field_names[i])) {
+            return i;
+        }
+    }
+    return TF_FIELD_META;
+}
+
 
 #define TF_EVAL_CHECK(res, ctx, arg, arg_len, out, outlen, fail_on_undef)\
 res = tf_eval_int (ctx, arg, arg_len, out, outlen, &bool_out, fail_on_undef);\
@@ -95,7 +239,13 @@ static playItem_t empty_track;
 // empty playlist is used when ctx.plt is null
 static playlist_t empty_playlist;
 // empty code is used when "code" argumen is null
-static char empty_code[4] = {0};
+static char empty_code[12] = {0};
+
+static int
+tf_cache_get (ddb_tf_context_t *ctx, uint32_t script_id, char *out, int outlen, int *res);
+
+static void
+tf_cache_put (ddb_tf_context_t *ctx, uint32_t script_id, const char *out, int outlen, int res);
 
 int
 tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
@@ -117,6 +267,11 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
 
     int32_t codelen = *((int32_t *)code);
     code += 4;
+    uint32_t script_id;
+    memcpy (&script_id, code + codelen + 4, 4);
+    if (null_it || (ctx->flags & DDB_TF_CONTEXT_NO_CACHE)) {
+        script_id = 0;
+    }
     memset (out, 0, outlen);
     int l = 0;
 
@@ -140,8 +295,16 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
         l = pl_format_item_queue ((playItem_t *)ctx->it, out, outlen);
         break;
     default:
-        // tf_eval_int expects outlen to not include the terminating zero
-        l = tf_eval_int (ctx, code, codelen, out, outlen-1, &bool_out, 0);
+        // the lock is taken once for the whole script, not per field
+        pl_lock ();
+        if (!script_id || !tf_cache_get (ctx, script_id, out, outlen, &l)) {
+            // tf_eval_int expects outlen to not include the terminating zero
+            l = tf_eval_int (ctx, code, codelen, out, outlen-1, &bool_out, 0);
+            if (script_id) {
+                tf_cache_put (ctx, script_id, out, outlen, l);
+            }
+        }
+        pl_unlock ();
         break;
     }
 
@@ -163,6 +326,173 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
     return l;
 }
 
+// results of tf_eval are cached per track, script, context flags and output
+// size, an entry is valid as long as the meta_serial of the track is the same.
+// the cache is protected by pl_lock, which tf_eval holds anyway.
+#define TF_CACHE_SIZE 4096
+#define TF_CACHE_HASH_SIZE 4096 // must be a power of 2
+
+typedef struct tf_cache_entry_s {
+    playItem_t *it; // only compared, never dereferenced
+    uint32_t script_id;
+    uint32_t flags;
+    int outlen;
+    unsigned meta_serial;
+    int res;
+    int text_size;
+    char *text;
+    struct tf_cache_entry_s *hash_next;
+    struct tf_cache_entry_s *lru_prev; // more recently used
+    struct tf_cache_entry_s *lru_next; // less recently used
+} tf_cache_entry_t;
+
+static tf_cache_entry_t *tf_cache_entries;
+static tf_cache_entry_t **tf_cache_hash;
+static tf_cache_entry_t *tf_cache_lru_head;
+static tf_cache_entry_t *tf_cache_lru_tail;
+static int tf_cache_count;
+
+// last id given to a cacheable script
+static uint32_t tf_script_id;
+
+static inline uint32_t
+tf_cache_bucket (playItem_t *it, uint32_t script_id, int outlen) {
+    uint32_t h = (uint32_t)((uintptr_t)it >> 4) * 2654435761u;
+    h ^= script_id * 0x9e3779b1u;
+    h ^= (uint32_t)outlen * 0x85ebca6bu;
+    h ^= h >> 16;
+    return h & (TF_CACHE_HASH_SIZE - 1);
+}
+
+static tf_cache_entry_t *
+tf_cache_find (ddb_tf_context_t *ctx, uint32_t script_id, int outlen) {
+    if (!tf_cache_hash) {
+        return NULL;
+    }
+    tf_cache_entry_t *e = tf_cache_hash[tf_cache_bucket ((playItem_t *)ctx->it, script_id, outlen)];
+    for (; e; e = e->hash_next) {
+        if (e->it == (playItem_t *)ctx->it && e->script_id == script_id && e->outlen == outlen && e->flags == ctx->flags) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void
+tf_cache_lru_remove (tf_cache_entry_t *e) {
+    if (e->lru_prev) {
+        e->lru_prev->lru_next = e->lru_next;
+    }
+    else {
+        tf_cache_lru_head = e->lru_next;
+    }
+    if (e->lru_next) {
+        e->lru_next->lru_prev = e->lru_prev;
+    }
+    else {
+        tf_cache_lru_tail = e->lru_prev;
+    }
+}
+
+static void
+tf_cache_lru_push (tf_cache_entry_t *e) {
+    e->lru_prev = NULL;
+    e->lru_next = tf_cache_lru_head;
+    if (tf_cache_lru_head) {
+        tf_cache_lru_head->lru_prev = e;
+    }
+    else {
+        tf_cache_lru_tail = e;
+    }
+    tf_cache_lru_head = e;
+}
+
+static int
+tf_cache_get (ddb_tf_context_t *ctx, uint32_t script_id, char *out, int outlen, int *res) {
+    tf_cache_entry_t *e = tf_cache_find (ctx, script_id, outlen);
+    if (!e || e->meta_serial != ((playItem_t *)ctx->it)->meta_serial) {
+        return 0;
+    }
+    if (e != tf_cache_lru_head) {
+        tf_cache_lru_remove (e);
+        tf_cache_lru_push (e);
+    }
+    strcpy (out, e->text);
+    *res = e->res;
+    return 1;
+}
+
+static void
+tf_cache_put (ddb_tf_context_t *ctx, uint32_t script_id, const char *out, int outlen, int res) {
+    if (!tf_cache_entries) {
+        tf_cache_entries = calloc (TF_CACHE_SIZE, sizeof (tf_cache_entry_t));
+        tf_cache_hash = calloc (TF_CACHE_HASH_SIZE, sizeof (tf_cache_entry_t *));
+    }
+
+    tf_cache_entry_t *e = tf_cache_find (ctx, script_id, outlen);
+    if (e) {
+        tf_cache_lru_remove (e);
+    }
+    else {
+        if (tf_cache_count < TF_CACHE_SIZE) {
+            e = &tf_cache_entries[tf_cache_count++];
+        }
+        else {
+            // reuse the least recently used entry
+            e = tf_cache_lru_tail;
+            tf_cache_lru_remove (e);
+            tf_cache_entry_t **pe = &tf_cache_hash[tf_cache_bucket (e->it, e->script_id, e->outlen)];
+            while (*pe != e) {
+                pe = &(*pe)->hash_next;
+            }
+            *pe = e->hash_next;
+        }
+        e->it = (playItem_t *)ctx->it;
+        e->script_id = script_id;
+        e->flags = ctx->flags;
+        e->outlen = outlen;
+        uint32_t bucket = tf_cache_bucket (e->it, script_id, outlen);
+        e->hash_next = tf_cache_hash[bucket];
+        tf_cache_hash[bucket] = e;
+    }
+
+    int len = (int)strlen (out);
+    if (e->text_size < len + 1) {
+        e->text_size = len + 1;
+        e->text = realloc (e->text, e->text_size);
+    }
+    memcpy (e->text, out, len + 1);
+    e->meta_serial = ((playItem_t *)ctx->it)->meta_serial;
+    e->res = res;
+    tf_cache_lru_push (e);
+}
+
+int
+tf_is_cacheable (const char *code) {
+    if (!code) {
+        return 1;
+    }
+    int32_t codelen = *((int32_t *)code);
+    uint32_t script_id;
+    memcpy (&script_id, code + 4 + codelen + 4, 4);
+    return script_id != 0;
+}
+
+void
+tf_cache_free (void) {
+    if (tf_cache_entries) {
+        for (int i = 0; i < tf_cache_count; i++) {
+            free (tf_cache_entries[i].text);
+        }
+        free (tf_cache_entries);
+        free (tf_cache_hash);
+    }
+    tf_cache_entries = NULL;
+    tf_cache_hash = NULL;
+    tf_cache_lru_head = tf_cache_lru_tail = NULL;
+    tf_cache_count = 0;
+}
+
 // $greater(a,b) returns true if a is greater than b, otherwise false
 int
 tf_func_greater (ddb_tf_context_t *ctx, int argc, const char *arglens, const char *args, char *out, int outlen, int fail_on_undef) {
@@ -1370,7 +1700,7 @@ tf_func_def tf_funcs[TF_MAX_FUNCS] = {
     { "mod", tf_func_mod },
     { "mul", tf_func_mul },
     { "muldiv", tf_func_muldiv },
-    { "rand", tf_func_rand },
+    { "rand", tf_func_rand, TF_FUNC_IMPURE | TF_FUNC_VOLATILE },
     { "sub", tf_func_sub },
     // Boolean
     { "and", tf_func_and },
@@ -1397,14 +1727,26 @@ tf_func_def tf_funcs[TF_MAX_FUNCS] = {
     { "strcmp", tf_func_strcmp },
     { "num", tf_func_num },
     // Track info
-    { "meta", tf_func_meta },
-    { "channels", tf_func_channels },
+    { "meta", tf_func_meta, TF_FUNC_IMPURE },
+    { "channels", tf_func_channels, TF_FUNC_IMPURE },
     { NULL, NULL }
 };
 
+static const char *
+_tf_get_combined_value_for_meta (DB_metaInfo_t *meta, int *needs_free);
+
 static const char *
 _tf_get_combined_value (playItem_t *it, const char *key, int *needs_free) {
-    DB_metaInfo_t *meta = pl_meta_for_key (it, key);
+    return _tf_get_combined_value_for_meta (pl_meta_for_key (it, key), needs_free);
+}
+
+static const char *
+_tf_get_combined_value_atom (playItem_t *it, uint32_t atom, int *needs_free) {
+    return _tf_get_combined_value_for_meta (atom ? pl_meta_for_atom (it, atom) : NULL, needs_free);
+}
+
+static const char *
+_tf_get_combined_value_for_meta (DB_metaInfo_t *meta, int *needs_free) {
 
     if (!meta) {
         *needs_free = 0;
@@ -1450,6 +1792,506 @@ _tf_get_combined_value (playItem_t *it, const char *key, int *needs_free) {
     return out;
 }
 
+// state passed to the field handlers; a handler either points val to the
+// value to copy to the output, or writes the output itself and sets skip_out
+typedef struct {
+    ddb_tf_context_t *ctx;
+    playItem_t *it;
+    int field;
+    uint32_t atom;
+    char *out;
+    int outlen;
+    const char *val;
+    int needs_free;
+    int skip_out;
+} tf_field_state_t;
+
+typedef void (*tf_field_handler_t) (tf_field_state_t *s);
+
+static const uint32_t aa_fields[] = { META_ATOM_ALBUM_ARTIST, META_ATOM_ALBUMARTIST, META_ATOM_BAND, META_ATOM_ARTIST, META_ATOM_COMPOSER, META_ATOM_PERFORMER, 0 };
+static const uint32_t a_fields[] = { META_ATOM_ARTIST, META_ATOM_ALBUM_ARTIST, META_ATOM_ALBUMARTIST, META_ATOM_COMPOSER, META_ATOM_PERFORMER, 0 };
+static const uint32_t alb_fields[] = { META_ATOM_ALBUM, META_ATOM_VENUE, 0 };
+
+// fields which are plain lookups of another metadata key
+static const uint32_t tf_field_raw_atoms[TF_FIELD_COUNT] = {
+    [TF_FIELD_DISCNUMBER] = META_ATOM_DISC,
+    [TF_FIELD_TOTALDISCS] = META_ATOM_NUMDISCS,
+    // NOTE: foobar2000 uses "date" instead of "year"
+    // so for %date% we simply return the content of "year"
+    [TF_FIELD_DATE] = META_ATOM_YEAR,
+    [TF_FIELD_SAMPLERATE] = META_ATOM_SAMPLERATE,
+    [TF_FIELD_BITRATE] = META_ATOM_BITRATE,
+    [TF_FIELD_FILESIZE] = META_ATOM_FILE_SIZE,
+    [TF_FIELD_CODEC] = META_ATOM_FILETYPE,
+    [TF_FIELD_REPLAYGAIN_ALBUM_GAIN] = META_ATOM_REPLAYGAIN_ALBUMGAIN,
+    [TF_FIELD_REPLAYGAIN_ALBUM_PEAK] = META_ATOM_REPLAYGAIN_ALBUMPEAK,
+    [TF_FIELD_REPLAYGAIN_TRACK_GAIN] = META_ATOM_REPLAYGAIN_TRACKGAIN,
+    [TF_FIELD_REPLAYGAIN_TRACK_PEAK] = META_ATOM_REPLAYGAIN_TRACKPEAK,
+    [TF_FIELD_PATH] = META_ATOM_URI,
+};
+
+static void
+tf_field_advance (tf_field_state_t *s, int len) {
+    s->out += len;
+    s->outlen -= len;
+    s->skip_out = 1;
+}
+
+static const char *
+tf_field_first_value (tf_field_state_t *s, const uint32_t *atoms) {
+    const char *val = NULL;
+    for (int i = 0; !val && atoms[i]; i++) {
+        val = _tf_get_combined_value_atom (s->it, atoms[i], &s->needs_free);
+    }
+    return val;
+}
+
+static void
+tf_field_meta (tf_field_state_t *s) {
+    s->val = _tf_get_combined_value_atom (s->it, s->atom, &s->needs_free);
+}
+
+static void
+tf_field_raw (tf_field_state_t *s) {
+    s->val = pl_find_meta_raw_atom (s->it, tf_field_raw_atoms[s->field]);
+}
+
+static void
+tf_field_album_artist (tf_field_state_t *s) {
+    s->val = tf_field_first_value (s, aa_fields);
+}
+
+static void
+tf_field_artist (tf_field_state_t *s) {
+    s->val = tf_field_first_value (s, a_fields);
+}
+
+static void
+tf_field_album (tf_field_state_t *s) {
+    s->val = tf_field_first_value (s, alb_fields);
+}
+
+static void
+tf_field_track_artist (tf_field_state_t *s) {
+    const char *aa = tf_field_first_value (s, aa_fields);
+    int aa_needs_free = s->needs_free;
+    const char *val = tf_field_first_value (s, a_fields);
+    if (val && aa && !strcmp (val, aa)) {
+        if (s->needs_free) {
+            free ((char *)val);
+        }
+        s->needs_free = 0;
+        val = NULL;
+    }
+    if (aa && aa_needs_free) {
+        free ((char *)aa);
+    }
+    s->val = val;
+}
+
+static void
+tf_field_tracknumber_int (tf_field_state_t *s, const char *fmt) {
+    const char *v = pl_find_meta_raw_atom (s->it, META_ATOM_TRACK);
+    if (v) {
+        const char *p = v;
+        while (*p) {
+            if (!isdigit (*p)) {
+                break;
+            }
+            p++;
+        }
+        if (p > v) {
+            tf_field_advance (s, snprintf (s->out, s->outlen, fmt, atoi(v)));
+        }
+    }
+}
+
+static void
+tf_field_tracknumber (tf_field_state_t *s) {
+    tf_field_tracknumber_int (s, "%02d");
+}
+
+static void
+tf_field_track_number (tf_field_state_t *s) {
+    tf_field_tracknumber_int (s, "%d");
+}
+
+static void
+tf_field_title (tf_field_state_t *s) {
+    s->val = _tf_get_combined_value_atom (s->it, META_ATOM_TITLE, &s->needs_free);
+    if (!s->val) {
+        const char *v = pl_find_meta_raw_atom (s->it, META_ATOM_URI);
+        if (v) {
+            const char *start = strrchr (v, '/');
+            if (start) {
+                start++;
+            }
+            else {
+                start = v;
+            }
+            const char *end = strrchr (start, '.');
+            if (end) {
+                int n = min ((int)(end-start), s->outlen);
+                n = u8_strnbcpy (s->out, start, n);
+                s->outlen -= n;
+                s->out += n;
+            }
+        }
+    }
+}
+
+static void
+tf_field_filesize_natural (tf_field_state_t *s) {
+    const char *v = pl_find_meta_raw_atom (s->it, META_ATOM_FILE_SIZE);
+    if (v) {
+        int64_t bs = atoll (v);
+        int len;
+        if (bs >= 1024*1024*1024) {
+            double gb = (double)bs / (double)(1024*1024*1024);
+            len = snprintf (s->out, s->outlen, "%.3lf GB", gb);
+        }
+        else if (bs >= 1024*1024) {
+            double mb = (double)bs / (double)(1024*1024);
+            len = snprintf (s->out, s->outlen, "%.3lf MB", mb);
+        }
+        else if (bs >= 1024) {
+            double kb = (double)bs / (double)(1024);
+            len = snprintf (s->out, s->outlen, "%.3lf KB", kb);
+        }
+        else {
+            len = snprintf (s->out, s->outlen, "%lld B", bs);
+        }
+        tf_field_advance (s, len);
+    }
+}
+
+static void
+tf_field_channels (tf_field_state_t *s) {
+    s->val = tf_get_channels_string_for_track (s->it);
+}
+
+static void
+tf_field_playback_time_int (tf_field_state_t *s, int remaining, int seconds) {
+    playItem_t *playing = streamer_get_playing_track ();
+    if (s->it && playing == s->it && !(s->ctx->flags & DDB_TF_CONTEXT_NO_DYNAMIC)) {
+        float t = streamer_get_playpos ();
+        if (remaining) {
+            float dur = pl_get_item_duration (s->it);
+            t = dur - t;
+        }
+        if (t >= 0) {
+            int len = 0;
+            if (!seconds) {
+                int hr = t/3600;
+                int mn = (t-hr*3600)/60;
+                int sc = t-hr*3600-mn*60;
+                if (hr) {
+                    len = snprintf (s->out, s->outlen, "%d:%02d:%02d", hr, mn, sc);
+                }
+                else {
+                    len = snprintf (s->out, s->outlen, "%d:%02d", mn, sc);
+                }
+            }
+            else {
+                len = snprintf (s->out, s->outlen, "%0.2f", t);
+            }
+            tf_field_advance (s, len);
+            // notify the caller about update interval
+            if (!s->ctx->update || (s->ctx->update > 1000)) {
+                s->ctx->update = 1000;
+            }
+        }
+    }
+    if (playing) {
+        pl_item_unref (playing);
+    }
+}
+
+static void
+tf_field_playback_time (tf_field_state_t *s) {
+    tf_field_playback_time_int (s, 0, 0);
+}
+
+static void
+tf_field_playback_time_seconds (tf_field_state_t *s) {
+    tf_field_playback_time_int (s, 0, 1);
+}
+
+static void
+tf_field_playback_time_remaining (tf_field_state_t *s) {
+    tf_field_playback_time_int (s, 1, 0);
+}
+
+static void
+tf_field_playback_time_remaining_seconds (tf_field_state_t *s) {
+    tf_field_playback_time_int (s, 1, 1);
+}
+
+static void
+tf_field_length (tf_field_state_t *s) {
+    float t = roundf (pl_get_item_duration (s->it));
+    if (t >= 0) {
+        int hr = t/3600;
+        int mn = (t-hr*3600)/60;
+        int sc = t-hr*3600-mn*60;
+        int len;
+        if (hr) {
+            len = snprintf (s->out, s->outlen, "%d:%02d:%02d", hr, mn, sc);
+        }
+        else {
+            len = snprintf (s->out, s->outlen, "%d:%02d", mn, sc);
+        }
+        tf_field_advance (s, len);
+    }
+}
+
+static void
+tf_field_length_ex (tf_field_state_t *s) {
+    float t = roundf (pl_get_item_duration (s->it) * 1000) / 1000.f;
+    if (t >= 0) {
+        int hr = t/3600;
+        int mn = (t-hr*3600)/60;
+        int sc = t-hr*3600-mn*60;
+        int ms = (t-hr*3600-mn*60-sc) * 1000.f;
+        int len;
+        if (hr) {
+            len = snprintf (s->out, s->outlen, "%d:%02d:%02d.%03d", hr, mn, sc, ms);
+        }
+        else {
+            len = snprintf (s->out, s->outlen, "%d:%02d.%03d", mn, sc, ms);
+        }
+        tf_field_advance (s, len);
+    }
+}
+
+// NOTE: %length_seconds_fp% has always been formatted the same way as
+// %length_seconds%, scripts in the wild depend on that
+static void
+tf_field_length_seconds (tf_field_state_t *s) {
+    float t = pl_get_item_duration (s->it);
+    if (t >= 0) {
+        tf_field_advance (s, snprintf (s->out, s->outlen, "%d", (int)roundf(t)));
+    }
+}
+
+static void
+tf_field_length_samples (tf_field_state_t *s) {
+    tf_field_advance (s, snprintf (s->out, s->outlen, "%d", s->ctx->it->endsample - s->ctx->it->startsample));
+}
+
+static void
+tf_field_playstate_int (tf_field_state_t *s, int state) {
+    playItem_t *playing = streamer_get_playing_track ();
+    if (playing && plug_get_output ()->state () == state) {
+        *s->out = '1';
+        tf_field_advance (s, 1);
+    }
+    if (playing) {
+        pl_item_unref (playing);
+    }
+}
+
+static void
+tf_field_isplaying (tf_field_state_t *s) {
+    tf_field_playstate_int (s, OUTPUT_STATE_PLAYING);
+}
+
+static void
+tf_field_ispaused (tf_field_state_t *s) {
+    tf_field_playstate_int (s, OUTPUT_STATE_PAUSED);
+}
+
+static void
+tf_field_filename (tf_field_state_t *s) {
+    const char *v = pl_find_meta_raw_atom (s->it, META_ATOM_URI);
+    if (v) {
+        const char *start = strrchr (v, '/');
+        if (start) {
+            start++;
+        }
+        else {
+            start = v;
+        }
+        const char *end = strrchr (start, '.');
+        if (end) {
+            tf_append_out (&s->out, &s->outlen, start, (int)(end-start));
+            s->skip_out = 1;
+        }
+    }
+}
+
+static void
+tf_field_filename_ext (tf_field_state_t *s) {
+    const char *v = pl_find_meta_raw_atom (s->it, META_ATOM_URI);
+    if (v) {
+        const char *start = strrchr (v, '/');
+        if (start) {
+            start++;
+        }
+        else {
+            start = v;
+        }
+        tf_append_out (&s->out, &s->outlen, start, (int)strlen (start));
+        s->skip_out = 1;
+    }
+}
+
+static void
+tf_field_directoryname (tf_field_state_t *s) {
+    const char *v = pl_find_meta_raw_atom (s->it, META_ATOM_URI);
+    if (v) {
+        const char *end = strrchr (v, '/');
+        if (end) {
+            const char *start = end - 1;
+            while (start >= v && *start != '/') {
+                start--;
+            }
+            if (start && start != end) {
+                start++;
+                tf_append_out (&s->out, &s->outlen, start, (int)(end-start));
+                s->skip_out = 1;
+            }
+        }
+    }
+}
+
+// index of track in playlist (zero-padded)
+static void
+tf_field_list_index (tf_field_state_t *s) {
+    ddb_tf_context_t *ctx = s->ctx;
+    if (s->it) {
+        int total_tracks = plt_get_item_count ((playlist_t *)ctx->plt, ctx->iter);
+        int digits = 0;
+        do {
+            total_tracks /= 10;
+            digits++;
+        } while (total_tracks);
+
+        int idx = 0;
+        if (ctx->flags & DDB_TF_CONTEXT_HAS_INDEX) {
+            idx = ctx->idx + 1;
+        }
+        else {
+            idx = pl_get_idx_of_iter (s->it, ctx->iter) + 1;
+        }
+        tf_field_advance (s, snprintf (s->out, s->outlen, "%0*d", digits, idx));
+    }
+}
+
+// total number of tracks in playlist
+static void
+tf_field_list_total (tf_field_state_t *s) {
+    ddb_tf_context_t *ctx = s->ctx;
+    int total_tracks = -1;
+    if (ctx->plt) {
+        total_tracks = plt_get_item_count ((playlist_t *)ctx->plt, ctx->iter);
+    }
+    else {
+        playlist_t *plt = plt_get_curr ();
+        if (plt) {
+            total_tracks = plt_get_item_count (plt, ctx->iter);
+            plt_unref (plt);
+        }
+    }
+    if (total_tracks >= 0) {
+        tf_field_advance (s, snprintf (s->out, s->outlen, "%d", total_tracks));
+    }
+}
+
+// index of track in queue
+static void
+tf_field_queue_index (tf_field_state_t *s) {
+    if (s->it) {
+        int idx = playqueue_test (s->it) + 1;
+        if (idx >= 1) {
+            tf_field_advance (s, snprintf (s->out, s->outlen, "%d", idx));
+        }
+    }
+}
+
+// indexes of track in queue
+static void
+tf_field_queue_indexes (tf_field_state_t *s) {
+    if (s->it) {
+        int idx = playqueue_test (s->it) + 1;
+        if (idx >= 1) {
+            tf_field_advance (s, snprintf (s->out, s->outlen, "%d", idx));
+            int count = playqueue_getcount ();
+            for (int i = idx; i < count; i++) {
+                playItem_t *trk = playqueue_get_item (i);
+                if (trk) {
+                    if (s->it == trk) {
+                        tf_field_advance (s, snprintf (s->out, s->outlen, ",%d", i + 1));
+                    }
+                    pl_item_unref (trk);
+                }
+            }
+        }
+    }
+}
+
+// total amount of tracks in queue
+static void
+tf_field_queue_total (tf_field_state_t *s) {
+    int count = playqueue_getcount ();
+    if (count >= 0) {
+        tf_field_advance (s, snprintf (s->out, s->outlen, "%d", count));
+    }
+}
+
+static void
+tf_field_deadbeef_version (tf_field_state_t *s) {
+    s->val = VERSION;
+}
+
+// special cases
+// most if not all of this stuff is to make tf scripts
+// compatible with fb2k syntax
+static const tf_field_handler_t tf_field_handlers[TF_FIELD_COUNT] = {
+    [TF_FIELD_META] = tf_field_meta,
+    [TF_FIELD_ALBUM_ARTIST] = tf_field_album_artist,
+    [TF_FIELD_ARTIST] = tf_field_artist,
+    [TF_FIELD_ALBUM] = tf_field_album,
+    [TF_FIELD_TRACK_ARTIST] = tf_field_track_artist,
+    [TF_FIELD_TRACKNUMBER] = tf_field_tracknumber,
+    [TF_FIELD_TITLE] = tf_field_title,
+    [TF_FIELD_DISCNUMBER] = tf_field_raw,
+    [TF_FIELD_TOTALDISCS] = tf_field_raw,
+    [TF_FIELD_TRACK_NUMBER] = tf_field_track_number,
+    [TF_FIELD_DATE] = tf_field_raw,
+    [TF_FIELD_SAMPLERATE] = tf_field_raw,
+    [TF_FIELD_BITRATE] = tf_field_raw,
+    [TF_FIELD_FILESIZE] = tf_field_raw,
+    [TF_FIELD_FILESIZE_NATURAL] = tf_field_filesize_natural,
+    [TF_FIELD_CHANNELS] = tf_field_channels,
+    [TF_FIELD_CODEC] = tf_field_raw,
+    [TF_FIELD_REPLAYGAIN_ALBUM_GAIN] = tf_field_raw,
+    [TF_FIELD_REPLAYGAIN_ALBUM_PEAK] = tf_field_raw,
+    [TF_FIELD_REPLAYGAIN_TRACK_GAIN] = tf_field_raw,
+    [TF_FIELD_REPLAYGAIN_TRACK_PEAK] = tf_field_raw,
+    [TF_FIELD_PLAYBACK_TIME] = tf_field_playback_time,
+    [TF_FIELD_PLAYBACK_TIME_SECONDS] = tf_field_playback_time_seconds,
+    [TF_FIELD_PLAYBACK_TIME_REMAINING] = tf_field_playback_time_remaining,
+    [TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS] = tf_field_playback_time_remaining_seconds,
+    [TF_FIELD_LENGTH] = tf_field_length,
+    [TF_FIELD_LENGTH_EX] = tf_field_length_ex,
+    [TF_FIELD_LENGTH_SECONDS] = tf_field_length_seconds,
+    [TF_FIELD_LENGTH_SECONDS_FP] = tf_field_length_seconds,
+    [TF_FIELD_LENGTH_SAMPLES] = tf_field_length_samples,
+    [TF_FIELD_ISPLAYING] = tf_field_isplaying,
+    [TF_FIELD_ISPAUSED] = tf_field_ispaused,
+    [TF_FIELD_FILENAME] = tf_field_filename,
+    [TF_FIELD_FILENAME_EXT] = tf_field_filename_ext,
+    [TF_FIELD_DIRECTORYNAME] = tf_field_directoryname,
+    [TF_FIELD_PATH] = tf_field_raw,
+    [TF_FIELD_LIST_INDEX] = tf_field_list_index,
+    [TF_FIELD_LIST_TOTAL] = tf_field_list_total,
+    [TF_FIELD_QUEUE_INDEX] = tf_field_queue_index,
+    [TF_FIELD_QUEUE_INDEXES] = tf_field_queue_indexes,
+    [TF_FIELD_QUEUE_TOTAL] = tf_field_queue_total,
+    [TF_FIELD_DEADBEEF_VERSION] = tf_field_deadbeef_version,
+};
+
 static int
 tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int outlen, int *bool_out, int fail_on_undef) {
     playItem_t *it = (playItem_t *)ctx->it;
@@ -1501,457 +2343,62 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 code += blocksize;
                 size -= blocksize;
             }
-            else if (*code == 2) {
-                code++;
-                size--;
-                uint8_t len = *code;
-                code++;
-                size--;
-
-                char name[len+1];
-                memcpy (name, code, len);
-                name[len] = 0;
-
-                // special cases
-                // most if not all of this stuff is to make tf scripts
-                // compatible with fb2k syntax
-                pl_lock ();
-                const char *val = NULL;
-                int needs_free = 0;
-                const char *aa_fields[] = { "album artist", "albumartist", "band", "artist", "composer", "performer", NULL };
-                const char *a_fields[] = { "artist", "album artist", "albumartist", "composer", "performer", NULL };
-                const char *alb_fields[] = { "album", "venue", NULL };
-
-                // set to 1 if special case handler successfully wrote the output
-                int skip_out = 0;
-
-                // temp vars used for strcmp optimizations
-                int tmp_a = 0, tmp_b = 0, tmp_c = 0, tmp_d = 0;
-
-                if (!strcmp (name, aa_fields[0])) {
-                    for (int i = 0; !val && aa_fields[i]; i++) {
-                        val = _tf_get_combined_value(it, aa_fields[i], &needs_free);
-                    }
-                }
-                else if (!strcmp (name, a_fields[0])) {
-                    for (int i = 0; !val && a_fields[i]; i++) {
-                        val = _tf_get_combined_value(it, a_fields[i], &needs_free);
-                    }
-                }
-                else if (!strcmp (name, "album")) {
-                    for (int i = 0; !val && alb_fields[i]; i++) {
-                        val = _tf_get_combined_value (it, alb_fields[i], &needs_free);
-                    }
-                }
-                else if (!strcmp (name, "track artist")) {
-                    const char *aa = NULL;
-                    for (int i = 0; !val && aa_fields[i]; i++) {
-                        val = _tf_get_combined_value (it, aa_fields[i], &needs_free);
-                    }
-                    aa = val;
-                    val = NULL;
-                    for (int i = 0; !val && a_fields[i]; i++) {
-                        val = _tf_get_combined_value (it, a_fields[i], &needs_free);
-                    }
-                    if (val && aa && !strcmp (val, aa)) {
-                        val = NULL;
-                    }
-                }
-                else if (!strcmp (name, "tracknumber")) {
-                    const char *v = pl_find_meta_raw (it, "track");
-                    if (v) {
-                        const char *p = v;
-                        while (*p) {
-                            if (!isdigit (*p)) {
-                                break;
-                            }
-                            p++;
-                        }
-                        if (p > v) {
-                            int len = snprintf (out, outlen, "%02d", atoi(v));
-                            out += len;
-                            outlen -= len;
-                            skip_out = 1;
-                        }
-                    }
-                }
-                else if (!strcmp (name, "title")) {
-                    val = _tf_get_combined_value (it, "title", &needs_free);
-                    if (!val) {
-                        const char *v = pl_find_meta_raw (it, ":URI");
-                        if (v) {
-                            const char *start = strrchr (v, '/');
-                            if (start) {
-                                start++;
-                            }
-                            else {
-                                start = v;
-                            }
-                            const char *end = strrchr (start, '.');
-                            if (end) {
-                                int n = (int)(end-start);
-                                n = min ((int)(end-start), outlen);
-                                n = u8_strnbcpy (out, start, n);
-                                outlen -= n;
-                                out += n;
-                            }
-                        }
-                    }
-                }
-                else if (!strcmp (name, "discnumber")) {
-                    val = pl_find_meta_raw (it, "disc");
-                }
-                else if (!strcmp (name, "totaldiscs")) {
-                    val = pl_find_meta_raw (it, "numdiscs");
-                }
-                else if (!strcmp (name, "track number")) {
-                    const char *v = pl_find_meta_raw (it, "track");
-                    if (v) {
-                        const char *p = v;
-                        while (*p) {
-                            if (!isdigit (*p)) {
-                                break;
-                            }
-                            p++;
-                        }
-                        if (p > v) {
-                            int len = snprintf (out, outlen, "%d", atoi(v));
-                            out += len;
-                            outlen -= len;
-                            skip_out = 1;
-                        }
+            else if (*code == 2 || *code == 5) {
+                int field;
+                uint32_t atom = 0;
+                int len;
+                if (*code == 2) {
+                    // unresolved field, look it up by name
+                    code++;
+                    size--;
+                    len = (uint8_t)*code;
+                    code++;
+                    size--;
+
+                    char name[len+1];
+                    memcpy (name, code, len);
+                    name[len] = 0;
+                    field = tf_field_for_name (name);
+                    if (field == TF_FIELD_META) {
+                        atom = metacache_find_key_atom (name);
                     }
                 }
-                else if (!strcmp (name, "date")) {
-                    // NOTE: foobar2000 uses "date" instead of "year"
-                    // so for %date% we simply return the content of "year"
-                    val = pl_find_meta_raw (it, "year");
-                }
-                else if (!strcmp (name, "samplerate")) {
-                    val = pl_find_meta_raw (it, ":SAMPLERATE");
-                }
-                else if (!strcmp (name, "bitrate")) {
-                    val = pl_find_meta_raw (it, ":BITRATE");
-                }
-                else if (!strcmp (name, "filesize")) {
-                    val = pl_find_meta_raw (it, ":FILE_SIZE");
-                }
-                else if (!strcmp (name, "filesize_natural")) {
-                    const char *v = pl_find_meta_raw (it, ":FILE_SIZE");
-                    if (v) {
-                        int64_t bs = atoll (v);
-                        int len;
-                        if (bs >= 1024*1024*1024) {
-                            double gb = (double)bs / (double)(1024*1024*1024);
-                            len = snprintf (out, outlen, "%.3lf GB", gb);
-                        }
-                        else if (bs >= 1024*1024) {
-                            double mb = (double)bs / (double)(1024*1024);
-                            len = snprintf (out, outlen, "%.3lf MB", mb);
-                        }
-                        else if (bs >= 1024) {
-                            double kb = (double)bs / (double)(1024);
-                            len = snprintf (out, outlen, "%.3lf KB", kb);
-                        }
-                        else {
-                            len = snprintf (out, outlen, "%lld B", bs);
-                        }
-                        out += len;
-                        outlen -= len;
-                        skip_out = 1;
-                    }
-                }
-                else if (!strcmp (name, "channels")) {
-                    val = tf_get_channels_string_for_track (it);
-                }
-                else if (!strcmp (name, "codec")) {
-                    val = pl_find_meta_raw (it, ":FILETYPE");
-                }
-                else if (!strcmp (name, "replaygain_album_gain")) {
-                    val = pl_find_meta_raw (it, ":REPLAYGAIN_ALBUMGAIN");
-                }
-                else if (!strcmp (name, "replaygain_album_peak")) {
-                    val = pl_find_meta_raw (it, ":REPLAYGAIN_ALBUMPEAK");
-                }
-                else if (!strcmp (name, "replaygain_track_gain")) {
-                    val = pl_find_meta_raw (it, ":REPLAYGAIN_TRACKGAIN");
-                }
-                else if (!strcmp (name, "replaygain_track_peak")) {
-                    val = pl_find_meta_raw (it, ":REPLAYGAIN_TRACKPEAK");
-                }
-                else if ((tmp_a = !strcmp (name, "playback_time")) || (tmp_b = !strcmp (name, "playback_time_seconds")) || (tmp_c = !strcmp (name, "playback_time_remaining")) || (tmp_d = !strcmp (name, "playback_time_remaining_seconds"))) {
-                    playItem_t *playing = streamer_get_playing_track ();
-                    if (it && playing == it && !(ctx->flags & DDB_TF_CONTEXT_NO_DYNAMIC)) {
-                        float t = streamer_get_playpos ();
-                        if (tmp_c || tmp_d) {
-                            printf ("inverse time %d %d %d %d\n", tmp_a, tmp_b, tmp_c, tmp_d);
-                            float dur = pl_get_item_duration (it);
-                            t = dur - t;
-                        }
-                        if (t >= 0) {
-                            int len = 0;
-                            if (tmp_a || tmp_c) {
-                                int hr = t/3600;
-                                int mn = (t-hr*3600)/60;
-                                int sc = t-hr*3600-mn*60;
-                                if (hr) {
-                                    len = snprintf (out, outlen, "%d:%02d:%02d", hr, mn, sc);
-                                }
-                                else {
-                                    len = snprintf (out, outlen, "%d:%02d", mn, sc);
-                                }
-                            }
-                            else if (tmp_b || tmp_d) {
-                                len = snprintf (out, outlen, "%0.2f", t);
-                            }
-                            out += len;
-                            outlen -= len;
-                            skip_out = 1;
-                            // notify the caller about update interval
-                            if (!ctx->update || (ctx->update > 1000)) {
-                                ctx->update = 1000;
-                            }
-                        }
-                    }
-                    if (playing) {
-                        pl_item_unref (playing);
-                    }
-                }
-                else if ((tmp_a = !strcmp (name, "length")) || (tmp_b = !strcmp (name, "length_ex"))) {
-                    float t = pl_get_item_duration (it);
-                    if (tmp_a) {
-                        t = roundf (t);
-                    }
-                    else if (tmp_b) {
-                        t = roundf(t * 1000) / 1000.f;
-                    }
-                    if (t >= 0) {
-                        int hr = t/3600;
-                        int mn = (t-hr*3600)/60;
-                        int sc = tmp_a ? t-hr*3600-mn*60 : t-hr*3600-mn*60;
-                        int ms = tmp_b ? (t-hr*3600-mn*60-sc) * 1000.f : 0;
-                        int len = 0;
-                        if (tmp_a) {
-                            if (hr) {
-                                len = snprintf (out, outlen, "%d:%02d:%02d", hr, mn, sc);
-                            }
-                            else {
-                                len = snprintf (out, outlen, "%d:%02d", mn, sc);
-                            }
-                        }
-                        else if (tmp_b) {
-                            if (hr) {
-                                len = snprintf (out, outlen, "%d:%02d:%02d.%03d", hr, mn, sc, ms);
-                            }
-                            else {
-                                len = snprintf (out, outlen, "%d:%02d.%03d", mn, sc, ms);
-                            }
-                        }
-                        out += len;
-                        outlen -= len;
-                        skip_out = 1;
-                    }
-                }
-                else if ((tmp_a = !strcmp (name, "length_seconds") || (tmp_b = !strcmp (name, "length_seconds_fp")))) {
-                    float t = pl_get_item_duration (it);
-                    if (t >= 0) {
-                        int len;
-                        if (tmp_a) {
-                            len = snprintf (out, outlen, "%d", (int)roundf(t));
-                        }
-                        else {
-                            len = snprintf (out, outlen, "%0.3f", t);
-                        }
-                        out += len;
-                        outlen -= len;
-                        skip_out = 1;
-                    }
-                }
-                else if (!strcmp (name, "length_samples")) {
-                    int len = snprintf (out, outlen, "%d", ctx->it->endsample - ctx->it->startsample);
-                    out += len;
-                    outlen -= len;
-                    skip_out = 1;
-                }
-                else if ((tmp_a = !strcmp (name, "isplaying")) || (tmp_b = !strcmp (name, "ispaused"))) {
-                    playItem_t *playing = streamer_get_playing_track ();
-                    
-                    if (playing && 
-                            (
-                            (tmp_a && plug_get_output ()->state () == OUTPUT_STATE_PLAYING)
-                            || (tmp_b && plug_get_output ()->state () == OUTPUT_STATE_PAUSED)
-                            )) {
-                        *out++ = '1';
-                        outlen--;
-                        skip_out = 1;
-                    }
-                    if (playing) {
-                        pl_item_unref (playing);
-                    }
-                }
-                else if (!strcmp (name, "filename")) {
-                    const char *v = pl_find_meta_raw (it, ":URI");
-                    if (v) {
-                        const char *start = strrchr (v, '/');
-                        if (start) {
-                            start++;
-                        }
-                        else {
-                            start = v;
-                        }
-                        const char *end = strrchr (start, '.');
-                        if (end) {
-                            tf_append_out(&out, &outlen, start, (int)(end-start));
-                            skip_out = 1;
-                        }
-                    }
-                }
-                else if (!strcmp (name, "filename_ext")) {
-                    const char *v = pl_find_meta_raw (it, ":URI");
-                    if (v) {
-                        const char *start = strrchr (v, '/');
-                        if (start) {
-                            start++;
-                        }
-                        else {
-                            start = v;
-                        }
-                        tf_append_out (&out, &outlen, start, (int)strlen (start));
-                        skip_out = 1;
-                    }
-                }
-                else if (!strcmp (name, "directoryname")) {
-                    const char *v = pl_find_meta_raw (it, ":URI");
-                    if (v) {
-                        const char *end = strrchr (v, '/');
-                        if (end) {
-                            const char *start = end - 1;
-                            while (start >= v && *start != '/') {
-                                start--;
-                            }
-                            if (start && start != end) {
-                                start++;
-                                tf_append_out(&out, &outlen, start, (int)(end-start));
-                                skip_out = 1;
-                            }
-                        }
-                    }
-                }
-                else if (!strcmp (name, "path")) {
-                    val = pl_find_meta_raw (it, ":URI");
-                }
-                // index of track in playlist (zero-padded)
-                else if (!strcmp (name, "list_index")) {
-                    if (it) {
-                        int total_tracks = plt_get_item_count ((playlist_t *)ctx->plt, ctx->iter);
-                        int digits = 0;
-                        do {
-                            total_tracks /= 10;
-                            digits++;
-                        } while (total_tracks);
-
-                        int idx = 0;
-                        if (ctx->flags & DDB_TF_CONTEXT_HAS_INDEX) {
-                            idx = ctx->idx + 1;
-                        }
-                        else {
-                            idx = pl_get_idx_of_iter (it, ctx->iter) + 1;
-                        }
-                        int len = snprintf (out, outlen, "%0*d", digits, idx);
-                        out += len;
-                        outlen -= len;
-                        skip_out = 1;
-                    }
-                }
-                // total number of tracks in playlist
-                else if (!strcmp (name, "list_total")) {
-                    int total_tracks = -1;
-                    if (ctx->plt) {
-                        total_tracks = plt_get_item_count ((playlist_t *)ctx->plt, ctx->iter);
-                    }
-                    else {
-                        playlist_t *plt = plt_get_curr ();
-                        if (plt) {
-                            total_tracks = plt_get_item_count (plt, ctx->iter);
-                            plt_unref (plt);
-                        }
-                    }
-                    if (total_tracks >= 0) {
-                        int len = snprintf (out, outlen, "%d", total_tracks);
-                        out += len;
-                        outlen -= len;
-                        skip_out = 1;
-                    }
-                }
-                // index of track in queue
-                else if (!strcmp (name, "queue_index")) {
-                    if (it) {
-                        int idx = playqueue_test (it) + 1;
-                        if (idx >= 1) {
-                            int len = snprintf (out, outlen, "%d", idx);
-                            out += len;
-                            outlen -= len;
-                            skip_out = 1;
-                        }
-                    }
-                }
-                // indexes of track in queue
-                else if (!strcmp (name, "queue_indexes")) {
-                    if (it) {
-                        int idx = playqueue_test (it) + 1;
-                        if (idx >= 1) {
-                            int len = snprintf (out, outlen, "%d", idx);
-                            out += len;
-                            outlen -= len;
-                            int count = playqueue_getcount ();
-                            for (int i = idx; i < count; i++) {
-                                playItem_t *trk = playqueue_get_item (i);
-                                if (trk) {
-                                    if (it == trk) {
-                                        len = snprintf (out, outlen, ",%d", i + 1);
-                                        out += len;
-                                        outlen -= len;
-                                    }
-                                    pl_item_unref (trk);
-                                }
-                            }
-                            skip_out = 1;
-                        }
-                    }
-                }
-                // total amount of tracks in queue
-                else if (!strcmp (name, "queue_total")) {
-                    int count = playqueue_getcount ();
-                    if (count >= 0) {
-                        int len = snprintf (out, outlen, "%d", count);
-                        out += len;
-                        outlen -= len;
-                        skip_out = 1;
-                    }
-                }
-                else if (!strcmp (name, "_deadbeef_version")) {
-                    val = VERSION;
-                }
                 else {
-                    val = _tf_get_combined_value (it, name, &needs_free);
+                    field = (uint8_t)code[1];
+                    atom = (uint8_t)code[2] | ((uint8_t)code[3] << 8);
+                    code += 1;
+                    size -= 1;
+                    len = 3;
                 }
 
+                tf_field_state_t s = {
+                    .ctx = ctx,
+                    .it = it,
+                    .field = field,
+                    .atom = atom,
+                    .out = out,
+                    .outlen = outlen,
+                };
+                tf_field_handlers[field] (&s);
+                out = s.out;
+                outlen = s.outlen;
+                const char *val = s.val;
+
                 if (val || (!val && out > init_out)) {
                     *bool_out = 1;
                 }
 
                 // default case
-                if (!skip_out && val) {
+                if (!s.skip_out && val) {
                     int32_t l = u8_strnbcpy (out, val, outlen);
                     out += l;
                     outlen -= l;
                 }
-                pl_unlock ();
-                if (!skip_out && !val && fail_on_undef) {
+                if (!s.skip_out && !val && fail_on_undef) {
                     return -1;
                 }
 
-                if (val && needs_free) {
+                if (val && s.needs_free) {
                     free ((char *)val);
                 }
 
@@ -1987,11 +2434,55 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 memcpy (&len, code, 4);
                 code += 4;
                 size -= 4;
-                int32_t l = u8_strnbcpy(out, code, len);
-                out += l;
-                outlen -= l;
+                if (len > outlen) {
+                    // same as plain text: copy the characters which fit, and stop
+                    int32_t n = 0;
+                    for (;;) {
+                        int32_t next = n;
+                        u8_inc (code, &next);
+                        if (next > outlen) {
+                            break;
+                        }
+                        n = next;
+                    }
+                    memcpy (out, code, n);
+                    out += n;
+                    break;
+                }
+                memcpy (out, code, len);
+                out += len;
+                outlen -= len;
+                code += len;
+                size -= len;
+            }
+            else if (*code == 6) {
+                code++;
+                size--;
+                int folded_bool = *code;
+                code++;
+                size--;
+                int32_t len;
+                memcpy (&len, code, 4);
+                code += 4;
+                size -= 4;
+                if (len > outlen) {
+                    // functions may give a different result when the output
+                    // is truncated, run the original call which follows
+                    code += len;
+                    size -= len;
+                    continue;
+                }
+                if (folded_bool) {
+                    *bool_out = 1;
+                }
+                memcpy (out, code, len);
+                out += len;
+                outlen -= len;
                 code += len;
                 size -= len;
+                int callsize = tf_opt_block_size (code);
+                code += callsize;
+                size -= callsize;
             }
             else {
                 return -1;
@@ -2119,6 +2610,18 @@ tf_compile_field (tf_compiler_t *c) {
     char field[len+1];
     memcpy (field, fstart, len);
     field[len] = 0;
+
+    // resolve the field once, to avoid name lookups during evaluation;
+    // the resolved form is never longer than the name
+    int f = tf_field_for_name (field);
+    uint32_t atom = f == TF_FIELD_META ? metacache_key_atom (field) : 0;
+    if (len >= 2 && atom <= 0xffff) {
+        c->o = plen - 1;
+        *(c->o++) = 5;
+        *(c->o++) = f;
+        *(c->o++) = atom & 0xff;
+        *(c->o++) = atom >> 8;
+    }
     return 0;
 }
 
@@ -2231,6 +2734,245 @@ tf_compile_plain (tf_compiler_t *c) {
     return 0;
 }
 
+// optimization pass over the compiled bytecode:
+// plain text runs become literal blocks copied with a single memcpy,
+// field names are resolved to field handlers and atoms,
+// and calls to pure functions with constant arguments are evaluated once
+typedef struct {
+    char *code;
+    int size;
+    int capacity;
+} tf_optimizer_t;
+
+// only results shorter than this are folded, the rest is evaluated as usual
+#define TF_FOLD_MAX 1024
+
+static void
+tf_opt_append (tf_optimizer_t *o, const void *data, int len) {
+    if (o->size + len > o->capacity) {
+        while (o->size + len > o->capacity) {
+            o->capacity = o->capacity ? o->capacity * 2 : 256;
+        }
+        o->code = realloc (o->code, o->capacity);
+    }
+    memcpy (o->code + o->size, data, len);
+    o->size += len;
+}
+
+static void
+tf_opt_append_block (tf_optimizer_t *o, char op, const char *data, int32_t len) {
+    char hdr[6] = { 0, op };
+    memcpy (hdr + 2, &len, 4);
+    tf_opt_append (o, hdr, 6);
+    tf_opt_append (o, data, len);
+}
+
+// size of the special block at code, which starts with the 0 marker
+static int
+tf_opt_block_size (const char *code) {
+    int32_t len;
+    switch (code[1]) {
+    case 1: {
+        int size = 4 + code[3];
+        for (int i = 0; i < code[3]; i++) {
+            size += code[4+i];
+        }
+        return size;
+    }
+    case 2:
+        return 3 + (uint8_t)code[2];
+    case 3:
+    case 4:
+        memcpy (&len, code + 2, 4);
+        return 6 + len;
+    case 5:
+        return 5;
+    case 6:
+        memcpy (&len, code + 3, 4);
+        return 7 + len + tf_opt_block_size (code + 7 + len);
+    }
+    return -1;
+}
+
+// returns 1 if the code doesn't depend on the track, playlist or playback state
+static int
+tf_opt_is_constant (const char *code, int size) {
+    while (size > 0) {
+        if (*code) {
+            code++;
+            size--;
+            continue;
+        }
+        int blocksize = tf_opt_block_size (code);
+        if (blocksize < 0 || blocksize > size) {
+            return 0;
+        }
+        if (code[1] == 1) {
+            if (tf_funcs[(uint8_t)code[2]].flags) {
+                return 0;
+            }
+            const char *arg = code + 4 + code[3];
+            for (int i = 0; i < code[3]; i++) {
+                if (!tf_opt_is_constant (arg, code[4+i])) {
+                    return 0;
+                }
+                arg += code[4+i];
+            }
+        }
+        else if (code[1] == 2 || code[1] == 5) {
+            return 0;
+        }
+        else if (code[1] == 3) {
+            if (!tf_opt_is_constant (code + 6, blocksize - 6)) {
+                return 0;
+            }
+        }
+        code += blocksize;
+        size -= blocksize;
+    }
+    return 1;
+}
+
+// returns 1 if the results of the code can be cached, see tf_field_volatile
+static int
+tf_opt_is_cacheable (const char *code, int size) {
+    while (size > 0) {
+        if (*code) {
+            code++;
+            size--;
+            continue;
+        }
+        int blocksize = tf_opt_block_size (code);
+        if (blocksize < 0 || blocksize > size) {
+            return 0;
+        }
+        if (code[1] == 1) {
+            if (tf_funcs[(uint8_t)code[2]].flags & TF_FUNC_VOLATILE) {
+                return 0;
+            }
+            const char *arg = code + 4 + code[3];
+            for (int i = 0; i < code[3]; i++) {
+                if (!tf_opt_is_cacheable (arg, code[4+i])) {
+                    return 0;
+                }
+                arg += code[4+i];
+            }
+        }
+        else if (code[1] == 2) {
+            uint8_t len = (uint8_t)code[2];
+            char name[len+1];
+            memcpy (name, code + 3, len);
+            name[len] = 0;
+            if (tf_field_volatile[tf_field_for_name (name)]) {
+                return 0;
+            }
+        }
+        else if (code[1] == 5) {
+            if (tf_field_volatile[(uint8_t)code[2]]) {
+                return 0;
+            }
+        }
+        else if (code[1] == 3) {
+            if (!tf_opt_is_cacheable (code + 6, blocksize - 6)) {
+                return 0;
+            }
+        }
+        code += blocksize;
+        size -= blocksize;
+    }
+    return 1;
+}
+
+static int
+tf_opt_fold_func (tf_optimizer_t *o, const char *code, int size) {
+    if (!tf_opt_is_constant (code, size)) {
+        return -1;
+    }
+
+    ddb_tf_context_t ctx = {
+        ._size = sizeof (ddb_tf_context_t),
+        .it = (ddb_playItem_t *)&empty_track,
+        .plt = (ddb_playlist_t *)&empty_playlist,
+    };
+    char out[TF_FOLD_MAX];
+    int bool_out = 0;
+    int res = tf_eval_int (&ctx, code, size, out, sizeof (out) - 1, &bool_out, 0);
+    if (res < 0 || res >= sizeof (out) - 2) {
+        return -1;
+    }
+
+    char hdr[7] = { 0, 6, bool_out ? 1 : 0 };
+    int32_t len = res;
+    memcpy (hdr + 3, &len, 4);
+    tf_opt_append (o, hdr, 7);
+    tf_opt_append (o, out, res);
+    tf_opt_append (o, code, size);
+    return 0;
+}
+
+static int
+tf_optimize (tf_optimizer_t *o, const char *code, int size) {
+    while (size > 0) {
+        if (*code) {
+            int len = 1;
+            while (len < size && code[len]) {
+                len++;
+            }
+            if (len > 1) {
+                tf_opt_append_block (o, 4, code, len);
+            }
+            else {
+                tf_opt_append (o, code, len);
+            }
+            code += len;
+            size -= len;
+            continue;
+        }
+
+        int blocksize = tf_opt_block_size (code);
+        if (blocksize < 0 || blocksize > size) {
+            return -1;
+        }
+
+        if (code[1] == 1) {
+            if (tf_opt_fold_func (o, code, blocksize)) {
+                tf_opt_append (o, code, blocksize);
+            }
+        }
+        else if (code[1] == 2) {
+            // tf_compile_field leaves short names unresolved to fit in place
+            uint8_t len = (uint8_t)code[2];
+            char name[len+1];
+            memcpy (name, code + 3, len);
+            name[len] = 0;
+            int f = tf_field_for_name (name);
+            uint32_t atom = f == TF_FIELD_META ? metacache_key_atom (name) : 0;
+            if (atom <= 0xffff) {
+                char field[5] = { 0, 5, f, atom & 0xff, atom >> 8 };
+                tf_opt_append (o, field, 5);
+            }
+            else {
+                tf_opt_append (o, code, blocksize);
+            }
+        }
+        else if (code[1] == 3) {
+            int hdr = o->size;
+            tf_opt_append (o, code, 6);
+            if (tf_optimize (o, code + 6, blocksize - 6)) {
+                return -1;
+            }
+            int32_t len = o->size - hdr - 6;
+            memcpy (o->code + hdr + 2, &len, 4);
+        }
+        else {
+            tf_opt_append (o, code, blocksize);
+        }
+        code += blocksize;
+        size -= blocksize;
+    }
+    return 0;
+}
+
 char *
 tf_compile (const char *script) {
     tf_compiler_t c;
@@ -2251,11 +2993,25 @@ tf_compile (const char *script) {
         }
     }
 
-    size_t size = c.o - code;
-    char *out = malloc (size + 8);
-    memcpy (out + 4, code, size);
+    tf_optimizer_t o;
+    memset (&o, 0, sizeof (o));
+    if (tf_optimize (&o, code, (int)(c.o - code))) {
+        free (o.code);
+        return NULL;
+    }
+
+    uint32_t script_id = 0;
+    if (tf_opt_is_cacheable (o.code, o.size)) {
+        script_id = __sync_add_and_fetch (&tf_script_id, 1);
+    }
+
+    size_t size = o.size;
+    char *out = malloc (size + 12);
+    memcpy (out + 4, o.code, size);
     memset (out + 4 + size, 0, 4); // FIXME: this is the padding for possible buffer overflow bug fix
+    memcpy (out + 8 + size, &script_id, 4);
     *((int32_t *)out) = (int32_t)(size);
+    free (o.code);
     return out;
 }
 
@@ -42,6 +42,15 @@ tf_free (char *code);
 int
 tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen);
 
+// returns 1 if the output of the script only depends on the track metadata,
+// and can be remembered until pl_get_item_meta_serial of the track changes
+int
+tf_is_cacheable (const char *code);
+
+// free the results cached by tf_eval
+void
+tf_cache_free (void);
+
 // convert legacy title formatting to the new format, usable with tf_compile
 void
 tf_import_legacy (const char *fmt, char *out, int outsize);
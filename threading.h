@@ -59,6 +59,10 @@ mutex_lock (uintptr_t mtx);
 int
 mutex_unlock (uintptr_t mtx);
 
+// returns 0 if the mutex was locked, non-zero if it's held by another thread
+int
+mutex_trylock (uintptr_t mtx);
+
 uintptr_t
 cond_create (void);
 
@@ -68,6 +72,12 @@ cond_free (uintptr_t cond);
 int
 cond_wait (uintptr_t cond, uintptr_t mutex);
 
+// unlike cond_wait, expects the mutex to be locked by the caller,
+// which allows to check the predicate atomically with going to sleep.
+// returns 0 when signalled, ETIMEDOUT on timeout
+int
+cond_wait_timeout (uintptr_t cond, uintptr_t mutex, int timeout_ms);
+
 int
 cond_signal (uintptr_t cond);
 
@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/time.h>
 #include "threading.h"
 #ifdef HAVE_CONFIG_H
 #include <config.h>
@@ -176,6 +177,12 @@ mutex_lock (uintptr_t _mtx) {
     return err;
 }
 
+int
+mutex_trylock (uintptr_t _mtx) {
+    pthread_mutex_t *mtx = (pthread_mutex_t *)_mtx;
+    return pthread_mutex_trylock (mtx);
+}
+
 int
 mutex_unlock (uintptr_t _mtx) {
     pthread_mutex_t *mtx = (pthread_mutex_t *)_mtx;
@@ -221,6 +228,23 @@ cond_wait (uintptr_t c, uintptr_t m) {
     return err;
 }
 
+int
+cond_wait_timeout (uintptr_t c, uintptr_t m, int timeout_ms) {
+    pthread_cond_t *cond = (pthread_cond_t *)c;
+    pthread_mutex_t *mutex = (pthread_mutex_t *)m;
+    struct timeval now;
+    struct timespec ts;
+    gettimeofday (&now, NULL);
+    int64_t nsec = (int64_t)now.tv_usec * 1000 + (int64_t)timeout_ms * 1000000;
+    ts.tv_sec = now.tv_sec + nsec / 1000000000;
+    ts.tv_nsec = nsec % 1000000000;
+    int err = pthread_cond_timedwait (cond, mutex, &ts);
+    if (err != 0 && err != ETIMEDOUT) {
+        fprintf (stderr, "pthread_cond_timedwait failed: %s\n", strerror (err));
+    }
+    return err;
+}
+
 int
 cond_signal (uintptr_t c) {
     pthread_cond_t *cond = (pthread_cond_t *)c;